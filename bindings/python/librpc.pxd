@@ -394,6 +394,8 @@ cdef extern from "rpc/typing.h" nogil:
     rpct_typei_t rpct_typei_get_generic_var(rpct_typei_t typei, const char *name)
 
     rpct_typei_t rpct_typei_get_member_type(rpct_typei_t typei, rpct_member_t member)
+    rpct_typei_t rpct_typei_retain(rpct_typei_t typei)
+    void rpct_typei_release(rpct_typei_t typei)
 
     const char *rpct_member_get_name(rpct_member_t member)
     const char *rpct_member_get_description(rpct_member_t member)
@@ -507,7 +509,7 @@ cdef class TypeInstance(object):
     cdef rpct_typei_t rpctypei
 
     @staticmethod
-    cdef TypeInstance wrap(rpct_typei_t typei)
+    cdef TypeInstance wrap(rpct_typei_t typei, bint retain=*)
     cdef rpct_typei_t unwrap(self) nogil
 
 
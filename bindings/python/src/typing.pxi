@@ -147,15 +147,19 @@ cdef class TypeInstance(object):
     def __repr__(self):
         return str(self)
 
+    def __dealloc__(self):
+        if self.rpctypei != <rpct_typei_t>NULL:
+            rpct_typei_release(self.rpctypei)
+
     @staticmethod
-    cdef TypeInstance wrap(rpct_typei_t typei):
+    cdef TypeInstance wrap(rpct_typei_t typei, bint retain=True):
         cdef TypeInstance ret
 
         if typei == <rpct_typei_t>NULL:
             return None
 
         ret = TypeInstance.__new__(TypeInstance)
-        ret.rpctypei = typei
+        ret.rpctypei = rpct_typei_retain(typei) if retain else typei
         return ret
 
     cdef rpct_typei_t unwrap(self) nogil:
@@ -492,7 +496,10 @@ cdef class FunctionArgument(object):
 
 cdef class StructUnionMember(Member):
     def specialize(self, TypeInstance typei):
-        return TypeInstance.wrap(rpct_typei_get_member_type(typei.rpctypei, self.rpcmem))
+        return TypeInstance.wrap(
+            rpct_typei_get_member_type(typei.rpctypei, self.rpcmem),
+            False
+        )
 
 
 cdef class BaseTypingObject(object):
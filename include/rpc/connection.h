@@ -281,6 +281,9 @@ int rpc_connection_set_dispatch_queue(_Nonnull rpc_connection_t conn,
  * Calls to rpc_connection_subscribe_event() must be paired with
  * rpc_connection_unsubscribe_event().
  *
+ * If the last component of @p path is "*", the subscription matches
+ * events emitted on any path below that prefix.
+ *
  * @param conn Connection to subscribe on
  * @param name Event name
  * @return 0 on success, -1 on failure
@@ -573,6 +576,36 @@ void rpc_connection_set_raw_message_handler(_Nonnull rpc_connection_t conn,
 void rpc_connection_set_event_handler(_Nonnull rpc_connection_t conn,
     _Nullable rpc_handler_t handler);
 
+/**
+ * Switches a connection to asynchronous sending.
+ *
+ * Outgoing frames are serialized by the calling thread and put on a
+ * per-connection queue, which is drained by a dedicated writer thread.
+ * The writer gathers multiple queued frames into a single write where
+ * the transport supports it. Once enabled, the send queue stays enabled
+ * for the lifetime of the connection; calling this function again only
+ * changes the high-water mark.
+ *
+ * When the queue holds @p highwater frames or more, rpc_function_yield()
+ * and event emission block until the writer catches up. Responses and
+ * errors are never throttled. A @p highwater of 0 disables backpressure.
+ * Events emitted through a context never block; they wait in the
+ * connection's event queue instead (see
+ * rpc_context_set_event_queue_limit()). Delivering such an event
+ * enables the send queue on its own, without a high-water mark.
+ *
+ * Since frames are written after the sending function returns, a write
+ * error can't be reported to the sender of the frame that failed.
+ * Instead, the writer stops and every later send on the connection
+ * fails, with the last error set to the transport error.
+ *
+ * @param conn Connection handle
+ * @param highwater Maximum number of queued frames before throttling
+ * @return 0 on success, -1 on error
+ */
+int rpc_connection_set_send_queue(_Nonnull rpc_connection_t conn,
+    size_t highwater);
+
 /**
  * Sets global error handler for a connection.
  *
@@ -668,12 +701,31 @@ int rpc_call_abort(_Nonnull rpc_call_t call);
 /**
  * Sets how many items librpc should prefetch in a streaming call.
  *
+ * This turns off adaptive prefetching for the call and uses a fixed
+ * window of @p nitems instead.
+ *
  * @param call
  * @param nitems
  * @return
  */
 int rpc_call_set_prefetch(_Nonnull rpc_call_t call, size_t nitems);
 
+/**
+ * Enables adaptive prefetching in a streaming call.
+ *
+ * The prefetch window starts small and grows whenever the consumer runs
+ * out of credit, up to the amount of fragments consumed in one round trip
+ * to the server. It is kept between @p min and @p max items. Adaptive
+ * prefetching is on by default, with a window of 1 to 256 items.
+ *
+ * @param call Streaming call
+ * @param min Minimum prefetch window
+ * @param max Maximum prefetch window
+ * @return 0 on success, -1 on error
+ */
+int rpc_call_set_prefetch_bounds(_Nonnull rpc_call_t call, size_t min,
+    size_t max);
+
 /**
  * Waits for a call to change status.
  *
@@ -712,6 +764,21 @@ rpc_call_status_t rpc_call_status(_Nonnull rpc_call_t call);
  */
 _Nullable rpc_object_t rpc_call_result(_Nonnull rpc_call_t call);
 
+/**
+ * Returns all fragments of a streaming call that are already received.
+ *
+ * The current fragment and up to @p max - 1 of the fragments queued after
+ * it are returned as an array and consumed, as if @ref rpc_call_continue
+ * was called asynchronously for each of them. Call @ref rpc_call_wait to
+ * wait for the next fragment afterwards.
+ *
+ * @param call Streaming call with RPC_CALL_MORE_AVAILABLE status
+ * @param max Maximum number of fragments to return, or 0 for no limit
+ * @return Array of fragments or NULL on error
+ */
+_Nullable rpc_object_t rpc_call_result_batch(_Nonnull rpc_call_t call,
+    size_t max);
+
 /**
  * Frees a rpc_call_t object.
  *
@@ -72,6 +72,11 @@ typedef enum {
  */
 typedef struct rpc_object *rpc_object_t;
 
+/**
+ * Definition of compiled pack format pointer.
+ */
+typedef struct rpc_pack_fmt *rpc_pack_fmt_t;
+
 /**
  * Definition of array applier block type.
  *
@@ -532,6 +537,52 @@ int rpc_object_unpack(_Nonnull rpc_object_t, const char *_Nonnull fmt, ...);
 int rpc_object_vunpack(_Nonnull rpc_object_t, const char *_Nonnull fmt,
     va_list ap);
 
+/**
+ * Compiles a format string for use with rpc_object_pack_compiled() and
+ * rpc_object_unpack_compiled().
+ *
+ * Compiling a format string parses it and resolves type prefixes once,
+ * so packing or unpacking with the result doesn't re-parse it on every
+ * call. rpc_object_pack() and rpc_object_unpack() also cache compiled
+ * formats internally when the format string is a string literal; other
+ * format strings are interpreted on every call.
+ *
+ * Type prefixes are only supported at the top level of a compiled
+ * format. If the type system is freed and initialized again after
+ * compiling, they are resolved against the new one on each use.
+ *
+ * @param fmt Format string.
+ * @return Compiled format or NULL if the format string is invalid.
+ */
+_Nullable rpc_pack_fmt_t rpc_pack_fmt_compile(const char *_Nonnull fmt);
+
+/**
+ * Releases a compiled format.
+ *
+ * @param fmt Compiled format.
+ */
+void rpc_pack_fmt_release(_Nullable rpc_pack_fmt_t fmt);
+
+/**
+ * Same as rpc_object_pack(), but takes a compiled format.
+ *
+ * @param fmt Compiled format.
+ * @param ... Variable length list of values to be packed.
+ * @return Packed object.
+ */
+_Nullable rpc_object_t rpc_object_pack_compiled(_Nonnull rpc_pack_fmt_t fmt,
+    ...);
+
+/**
+ * Same as rpc_object_unpack(), but takes a compiled format.
+ *
+ * @param fmt Compiled format.
+ * @param ... Variable length list of values to be unpacked.
+ * @return The number of successfully unpacked objects or -1 on error.
+ */
+int rpc_object_unpack_compiled(_Nonnull rpc_object_t,
+    _Nonnull rpc_pack_fmt_t fmt, ...);
+
 /**
  * Creates an object holding null value.
  *
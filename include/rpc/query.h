@@ -52,6 +52,24 @@ struct rpc_query_iter;
  */
 typedef struct rpc_query_iter *rpc_query_iter_t;
 
+/**
+ * Definition of compiled query rules pointer type.
+ */
+typedef struct rpc_query_plan *rpc_query_plan_t;
+
+/**
+ * Definition of rpc_query_index pointer type.
+ */
+typedef struct rpc_query_index *rpc_query_index_t;
+
+/**
+ * Enumerates kinds of query indexes.
+ */
+typedef enum {
+	RPC_QUERY_INDEX_HASH,		/**< serves "=" and "in" rules */
+	RPC_QUERY_INDEX_SORTED,		/**< serves "<", ">", "<=", ">=", "=" */
+} rpc_query_index_type_t;
+
 /**
  * Definition of query callback block type.
  *
@@ -97,6 +115,12 @@ typedef _Nullable rpc_object_t (^rpc_query_cb_t)(_Nonnull rpc_object_t object);
  *   a callback function first - query will return an RPC object returned
  *   by a callback function, but will skip it if a callback function
  *   returns NULL instead of an RPC object.
+ * - parallel (boolean) - split the input array into chunks and evaluate
+ *   the rules on a pool of worker threads - only pays off for large arrays,
+ *   small ones are processed sequentially anyway. The callback still runs
+ *   in the calling thread.
+ * - unordered (boolean) - with parallel set, yield matching elements
+ *   in the order workers find them, instead of the input array order.
  */
 struct rpc_query_params {
 	bool 				single;
@@ -106,6 +130,8 @@ struct rpc_query_params {
 	bool				reverse;
 	_Nullable rpc_array_cmp_t	sort;
 	_Nullable rpc_query_cb_t	callback;
+	bool				parallel;
+	bool				unordered;
 };
 
 /**
@@ -243,6 +269,48 @@ bool rpc_query_contains(_Nonnull rpc_object_t object, const char *_Nonnull path)
 _Nullable rpc_query_iter_t rpc_query(_Nonnull rpc_object_t object,
     _Nullable rpc_query_params_t params, _Nullable rpc_object_t rules);
 
+/**
+ * Compiles query rules.
+ *
+ * Rules have the same format as in the rpc_query function case. Compiling
+ * resolves operators, splits field paths and compiles regular expressions
+ * once, so the result can be used to run the same query many times
+ * with rpc_query_compiled. rpc_query compiles its rules internally.
+ *
+ * @param rules Query rules.
+ * @return Compiled rules or NULL if rules are not an array.
+ */
+_Nullable rpc_query_plan_t rpc_query_compile(_Nonnull rpc_object_t rules);
+
+/**
+ * Increases reference count of compiled query rules.
+ *
+ * @param plan Compiled rules.
+ * @return The same compiled rules.
+ */
+_Nonnull rpc_query_plan_t rpc_query_plan_retain(_Nonnull rpc_query_plan_t plan);
+
+/**
+ * Decreases reference count of compiled query rules, freeing them once
+ * it drops to zero.
+ *
+ * @param plan Compiled rules.
+ */
+void rpc_query_plan_release(_Nullable rpc_query_plan_t plan);
+
+/**
+ * Performs a query operation on a given object using compiled rules.
+ *
+ * The function works exactly the same as the rpc_query function.
+ *
+ * @param object Object to be queried.
+ * @param params Query parameters.
+ * @param plan Compiled query rules.
+ * @return Query iterator.
+ */
+_Nullable rpc_query_iter_t rpc_query_compiled(_Nonnull rpc_object_t object,
+    _Nullable rpc_query_params_t params, _Nullable rpc_query_plan_t plan);
+
 /**
  * Performs a query operation on a given object.
  *
@@ -294,6 +362,38 @@ _Nullable rpc_object_t rpc_query_apply(_Nonnull rpc_object_t object,
 bool rpc_query_next(_Nonnull rpc_query_iter_t iter,
     _Nonnull rpc_object_t *_Nullable chunk);
 
+/**
+ * Creates an index of an array's elements by a value found under
+ * a given path.
+ *
+ * Once created, the index is used automatically by queries run
+ * on the same array object, whenever one of the top level rules
+ * is a field rule on the indexed path that the index can serve.
+ * Only the matching elements are evaluated then, instead
+ * of the whole array. Queries with the reverse parameter set
+ * can't use indexes.
+ *
+ * The index is updated as elements get appended to or removed from
+ * the array. Any other modification of the array makes the index
+ * rebuild itself on the next query. Modifying the indexed elements
+ * themselves is not tracked.
+ *
+ * @param array Array to be indexed.
+ * @param path Path of the indexed value within each element, in the
+ * rpc_query_get format.
+ * @param type Type of the index.
+ * @return Index or NULL if array is not an array.
+ */
+_Nullable rpc_query_index_t rpc_query_index_create(_Nonnull rpc_object_t array,
+    const char *_Nonnull path, rpc_query_index_type_t type);
+
+/**
+ * Removes an index from its array and frees it.
+ *
+ * @param index Index to be freed.
+ */
+void rpc_query_index_free(_Nonnull rpc_query_index_t index);
+
 /**
  * Releases internal contents of rpc query iterator structure and then
  * the structure itself.
@@ -142,6 +142,21 @@ void rpc_server_broadcast_event(_Nonnull rpc_server_t server,
 void rpc_server_set_event_handler(_Nonnull rpc_server_t server,
     _Nullable rpc_server_ev_handler_t handler);
 
+/**
+ * Sets admission limits for a server.
+ *
+ * Calls over a limit are not queued. They fail immediately with an EBUSY
+ * error whose extra dictionary holds a "retry_after" hint, in
+ * milliseconds. A limit of 0 means unlimited, which is the default.
+ *
+ * @param server Server handle
+ * @param max_conn_calls Maximum number of concurrent calls per connection
+ * @param max_queued Maximum number of calls queued while server is paused
+ * @param retry_after Retry hint sent to rejected clients, in milliseconds
+ */
+void rpc_server_set_limits(_Nonnull rpc_server_t server,
+    size_t max_conn_calls, size_t max_queued, uint32_t retry_after);
+
 /**
  * Closes a given RPC server.
  *
@@ -191,6 +191,53 @@ typedef void (^rpc_abort_handler_t)(void);
                 }							\
 	}
 
+/**
+ * Same as @ref RPC_METHOD, but also sets method flags
+ * (see @ref rpc_method_flags).
+ */
+#define	RPC_METHOD_FLAGS(_name, _fn, _flags)				\
+	{								\
+		.rim_type = RPC_MEMBER_METHOD,				\
+		.rim_name = (#_name),					\
+		.rim_method = {						\
+                        .rm_block = RPC_FUNCTION(_fn),			\
+			.rm_arg = NULL,					\
+			.rm_flags = (_flags)				\
+                }							\
+	}
+
+/**
+ * Same as @ref RPC_PROPERTY_RO, but also sets property flags
+ * (see @ref rpc_property_flags).
+ */
+#define	RPC_PROPERTY_RO_FLAGS(_name, _getter, _flags)			\
+	{								\
+		.rim_type = RPC_MEMBER_PROPERTY,			\
+		.rim_name = (#_name),					\
+		.rim_property = {					\
+                        .rp_getter = RPC_PROPERTY_GETTER(_getter),	\
+			.rp_setter = NULL,				\
+			.rp_arg = NULL,					\
+			.rp_flags = (_flags)				\
+                }							\
+	}
+
+/**
+ * Same as @ref RPC_PROPERTY_RW, but also sets property flags
+ * (see @ref rpc_property_flags).
+ */
+#define	RPC_PROPERTY_RW_FLAGS(_name, _getter, _setter, _flags)		\
+	{								\
+		.rim_type = RPC_MEMBER_PROPERTY,			\
+		.rim_name = (#_name),					\
+		.rim_property = {					\
+                        .rp_getter = RPC_PROPERTY_GETTER(_getter),	\
+			.rp_setter = RPC_PROPERTY_SETTER(_setter),	\
+			.rp_arg = NULL,					\
+			.rp_flags = (_flags)				\
+                }							\
+	}
+
 /**
  * Same as @ref RPC_METHOD, but takes a block instead of a function
  * pointer.
@@ -225,6 +272,66 @@ enum rpc_property_rights
 	RPC_PROPERTY_WRITE = (1 << 1),	/**< Property is writable */
 };
 
+/**
+ * Enumerates possible property flags.
+ */
+enum rpc_property_flags
+{
+	/**
+	 * The getter does not depend on other getters of the same interface
+	 * and may run concurrently with them. Observable.get_all runs
+	 * getters of such properties in parallel on the worker pool.
+	 */
+	RPC_PROPERTY_INDEPENDENT = (1 << 0),
+};
+
+
+/**
+ * Enumerates possible method flags.
+ */
+enum rpc_method_flags
+{
+	/**
+	 * Run the method directly on the thread that received the call,
+	 * instead of handing it over to the worker pool. Only suitable for
+	 * short, non-blocking methods: an inline method must not stream
+	 * nor make calls over the same connection. Methods that exceed the
+	 * context's inline time budget are moved back to the worker pool,
+	 * and so are methods that try to stream: the streaming functions
+	 * fail with EINVAL and the caller receives an error.
+	 */
+	RPC_METHOD_INLINE = (1 << 0),
+
+	/**
+	 * Queue calls to the method ahead of normal priority calls.
+	 */
+	RPC_METHOD_HIGH_PRIORITY = (1 << 1),
+};
+
+/**
+ * Worker pool statistics of a context.
+ */
+struct rpc_context_stats
+{
+	size_t		rcs_workers;		/**< Worker threads */
+	size_t		rcs_running;		/**< Calls being executed */
+	size_t		rcs_detached;		/**< Streams running off the pool */
+	size_t		rcs_queued_high;	/**< Queued high priority calls */
+	size_t		rcs_queued_normal;	/**< Queued normal priority calls */
+	uint64_t	rcs_completed;		/**< Calls completed so far */
+	uint64_t	rcs_stolen;		/**< Calls stolen by idle workers */
+};
+
+/**
+ * Enumerates policies applied when the queue of events pending delivery
+ * to a single connection reaches its limit.
+ */
+typedef enum rpc_event_overflow_policy
+{
+	RPC_EVENT_DROP_OLDEST,		/**< Drop the oldest pending event */
+	RPC_EVENT_COALESCE,		/**< Replace pending event of same kind */
+	RPC_EVENT_DISCONNECT,		/**< Close the slow connection */
+} rpc_event_overflow_policy_t;
 
 /**
  * Method descriptor.
@@ -233,6 +340,7 @@ struct rpc_if_method
 {
 	__unsafe_unretained _Nonnull rpc_function_t rm_block;
 	void *_Nullable	rm_arg;
+	int rm_flags;
 };
 
 /**
@@ -244,6 +352,7 @@ struct rpc_if_property
 	__unsafe_unretained _Nullable rpc_property_setter_t rp_setter;
 	void *_Nullable rp_arg;
 	bool rp_notify;
+	int rp_flags;
 };
 
 /**
@@ -384,6 +493,40 @@ void rpc_context_set_pre_call_hook(_Nonnull rpc_context_t context,
 void rpc_context_set_post_call_hook(_Nonnull rpc_context_t context,
     _Nonnull rpc_function_t fn);
 
+/**
+ * Sets the time budget for methods flagged with @ref RPC_METHOD_INLINE.
+ *
+ * An inline method whose single invocation takes longer than @p usec
+ * microseconds loses its inline flag and is dispatched to the worker pool
+ * from then on. The default budget is 1 millisecond.
+ *
+ * A watchdog checking running invocations about once per budget demotes
+ * the method shortly after the budget elapses, even if the invocation is
+ * still running. The running invocation itself can't
+ * be moved and keeps blocking its connection until it returns; only the
+ * calls received after that go to the worker pool.
+ *
+ * @param context Target context
+ * @param usec Time budget in microseconds
+ */
+void rpc_context_set_inline_budget(_Nonnull rpc_context_t context,
+    uint64_t usec);
+
+/**
+ * Returns worker pool statistics of a context.
+ *
+ * Calls are executed by a fixed number of worker threads. A call that
+ * starts a stream hands its worker over to a new thread and keeps running
+ * outside of the pool, so producers waiting for the consumer don't hold
+ * up other calls. Queue depths are a snapshot and may be stale by the
+ * time this function returns.
+ *
+ * @param context Context handle
+ * @param stats Statistics structure to fill in
+ */
+void rpc_context_get_stats(_Nonnull rpc_context_t context,
+    struct rpc_context_stats *_Nonnull stats);
+
 /**
  *
  * @param context RPC context handle
@@ -405,6 +548,25 @@ void rpc_context_emit_event(_Nonnull rpc_context_t context,
     const char *_Nullable path, const char *_Nullable interface,
     const char *_Nonnull name, _Nonnull rpc_object_t args);
 
+/**
+ * Limits the number of events queued for delivery to a single connection.
+ *
+ * Events are delivered to each subscribed connection by one of several
+ * emitter threads, so a slow consumer only delays its own events. An
+ * emitter thread never waits for a connection: while the connection's
+ * send queue is full, its events stay pending. Once @p limit events are
+ * pending for a connection, @p policy decides what happens with the
+ * next one. When @ref RPC_EVENT_COALESCE is used, the most recent
+ * pending event with the same path, interface and name is replaced by
+ * the new one; if there is none, the oldest event is dropped.
+ *
+ * @param context RPC context handle
+ * @param limit Maximum number of pending events or 0 for no limit
+ * @param policy Overflow policy
+ */
+void rpc_context_set_event_queue_limit(_Nonnull rpc_context_t context,
+    size_t limit, rpc_event_overflow_policy_t policy);
+
 /**
  * Returns the argument associated with method.
  *
@@ -513,6 +675,21 @@ int rpc_function_start_stream(void *_Nonnull cookie);
  */
 int rpc_function_yield(void *_Nonnull cookie, _Nonnull rpc_object_t fragment);
 
+/**
+ * Generates multiple values in a streaming response at once.
+ *
+ * Fragments are sent in as few frames as the consumer's flow control
+ * window allows. Each element of @p fragments still counts as a single
+ * fragment on the consumer side. Peers must be recent enough to understand
+ * batched fragment frames.
+ *
+ * @param cookie Running call handle
+ * @param fragments Array of data fragments (consumed by the function)
+ * @return Status. Success is reported by returning 0
+ */
+int rpc_function_yield_many(void *_Nonnull cookie,
+    _Nonnull rpc_object_t fragments);
+
 /**
  * Ends a streaming response.
  *
@@ -594,6 +771,39 @@ _Nullable rpc_instance_t rpc_instance_new(void *_Nullable arg,
 void rpc_instance_set_description(_Nonnull rpc_instance_t instance,
     const char *_Nonnull fmt, ...);
 
+/**
+ * Pins all calls to an instance to a single worker thread.
+ *
+ * Calls to a pinned instance are executed one at a time, in the order
+ * they were received, so the instance state may be accessed without
+ * locking and stays cache-hot. Instances are not pinned by default.
+ *
+ * This includes methods flagged with @ref RPC_METHOD_INLINE, which run
+ * on the worker pool for pinned instances, and streaming methods, which
+ * keep the worker busy until the stream ends.
+ *
+ * @param instance Instance handle
+ * @param affinity true to pin the instance, false to unpin it
+ */
+void rpc_instance_set_affinity(_Nonnull rpc_instance_t instance,
+    bool affinity);
+
+/**
+ * Limits the number of concurrent calls of a method.
+ *
+ * Calls over the limit fail immediately with an EBUSY error carrying
+ * a "retry_after" hint, in milliseconds, as configured with
+ * rpc_server_set_limits(). A limit of 0 removes the limit.
+ *
+ * @param instance Instance handle
+ * @param interface Interface name
+ * @param name Method name
+ * @param max Maximum number of concurrently running calls
+ * @return 0 on success, -1 on error
+ */
+int rpc_instance_set_method_limit(_Nonnull rpc_instance_t instance,
+    const char *_Nullable interface, const char *_Nonnull name, size_t max);
+
 /**
  * Returns the user data pointer associated with @p instance.
  *
@@ -780,6 +990,32 @@ void rpc_instance_property_changed(_Nonnull rpc_instance_t instance,
     const char *_Nonnull interface, const char *_Nonnull name,
     _Nullable rpc_object_t value);
 
+/**
+ * Sets caching and change notification policy of a property.
+ *
+ * If @p cacheable is true, librpc remembers the last value of the property,
+ * either reported with rpc_instance_property_changed() or returned by the
+ * getter. Observable.get and Observable.get_all return that value without
+ * calling the getter. A getter result that raced with a change reported in
+ * the meantime is returned but not cached. After Observable.set, a cached
+ * property is read back through its getter, as the setter may have stored
+ * a different value; other properties notify the value that was set.
+ *
+ * If @p min_interval is non-zero, at most one change notification is sent
+ * every @p min_interval milliseconds. Changes reported in between are
+ * merged and only the latest value is sent once the interval passes.
+ *
+ * @param instance Instance handle
+ * @param interface Interface name
+ * @param name Property name
+ * @param cacheable Whether to cache last property value
+ * @param min_interval Minimum interval between notifications, in milliseconds
+ * @return 0 on success, -1 on error
+ */
+int rpc_instance_set_property_policy(_Nonnull rpc_instance_t instance,
+    const char *_Nonnull interface, const char *_Nonnull name,
+    bool cacheable, uint32_t min_interval);
+
 /**
  * Returns instance associated with the getter or setter call.
  *
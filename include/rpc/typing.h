@@ -201,15 +201,41 @@ int rpct_read_idl(const char *name, rpc_object_t idl);
 int rpct_load_types(const char *path);
 
 /**
+ * Loads type information from all IDL files in a directory tree.
  *
- * @param path
- * @return
+ * Only names of the declared types and interfaces are indexed; each
+ * declaration is read when it's first referenced.
+ *
+ * If the directory contains a cache file written by
+ * @ref rpct_compile_types_dir, files whose size and modification time
+ * (in nanoseconds) match the cache are read from it instead of being
+ * parsed again. New and modified files are parsed as usual.
+ *
+ * @param path Directory path
+ * @return 0 on success, -1 on error
  */
 int rpct_load_types_dir(const char *path);
 
+/**
+ * Precompiles all IDL files in a directory tree into a binary cache file
+ * stored in that directory.
+ *
+ * Files are recorded relative to @p path, so the cache stays usable when
+ * the directory is moved. This is what the rpcidlc tool runs on each
+ * directory given on its command line.
+ *
+ * @param path Directory path
+ * @return 0 on success, -1 on error
+ */
+int rpct_compile_types_dir(const char *path);
+
 /**
  * Loads type information from an interface definition stream.
  *
+ * The stream is a sequence of YAML documents, each starting with
+ * a "---" line. Every document is read as soon as it's complete,
+ * without waiting for the rest of the stream.
+ *
  * File descriptor is closed once all definitions have been
  * read from it or error happened.
  *
@@ -373,6 +399,9 @@ const char *rpct_typei_get_canonical_form(rpct_typei_t typei);
 /**
  * Returns type instance handler of a structure or union member.
  *
+ * The returned type instance is owned by the caller and has to be
+ * released with @ref rpct_typei_release.
+ *
  * @param typei Type instance handle
  * @param member Member handle
  * @return Type instance handle or NULL in case of error
@@ -32,41 +32,36 @@ static bool
 container_validate(struct rpct_typei *typei, rpc_object_t obj,
     struct rpct_error_context *errctx)
 {
+	struct rpct_validation_plan *plan;
 	rpct_typei_t value_typei;
 	bool fail;
 
-	/*
-	 * typei->type->value_type might be a generic variable reference,
-	 * eg. "T" so we must instantiate it in context of a parent type.
-	 */
-	value_typei = rpct_instantiate_type(
-	    typei->type->value_type->canonical_form, typei, typei->type,
-	    typei->type->file);
+	/* Value type is instantiated once and kept in the plan */
+	plan = rpct_typei_get_plan(typei);
+	value_typei = plan->rvp_value;
+	if (value_typei == NULL) {
+		rpct_add_error(errctx, NULL, "Cannot instantiate value type");
+		return (false);
+	}
 
 	switch (rpc_get_type(obj)) {
 	case RPC_TYPE_ARRAY:
 		fail = rpc_array_apply(obj, ^(size_t idx, rpc_object_t value) {
 			struct rpct_error_context newctx;
-			char *name = g_strdup_printf("%zu", idx);
-			bool ret;
-
-			rpct_derive_error_context(&newctx, errctx, name);
-			ret = rpct_validate_instance(value_typei, value, &newctx);
-			rpct_release_error_context(&newctx);
-			g_free(name);
-			return (ret);
+
+			rpct_derive_error_context_index(&newctx, errctx, idx);
+			return (rpct_validate_instance(value_typei, value,
+			    &newctx));
 		});
 		break;
 
 	case RPC_TYPE_DICTIONARY:
 		fail = rpc_dictionary_apply(obj, ^(const char *key, rpc_object_t value) {
 			struct rpct_error_context newctx;
-			bool ret;
 
 			rpct_derive_error_context(&newctx, errctx, key);
-			ret = rpct_validate_instance(value_typei, value, &newctx);
-			rpct_release_error_context(&newctx);
-			return (ret);
+			return (rpct_validate_instance(value_typei, value,
+			    &newctx));
 		});
 		break;
 
@@ -79,7 +74,6 @@ container_validate(struct rpct_typei *typei, rpc_object_t obj,
 	if (fail)
 		return (false);
 
-	//rpct_typei_release(value_typei);
 	return (rpct_run_validators(typei, obj, errctx));
 }
 
@@ -78,30 +78,38 @@ static bool
 struct_validate(struct rpct_typei *typei, rpc_object_t obj,
     struct rpct_error_context *errctx)
 {
-	__block bool valid = true;
-
-	rpct_members_apply(typei->type, ^(struct rpct_member *member) {
-	    struct rpct_error_context newctx;
-	    struct rpct_typei *mtypei;
-	    rpc_object_t mvalue;
-
-	    mtypei = rpct_typei_get_member_type(typei, member);
-	    mvalue = rpc_dictionary_get_value(obj, member->name);
-	    if (mvalue == NULL) {
-		    rpct_add_error(errctx, NULL, "Member %s not found",
-		        member->name);
-		    valid = false;
-		    return ((bool)false);
-	    }
-
-	    rpct_derive_error_context(&newctx, errctx, member->name);
-	    if (!rpct_validate_instance(mtypei, mvalue, &newctx))
-		    valid = false;
-
-	    rpct_release_error_context(&newctx);
-
-	    return ((bool)true);
-	});
+	struct rpct_validation_plan *plan;
+	struct rpct_error_context newctx;
+	struct rpct_member *member;
+	rpc_object_t mvalue;
+	bool valid = true;
+	guint i;
+
+	/* Member types are instantiated once, when the plan is built */
+	plan = rpct_typei_get_plan(typei);
+	for (i = 0; i < plan->rvp_nmembers; i++) {
+		member = plan->rvp_members[i].rpm_member;
+		mvalue = rpc_dictionary_get_value(obj, member->name);
+		if (mvalue == NULL) {
+			rpct_add_error(errctx, NULL, "Member %s not found",
+			    member->name);
+			valid = false;
+			break;
+		}
+
+		rpct_derive_error_context(&newctx, errctx, member->name);
+		if (plan->rvp_members[i].rpm_typei == NULL) {
+			rpct_add_error(&newctx, NULL,
+			    "Cannot resolve type %s of member %s",
+			    member->type->canonical_form, member->name);
+			valid = false;
+			continue;
+		}
+
+		if (!rpct_validate_instance(plan->rvp_members[i].rpm_typei,
+		    mvalue, &newctx))
+			valid = false;
+	}
 
 	if (!valid)
 		return (false);
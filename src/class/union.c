@@ -75,12 +75,16 @@ union_validate(struct rpct_typei *typei, rpc_object_t obj,
 	bool ret;
 
 	ret = rpct_members_apply(typei->type, ^(struct rpct_member *member) {
-		struct rpct_error_context newctx = {
-			.path = errctx->path,
-			.errors = g_ptr_array_new()
-		};
+		struct rpct_error_context newctx = *errctx;
+
+		newctx.errors = g_ptr_array_new();
 
 		mtypei = rpct_typei_get_member_type(typei, member);
+		if (mtypei == NULL) {
+			g_ptr_array_free(newctx.errors, true);
+			return ((bool)true);
+		}
+
 		interior = rpc_copy(obj);
 		rpct_set_typei(mtypei, interior);
 
@@ -90,6 +94,10 @@ union_validate(struct rpct_typei *typei, rpc_object_t obj,
 		}
 
 		g_ptr_array_free(newctx.errors, true);
+		rpc_release(interior);
+		rpct_typei_release(mtypei);
+		interior = NULL;
+		mtypei = NULL;
 		return ((bool)true);
 	});
 
@@ -101,6 +109,7 @@ union_validate(struct rpct_typei *typei, rpc_object_t obj,
 
 	ret = rpct_run_validators(mtypei, interior, errctx);
 	rpc_release(interior);
+	rpct_typei_release(mtypei);
 	return (ret);
 }
 
@@ -63,6 +63,8 @@
 #define RPC_TRANSPORT_FD_PASSING		(1 << 2)
 #define	RPC_TRANSPORT_NO_RPCT_SERIALIZE		(1 << 3)
 
+#define	RPC_DEFAULT_RETRY_AFTER		100
+
 #if RPC_DEBUG
 #define debugf(...) 				\
     do { 					\
@@ -93,6 +95,9 @@ typedef int gid_t;
 
 struct rpc_connection;
 struct rpc_credentials;
+struct rpc_trie;
+struct rpc_scheduler;
+struct rpc_send_item;
 struct rpc_server;
 struct rpct_validator;
 struct rpct_error_context;
@@ -100,6 +105,7 @@ struct rpct_error_context;
 typedef int (*rpc_recv_msg_fn_t)(struct rpc_connection *, const void *, size_t,
     int *, size_t);
 typedef int (*rpc_send_msg_fn_t)(void *, const void *, size_t, const int *, size_t);
+typedef int (*rpc_send_msgv_fn_t)(void *, struct rpc_send_item *const *, size_t);
 typedef int (*rpc_abort_fn_t)(void *);
 typedef int (*rpc_get_fd_fn_t)(void *);
 typedef void (*rpc_release_fn_t)(void *);
@@ -117,22 +123,121 @@ typedef rpc_object_t (*rpct_serialize_fn_t)(rpc_object_t);
 
 typedef bool (*rpct_validator_fn_t)(rpc_object_t, rpc_object_t,
     struct rpct_typei *, struct rpct_error_context *);
+typedef void *(*rpct_validator_prepare_fn_t)(rpc_object_t);
+typedef bool (*rpct_validator_run_fn_t)(rpc_object_t, void *,
+    struct rpct_typei *, struct rpct_error_context *);
 
 typedef void (*rpc_fn_respond_fn_t)(void *, rpc_object_t);
 typedef void (*rpc_fn_error_fn_t)(void *, int , const char *, va_list ap);
 typedef void (*rpc_fn_error_ex_fn_t)(void *, rpc_object_t);
 typedef int (*rpc_fn_start_strm_fn_t)(void *);
 typedef int (*rpc_fn_yield_fn_t)(void *, rpc_object_t);
+typedef int (*rpc_fn_yield_many_fn_t)(void *, rpc_object_t);
 typedef void (*rpc_fn_end_fn_t)(void *);
 typedef void (*rpc_fn_kill_fn_t)(void *);
 typedef bool (*rpc_fn_should_abt_fn_t)(void *);
 typedef void (*rpc_fn_set_abt_h_fn_t)(void *, rpc_abort_handler_t);
 
+typedef bool (^rpc_trie_applier_t)(const char *, void *);
+
+typedef enum rpc_priority
+{
+	RPC_PRIORITY_HIGH,
+	RPC_PRIORITY_NORMAL,
+	RPC_PRIORITY_COUNT
+} rpc_priority_t;
+
+enum rpc_query_op
+{
+	RPC_QUERY_OP_FALSE,
+	RPC_QUERY_OP_AND,
+	RPC_QUERY_OP_OR,
+	RPC_QUERY_OP_NOR,
+	RPC_QUERY_OP_EQ,
+	RPC_QUERY_OP_NE,
+	RPC_QUERY_OP_GT,
+	RPC_QUERY_OP_LT,
+	RPC_QUERY_OP_GE,
+	RPC_QUERY_OP_LE,
+	RPC_QUERY_OP_REGEX,
+	RPC_QUERY_OP_IN,
+	RPC_QUERY_OP_NIN,
+	RPC_QUERY_OP_MATCH
+};
+
+struct rpc_query_path_elem
+{
+	char *			rqe_name;
+	size_t			rqe_index;
+};
+
+struct rpc_query_node
+{
+	enum rpc_query_op	rqn_op;
+	bool			rqn_has_path;
+	guint			rqn_npath;
+	struct rpc_query_path_elem *rqn_path;
+	rpc_object_t		rqn_value;
+	GRegex *		rqn_regex;
+	GPtrArray *		rqn_children;
+};
+
+struct rpc_query_plan
+{
+	volatile gint		rqp_refcnt;
+	GPtrArray *		rqp_rules;	/**< All of them must match */
+};
+
+struct rpc_query_sorted_entry
+{
+	gint			rqs_hash;
+	size_t			rqs_pos;
+};
+
+struct rpc_query_index
+{
+	rpc_object_t		rqx_array;
+	rpc_query_index_type_t	rqx_type;
+	guint			rqx_npath;
+	struct rpc_query_path_elem *rqx_path;
+	GHashTable *		rqx_hash;	/**< Value to positions */
+	GArray *		rqx_sorted;	/**< Sorted by rpc_cmp() */
+	bool			rqx_stale;
+};
+
+struct rpc_query_job;
+
+struct rpc_query_chunk
+{
+	struct rpc_query_job *	rqc_job;
+	guint			rqc_index;
+	GArray *		rqc_matches;
+};
+
+struct rpc_query_job
+{
+	struct rpc_query_iter *	rqj_iter;
+	GMutex			rqj_mtx;
+	GCond			rqj_cv;
+	size_t			rqj_total;
+	size_t			rqj_chunk_size;
+	guint			rqj_nchunks;
+	guint			rqj_remaining;
+	struct rpc_query_chunk *rqj_chunks;
+	size_t			rqj_needed;	/**< 0 means all of them */
+	size_t			rqj_found;	/**< Within the prefix */
+	guint			rqj_prefix;	/**< First unfinished chunk */
+	volatile gint		rqj_stop_chunk;
+	GArray *		rqj_merged;
+};
+
 struct rpc_query_iter
 {
 	rpc_object_t 		rqi_source;
 	size_t 			rqi_idx;
-	rpc_object_t 		rqi_rules;
+	GArray *		rqi_candidates;
+	bool			rqi_prefiltered;
+	struct rpc_query_plan *	rqi_plan;
 	rpc_query_params_t 	rqi_params;
 	bool			rqi_done;
 	bool			rqi_initialized;
@@ -187,6 +292,7 @@ struct rpc_object
 	size_t			ro_column;
 	union rpc_value		ro_value;
 	struct rpct_typei *	ro_typei;
+	volatile int		ro_indexed;
 };
 
 struct rpc_subscription
@@ -196,9 +302,26 @@ struct rpc_subscription
 	char *			rsu_interface;
     	int 			rsu_refcount;
 	bool			rsu_busy;
+	bool			rsu_wildcard;
     	GPtrArray *		rsu_handlers;
 };
 
+struct rpc_emit_item
+{
+	rpc_context_t		rei_context;
+	char *			rei_path;
+	char *			rei_interface;
+	char *			rei_name;
+	rpc_object_t		rei_args;
+	volatile int		rei_refcnt;
+};
+
+struct rpc_emitter
+{
+	GAsyncQueue *		re_queue;
+	GThread *		re_thread;
+};
+
 struct rpc_subscription_handler
 {
 	struct rpc_subscription *rsh_parent;
@@ -227,6 +350,13 @@ struct rpc_call
 	atomic_int_fast64_t	rc_producer_seqno;
 	atomic_int_fast64_t	rc_consumer_seqno; /* also rc_seqno */
 	uint64_t 		rc_prefetch;
+	bool			rc_prefetch_adaptive;
+	uint64_t		rc_prefetch_min;
+	uint64_t		rc_prefetch_max;
+	gint64			rc_grant_time;
+	gint64			rc_rtt;
+	gint64			rc_rate_time;
+	int64_t			rc_rate_seqno;
 	rpc_instance_t 		rc_instance;
 	rpc_abort_handler_t	rc_abort_handler;
 	struct rpc_if_method *	rc_if_method;
@@ -235,6 +365,8 @@ struct rpc_call
 	bool			rc_responded;
 	bool			rc_ended;
 	bool			rc_aborted;
+	bool			rc_inline;
+	struct rpc_call_counter *rc_active;
 };
 
 struct rpc_credentials
@@ -251,12 +383,22 @@ struct rpc_fn_callbacks
 	rpc_fn_error_ex_fn_t	rcf_fn_error_ex;
 	rpc_fn_start_strm_fn_t	rcf_fn_start_stream;
 	rpc_fn_yield_fn_t	rcf_fn_yield;
+	rpc_fn_yield_many_fn_t	rcf_fn_yield_many;
 	rpc_fn_end_fn_t		rcf_fn_end;
 	rpc_fn_kill_fn_t	rcf_fn_kill;
 	rpc_fn_should_abt_fn_t	rcf_should_abort;
 	rpc_fn_set_abt_h_fn_t	rcf_set_async_abort_handler;
 };
 
+struct rpc_send_item
+{
+	rpc_object_t		rsi_frame;
+	void *			rsi_buf;
+	size_t			rsi_len;
+	int *			rsi_fds;
+	size_t			rsi_nfds;
+};
+
 struct rpc_connection
 {
 	struct rpc_server *	rco_server;
@@ -273,13 +415,26 @@ struct rpc_connection
 	guint                 	rco_rpc_timeout;
 	GHashTable *		rco_calls;
 	GHashTable *		rco_inbound_calls;
-    	GPtrArray *		rco_subscriptions;
+	GHashTable *		rco_subscriptions;
+	struct rpc_trie *	rco_wildcard_subscriptions;
 	GRWLock			rco_subscription_rwlock;
 	GMutex			rco_mtx;
 	GMutex			rco_ref_mtx;
 	GMutex			rco_send_mtx;
 	GRWLock			rco_icall_rwlock;
 	GRWLock			rco_call_rwlock;
+	GQueue *		rco_event_queue;
+	GMutex			rco_event_mtx;
+	bool			rco_event_scheduled;
+	bool			rco_event_overflow;
+	GQueue *		rco_send_queue;
+	GMutex			rco_send_queue_mtx;
+	GCond			rco_send_queue_cv;
+	GThread *		rco_send_thread;
+	size_t			rco_send_highwater;
+	bool			rco_send_stop;
+	struct rpc_emitter *	rco_send_emitter;
+	rpc_object_t		rco_send_error;
 	GMainContext *		rco_main_context;
 	rpc_object_t            rco_error;
     	GThreadPool *		rco_callback_pool;
@@ -294,6 +449,7 @@ struct rpc_connection
     	/* Callbacks */
 	rpc_recv_msg_fn_t	rco_recv_msg;
 	rpc_send_msg_fn_t	rco_send_msg;
+	rpc_send_msgv_fn_t	rco_send_msgv;
 	rpc_abort_fn_t 		rco_abort;
 	rpc_close_fn_t		rco_close;
     	rpc_get_fd_fn_t 	rco_get_fd;
@@ -308,7 +464,9 @@ struct rpc_server
     	GMainContext *		rs_g_context;
     	GMainLoop *		rs_g_loop;
     	GThread *		rs_thread;
-    	GList *			rs_connections;
+    	GHashTable *		rs_connections;
+	GPtrArray *		rs_conn_snapshot;
+	guint			rs_conn_generation;
 	GQueue *		rs_calls;
     	GMutex			rs_mtx;
 	GMutex			rs_calls_mtx;
@@ -329,6 +487,9 @@ struct rpc_server
 	int			rs_conn_aborted;
 	rpc_object_t 		rs_params;
 	rpc_server_ev_handler_t rs_event_handler;
+	size_t			rs_max_conn_calls;
+	size_t			rs_max_queued;
+	uint32_t		rs_retry_after;
 
     	/* Callbacks */
 	rpc_valid_fn_t		rs_valid;
@@ -354,6 +515,7 @@ struct rpc_instance
 	char *			ri_descr;
 	void *			ri_arg;
 	bool			ri_destroyed;
+	bool			ri_affinity;
 	int	 		ri_refcnt;
 	rpc_context_t 		ri_context;
 	GHashTable *		ri_interfaces;
@@ -362,6 +524,37 @@ struct rpc_instance
 	GRWLock			ri_rwlock;
 };
 
+struct rpc_property_state
+{
+	volatile gint		rps_refcnt;
+	GMutex			rps_mtx;
+	rpc_instance_t		rps_instance;
+	char *			rps_interface;
+	char *			rps_name;
+	rpc_object_t		rps_value;
+	guint			rps_seq;
+	rpc_object_t		rps_pending;
+	GSource *		rps_timer;
+	gint64			rps_interval;
+	gint64			rps_last_emit;
+	bool			rps_cacheable;
+	bool			rps_dead;
+};
+
+struct rpc_call_counter
+{
+	volatile gint		rcc_refcnt;
+	volatile gint		rcc_active;
+};
+
+struct rpc_member_priv
+{
+	struct rpc_if_member	rmp_member;
+	struct rpc_call_counter *rmp_active;
+	gint			rmp_limit;
+	struct rpc_property_state *rmp_prop;
+};
+
 struct rpc_interface_priv
 {
 	const char *		rip_name;
@@ -381,8 +574,9 @@ struct rpc_property_cookie
 
 struct rpc_context
 {
-    	GThreadPool *		rcx_threadpool;
+	struct rpc_scheduler *	rcx_scheduler;
 	GHashTable *		rcx_instances;
+	struct rpc_trie *	rcx_instance_tree;
 	GPtrArray * 		rcx_servers;
 	GRWLock			rcx_rwlock;
 	GRWLock			rcx_server_rwlock;
@@ -390,6 +584,16 @@ struct rpc_context
 	GAsyncQueue *		rcx_emit_queue;
 	GThread *		rcx_emit_thread;
 	GHashTable *		rcx_event_watchers;
+	struct rpc_emitter *	rcx_emitters;
+	guint			rcx_n_emitters;
+	volatile gsize		rcx_event_queue_limit;
+	volatile gint		rcx_event_overflow_policy;
+	uint64_t		rcx_inline_budget;
+	struct rpc_inline_slot *rcx_inline_slots;
+	volatile gint		rcx_inline_armed;
+	GMainContext *		rcx_g_context;
+	GMainLoop *		rcx_g_loop;
+	GThread *		rcx_g_thread;
 
 	/* Hooks */
 	rpc_function_t		rcx_pre_call_hook;
@@ -422,12 +626,55 @@ struct rpc_serializer
 	const char *name;
 };
 
+/**
+ * Append-only table of strings, probed without locks. Writers are
+ * serialized by the context lock and publish a slot by storing its key
+ * last. Growing the table publishes a new slot array; retired arrays
+ * stay around until the context is freed, as readers may still probe
+ * them.
+ */
+struct rpct_lookup_slot
+{
+	volatile gpointer	key;
+	gpointer		value;
+};
+
+struct rpct_lookup_array
+{
+	guint			size;
+	struct rpct_lookup_slot	slots[];
+};
+
+struct rpct_lookup
+{
+	volatile gpointer	array;
+	guint			count;
+	GPtrArray *		retired;
+};
+
+/*
+ * Lookups in types, interfaces and typei_cache go through their lookup
+ * tables and take no locks. Everything that adds to the context
+ * (reading files, materializing declarations) is serialized by
+ * load_lock, which is recursive since reading one type may chain-load
+ * others; those paths take the writer side of lock just to publish
+ * new entries. files and the indexes are only touched under load_lock.
+ * Published types, interfaces and cached typeis live as long as the
+ * context, so pointers returned by lookups stay valid.
+ */
 struct rpct_context
 {
+	GRWLock			lock;
+	GRecMutex		load_lock;
 	GHashTable *		files;
 	GHashTable *		types;
 	GHashTable *		interfaces;
+	GHashTable *		type_index;
+	GHashTable *		interface_index;
 	GHashTable *		typei_cache;
+	struct rpct_lookup	types_lookup;
+	struct rpct_lookup	interfaces_lookup;
+	struct rpct_lookup	typei_lookup;
 	rpc_function_t		pre_call_hook;
 	rpc_function_t 		post_call_hook;
 };
@@ -445,6 +692,18 @@ struct rpct_file
 	rpc_object_t 		body;
 };
 
+/**
+ * Location of a not yet materialized type or interface declaration.
+ */
+struct rpct_decl
+{
+	struct rpct_file *	file;
+	const char *		decl;
+	rpc_object_t		body;
+	bool			failed;
+	guint			failed_nfiles;
+};
+
 /**
  * An RPC type.
  */
@@ -487,6 +746,7 @@ struct rpct_typei
 	GHashTable *		specializations;
 	GHashTable *		constraints;
 	volatile int		refcnt;
+	struct rpct_validation_plan *plan;
 };
 
 struct rpct_member
@@ -514,9 +774,18 @@ struct rpct_argument
 	bool			opt;
 };
 
+/*
+ * Error contexts form a chain through the validated object. The path
+ * string is only assembled when an error is actually added; until then
+ * a derived context just points at its parent and a member name or an
+ * array index.
+ */
 struct rpct_error_context
 {
-	char *			path;
+	const char *		path;	/**< Root contexts only */
+	struct rpct_error_context *parent;
+	const char *		name;
+	size_t			index;
 	GPtrArray *		errors;
 };
 
@@ -543,6 +812,45 @@ struct rpct_validator
 	const char *		type;
 	const char * 		name;
 	rpct_validator_fn_t 	validate;
+	rpct_validator_prepare_fn_t prepare;	/**< Optional */
+	rpct_validator_run_fn_t	run;		/**< Required if prepare is set */
+	GDestroyNotify		release;	/**< Frees prepared state */
+};
+
+struct rpct_validation_step
+{
+	const char *		rvs_name;
+	const struct rpct_validator *rvs_validator;
+	rpc_object_t		rvs_params;
+	void *			rvs_state;
+};
+
+struct rpct_plan_member
+{
+	struct rpct_member *	rpm_member;
+	struct rpct_typei *	rpm_typei;
+};
+
+/*
+ * Everything rpct_validate_instance() needs to know about a type
+ * instance, resolved once and cached on the typei.
+ */
+struct rpct_validation_plan
+{
+	const struct rpct_class_handler *rvp_handler;
+	struct rpct_typei *	rvp_raw;
+	bool			rvp_any;
+	bool			rvp_nullptr;
+	bool			rvp_builtin;
+	rpc_type_t		rvp_builtin_type;
+	GHashTable *		rvp_constraints;
+	bool			rvp_steps_valid;
+	rpc_type_t		rvp_steps_type;
+	guint			rvp_nsteps;
+	struct rpct_validation_step *rvp_steps;
+	guint			rvp_nmembers;
+	struct rpct_plan_member *rvp_members;
+	struct rpct_typei *	rvp_value;
 };
 
 INTERNAL_LINKAGE rpc_object_t rpc_prim_create(rpc_type_t type,
@@ -556,6 +864,9 @@ INTERNAL_LINKAGE off_t rpc_shmem_get_offset(rpc_object_t shmem);
 #endif
 
 INTERNAL_LINKAGE rpc_object_t rpc_error_create_from_gerror(GError *g_error);
+INTERNAL_LINKAGE void rpc_call_counter_release(struct rpc_call_counter *);
+INTERNAL_LINKAGE rpc_object_t rpc_error_create_busy(const char *msg,
+    uint32_t retry_after);
 
 INTERNAL_LINKAGE void rpc_abort(const char *fmt, ...);
 INTERNAL_LINKAGE void rpc_trace(const char *msg, const char *ident,
@@ -566,6 +877,39 @@ INTERNAL_LINKAGE gboolean rpc_kill_main_loop(void *arg);
 INTERNAL_LINKAGE int rpc_ptr_array_string_index(GPtrArray *arr,
     const char *str);
 
+INTERNAL_LINKAGE struct rpc_trie *rpc_trie_new(GDestroyNotify value_free);
+INTERNAL_LINKAGE struct rpc_scheduler *rpc_scheduler_new(guint nworkers);
+INTERNAL_LINKAGE void rpc_scheduler_free(struct rpc_scheduler *sched);
+INTERNAL_LINKAGE guint rpc_scheduler_get_nworkers(struct rpc_scheduler *sched);
+INTERNAL_LINKAGE bool rpc_scheduler_detach(struct rpc_scheduler *sched);
+INTERNAL_LINKAGE void rpc_scheduler_push(struct rpc_scheduler *sched,
+    GFunc func, gpointer data, gpointer user_data, rpc_priority_t prio,
+    gint affinity);
+INTERNAL_LINKAGE void rpc_scheduler_get_stats(struct rpc_scheduler *sched,
+    struct rpc_context_stats *stats);
+INTERNAL_LINKAGE struct rpc_pack_fmt *rpc_pack_fmt_lookup(const char *fmt);
+INTERNAL_LINKAGE rpc_object_t rpc_pack_fmt_vpack(struct rpc_pack_fmt *prog,
+    va_list ap);
+INTERNAL_LINKAGE int rpc_pack_fmt_vunpack(rpc_object_t obj,
+    struct rpc_pack_fmt *prog, va_list ap);
+INTERNAL_LINKAGE int rpc_object_vunpack_interp(rpc_object_t obj,
+    const char *fmt, va_list ap);
+
+INTERNAL_LINKAGE void rpc_trie_free(struct rpc_trie *trie);
+INTERNAL_LINKAGE size_t rpc_trie_count(struct rpc_trie *trie);
+INTERNAL_LINKAGE void *rpc_trie_lookup(struct rpc_trie *trie,
+    const char *path);
+INTERNAL_LINKAGE bool rpc_trie_insert(struct rpc_trie *trie,
+    const char *path, void *value);
+INTERNAL_LINKAGE void *rpc_trie_steal(struct rpc_trie *trie,
+    const char *path);
+INTERNAL_LINKAGE bool rpc_trie_remove(struct rpc_trie *trie,
+    const char *path);
+INTERNAL_LINKAGE bool rpc_trie_walk(struct rpc_trie *trie, const char *path,
+    rpc_trie_applier_t applier);
+INTERNAL_LINKAGE bool rpc_trie_apply_subtree(struct rpc_trie *trie,
+    const char *path, bool include_self, rpc_trie_applier_t applier);
+
 INTERNAL_LINKAGE const struct rpc_transport *rpc_find_transport(
     const char *scheme);
 INTERNAL_LINKAGE const struct rpc_serializer *rpc_find_serializer(
@@ -575,6 +919,12 @@ INTERNAL_LINKAGE const struct rpct_validator *rpc_find_validator(
     const char *name);
 INTERNAL_LINKAGE const struct rpct_class_handler *rpc_find_class_handler(
     const char *name, rpct_class_t cls);
+INTERNAL_LINKAGE GRegex *rpc_regex_get(const char *pattern);
+INTERNAL_LINKAGE void rpc_query_index_notify_append(rpc_object_t array,
+    size_t index);
+INTERNAL_LINKAGE void rpc_query_index_notify_remove(rpc_object_t array,
+    size_t index);
+INTERNAL_LINKAGE void rpc_query_index_notify_invalidate(rpc_object_t array);
 
 INTERNAL_LINKAGE void rpc_set_last_error(int code, const char *msg,
     rpc_object_t extra);
@@ -588,6 +938,8 @@ INTERNAL_LINKAGE int rpc_connection_retain(rpc_connection_t);
 INTERNAL_LINKAGE int rpc_connection_release(rpc_connection_t);
 INTERNAL_LINKAGE int rpc_connection_retain_if_valid(rpc_connection_t, bool);
 INTERNAL_LINKAGE int rpc_context_dispatch(rpc_context_t, struct rpc_call *);
+INTERNAL_LINKAGE int rpc_context_submit(rpc_context_t, struct rpc_call *);
+INTERNAL_LINKAGE void rpc_context_run_inline(rpc_context_t, struct rpc_call *);
 INTERNAL_LINKAGE int rpc_server_dispatch(rpc_server_t, struct rpc_call *);
 INTERNAL_LINKAGE void rpc_server_release(rpc_server_t);
 INTERNAL_LINKAGE void rpc_server_quit(rpc_server_t);
@@ -605,13 +957,22 @@ INTERNAL_LINKAGE void rpc_connection_send_start_stream(rpc_connection_t,
     rpc_object_t, int64_t);
 INTERNAL_LINKAGE void rpc_connection_send_fragment(rpc_connection_t,
     rpc_object_t, int64_t, rpc_object_t);
+INTERNAL_LINKAGE void rpc_connection_send_fragments(rpc_connection_t,
+    rpc_object_t, int64_t, rpc_object_t);
 INTERNAL_LINKAGE void rpc_connection_send_end(rpc_connection_t, rpc_object_t,
     int64_t);
 INTERNAL_LINKAGE void rpc_connection_close_inbound_call(struct rpc_call *);
 INTERNAL_LINKAGE int rpc_connection_call_retain(struct rpc_call *call);
 INTERNAL_LINKAGE int rpc_connection_call_release(struct rpc_call *call);
 INTERNAL_LINKAGE int rpc_connection_get_subscription_count(rpc_connection_t conn);
+INTERNAL_LINKAGE int rpc_connection_queue_event(rpc_connection_t,
+    struct rpc_emitter *, const char *, const char *, const char *,
+    rpc_object_t);
+INTERNAL_LINKAGE void rpc_connection_wake_emitter(rpc_connection_t);
+INTERNAL_LINKAGE bool rpc_connection_is_subscribed(rpc_connection_t conn,
+    const char *path, const char *interface, const char *name);
 INTERNAL_LINKAGE rpc_instance_t rpc_instance_retain(rpc_instance_t);
+INTERNAL_LINKAGE void rpc_emit_item_release(struct rpc_emit_item *item);
 INTERNAL_LINKAGE void rpc_instance_release(rpc_instance_t);
 
 INTERNAL_LINKAGE void rpc_bus_event(rpc_bus_event_t, struct rpc_bus_node *);
@@ -621,15 +982,19 @@ INTERNAL_LINKAGE void rpct_add_error(struct rpct_error_context *ctx,
 INTERNAL_LINKAGE void rpct_derive_error_context(
     struct rpct_error_context *newctx, struct rpct_error_context *oldctx,
     const char *name);
-INTERNAL_LINKAGE void rpct_release_error_context(
-    struct rpct_error_context *ctx);
+INTERNAL_LINKAGE void rpct_derive_error_context_index(
+    struct rpct_error_context *newctx, struct rpct_error_context *oldctx,
+    size_t index);
 INTERNAL_LINKAGE bool rpct_validate_instance(struct rpct_typei *typei,
     rpc_object_t obj, struct rpct_error_context *errctx);
 INTERNAL_LINKAGE bool rpct_run_validators(struct rpct_typei *typei,
     rpc_object_t obj, struct rpct_error_context *errctx);
+INTERNAL_LINKAGE struct rpct_validation_plan *rpct_typei_get_plan(
+    struct rpct_typei *typei);
 INTERNAL_LINKAGE struct rpct_typei *rpct_instantiate_type(const char *decl,
     struct rpct_typei *parent, struct rpct_type *ptype,
     struct rpct_file *origin);
+INTERNAL_LINKAGE int rpct_get_generation(void);
 
 INTERNAL_LINKAGE void rpc_function_respond_impl(void *cookie,
     rpc_object_t object);
@@ -640,6 +1005,8 @@ INTERNAL_LINKAGE void rpc_function_error_ex_impl(void *cookie,
 INTERNAL_LINKAGE int rpc_function_start_stream_impl(void *cookie);
 INTERNAL_LINKAGE int rpc_function_yield_impl(void *cookie,
     rpc_object_t fragment);
+INTERNAL_LINKAGE int rpc_function_yield_many_impl(void *cookie,
+    rpc_object_t fragments);
 INTERNAL_LINKAGE void rpc_function_end_impl(void *cookie);
 INTERNAL_LINKAGE void rpc_function_kill_impl(void *cookie);
 INTERNAL_LINKAGE bool rpc_function_should_abort_impl(void *cookie);
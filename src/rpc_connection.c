@@ -26,6 +26,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -42,6 +43,10 @@
 
 #define	DEFAULT_RPC_TIMEOUT	60
 #define	MAX_FDS			128
+#define	DEFAULT_PREFETCH_MAX	256
+#define	SEND_BATCH_FRAMES	32
+#define	SEND_BATCH_BYTES	(256 * 1024)
+#define	SEND_EVENT_BACKLOG	64
 
 typedef enum rpc_close_source
 {
@@ -58,6 +63,13 @@ static bool rpc_run_callback(rpc_connection_t, struct work_item *);
 static struct rpc_call *rpc_call_alloc(rpc_connection_t, rpc_object_t,
     const char *, const char *, const char *, rpc_object_t);
 static int rpc_send_frame(rpc_connection_t, rpc_object_t);
+static int rpc_send_frame_throttled(rpc_connection_t, rpc_object_t);
+static int rpc_send_frame_impl(rpc_connection_t, rpc_object_t, bool);
+static int rpc_send_queue_push(rpc_connection_t, rpc_object_t, bool);
+static gpointer rpc_send_worker(gpointer);
+static void rpc_send_queue_stop(rpc_connection_t);
+static void rpc_send_queue_resume(rpc_connection_t, bool);
+static void rpc_send_item_free(struct rpc_send_item *);
 static void on_rpc_call(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_rpc_response(rpc_connection_t, rpc_object_t, rpc_object_t);
 static void on_rpc_start_stream(rpc_connection_t, rpc_object_t, rpc_object_t);
@@ -82,6 +94,10 @@ static void rpc_connection_free_resources(rpc_connection_t);
 static int cancel_timeout_locked(rpc_call_t call);
 static void rpc_connection_set_default_fn_handlers(rpc_connection_t);
 static inline rpc_object_t rpc_call_result_save(rpc_call_t call);
+static int64_t rpc_call_credit_locked(rpc_call_t call);
+static int rpc_call_advance_locked(rpc_call_t call, size_t count);
+static void rpc_call_push_fragment_locked(rpc_call_t call,
+    rpc_object_t payload);
 static int rpc_connection_do_close(rpc_connection_t conn, rpc_close_source_t);
 static rpc_connection_t rpc_connection_init(int);
 static void rpc_abort_worker(void *arg, void *data);
@@ -91,6 +107,10 @@ static void rpc_rsh_release(struct rpc_subscription_handler *rsh);
 static int rpc_set_creds(rpc_connection_t conn, pid_t pid, uid_t uid, gid_t gid);
 static int rpc_connection_unsubscribe_event_locked(rpc_connection_t conn,
     struct rpc_subscription *sub);
+static void rpc_connection_add_subscription(rpc_connection_t conn,
+    struct rpc_subscription *sub);
+static void rpc_connection_remove_subscription(rpc_connection_t conn,
+    struct rpc_subscription *sub);
 
 struct message_handler
 {
@@ -376,6 +396,7 @@ on_rpc_call(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 	const char *path = NULL;
 	rpc_object_t call_args = NULL;
 	rpc_object_t err;
+	size_t ncalls;
 	int res;
 
 	if (conn->rco_rpc_context == NULL) {
@@ -383,6 +404,19 @@ on_rpc_call(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 		return;
 	}
 
+	if (conn->rco_server != NULL && conn->rco_server->rs_max_conn_calls > 0) {
+		g_rw_lock_reader_lock(&conn->rco_icall_rwlock);
+		ncalls = g_hash_table_size(conn->rco_inbound_calls);
+		g_rw_lock_reader_unlock(&conn->rco_icall_rwlock);
+
+		if (ncalls >= conn->rco_server->rs_max_conn_calls) {
+			rpc_connection_send_errx(conn, id, rpc_error_create_busy(
+			    "Too many concurrent calls",
+			    conn->rco_server->rs_retry_after));
+			return;
+		}
+	}
+
 	rpc_object_unpack(args, "{s,s,s,v}",
 	    "method", &method,
 	    "interface", &interface,
@@ -411,13 +445,15 @@ on_rpc_call(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 		res = rpc_context_dispatch(conn->rco_rpc_context, call);
 
 	if (res != 0) {
-		if (call->rc_err != NULL) {
-			rpc_function_error(call,
-			    rpc_error_get_code(call->rc_err),
-			    rpc_error_get_message(call->rc_err));
-		}
+		if (call->rc_err != NULL)
+			rpc_function_error_ex(call, rpc_retain(call->rc_err));
+
 		rpc_connection_close_inbound_call(call);
+		return;
 	}
+
+	if (call->rc_inline)
+		rpc_context_run_inline(call->rc_context, call);
 }
 
 static void
@@ -512,13 +548,32 @@ on_rpc_start_stream(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 }
 
 static void
-on_rpc_fragment(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
+rpc_call_push_fragment_locked(rpc_call_t call, rpc_object_t payload)
 {
 	struct queue_item *q_item;
 	struct work_item *item;
+
+	if (call->rc_callback) {
+		item = g_malloc0(sizeof(*item));
+		item->call = call;
+		if (!rpc_run_callback(call->rc_conn, item))
+			g_free(item);
+	}
+
+	q_item = g_malloc(sizeof(*q_item));
+	q_item->status = RPC_CALL_MORE_AVAILABLE;
+	q_item->item = rpc_retain(payload);
+	g_queue_push_tail(call->rc_queue, q_item);
+}
+
+static void
+on_rpc_fragment(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
+{
 	rpc_call_t call;
 	rpc_object_t payload;
+	rpc_object_t fragments;
 	int64_t seqno;
+	gint64 rtt;
 
 	g_rw_lock_reader_lock(&conn->rco_call_rwlock);
 	call = g_hash_table_lookup(conn->rco_calls,
@@ -541,26 +596,34 @@ on_rpc_fragment(rpc_connection_t conn, rpc_object_t args, rpc_object_t id)
 
 	seqno = rpc_dictionary_get_int64(args, "seqno");
 	payload = rpc_dictionary_get_value(args, "fragment");
+	fragments = rpc_dictionary_get_value(args, "fragments");
+
+	if (call->rc_grant_time != 0) {
+		/* First fragment after running out of credit: sample RTT */
+		rtt = g_get_monotonic_time() - call->rc_grant_time;
+		call->rc_rtt = call->rc_rtt == 0 ? rtt :
+		    (call->rc_rtt * 7 + rtt) / 8;
+		call->rc_grant_time = 0;
+	}
 
-	if (payload == NULL) {
+	if (payload == NULL && fragments == NULL) {
 		debugf("Fragment with no payload received on %p", conn);
 		g_mutex_unlock(&call->rc_mtx);
 		rpc_connection_call_release(call);
 		return;
 	}
 
-	if (call->rc_callback) {
-		item = g_malloc0(sizeof(*item));
-		item->call = call;
-		if (!rpc_run_callback(conn, item))
-			g_free(item);
+	/* Batched fragments are queued one by one, each taking one seqno */
+	if (payload != NULL)
+		rpc_call_push_fragment_locked(call, payload);
+	else {
+		rpc_array_apply(fragments, ^(size_t idx __unused,
+		    rpc_object_t value) {
+			rpc_call_push_fragment_locked(call, value);
+			return ((bool)true);
+		});
 	}
 
-	q_item = g_malloc(sizeof(*q_item));
-	q_item->status = RPC_CALL_MORE_AVAILABLE;
-	q_item->item = rpc_retain(payload);
-
-	g_queue_push_tail(call->rc_queue, q_item);
 	notify_signal(&call->rc_notify);
 	g_mutex_unlock(&call->rc_mtx);
 	rpc_connection_call_release(call);
@@ -769,19 +832,18 @@ on_events_subscribe(rpc_connection_t conn, rpc_object_t args,
 	    		return ((bool)true);
 
 		g_rw_lock_writer_lock(&conn->rco_subscription_rwlock);
-		if (conn->rco_subscriptions->len > 0)
-			sub = rpc_connection_find_subscription(conn, path,
-			    interface, name);
-		if (sub == NULL) {
+		sub = rpc_connection_find_subscription(conn, path, interface,
+		    name);
+		if (sub == NULL || g_strcmp0(sub->rsu_path, path) != 0) {
 			sub = g_malloc0(sizeof(*sub));
 			sub->rsu_path = g_strdup(path);
 			sub->rsu_interface = g_strdup(interface);
 			sub->rsu_name = g_strdup(name);
-			g_ptr_array_add(conn->rco_subscriptions, sub);
+			rpc_connection_add_subscription(conn, sub);
 		}
 
 		sub->rsu_refcount++;
-		if (conn->rco_subscriptions->len == 1) {
+		if (g_hash_table_size(conn->rco_subscriptions) == 1) {
 			/* just added, add conn to context */
 			g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
 			g_rw_lock_writer_lock(
@@ -839,15 +901,15 @@ on_events_unsubscribe(rpc_connection_t conn, rpc_object_t args,
 
 		g_rw_lock_writer_lock(&conn->rco_subscription_rwlock);
 		sub = rpc_connection_find_subscription(conn, path, interface, name);
-		if (sub == NULL) {
+		if (sub == NULL || g_strcmp0(sub->rsu_path, path) != 0) {
 			g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
 			return ((bool)true);
 		}
 
 		sub->rsu_refcount--;
 		if (sub->rsu_refcount == 0) {
-			g_ptr_array_remove(conn->rco_subscriptions, sub);
-			if (conn->rco_subscriptions->len == 0) {
+			rpc_connection_remove_subscription(conn, sub);
+			if (g_hash_table_size(conn->rco_subscriptions) == 0) {
 				g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
 				g_rw_lock_writer_lock(&conn->rco_rpc_context->rcx_rwlock);
 				g_assert(g_hash_table_remove(
@@ -1096,6 +1158,9 @@ rpc_call_alloc(rpc_connection_t conn, rpc_object_t id, const char *path,
 	call->rc_refcount = 1;
 	call->rc_queue = g_queue_new();
 	call->rc_prefetch = 1;
+	call->rc_prefetch_adaptive = true;
+	call->rc_prefetch_min = 1;
+	call->rc_prefetch_max = DEFAULT_PREFETCH_MAX;
 	call->rc_conn = conn;
 	call->rc_context = conn->rco_rpc_context;
 	call->rc_path = g_strdup(path);
@@ -1112,6 +1177,24 @@ rpc_call_alloc(rpc_connection_t conn, rpc_object_t id, const char *path,
 
 static int
 rpc_send_frame(rpc_connection_t conn, rpc_object_t frame)
+{
+
+	return (rpc_send_frame_impl(conn, frame, false));
+}
+
+static int
+rpc_send_frame_throttled(rpc_connection_t conn, rpc_object_t frame)
+{
+
+	/*
+	 * Used for stream fragments and events only. Responses are never
+	 * throttled, so that the reader thread can't block on the writer.
+	 */
+	return (rpc_send_frame_impl(conn, frame, true));
+}
+
+static int
+rpc_send_frame_impl(rpc_connection_t conn, rpc_object_t frame, bool throttle)
 {
 	void *buf = frame;
 	int fds[MAX_FDS];
@@ -1130,6 +1213,9 @@ rpc_send_frame(rpc_connection_t conn, rpc_object_t frame)
 	rpc_trace("SEND", conn->rco_uri, frame);
 #endif
 
+	if (g_atomic_pointer_get(&conn->rco_send_queue) != NULL)
+		return (rpc_send_queue_push(conn, frame, throttle));
+
 	g_mutex_lock(&conn->rco_send_mtx);
 	nfds = rpc_serialize_fds(frame, fds, NULL, 0);
 
@@ -1151,29 +1237,384 @@ rpc_send_frame(rpc_connection_t conn, rpc_object_t frame)
 	return (ret);
 }
 
+static void
+rpc_send_item_free(struct rpc_send_item *item)
+{
+
+	if (item->rsi_buf != item->rsi_frame)
+		free(item->rsi_buf);
+
+	rpc_release(item->rsi_frame);
+	g_free(item->rsi_fds);
+	g_free(item);
+}
+
+static int
+rpc_send_queue_push(rpc_connection_t conn, rpc_object_t frame, bool throttle)
+{
+	struct rpc_send_item *item;
+	int fds[MAX_FDS];
+
+	item = g_malloc0(sizeof(*item));
+	item->rsi_frame = frame;
+	item->rsi_buf = frame;
+	item->rsi_nfds = rpc_serialize_fds(frame, fds, NULL, 0);
+	if (item->rsi_nfds > 0)
+		item->rsi_fds = g_memdup(fds, sizeof(int) * item->rsi_nfds);
+
+	/* Serialize in the caller's thread; the writer only does I/O */
+	if ((conn->rco_flags & RPC_TRANSPORT_NO_SERIALIZE) == 0) {
+		if (rpc_msgpack_serialize(frame, &item->rsi_buf,
+		    &item->rsi_len) != 0) {
+			item->rsi_buf = frame;
+			rpc_send_item_free(item);
+			return (-1);
+		}
+	}
+
+	g_mutex_lock(&conn->rco_send_queue_mtx);
+	while (throttle && !conn->rco_send_stop &&
+	    conn->rco_send_highwater > 0 &&
+	    g_queue_get_length(conn->rco_send_queue) >=
+	    conn->rco_send_highwater) {
+		g_cond_wait(&conn->rco_send_queue_cv,
+		    &conn->rco_send_queue_mtx);
+	}
+
+	if (conn->rco_send_stop) {
+		/* Report why the writer gave up, if it did */
+		if (conn->rco_send_error != NULL)
+			rpc_set_last_rpc_error(conn->rco_send_error);
+		else
+			rpc_set_last_error(ENOTCONN, "Connection is closed",
+			    NULL);
+
+		g_mutex_unlock(&conn->rco_send_queue_mtx);
+		rpc_send_item_free(item);
+		return (-1);
+	}
+
+	g_queue_push_tail(conn->rco_send_queue, item);
+	g_cond_broadcast(&conn->rco_send_queue_cv);
+	g_mutex_unlock(&conn->rco_send_queue_mtx);
+	return (0);
+}
+
+static int
+rpc_send_batch(rpc_connection_t conn, struct rpc_send_item **batch,
+    size_t nitems)
+{
+	size_t i;
+	int ret = 0;
+
+	g_mutex_lock(&conn->rco_send_mtx);
+	if (conn->rco_send_msgv != NULL &&
+	    (conn->rco_flags & RPC_TRANSPORT_NO_SERIALIZE) == 0) {
+		ret = conn->rco_send_msgv(conn->rco_arg, batch, nitems);
+		goto done;
+	}
+
+	for (i = 0; i < nitems; i++) {
+		ret = conn->rco_send_msg(conn->rco_arg, batch[i]->rsi_buf,
+		    batch[i]->rsi_len, batch[i]->rsi_fds, batch[i]->rsi_nfds);
+		if (ret != 0)
+			break;
+	}
+
+done:
+	g_mutex_unlock(&conn->rco_send_mtx);
+	return (ret);
+}
+
+static gpointer
+rpc_send_worker(gpointer arg)
+{
+	rpc_connection_t conn = arg;
+	struct rpc_send_item *batch[SEND_BATCH_FRAMES];
+	struct rpc_send_item *item;
+	size_t nitems;
+	size_t len;
+	size_t i;
+	int ret = 0;
+
+	for (;;) {
+		g_mutex_lock(&conn->rco_send_queue_mtx);
+		while (g_queue_is_empty(conn->rco_send_queue) &&
+		    !conn->rco_send_stop) {
+			g_cond_wait(&conn->rco_send_queue_cv,
+			    &conn->rco_send_queue_mtx);
+		}
+
+		if (g_queue_is_empty(conn->rco_send_queue)) {
+			g_mutex_unlock(&conn->rco_send_queue_mtx);
+			break;
+		}
+
+		/*
+		 * Gather as many queued frames as fit into a single write.
+		 * Frames carrying file descriptors always go out on their
+		 * own, so that the peer can associate them correctly.
+		 */
+		nitems = 0;
+		len = 0;
+		while (nitems < SEND_BATCH_FRAMES) {
+			item = g_queue_peek_head(conn->rco_send_queue);
+			if (item == NULL)
+				break;
+
+			if (nitems > 0 && (item->rsi_nfds > 0 ||
+			    len + item->rsi_len > SEND_BATCH_BYTES))
+				break;
+
+			batch[nitems++] = g_queue_pop_head(
+			    conn->rco_send_queue);
+			len += item->rsi_len;
+
+			if (item->rsi_nfds > 0)
+				break;
+		}
+
+		/* Wake up producers waiting for the queue to drain */
+		g_cond_broadcast(&conn->rco_send_queue_cv);
+		rpc_send_queue_resume(conn, false);
+
+		if (ret == 0) {
+			ret = rpc_send_batch(conn, batch, nitems);
+			if (ret != 0) {
+				/* Fail any further producers immediately */
+				g_mutex_lock(&conn->rco_send_queue_mtx);
+				conn->rco_send_error = rpc_error_create(
+				    ECONNRESET, "Asynchronous send failed",
+				    conn->rco_error);
+				conn->rco_send_stop = true;
+				g_cond_broadcast(&conn->rco_send_queue_cv);
+				g_mutex_unlock(&conn->rco_send_queue_mtx);
+			}
+		}
+
+		for (i = 0; i < nitems; i++)
+			rpc_send_item_free(batch[i]);
+	}
+
+	return (NULL);
+}
+
+static size_t
+rpc_send_queue_event_limit(rpc_connection_t conn)
+{
+
+	return (conn->rco_send_highwater > 0 ? conn->rco_send_highwater :
+	    SEND_EVENT_BACKLOG);
+}
+
+/*
+ * Hands the connection back to the event emitter shard that found its
+ * send queue full, once there is room again or sending stopped. Called
+ * with rco_send_queue_mtx held, which it drops.
+ */
+static void
+rpc_send_queue_resume(rpc_connection_t conn, bool force)
+{
+	struct rpc_emitter *emitter = conn->rco_send_emitter;
+
+	if (emitter != NULL && (force || conn->rco_send_stop ||
+	    g_queue_get_length(conn->rco_send_queue) <
+	    rpc_send_queue_event_limit(conn)))
+		conn->rco_send_emitter = NULL;
+	else
+		emitter = NULL;
+
+	g_mutex_unlock(&conn->rco_send_queue_mtx);
+
+	/* The emitter's connection reference is passed back along */
+	if (emitter != NULL)
+		g_async_queue_push(emitter->re_queue, conn);
+}
+
+static void
+rpc_send_queue_stop(rpc_connection_t conn)
+{
+
+	if (conn->rco_send_thread == NULL)
+		return;
+
+	g_mutex_lock(&conn->rco_send_queue_mtx);
+	conn->rco_send_stop = true;
+	g_cond_broadcast(&conn->rco_send_queue_cv);
+	g_mutex_unlock(&conn->rco_send_queue_mtx);
+
+	g_thread_join(conn->rco_send_thread);
+	conn->rco_send_thread = NULL;
+}
+
+int
+rpc_connection_set_send_queue(rpc_connection_t conn, size_t highwater)
+{
+
+	g_mutex_lock(&conn->rco_send_queue_mtx);
+	conn->rco_send_highwater = highwater;
+	g_cond_broadcast(&conn->rco_send_queue_cv);
+
+	if (conn->rco_send_queue != NULL) {
+		g_mutex_unlock(&conn->rco_send_queue_mtx);
+		return (0);
+	}
+
+	if (!rpc_connection_is_open(conn)) {
+		g_mutex_unlock(&conn->rco_send_queue_mtx);
+		rpc_set_last_error(ENOTCONN, "Connection is closed", NULL);
+		return (-1);
+	}
+
+	/* Make sure no synchronous send is still in flight */
+	g_mutex_lock(&conn->rco_send_mtx);
+	g_atomic_pointer_set(&conn->rco_send_queue, g_queue_new());
+	g_mutex_unlock(&conn->rco_send_mtx);
+
+	conn->rco_send_thread = g_thread_new("send queue", rpc_send_worker,
+	    conn);
+	g_mutex_unlock(&conn->rco_send_queue_mtx);
+	return (0);
+}
+
+static guint
+rpc_subscription_hash(gconstpointer key)
+{
+	const struct rpc_subscription *sub = key;
+	guint hash = 17;
+
+	hash = hash * 31 + (sub->rsu_path ? g_str_hash(sub->rsu_path) : 0);
+	hash = hash * 31 + (sub->rsu_interface ?
+	    g_str_hash(sub->rsu_interface) : 0);
+	hash = hash * 31 + (sub->rsu_name ? g_str_hash(sub->rsu_name) : 0);
+	return (hash);
+}
+
+static gboolean
+rpc_subscription_equal(gconstpointer a, gconstpointer b)
+{
+	const struct rpc_subscription *sa = a;
+	const struct rpc_subscription *sb = b;
+
+	return (g_strcmp0(sa->rsu_path, sb->rsu_path) == 0 &&
+	    g_strcmp0(sa->rsu_interface, sb->rsu_interface) == 0 &&
+	    g_strcmp0(sa->rsu_name, sb->rsu_name) == 0);
+}
+
+/*
+ * Wildcard subscriptions have a path whose last component is "*" and
+ * match events emitted on any path below the prefix (but not on the
+ * prefix itself).
+ */
+static char *
+rpc_subscription_wildcard_prefix(const char *path)
+{
+	size_t len;
+
+	if (path == NULL || !g_str_has_suffix(path, "/*"))
+		return (NULL);
+
+	len = strlen(path) - 2;
+	return (len == 0 ? g_strdup("/") : g_strndup(path, len));
+}
+
+static void
+rpc_connection_add_subscription(rpc_connection_t conn,
+    struct rpc_subscription *sub)
+{
+	GPtrArray *subs;
+	char *prefix;
+
+	/* Called with the subscription lock held */
+	g_hash_table_add(conn->rco_subscriptions, sub);
+
+	prefix = rpc_subscription_wildcard_prefix(sub->rsu_path);
+	if (prefix == NULL)
+		return;
+
+	sub->rsu_wildcard = true;
+	subs = rpc_trie_lookup(conn->rco_wildcard_subscriptions, prefix);
+	if (subs == NULL) {
+		subs = g_ptr_array_new();
+		rpc_trie_insert(conn->rco_wildcard_subscriptions, prefix, subs);
+	}
+
+	g_ptr_array_add(subs, sub);
+	g_free(prefix);
+}
+
+static void
+rpc_connection_remove_subscription(rpc_connection_t conn,
+    struct rpc_subscription *sub)
+{
+	GPtrArray *subs;
+	char *prefix;
+
+	/* Called with the subscription lock held */
+	if (sub->rsu_wildcard) {
+		prefix = rpc_subscription_wildcard_prefix(sub->rsu_path);
+		subs = rpc_trie_lookup(conn->rco_wildcard_subscriptions,
+		    prefix);
+
+		if (subs != NULL) {
+			g_ptr_array_remove_fast(subs, sub);
+			if (subs->len == 0) {
+				rpc_trie_remove(conn->rco_wildcard_subscriptions,
+				    prefix);
+			}
+		}
+
+		g_free(prefix);
+	}
+
+	/* Frees the subscription */
+	g_hash_table_remove(conn->rco_subscriptions, sub);
+}
+
 static struct rpc_subscription *
 rpc_connection_find_subscription(rpc_connection_t conn, const char *path,
     const char *interface, const char *name)
 {
-	struct rpc_subscription *result;
-	guint i;
+	struct rpc_subscription key;
+	__block struct rpc_subscription *result;
 
-	for (i = 0; i < conn->rco_subscriptions->len; i++) {
-		result = g_ptr_array_index(conn->rco_subscriptions, i);
+	key.rsu_path = (char *)path;
+	key.rsu_interface = (char *)interface;
+	key.rsu_name = (char *)name;
 
-		if (g_strcmp0(result->rsu_path, path) != 0)
-			continue;
+	result = g_hash_table_lookup(conn->rco_subscriptions, &key);
+	if (result != NULL)
+		return (result);
 
-		if (g_strcmp0(result->rsu_interface, interface) != 0)
-			continue;
+	if (rpc_trie_count(conn->rco_wildcard_subscriptions) == 0)
+		return (NULL);
 
-		if (g_strcmp0(result->rsu_name, name) != 0)
-			continue;
+	/* Find the most specific wildcard subscription matching the path */
+	rpc_trie_walk(conn->rco_wildcard_subscriptions, path,
+	    ^(const char *prefix, void *value) {
+		GPtrArray *subs = value;
+		struct rpc_subscription *sub;
 
-		return (result);
-	}
+		if (g_strcmp0(prefix, path) == 0)
+			return ((bool)true);
 
-	return (NULL);
+		for (guint i = 0; i < subs->len; i++) {
+			sub = g_ptr_array_index(subs, i);
+
+			if (g_strcmp0(sub->rsu_interface, interface) != 0)
+				continue;
+
+			if (g_strcmp0(sub->rsu_name, name) != 0)
+				continue;
+
+			result = sub;
+			break;
+		}
+
+		return ((bool)true);
+	});
+
+	return (result);
 }
 
 void
@@ -1290,7 +1731,21 @@ rpc_connection_send_fragment(rpc_connection_t conn, rpc_object_t id,
 	rpc_dictionary_set_int64(args, "seqno", seqno);
 	rpc_dictionary_steal_value(args, "fragment", fragment);
 	frame = rpc_pack_frame("rpc", "fragment", id, args);
-	rpc_send_frame(conn, frame);
+	rpc_send_frame_throttled(conn, frame);
+}
+
+void
+rpc_connection_send_fragments(rpc_connection_t conn, rpc_object_t id,
+    int64_t seqno, rpc_object_t fragments)
+{
+	rpc_object_t frame;
+	rpc_object_t args;
+
+	args = rpc_dictionary_create();
+	rpc_dictionary_set_int64(args, "seqno", seqno);
+	rpc_dictionary_steal_value(args, "fragments", fragments);
+	frame = rpc_pack_frame("rpc", "fragment", id, args);
+	rpc_send_frame_throttled(conn, frame);
 }
 
 void
@@ -1383,6 +1838,12 @@ rpc_connection_close_inbound_call(struct rpc_call *call)
 
 	g_rw_lock_writer_unlock(&conn->rco_icall_rwlock);
 
+	if (call->rc_active != NULL) {
+		g_atomic_int_add(&call->rc_active->rcc_active, -1);
+		rpc_call_counter_release(call->rc_active);
+		call->rc_active = NULL;
+	}
+
 	rpc_connection_call_release(call);
 	rpc_connection_release(conn);
 }
@@ -1406,6 +1867,7 @@ rpc_connection_set_default_fn_handlers(rpc_connection_t conn)
 	conn->rco_fn_cbs.rcf_fn_error_ex = rpc_function_error_ex_impl;
 	conn->rco_fn_cbs.rcf_fn_start_stream = rpc_function_start_stream_impl;
 	conn->rco_fn_cbs.rcf_fn_yield = rpc_function_yield_impl;
+	conn->rco_fn_cbs.rcf_fn_yield_many = rpc_function_yield_many_impl;
 	conn->rco_fn_cbs.rcf_fn_end = rpc_function_end_impl;
 	conn->rco_fn_cbs.rcf_fn_kill = rpc_function_kill_impl;
 	conn->rco_fn_cbs.rcf_should_abort = rpc_function_should_abort_impl;
@@ -1421,13 +1883,21 @@ rpc_connection_init(int flags)
 	g_mutex_init(&conn->rco_mtx);
 	g_mutex_init(&conn->rco_ref_mtx);
 	g_mutex_init(&conn->rco_send_mtx);
+	g_mutex_init(&conn->rco_send_queue_mtx);
+	g_cond_init(&conn->rco_send_queue_cv);
 	g_rw_lock_init(&conn->rco_subscription_rwlock);
 	g_rw_lock_init(&conn->rco_call_rwlock);
 	g_rw_lock_init(&conn->rco_icall_rwlock);
+	g_mutex_init(&conn->rco_event_mtx);
 
+	conn->rco_event_queue = g_queue_new();
 	conn->rco_calls = g_hash_table_new(g_str_hash, g_str_equal);
 	conn->rco_inbound_calls = g_hash_table_new(g_str_hash, g_str_equal);
-	conn->rco_subscriptions = g_ptr_array_new_with_free_func((GDestroyNotify)rpc_subscription_release);
+	conn->rco_subscriptions = g_hash_table_new_full(rpc_subscription_hash,
+	    rpc_subscription_equal, (GDestroyNotify)rpc_subscription_release,
+	    NULL);
+	conn->rco_wildcard_subscriptions = rpc_trie_new(
+	    (GDestroyNotify)g_ptr_array_unref);
 	conn->rco_rpc_timeout = DEFAULT_RPC_TIMEOUT;
 	conn->rco_recv_msg = rpc_recv_msg;
 	conn->rco_close = rpc_close;
@@ -1546,8 +2016,21 @@ rpc_connection_register_context(rpc_connection_t conn, rpc_context_t ctx)
 int rpc_connection_get_subscription_count(rpc_connection_t conn)
 {
 
-	return (
-	    rpc_connection_is_open(conn) ? conn->rco_subscriptions->len : -1);
+	return (rpc_connection_is_open(conn)
+	    ? (int)g_hash_table_size(conn->rco_subscriptions) : -1);
+}
+
+bool
+rpc_connection_is_subscribed(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name)
+{
+	bool ret;
+
+	g_rw_lock_reader_lock(&conn->rco_subscription_rwlock);
+	ret = rpc_connection_find_subscription(conn, path, interface,
+	    name) != NULL;
+	g_rw_lock_reader_unlock(&conn->rco_subscription_rwlock);
+	return (ret);
 }
 
 static void
@@ -1560,7 +2043,22 @@ rpc_connection_free_resources(rpc_connection_t conn)
 	g_hash_table_destroy(conn->rco_inbound_calls);
 
 	if (conn->rco_subscriptions != NULL)
-		g_ptr_array_free(conn->rco_subscriptions, true);
+		g_hash_table_destroy(conn->rco_subscriptions);
+
+	rpc_trie_free(conn->rco_wildcard_subscriptions);
+
+	if (conn->rco_event_queue != NULL) {
+		g_queue_free_full(conn->rco_event_queue,
+		    (GDestroyNotify)rpc_emit_item_release);
+		conn->rco_event_queue = NULL;
+	}
+
+	if (conn->rco_send_queue != NULL) {
+		g_assert(conn->rco_send_thread == NULL);
+		g_queue_free_full(conn->rco_send_queue,
+		    (GDestroyNotify)rpc_send_item_free);
+		conn->rco_send_queue = NULL;
+	}
 
 	if (conn->rco_callback_pool != NULL) {
 		g_thread_pool_free(conn->rco_callback_pool, true, false);
@@ -1568,6 +2066,7 @@ rpc_connection_free_resources(rpc_connection_t conn)
 	}
 
 	rpc_release(conn->rco_error);
+	rpc_release(conn->rco_send_error);
 	g_free(conn->rco_endpoint_address);
 	g_rw_lock_clear(&conn->rco_call_rwlock);
 	g_rw_lock_clear(&conn->rco_icall_rwlock);
@@ -1709,6 +2208,9 @@ rpc_connection_release(rpc_connection_t conn)
 			g_assert_not_reached();
 		g_rw_lock_writer_unlock(&active_rwlock);
 
+		/* Flush queued frames before the transport goes away */
+		rpc_send_queue_stop(conn);
+
 		if (conn->rco_release && conn->rco_arg) {
 			conn->rco_release(conn->rco_arg);
 			conn->rco_arg = NULL;
@@ -1812,7 +2314,7 @@ rpc_connection_subscribe_event_locked(rpc_connection_t conn, const char *path,
 	rpc_object_t args;
 
 	sub = rpc_connection_find_subscription(conn, path, interface, name);
-	if (sub == NULL) {
+	if (sub == NULL || g_strcmp0(sub->rsu_path, path) != 0) {
 		sub = g_malloc0(sizeof(*sub));
 		sub->rsu_path = g_strdup(path);
 		sub->rsu_interface = g_strdup(interface);
@@ -1830,7 +2332,7 @@ rpc_connection_subscribe_event_locked(rpc_connection_t conn, const char *path,
 			return (NULL);
 		}
 		sub->rsu_refcount = 1;
-		g_ptr_array_add(conn->rco_subscriptions, sub);
+		rpc_connection_add_subscription(conn, sub);
 	} else {
 		if (!check_busy || !sub->rsu_busy)
 			sub->rsu_refcount++;
@@ -1875,7 +2377,7 @@ rpc_connection_unsubscribe_event(rpc_connection_t conn, const char *path,
 
 	g_rw_lock_writer_lock(&conn->rco_subscription_rwlock);
 	sub = rpc_connection_find_subscription(conn, path, interface, name);
-	if (sub == NULL) {
+	if (sub == NULL || g_strcmp0(sub->rsu_path, path) != 0) {
 		g_rw_lock_writer_unlock(&conn->rco_subscription_rwlock);
 		rpc_set_last_error(ENOENT, "Subscription not found", NULL);
 		rpc_connection_release(conn);
@@ -1909,7 +2411,7 @@ rpc_connection_unsubscribe_event_locked(rpc_connection_t conn,
 	frame = rpc_pack_frame("events", "unsubscribe", NULL, args);
 	ret = rpc_send_frame(conn, frame);
 
-	g_ptr_array_remove(conn->rco_subscriptions, sub);
+	rpc_connection_remove_subscription(conn, sub);
 
 	return (ret);
 }
@@ -2216,13 +2718,13 @@ rpc_connection_watch_property(rpc_connection_t conn, const char *path,
 	    RPC_OBSERVABLE_INTERFACE, "changed", block));
 }
 
-int
-rpc_connection_send_event(rpc_connection_t conn, const char *path,
-    const char *interface, const char *name, rpc_object_t args)
+static int
+rpc_connection_send_event_impl(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name, rpc_object_t args, bool throttle)
 {
 	rpc_object_t frame;
 	rpc_object_t event;
-	struct rpc_subscription *sub;
+	bool subscribed;
 	int ret = 0;
 
 	if (rpc_connection_retain_if_valid(conn, true) != 0)
@@ -2230,11 +2732,12 @@ rpc_connection_send_event(rpc_connection_t conn, const char *path,
 
 	/* Any listeners? */
 	g_rw_lock_reader_lock(&conn->rco_subscription_rwlock);
-	if (rpc_connection_get_subscription_count(conn) < 1)
-		goto done;
+	subscribed = rpc_connection_get_subscription_count(conn) > 0 &&
+	    rpc_connection_find_subscription(conn, path, interface,
+	    name) != NULL;
+	g_rw_lock_reader_unlock(&conn->rco_subscription_rwlock);
 
-	sub = rpc_connection_find_subscription(conn, path, interface, name);
-	if (sub == NULL)
+	if (!subscribed)
 		goto done;
 
 	event = rpc_object_pack("{s,s,s,v}",
@@ -2243,15 +2746,70 @@ rpc_connection_send_event(rpc_connection_t conn, const char *path,
 	    "name", name,
 	    "args", rpc_retain(args));
 
+	/*
+	 * A throttled send can wait for the send queue to drain, which
+	 * must not keep (un)subscribe requests from the peer waiting.
+	 */
 	frame = rpc_pack_frame("events", "event", NULL, event);
-	ret = rpc_send_frame(conn, frame);
+	ret = throttle ? rpc_send_frame_throttled(conn, frame) :
+	    rpc_send_frame(conn, frame);
 
 done:
-	g_rw_lock_reader_unlock(&conn->rco_subscription_rwlock);
 	rpc_connection_release(conn);
 	return (ret);
 }
 
+int
+rpc_connection_send_event(rpc_connection_t conn, const char *path,
+    const char *interface, const char *name, rpc_object_t args)
+{
+
+	return (rpc_connection_send_event_impl(conn, path, interface, name,
+	    args, true));
+}
+
+/*
+ * Hands an event over to the connection's send queue without waiting
+ * for it to drain, so that a slow consumer can't stall the emitter shard
+ * delivering it. Returns 1 if the send queue is full; the connection
+ * reference held by @p emitter is then passed to the send queue, which
+ * gives it back to the emitter once there is room again.
+ */
+int
+rpc_connection_queue_event(rpc_connection_t conn, struct rpc_emitter *emitter,
+    const char *path, const char *interface, const char *name,
+    rpc_object_t args)
+{
+
+	if (g_atomic_pointer_get(&conn->rco_send_queue) == NULL &&
+	    rpc_connection_set_send_queue(conn, 0) != 0)
+		return (-1);
+
+	g_mutex_lock(&conn->rco_send_queue_mtx);
+	if (!conn->rco_send_stop && g_queue_get_length(conn->rco_send_queue) >=
+	    rpc_send_queue_event_limit(conn)) {
+		conn->rco_send_emitter = emitter;
+		g_mutex_unlock(&conn->rco_send_queue_mtx);
+		return (1);
+	}
+
+	g_mutex_unlock(&conn->rco_send_queue_mtx);
+	return (rpc_connection_send_event_impl(conn, path, interface, name,
+	    args, false));
+}
+
+/*
+ * Gives the connection back to the emitter shard waiting for its send
+ * queue to drain right away, if there is one.
+ */
+void
+rpc_connection_wake_emitter(rpc_connection_t conn)
+{
+
+	g_mutex_lock(&conn->rco_send_queue_mtx);
+	rpc_send_queue_resume(conn, true);
+}
+
 int
 rpc_connection_send_raw_message(rpc_connection_t conn, const void *msg,
     size_t len, const int *fds, size_t nfds)
@@ -2369,11 +2927,8 @@ rpc_call_wait(rpc_call_t call)
 int
 rpc_call_continue(rpc_call_t call, bool sync)
 {
-	struct queue_item *q_item;
 	rpc_call_status_t status;
-	rpc_object_t frame;
-	int64_t seqno;
-	int ret = 0;
+	int ret;
 
 	g_mutex_lock(&call->rc_mtx);
 	status = rpc_call_status_locked(call);
@@ -2386,12 +2941,79 @@ rpc_call_continue(rpc_call_t call, bool sync)
 		return (-1);
 	}
 
-	if (call->rc_consumer_seqno == call->rc_producer_seqno) {
+	ret = rpc_call_advance_locked(call, 1);
+
+	if (sync && ret == 0) {
+		if (rpc_call_wait_locked(call) < 0) {
+			g_mutex_unlock(&call->rc_mtx);
+			return (-1);
+		}
+
+		g_mutex_unlock(&call->rc_mtx);
+		return (rpc_call_success(call));
+	}
+
+	g_mutex_unlock(&call->rc_mtx);
+	return (ret);
+}
+
+rpc_object_t
+rpc_call_result_batch(rpc_call_t call, size_t max)
+{
+	struct queue_item *q_item;
+	rpc_object_t result;
+	GList *iter;
+	size_t count = 0;
+
+	g_mutex_lock(&call->rc_mtx);
+	if (rpc_call_status_locked(call) != RPC_CALL_MORE_AVAILABLE) {
+		rpc_set_last_errorf(ENXIO, "No fragments available");
+		g_mutex_unlock(&call->rc_mtx);
+		return (NULL);
+	}
+
+	result = rpc_array_create();
+	for (iter = g_queue_peek_head_link(call->rc_queue); iter != NULL;
+	    iter = iter->next) {
+		q_item = iter->data;
+		if (q_item->status != RPC_CALL_MORE_AVAILABLE)
+			break;
+
+		if (max > 0 && count == max)
+			break;
+
+		rpc_array_append_value(result, q_item->item);
+		count++;
+	}
+
+	rpc_call_advance_locked(call, count);
+	g_mutex_unlock(&call->rc_mtx);
+	return (result);
+}
+
+static int
+rpc_call_advance_locked(rpc_call_t call, size_t count)
+{
+	struct queue_item *q_item;
+	rpc_object_t frame;
+	int64_t increment;
+	int64_t seqno;
+	size_t i;
+	int ret = 0;
+
+	/*
+	 * Credit is only computed once, before the last fragment is
+	 * consumed. If credit ran out earlier in the batch, that fragment
+	 * is necessarily the last one, so nothing is missed.
+	 */
+	call->rc_consumer_seqno += count - 1;
+	increment = rpc_call_credit_locked(call);
+	if (increment > 0) {
 		seqno = call->rc_producer_seqno + 1;
 		frame = rpc_pack_frame("rpc", "continue", call->rc_id, rpc_object_pack(
 		    "{i,i}",
 		    "seqno", seqno,
-		    "increment", call->rc_prefetch));
+		    "increment", increment));
 
 		if (rpc_send_frame(call->rc_conn, frame) != 0) {
 			q_item = g_malloc0(sizeof(*q_item));
@@ -2401,27 +3023,18 @@ rpc_call_continue(rpc_call_t call, bool sync)
 			ret = -1;
 		}
 
-		call->rc_producer_seqno += call->rc_prefetch;
+		call->rc_producer_seqno += increment;
 	}
 
 	call->rc_consumer_seqno++;
 
 	/* It is assumed that the caller retains q_item->item if it is needed */
-	q_item = g_queue_pop_head(call->rc_queue);
-	rpc_release(q_item->item);
-	g_free(q_item);
-
-	if (sync && ret == 0) {
-		if (rpc_call_wait_locked(call) < 0) {
-			g_mutex_unlock(&call->rc_mtx);
-			return (-1);
-		}
-
-		g_mutex_unlock(&call->rc_mtx);
-		return (rpc_call_success(call));
+	for (i = 0; i < count; i++) {
+		q_item = g_queue_pop_head(call->rc_queue);
+		rpc_release(q_item->item);
+		g_free(q_item);
 	}
 
-	g_mutex_unlock(&call->rc_mtx);
 	return (ret);
 }
 
@@ -2466,10 +3079,80 @@ rpc_call_set_prefetch(_Nonnull rpc_call_t call, size_t nitems)
 
 	g_mutex_lock(&call->rc_mtx);
 	call->rc_prefetch = (int64_t)nitems;
+	call->rc_prefetch_adaptive = false;
+	g_mutex_unlock(&call->rc_mtx);
+	return (0);
+}
+
+int
+rpc_call_set_prefetch_bounds(_Nonnull rpc_call_t call, size_t min, size_t max)
+{
+
+	if (min < 1 || min > max) {
+		rpc_set_last_errorf(EINVAL, "Invalid prefetch bounds");
+		return (-1);
+	}
+
+	g_mutex_lock(&call->rc_mtx);
+	call->rc_prefetch_adaptive = true;
+	call->rc_prefetch_min = min;
+	call->rc_prefetch_max = max;
+	call->rc_prefetch = CLAMP(call->rc_prefetch, min, max);
 	g_mutex_unlock(&call->rc_mtx);
 	return (0);
 }
 
+static int64_t
+rpc_call_credit_locked(rpc_call_t call)
+{
+	int64_t outstanding;
+	int64_t consumed;
+	int64_t window;
+	int64_t target;
+	gint64 elapsed;
+	gint64 now;
+
+	outstanding = call->rc_producer_seqno - call->rc_consumer_seqno;
+
+	if (!call->rc_prefetch_adaptive)
+		return (outstanding == 0 ? (int64_t)call->rc_prefetch : 0);
+
+	/* Top the window up once half of it has been consumed */
+	window = (int64_t)call->rc_prefetch;
+	if (outstanding > window / 2)
+		return (0);
+
+	now = g_get_monotonic_time();
+
+	if (call->rc_rate_time != 0) {
+		/* Out of credit means the consumer is about to stall */
+		if (outstanding == 0)
+			window *= 2;
+
+		/* Size the window to cover one round trip at consumer rate */
+		consumed = call->rc_consumer_seqno - call->rc_rate_seqno;
+		elapsed = now - call->rc_rate_time;
+		if (elapsed > 0 && call->rc_rtt > 0) {
+			target = consumed * call->rc_rtt / elapsed + 1;
+			if (outstanding > 0 && target < window / 4)
+				window /= 2;
+
+			window = MAX(window, target);
+		}
+	}
+
+	window = CLAMP(window, (int64_t)call->rc_prefetch_min,
+	    (int64_t)call->rc_prefetch_max);
+	call->rc_prefetch = (uint64_t)window;
+	call->rc_rate_time = now;
+	call->rc_rate_seqno = call->rc_consumer_seqno;
+
+	if (outstanding == 0)
+		call->rc_grant_time = now;
+
+	return (window - outstanding);
+}
+
 inline int
 rpc_call_timedwait(rpc_call_t call, const struct timespec *ts)
 {
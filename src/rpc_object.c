@@ -66,6 +66,8 @@ static const char *rpc_types[] = {
     [RPC_TYPE_ERROR] = "error"
 };
 
+static rpc_object_t rpc_object_vpack_interp(const char *, va_list);
+
 static struct rpc_object this_null_obj = {
 	.ro_type = RPC_TYPE_NULL,
 	.ro_value = (union rpc_value)0,
@@ -670,7 +672,8 @@ rpc_cmp(rpc_object_t o1, rpc_object_t o2)
 	int h1 = (int)rpc_hash(o1);
 	int h2 = (int)rpc_hash(o2);
 
-	return (h1 - h2);
+	/* Don't subtract, the result could overflow */
+	return ((h1 > h2) - (h1 < h2));
 }
 
 inline bool
@@ -877,6 +880,18 @@ rpc_object_pack(const char *fmt, ...)
 
 rpc_object_t
 rpc_object_vpack(const char *fmt, va_list ap)
+{
+	struct rpc_pack_fmt *prog;
+
+	prog = rpc_pack_fmt_lookup(fmt);
+	if (prog == NULL)
+		return (rpc_object_vpack_interp(fmt, ap));
+
+	return (rpc_pack_fmt_vpack(prog, ap));
+}
+
+static rpc_object_t
+rpc_object_vpack_interp(const char *fmt, va_list ap)
 {
 	GQueue *stack = g_queue_new();
 	GQueue *key_q = g_queue_new();
@@ -1170,6 +1185,18 @@ rpc_object_unpack(rpc_object_t obj, const char *fmt, ...)
 
 int
 rpc_object_vunpack(rpc_object_t obj, const char *fmt, va_list ap)
+{
+	struct rpc_pack_fmt *prog;
+
+	prog = rpc_pack_fmt_lookup(fmt);
+	if (prog != NULL)
+		return (rpc_pack_fmt_vunpack(obj, prog, ap));
+
+	return (rpc_object_vunpack_interp(obj, fmt, ap));
+}
+
+int
+rpc_object_vunpack_interp(rpc_object_t obj, const char *fmt, va_list ap)
 {
 	int cnt = 0;
 
@@ -1579,6 +1606,19 @@ rpc_error_create_from_gerror(GError *g_error)
         return (rpc_error_create(g_error->code, g_error->message, NULL));
 }
 
+rpc_object_t
+rpc_error_create_busy(const char *msg, uint32_t retry_after)
+{
+	rpc_object_t result;
+	rpc_object_t extra;
+
+	extra = rpc_dictionary_create();
+	rpc_dictionary_set_uint64(extra, "retry_after", retry_after);
+	result = rpc_error_create(EBUSY, msg, extra);
+	rpc_release(extra);
+	return (result);
+}
+
 
 rpc_object_t
 rpc_error_create_with_stack(int code, const char *msg, rpc_object_t extra,
@@ -1704,6 +1744,7 @@ rpc_array_steal_value(rpc_object_t array, size_t index, rpc_object_t value)
 		return;
 	}
 
+	rpc_query_index_notify_invalidate(array);
 	ro = (rpc_object_t *)&g_ptr_array_index(array->ro_value.rv_list, index);
 	rpc_release_impl(*ro);
 	*ro = value;
@@ -1719,6 +1760,7 @@ rpc_array_remove_index(rpc_object_t array, size_t index)
 	if (index >= rpc_array_get_count(array))
 		return;
 
+	rpc_query_index_notify_remove(array, index);
 	g_ptr_array_remove_index(array->ro_value.rv_list, (guint)index);
 }
 
@@ -1734,6 +1776,7 @@ rpc_array_remove_all(rpc_object_t array)
 	if (cnt == 0)
 		return;
 
+	rpc_query_index_notify_invalidate(array);
 	g_ptr_array_remove_range(array->ro_value.rv_list, 0, (guint)cnt);
 }
 
@@ -1753,6 +1796,8 @@ rpc_array_append_stolen_value(rpc_object_t array, rpc_object_t value)
 		rpc_abort("Trying array API on non-array object");
 
 	g_ptr_array_add(array->ro_value.rv_list, value);
+	rpc_query_index_notify_append(array,
+	    array->ro_value.rv_list->len - 1);
 }
 
 inline rpc_object_t
@@ -1798,6 +1843,7 @@ rpc_array_map(rpc_object_t array, rpc_array_mapper_t mapper)
 	rpc_object_t oldv, newv;
 	size_t i;
 
+	rpc_query_index_notify_invalidate(array);
 	for (i = 0; i < array->ro_value.rv_list->len; i++) {
 		oldv = g_ptr_array_index(array->ro_value.rv_list, i);
 		newv = mapper(i, oldv);
@@ -1852,6 +1898,7 @@ rpc_array_sort(rpc_object_t array, rpc_array_cmp_t comparator)
 	if (array->ro_type != RPC_TYPE_ARRAY)
 		rpc_abort("Trying array API on non-array object");
 
+	rpc_query_index_notify_invalidate(array);
 	g_ptr_array_sort_with_data(array->ro_value.rv_list,
 	    &rpc_array_comparator_converter, (void *)comparator);
 }
@@ -0,0 +1,908 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#if defined(__linux__)
+#include <link.h>
+#endif
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#include <mach-o/getsect.h>
+#endif
+#include <rpc/object.h>
+#include <rpc/typing.h>
+#include "internal.h"
+
+#define	PACK_MAX_DEPTH		32
+#define	PACK_CACHE_BITS		9
+#define	PACK_CACHE_SIZE		(1 << PACK_CACHE_BITS)
+#define	PACK_CACHE_PROBES	16
+#define	PACK_VALUE_CHARS	"vVnbBIfiudDs*R"
+
+enum rpc_pack_key
+{
+	RPC_PACK_KEY_NONE,
+	RPC_PACK_KEY_NAME,
+	RPC_PACK_KEY_ARG,
+	RPC_PACK_KEY_INDEX,
+	RPC_PACK_KEY_NEXT
+};
+
+struct rpc_pack_op
+{
+	char			rpo_code;
+	enum rpc_pack_key	rpo_key;
+	char *			rpo_name;
+	char *			rpo_string;
+	size_t			rpo_index;
+	char *			rpo_type;
+	rpct_typei_t		rpo_typei;
+};
+
+struct rpc_pack_fmt
+{
+	volatile gint		rpf_refcnt;
+	char *			rpf_fmt;
+	bool			rpf_valid;
+	bool			rpf_unpack_interp;
+	int			rpf_generation;
+	GArray *		rpf_ops;
+};
+
+struct rpc_pack_range
+{
+	uintptr_t		rpr_start;
+	uintptr_t		rpr_end;
+};
+
+struct rpc_pack_slot
+{
+	volatile gpointer	rps_key;
+	volatile gpointer	rps_prog;
+};
+
+struct rpc_pack_cache
+{
+	guint64			rpx_images;
+	GArray *		rpx_ranges;
+	struct rpc_pack_slot	rpx_slots[PACK_CACHE_SIZE];
+};
+
+struct rpc_pack_frame
+{
+	rpc_object_t		rpk_container;
+	const char *		rpk_key;
+	size_t			rpk_index;
+};
+
+static bool rpc_pack_compile_element(struct rpc_pack_fmt *, const char **,
+    char, guint);
+static void rpc_pack_op_clear(gpointer);
+
+static volatile gpointer rpc_pack_cache = NULL;
+static volatile gint rpc_pack_checked = -1;
+
+static void
+rpc_pack_op_clear(gpointer data)
+{
+	struct rpc_pack_op *op = data;
+
+	g_free(op->rpo_name);
+	g_free(op->rpo_string);
+	g_free(op->rpo_type);
+
+	if (op->rpo_typei != NULL)
+		rpct_typei_release(op->rpo_typei);
+}
+
+/*
+ * Returns a referenced typei for the type prefix of @p op. Programs
+ * compiled before the type system was torn down and set up again refer
+ * to the old types, so their prefixes are resolved again on each use.
+ */
+static rpct_typei_t
+rpc_pack_op_get_typei(struct rpc_pack_fmt *prog, struct rpc_pack_op *op)
+{
+
+	if (prog->rpf_generation == rpct_get_generation())
+		return (rpct_typei_retain(op->rpo_typei));
+
+	return (rpct_new_typei(op->rpo_type));
+}
+
+/*
+ * Compiles a single element of the format string, starting at @p pp.
+ * The element grammar matches the one of rpc_object_vpack() and
+ * rpc_object_vunpack(): an optional key or index followed by a ':',
+ * then a value character or a nested container.
+ */
+static bool
+rpc_pack_compile_element(struct rpc_pack_fmt *prog, const char **pp,
+    char parent, guint depth)
+{
+	struct rpc_pack_op op = { 0 };
+	const char *p = *pp;
+	const char *term;
+	const char *colon = NULL;
+	char *end;
+	char delim;
+	char open;
+	char close;
+	guint nesting;
+
+	if (depth >= PACK_MAX_DEPTH)
+		return (false);
+
+	if (parent != '\0') {
+		delim = parent == '[' ? ']' : '}';
+		for (term = p;; term++) {
+			if (*term == '\0')
+				return (false);
+
+			if (*term == ',')
+				break;
+
+			if (*term == ':')
+				colon = term;
+
+			if (strchr("<[]{}'", *term) != NULL)
+				break;
+		}
+
+		if (parent == '[') {
+			op.rpo_key = RPC_PACK_KEY_NEXT;
+			if (colon != NULL) {
+				op.rpo_key = RPC_PACK_KEY_INDEX;
+				op.rpo_index = (size_t)strtoul(p, &end, 10);
+				if (end != colon)
+					return (false);
+			}
+		} else {
+			op.rpo_key = RPC_PACK_KEY_ARG;
+			if (colon != NULL) {
+				op.rpo_key = RPC_PACK_KEY_NAME;
+				op.rpo_name = g_strndup(p, colon - p);
+			}
+		}
+
+		if (*term == ',' || *term == delim) {
+			/* The value character is the one right before */
+			if (term == p || term - 1 == colon)
+				goto fail;
+
+			p = term - 1;
+		} else if (*term == '}' || *term == ']')
+			goto fail;
+		else
+			p = term;
+	}
+
+	if (*p == '<') {
+		/* Typed values are only supported at the top level */
+		if (parent != '\0')
+			goto fail;
+
+		nesting = 1;
+		for (end = (char *)p + 1; nesting != 0; end++) {
+			if (*end == '\0')
+				goto fail;
+
+			if (*end == '<')
+				nesting++;
+
+			if (*end == '>')
+				nesting--;
+		}
+
+		op.rpo_type = g_strndup(p + 1, end - p - 2);
+		op.rpo_typei = rpct_new_typei(op.rpo_type);
+		if (op.rpo_typei == NULL)
+			goto fail;
+
+		/* Unpacking doesn't know about type prefixes */
+		prog->rpf_unpack_interp = true;
+		p = end;
+	}
+
+	op.rpo_code = *p;
+
+	switch (*p) {
+	case '\'':
+		end = strchr(p + 1, '\'');
+		if (end == NULL)
+			goto fail;
+
+		op.rpo_string = g_strndup(p + 1, end - p - 1);
+		g_array_append_val(prog->rpf_ops, op);
+		prog->rpf_unpack_interp = true;
+		p = end + 1;
+
+		/*
+		 * rpc_object_vpack() skips the character following a literal,
+		 * which only works out if it is a separator.
+		 */
+		if (parent != '\0' && *p != ',')
+			return (false);
+
+		break;
+
+	case '[':
+	case '{':
+		open = *p;
+		close = open == '[' ? ']' : '}';
+		g_array_append_val(prog->rpf_ops, op);
+		memset(&op, 0, sizeof(op));
+
+		/*
+		 * rpc_object_vunpack() treats the rest of the enclosing
+		 * container differently after a nested one, so keep its
+		 * behavior by interpreting such formats.
+		 */
+		if (parent != '\0')
+			prog->rpf_unpack_interp = true;
+
+		for (p++; *p != close;) {
+			if (!rpc_pack_compile_element(prog, &p, open,
+			    depth + 1))
+				return (false);
+		}
+
+		op.rpo_code = close;
+		g_array_append_val(prog->rpf_ops, op);
+		p++;
+		break;
+
+	default:
+		if (*p == '\0' || strchr(PACK_VALUE_CHARS, *p) == NULL)
+			goto fail;
+
+		g_array_append_val(prog->rpf_ops, op);
+		p++;
+		break;
+	}
+
+	if (parent != '\0' && *p == ',')
+		p++;
+
+	*pp = p;
+	return (true);
+
+fail:
+	rpc_pack_op_clear(&op);
+	return (false);
+}
+
+static struct rpc_pack_fmt *
+rpc_pack_fmt_new(const char *fmt)
+{
+	struct rpc_pack_fmt *prog;
+	const char *p = fmt;
+
+	prog = g_malloc0(sizeof(*prog));
+	prog->rpf_refcnt = 1;
+	prog->rpf_fmt = g_strdup(fmt);
+	prog->rpf_generation = rpct_get_generation();
+	prog->rpf_ops = g_array_new(false, true, sizeof(struct rpc_pack_op));
+	g_array_set_clear_func(prog->rpf_ops, rpc_pack_op_clear);
+	prog->rpf_valid = rpc_pack_compile_element(prog, &p, '\0', 0) &&
+	    *p == '\0';
+
+	return (prog);
+}
+
+rpc_pack_fmt_t
+rpc_pack_fmt_compile(const char *fmt)
+{
+	struct rpc_pack_fmt *prog;
+
+	prog = rpc_pack_fmt_new(fmt);
+	if (!prog->rpf_valid) {
+		rpc_pack_fmt_release(prog);
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	return (prog);
+}
+
+void
+rpc_pack_fmt_release(rpc_pack_fmt_t prog)
+{
+
+	if (prog == NULL || !g_atomic_int_dec_and_test(&prog->rpf_refcnt))
+		return;
+
+	g_array_free(prog->rpf_ops, true);
+	g_free(prog->rpf_fmt);
+	g_free(prog);
+}
+
+#if defined(__linux__)
+static int
+rpc_pack_count_images(struct dl_phdr_info *info, size_t size, void *arg)
+{
+	guint64 *images = arg;
+
+	/* Every load and unload bumps one of the counters */
+	if (size >= offsetof(struct dl_phdr_info, dlpi_subs) +
+	    sizeof(info->dlpi_subs))
+		*images = info->dlpi_adds + info->dlpi_subs;
+
+	return (1);
+}
+
+static int
+rpc_pack_add_image(struct dl_phdr_info *info, size_t size __unused,
+    void *arg)
+{
+	GArray *ranges = arg;
+	const ElfW(Phdr) *phdr;
+	struct rpc_pack_range range;
+	int i;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		phdr = &info->dlpi_phdr[i];
+		if (phdr->p_type != PT_LOAD || (phdr->p_flags & PF_W) != 0)
+			continue;
+
+		range.rpr_start = info->dlpi_addr + phdr->p_vaddr;
+		range.rpr_end = range.rpr_start + phdr->p_memsz;
+		g_array_append_val(ranges, range);
+	}
+
+	return (0);
+}
+#endif
+
+static guint64
+rpc_pack_images(void)
+{
+	guint64 images = 0;
+
+#if defined(__linux__)
+	dl_iterate_phdr(rpc_pack_count_images, &images);
+#endif
+#ifdef __APPLE__
+	images = _dyld_image_count();
+#endif
+	return (images);
+}
+
+static gint
+rpc_pack_range_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct rpc_pack_range *ra = a;
+	const struct rpc_pack_range *rb = b;
+
+	if (ra->rpr_start == rb->rpr_start)
+		return (0);
+
+	return (ra->rpr_start < rb->rpr_start ? -1 : 1);
+}
+
+/*
+ * Creates an empty cache for the images loaded right now, along with
+ * the sorted list of their read-only segments.
+ */
+static struct rpc_pack_cache *
+rpc_pack_cache_new(void)
+{
+	struct rpc_pack_cache *cache;
+#ifdef __APPLE__
+	struct rpc_pack_range range;
+	unsigned long size;
+	uint32_t i;
+#endif
+
+	cache = g_malloc0(sizeof(*cache));
+	cache->rpx_images = rpc_pack_images();
+	cache->rpx_ranges = g_array_new(false, false,
+	    sizeof(struct rpc_pack_range));
+
+#if defined(__linux__)
+	dl_iterate_phdr(rpc_pack_add_image, cache->rpx_ranges);
+#endif
+#ifdef __APPLE__
+	for (i = 0; i < _dyld_image_count(); i++) {
+		range.rpr_start = (uintptr_t)getsegmentdata(
+		    (const struct mach_header_64 *)_dyld_get_image_header(i),
+		    "__TEXT", &size);
+		range.rpr_end = range.rpr_start + size;
+		if (range.rpr_start != 0)
+			g_array_append_val(cache->rpx_ranges, range);
+	}
+#endif
+
+	g_array_sort(cache->rpx_ranges, rpc_pack_range_cmp);
+	return (cache);
+}
+
+static struct rpc_pack_cache *
+rpc_pack_cache_get(void)
+{
+	struct rpc_pack_cache *cache;
+
+	cache = g_atomic_pointer_get(&rpc_pack_cache);
+	if (cache != NULL)
+		return (cache);
+
+	cache = rpc_pack_cache_new();
+	if (!g_atomic_pointer_compare_and_exchange(&rpc_pack_cache, NULL,
+	    cache)) {
+		g_array_free(cache->rpx_ranges, true);
+		g_free(cache);
+	}
+
+	return (g_atomic_pointer_get(&rpc_pack_cache));
+}
+
+/*
+ * Tells whether @p fmt lives in a read-only segment of a loaded image,
+ * which is where string literals end up. Such a format can't change
+ * under the same pointer, so it is safe to cache by address.
+ *
+ * Pointers outside of the known segments may come from an image loaded
+ * after the cache was set up. The set of images is checked at most once
+ * a second, and when it changed a fresh cache replaces the current one.
+ * The old one is leaked, as other threads may still use its programs.
+ */
+static bool
+rpc_pack_is_static(struct rpc_pack_cache *cache, const char *fmt)
+{
+	struct rpc_pack_cache *fresh;
+	struct rpc_pack_range *range;
+	uintptr_t addr = (uintptr_t)fmt;
+	guint lo = 0;
+	guint hi = cache->rpx_ranges->len;
+	guint mid;
+	gint now;
+	gint checked;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		range = &g_array_index(cache->rpx_ranges,
+		    struct rpc_pack_range, mid);
+
+		if (addr < range->rpr_start)
+			hi = mid;
+		else if (addr >= range->rpr_end)
+			lo = mid + 1;
+		else
+			return (true);
+	}
+
+	now = (gint)(g_get_monotonic_time() / G_USEC_PER_SEC);
+	checked = g_atomic_int_get(&rpc_pack_checked);
+	if (now == checked ||
+	    !g_atomic_int_compare_and_exchange(&rpc_pack_checked, checked, now))
+		return (false);
+
+	if (rpc_pack_images() == cache->rpx_images)
+		return (false);
+
+	fresh = rpc_pack_cache_new();
+	if (!g_atomic_pointer_compare_and_exchange(&rpc_pack_cache, cache,
+	    fresh)) {
+		g_array_free(fresh->rpx_ranges, true);
+		g_free(fresh);
+	}
+
+	return (false);
+}
+
+/*
+ * Returns the program for @p fmt, compiling it on first use, or NULL if
+ * callers should interpret the format instead. The program is owned by
+ * the cache and never freed.
+ *
+ * Only formats in read-only memory are cached. They are looked up by
+ * pointer in an open addressing table whose slots are claimed with an
+ * atomic compare and exchange, so lookups take no locks. Formats that
+ * fail to compile are cached too, so they go straight to the
+ * interpreter next time. Once a format's neighbourhood in the table is
+ * full, it is interpreted.
+ */
+struct rpc_pack_fmt *
+rpc_pack_fmt_lookup(const char *fmt)
+{
+	struct rpc_pack_cache *cache;
+	struct rpc_pack_slot *slot = NULL;
+	struct rpc_pack_fmt *prog;
+	gpointer key;
+	guint hash;
+	guint i;
+
+	cache = rpc_pack_cache_get();
+	hash = (g_direct_hash(fmt) * 2654435761u) >> (32 - PACK_CACHE_BITS);
+
+	for (i = 0; i < PACK_CACHE_PROBES; i++) {
+		slot = &cache->rpx_slots[(hash + i) % PACK_CACHE_SIZE];
+		key = g_atomic_pointer_get(&slot->rps_key);
+		if (key == fmt) {
+			/* NULL while another thread is still compiling it */
+			prog = g_atomic_pointer_get(&slot->rps_prog);
+			return (prog != NULL && prog->rpf_valid ? prog : NULL);
+		}
+
+		if (key == NULL)
+			break;
+	}
+
+	if (i == PACK_CACHE_PROBES || !rpc_pack_is_static(cache, fmt))
+		return (NULL);
+
+	prog = rpc_pack_fmt_new(fmt);
+	if (!g_atomic_pointer_compare_and_exchange(&slot->rps_key, NULL,
+	    (gpointer)fmt)) {
+		rpc_pack_fmt_release(prog);
+		return (NULL);
+	}
+
+	g_atomic_pointer_set(&slot->rps_prog, prog);
+	return (prog->rpf_valid ? prog : NULL);
+}
+
+rpc_object_t
+rpc_pack_fmt_vpack(struct rpc_pack_fmt *prog, va_list ap)
+{
+	struct rpc_pack_frame frames[PACK_MAX_DEPTH];
+	struct rpc_pack_op *op;
+	rpc_object_t parent;
+	rpc_object_t current = NULL;
+	rpc_object_t tmp;
+	rpct_typei_t typei;
+	const char *key;
+	size_t index;
+	guint i;
+	int top = -1;
+
+	for (i = 0; i < prog->rpf_ops->len; i++) {
+		op = &g_array_index(prog->rpf_ops, struct rpc_pack_op, i);
+		parent = top >= 0 ? frames[top].rpk_container : NULL;
+		key = NULL;
+		index = 0;
+
+		switch (op->rpo_key) {
+		case RPC_PACK_KEY_NONE:
+			break;
+
+		case RPC_PACK_KEY_NAME:
+			key = op->rpo_name;
+			break;
+
+		case RPC_PACK_KEY_ARG:
+			key = va_arg(ap, const char *);
+			break;
+
+		case RPC_PACK_KEY_INDEX:
+			index = op->rpo_index;
+			break;
+
+		case RPC_PACK_KEY_NEXT:
+			index = rpc_array_get_count(parent);
+			break;
+		}
+
+		switch (op->rpo_code) {
+		case '{':
+		case '[':
+			tmp = op->rpo_code == '{'
+			    ? rpc_dictionary_create()
+			    : rpc_array_create();
+
+			if (op->rpo_typei != NULL) {
+				typei = rpc_pack_op_get_typei(prog, op);
+				if (typei == NULL ||
+				    rpct_set_typei(typei, tmp) == NULL) {
+					if (typei != NULL)
+						rpct_typei_release(typei);
+
+					rpc_release(tmp);
+					goto error;
+				}
+
+				rpct_typei_release(typei);
+			}
+
+			top++;
+			frames[top].rpk_container = tmp;
+			frames[top].rpk_key = key;
+			frames[top].rpk_index = index;
+			continue;
+
+		case '}':
+		case ']':
+			current = frames[top].rpk_container;
+			key = frames[top].rpk_key;
+			index = frames[top].rpk_index;
+			top--;
+			break;
+
+		case 'v':
+		case 'V':
+			current = va_arg(ap, rpc_object_t);
+			if (current == NULL)
+				current = rpc_null_create();
+			else if (op->rpo_code == 'V')
+				rpc_retain(current);
+
+			break;
+
+		case 'n':
+			current = rpc_null_create();
+			break;
+
+		case 'b':
+			current = rpc_bool_create(va_arg(ap, int));
+			break;
+
+		case 'B':
+			current = rpc_data_create(va_arg(ap, const void *),
+			    va_arg(ap, size_t),
+			    va_arg(ap, rpc_binary_destructor_t));
+			break;
+
+		case 'I':
+			current = rpc_data_create_iov(
+			    va_arg(ap, struct iovec *), va_arg(ap, size_t));
+			break;
+
+		case 'f':
+			current = rpc_fd_create(va_arg(ap, int));
+			break;
+
+		case 'i':
+			current = rpc_int64_create(va_arg(ap, int64_t));
+			break;
+
+		case 'u':
+			current = rpc_uint64_create(va_arg(ap, uint64_t));
+			break;
+
+		case 'd':
+			current = rpc_double_create(va_arg(ap, double));
+			break;
+
+		case 'D':
+			current = rpc_date_create(va_arg(ap, int64_t));
+			break;
+
+		case 's':
+			current = rpc_string_create(va_arg(ap, const char *));
+			break;
+
+		case '\'':
+			current = rpc_string_create(op->rpo_string);
+			break;
+
+		default:
+			goto error;
+		}
+
+		if (op->rpo_typei != NULL) {
+			typei = rpc_pack_op_get_typei(prog, op);
+			tmp = typei != NULL ? rpct_newi(typei, current) : NULL;
+			rpc_release(current);
+			current = tmp;
+			if (typei != NULL)
+				rpct_typei_release(typei);
+
+			if (current == NULL)
+				goto error;
+		}
+
+		if (top < 0)
+			return (current);
+
+		parent = frames[top].rpk_container;
+		if (rpc_get_type(parent) == RPC_TYPE_DICTIONARY)
+			rpc_dictionary_steal_value(parent, key, current);
+		else
+			rpc_array_steal_value(parent, index, current);
+
+		current = NULL;
+	}
+
+error:
+	rpc_release(current);
+	for (; top >= 0; top--)
+		rpc_release(frames[top].rpk_container);
+
+	errno = EINVAL;
+	return (NULL);
+}
+
+int
+rpc_pack_fmt_vunpack(rpc_object_t obj, struct rpc_pack_fmt *prog,
+    va_list ap)
+{
+	struct rpc_pack_frame frames[PACK_MAX_DEPTH];
+	struct rpc_pack_op *op;
+	rpc_object_t parent;
+	rpc_object_t current;
+	size_t index = 0;
+	guint i;
+	int top = -1;
+	int cnt = 0;
+
+	if (prog->rpf_unpack_interp)
+		return (rpc_object_vunpack_interp(obj, prog->rpf_fmt, ap));
+
+	if (obj == NULL)
+		return (-1);
+
+	for (i = 0; i < prog->rpf_ops->len; i++) {
+		op = &g_array_index(prog->rpf_ops, struct rpc_pack_op, i);
+		if (op->rpo_code == '}' || op->rpo_code == ']') {
+			top--;
+			continue;
+		}
+
+		parent = top >= 0 ? frames[top].rpk_container : NULL;
+		current = NULL;
+
+		switch (op->rpo_key) {
+		case RPC_PACK_KEY_NONE:
+			current = obj;
+			break;
+
+		case RPC_PACK_KEY_NAME:
+			if (parent != NULL)
+				current = rpc_dictionary_get_value(parent,
+				    op->rpo_name);
+			break;
+
+		case RPC_PACK_KEY_ARG:
+			if (parent != NULL)
+				current = rpc_dictionary_get_value(parent,
+				    va_arg(ap, const char *));
+			else
+				(void)va_arg(ap, const char *);
+			break;
+
+		case RPC_PACK_KEY_INDEX:
+		case RPC_PACK_KEY_NEXT:
+			/*
+			 * An explicit index replaces the implicit one, which
+			 * only advances past implicitly indexed elements.
+			 */
+			if (op->rpo_key == RPC_PACK_KEY_INDEX) {
+				index = op->rpo_index;
+				frames[top].rpk_index = index;
+			} else
+				index = frames[top].rpk_index++;
+
+			if (parent != NULL)
+				current = rpc_array_get_value(parent, index);
+			break;
+		}
+
+		if (op->rpo_code == '{' || op->rpo_code == '[') {
+			/* Nested containers are interpreted */
+			top++;
+			frames[top].rpk_container = current;
+			frames[top].rpk_index = 0;
+			continue;
+		}
+
+		if (current == NULL) {
+			(void)va_arg(ap, void *);
+			if (op->rpo_code == 'B')
+				(void)va_arg(ap, void *);
+
+			continue;
+		}
+
+		switch (op->rpo_code) {
+		case '*':
+			break;
+
+		case 'v':
+			*va_arg(ap, rpc_object_t *) = current;
+			break;
+
+		case 'b':
+			*va_arg(ap, bool *) = rpc_bool_get_value(current);
+			break;
+
+		case 'i':
+			*va_arg(ap, int64_t *) = rpc_int64_get_value(current);
+			break;
+
+		case 'u':
+			*va_arg(ap, uint64_t *) = rpc_uint64_get_value(current);
+			break;
+
+		case 'd':
+			*va_arg(ap, double *) = rpc_double_get_value(current);
+			break;
+
+		case 'f':
+			*va_arg(ap, int *) = rpc_fd_get_value(current);
+			break;
+
+		case 's':
+			*va_arg(ap, const char **) = rpc_string_get_string_ptr(
+			    current);
+			break;
+
+		case 'B':
+			*va_arg(ap, const void **) = rpc_data_get_bytes_ptr(
+			    current);
+			*va_arg(ap, size_t *) = rpc_data_get_length(current);
+			break;
+
+		case 'R':
+			if (parent == NULL ||
+			    rpc_get_type(parent) != RPC_TYPE_ARRAY) {
+				errno = EINVAL;
+				return (-1);
+			}
+
+			*va_arg(ap, rpc_object_t *) = rpc_array_slice(parent,
+			    frames[top].rpk_index + 1, -1);
+			break;
+
+		default:
+			return (-1);
+		}
+
+		cnt++;
+	}
+
+	return (cnt);
+}
+
+rpc_object_t
+rpc_object_pack_compiled(rpc_pack_fmt_t fmt, ...)
+{
+	va_list ap;
+	rpc_object_t result;
+
+	va_start(ap, fmt);
+	result = rpc_pack_fmt_vpack(fmt, ap);
+	va_end(ap);
+	return (result);
+}
+
+int
+rpc_object_unpack_compiled(rpc_object_t obj, rpc_pack_fmt_t fmt, ...)
+{
+	va_list ap;
+	int result;
+
+	va_start(ap, fmt);
+	result = rpc_pack_fmt_vunpack(obj, fmt, ap);
+	va_end(ap);
+	return (result);
+}
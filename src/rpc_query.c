@@ -34,7 +34,93 @@
 #endif
 #include "internal.h"
 
-static bool eval_rule(rpc_object_t obj, rpc_object_t rule);
+static struct rpc_query_node *rpc_query_compile_rule(rpc_object_t rule);
+static bool rpc_query_node_eval(struct rpc_query_node *node, rpc_object_t obj);
+
+#define	RPC_QUERY_CHUNK_MIN		4096
+#define	RPC_QUERY_CHECK_INTERVAL	256
+
+static GMutex rpc_query_index_mtx;
+static GHashTable *rpc_query_indexes;
+
+static struct rpc_query_path_elem *
+rpc_query_path_split(const char *path, guint *npath)
+{
+	struct rpc_query_path_elem *elems;
+	char **tokens;
+	char **t;
+
+	/* Split the path the same way rpc_query_get() does */
+	tokens = g_strsplit(path, ".", -1);
+	elems = g_new0(struct rpc_query_path_elem, g_strv_length(tokens));
+	*npath = 0;
+
+	for (t = tokens; *t != NULL; t++) {
+		if (**t == '\0')
+			continue;
+
+		elems[*npath].rqe_name = g_strdup(*t);
+		elems[*npath].rqe_index = (size_t)atoi(*t);
+		(*npath)++;
+	}
+
+	g_strfreev(tokens);
+	return (elems);
+}
+
+static void
+rpc_query_path_free(struct rpc_query_path_elem *elems, guint npath)
+{
+	guint i;
+
+	for (i = 0; i < npath; i++)
+		g_free(elems[i].rqe_name);
+
+	g_free(elems);
+}
+
+static bool
+rpc_query_path_equal(struct rpc_query_path_elem *e1, guint n1,
+    struct rpc_query_path_elem *e2, guint n2)
+{
+	guint i;
+
+	if (n1 != n2)
+		return (false);
+
+	for (i = 0; i < n1; i++) {
+		if (g_strcmp0(e1[i].rqe_name, e2[i].rqe_name) != 0)
+			return (false);
+	}
+
+	return (true);
+}
+
+static rpc_object_t
+rpc_query_path_resolve(struct rpc_query_path_elem *elems, guint npath,
+    rpc_object_t obj)
+{
+	rpc_object_t leaf = obj;
+	guint i;
+
+	for (i = 0; i < npath && leaf != NULL; i++) {
+		switch (rpc_get_type(leaf)) {
+		case RPC_TYPE_DICTIONARY:
+			leaf = rpc_dictionary_get_value(leaf,
+			    elems[i].rqe_name);
+			break;
+
+		case RPC_TYPE_ARRAY:
+			leaf = rpc_array_get_value(leaf, elems[i].rqe_index);
+			break;
+
+		default:
+			return (NULL);
+		}
+	}
+
+	return (leaf);
+}
 
 static rpc_object_t
 rpc_query_get_parent(rpc_object_t object, const char *path,
@@ -62,81 +148,177 @@ rpc_query_get_parent(rpc_object_t object, const char *path,
 	return (parent);
 }
 
-static bool
-eval_logic_and(rpc_object_t obj, rpc_object_t lst)
+static void
+rpc_query_node_free(struct rpc_query_node *node)
 {
-	__block bool result = false;
 
-	if (rpc_get_type(lst) != RPC_TYPE_ARRAY)
-		return (false);
+	if (node->rqn_children != NULL)
+		g_ptr_array_free(node->rqn_children, true);
 
-	rpc_array_apply(lst, ^(size_t idx __unused, rpc_object_t v) {
-		result = eval_rule(obj, v);
-		return ((bool)result);
-	});
+	if (node->rqn_regex != NULL)
+		g_regex_unref(node->rqn_regex);
 
-	return (result);
+	if (node->rqn_value != NULL)
+		rpc_release(node->rqn_value);
+
+	rpc_query_path_free(node->rqn_path, node->rqn_npath);
+	g_free(node);
 }
 
-static bool
-eval_logic_or(rpc_object_t obj, rpc_object_t lst)
+static struct rpc_query_node *
+rpc_query_node_new(enum rpc_query_op op)
 {
-	__block bool result = false;
+	struct rpc_query_node *node;
 
-	if (rpc_get_type(lst) != RPC_TYPE_ARRAY)
-		return (false);
-
-	rpc_array_apply(lst, ^(size_t idx __unused, rpc_object_t v) {
-	    result = eval_rule(obj, v);
-	    return ((bool)!result);
-	});
-
-	return (result);
+	node = g_malloc0(sizeof(*node));
+	node->rqn_op = op;
+	return (node);
 }
 
-static bool
-eval_logic_nor(rpc_object_t obj, rpc_object_t lst)
+static struct rpc_query_node *
+rpc_query_compile_logic(enum rpc_query_op op, rpc_object_t lst)
 {
-	__block bool result = false;
+	struct rpc_query_node *node;
 
 	if (rpc_get_type(lst) != RPC_TYPE_ARRAY)
-		return (false);
+		return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
+
+	node = rpc_query_node_new(op);
+	node->rqn_children = g_ptr_array_new_with_free_func(
+	    (GDestroyNotify)rpc_query_node_free);
 
 	rpc_array_apply(lst, ^(size_t idx __unused, rpc_object_t v) {
-	    result = !eval_rule(obj, v);
-	    return ((bool)result);
+		g_ptr_array_add(node->rqn_children,
+		    rpc_query_compile_rule(v));
+		return ((bool)true);
 	});
 
-	return (result);
+	return (node);
 }
 
-static bool
-eval_logic_operator(rpc_object_t obj, rpc_object_t rule)
+static struct rpc_query_node *
+rpc_query_compile_logic_operator(rpc_object_t rule)
 {
-	const char *op;
-	rpc_object_t lst;
 	rpc_object_t op_val;
-
-	if (rpc_get_type(rule) != RPC_TYPE_ARRAY)
-		return (false);
+	const char *op;
 
 	op_val = rpc_array_get_value(rule, 0);
 	if (rpc_get_type(op_val) == RPC_TYPE_ARRAY)
-		return (eval_logic_and(obj, rule));
+		return (rpc_query_compile_logic(RPC_QUERY_OP_AND, rule));
 
 	op = rpc_string_get_string_ptr(op_val);
-	lst = rpc_array_get_value(rule, 1);
 
 	if (!g_strcmp0(op, "or"))
-		return (eval_logic_or(obj, lst));
+		return (rpc_query_compile_logic(RPC_QUERY_OP_OR,
+		    rpc_array_get_value(rule, 1)));
 
 	if (!g_strcmp0(op, "and"))
-		return (eval_logic_and(obj, lst));
+		return (rpc_query_compile_logic(RPC_QUERY_OP_AND,
+		    rpc_array_get_value(rule, 1)));
 
 	if (!g_strcmp0(op, "nor"))
-		return (eval_logic_nor(obj, lst));
+		return (rpc_query_compile_logic(RPC_QUERY_OP_NOR,
+		    rpc_array_get_value(rule, 1)));
 
-	return (false);
+	return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
+}
+
+static enum rpc_query_op
+rpc_query_field_op(const char *op)
+{
+	static const struct {
+		const char *		name;
+		enum rpc_query_op	op;
+	} ops[] = {
+		{ "=", RPC_QUERY_OP_EQ },
+		{ "!=", RPC_QUERY_OP_NE },
+		{ ">", RPC_QUERY_OP_GT },
+		{ "<", RPC_QUERY_OP_LT },
+		{ ">=", RPC_QUERY_OP_GE },
+		{ "<=", RPC_QUERY_OP_LE },
+		{ "~", RPC_QUERY_OP_REGEX },
+		{ "in", RPC_QUERY_OP_IN },
+		{ "contains", RPC_QUERY_OP_IN },
+		{ "nin", RPC_QUERY_OP_NIN },
+		{ "ncontains", RPC_QUERY_OP_NIN },
+#ifndef _WIN32
+		{ "match", RPC_QUERY_OP_MATCH },
+#endif
+		{ NULL, RPC_QUERY_OP_FALSE }
+	};
+	guint i;
+
+	for (i = 0; ops[i].name != NULL; i++) {
+		if (!g_strcmp0(op, ops[i].name))
+			return (ops[i].op);
+	}
+
+	return (RPC_QUERY_OP_FALSE);
+}
+
+static struct rpc_query_node *
+rpc_query_compile_field_operator(rpc_object_t rule)
+{
+	struct rpc_query_node *node;
+	enum rpc_query_op op;
+	const char *path;
+	rpc_object_t right;
+
+	op = rpc_query_field_op(rpc_array_get_string(rule, 1));
+	right = rpc_array_get_value(rule, 2);
+
+	if (op == RPC_QUERY_OP_REGEX || op == RPC_QUERY_OP_MATCH) {
+		if (rpc_get_type(right) != RPC_TYPE_STRING)
+			op = RPC_QUERY_OP_FALSE;
+	}
+
+	node = rpc_query_node_new(op);
+	if (op == RPC_QUERY_OP_FALSE)
+		return (node);
+
+	if (op == RPC_QUERY_OP_REGEX) {
+		node->rqn_regex = rpc_regex_get(
+		    rpc_string_get_string_ptr(right));
+		if (node->rqn_regex == NULL)
+			node->rqn_op = RPC_QUERY_OP_FALSE;
+	}
+
+	node->rqn_value = rpc_retain(right);
+
+	path = rpc_array_get_string(rule, 0);
+	if (path == NULL)
+		return (node);
+
+	node->rqn_has_path = true;
+	node->rqn_path = rpc_query_path_split(path, &node->rqn_npath);
+	return (node);
+}
+
+static struct rpc_query_node *
+rpc_query_compile_rule(rpc_object_t rule)
+{
+
+	if (rpc_get_type(rule) != RPC_TYPE_ARRAY)
+		return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
+
+	switch (rule->ro_value.rv_list->len) {
+	case 2:
+		return (rpc_query_compile_logic_operator(rule));
+	case 3:
+		return (rpc_query_compile_field_operator(rule));
+	default:
+		return (rpc_query_node_new(RPC_QUERY_OP_FALSE));
+	}
+}
+
+static rpc_object_t
+rpc_query_node_get(struct rpc_query_node *node, rpc_object_t obj)
+{
+
+	if (!node->rqn_has_path)
+		return (NULL);
+
+	return (rpc_query_path_resolve(node->rqn_path, node->rqn_npath, obj));
 }
 
 static bool
@@ -152,114 +334,117 @@ op_in(rpc_object_t o1, rpc_object_t o2)
 }
 
 static bool
-eval_field_operator(rpc_object_t obj, rpc_object_t rule)
+rpc_query_node_eval(struct rpc_query_node *node, rpc_object_t obj)
 {
-	const char *left;
-	const char *op;
-	rpc_object_t right;
+	struct rpc_query_node *child;
 	rpc_object_t item;
+	bool result = false;
+	guint i;
 
-	if (rpc_get_type(rule) != RPC_TYPE_ARRAY)
+	switch (node->rqn_op) {
+	case RPC_QUERY_OP_FALSE:
 		return (false);
 
-	left = rpc_array_get_string(rule, 0);
-	op = rpc_array_get_string(rule, 1);
-	right = rpc_array_get_value(rule, 2);
+	case RPC_QUERY_OP_AND:
+		for (i = 0; i < node->rqn_children->len; i++) {
+			child = g_ptr_array_index(node->rqn_children, i);
+			result = rpc_query_node_eval(child, obj);
+			if (!result)
+				break;
+		}
 
-	item = rpc_query_get(obj, left, NULL);
+		return (result);
 
-	if (!g_strcmp0(op, "="))
-		return (rpc_equal(item, right));
+	case RPC_QUERY_OP_OR:
+		for (i = 0; i < node->rqn_children->len; i++) {
+			child = g_ptr_array_index(node->rqn_children, i);
+			result = rpc_query_node_eval(child, obj);
+			if (result)
+				break;
+		}
 
-	if (!g_strcmp0(op, "!="))
-		return (rpc_cmp(item, right) != 0);
+		return (result);
 
-	if (!g_strcmp0(op, ">"))
-		return (rpc_cmp(item, right) > 0);
+	case RPC_QUERY_OP_NOR:
+		for (i = 0; i < node->rqn_children->len; i++) {
+			child = g_ptr_array_index(node->rqn_children, i);
+			result = !rpc_query_node_eval(child, obj);
+			if (!result)
+				break;
+		}
 
-	if (!g_strcmp0(op, "<"))
-		return (rpc_cmp(item, right) < 0);
+		return (result);
 
-	if (!g_strcmp0(op, ">="))
-		return (rpc_cmp(item, right) >= 0);
+	default:
+		break;
+	}
 
-	if (!g_strcmp0(op, "<="))
-		return (rpc_cmp(item, right) <= 0);
+	/* Field operators; a missing field never matches */
+	item = rpc_query_node_get(node, obj);
+	if (item == NULL)
+		return (false);
 
-	if (!g_strcmp0(op, "~")) {
-		if (rpc_get_type(right) != RPC_TYPE_STRING)
-			return (false);
+	switch (node->rqn_op) {
+	case RPC_QUERY_OP_EQ:
+		return (rpc_equal(item, node->rqn_value));
 
-		if (rpc_get_type(item) != RPC_TYPE_STRING)
-			return (false);
+	case RPC_QUERY_OP_NE:
+		return (rpc_cmp(item, node->rqn_value) != 0);
 
-		return ((bool)g_regex_match_simple(
-		    rpc_string_get_string_ptr(right),
-		    rpc_string_get_string_ptr(item), 0, 0));
+	case RPC_QUERY_OP_GT:
+		return (rpc_cmp(item, node->rqn_value) > 0);
 
-	}
+	case RPC_QUERY_OP_LT:
+		return (rpc_cmp(item, node->rqn_value) < 0);
 
-	if ((!g_strcmp0(op, "in")) || (!g_strcmp0(op, "contains")))
-		return (op_in(item, right));
+	case RPC_QUERY_OP_GE:
+		return (rpc_cmp(item, node->rqn_value) >= 0);
 
-	if ((!g_strcmp0(op, "nin")) || (!g_strcmp0(op, "ncontains")))
-		return (!op_in(item, right));
+	case RPC_QUERY_OP_LE:
+		return (rpc_cmp(item, node->rqn_value) <= 0);
 
-#ifndef _WIN32
-	if (!g_strcmp0(op, "match")) {
-		if (rpc_get_type(right) != RPC_TYPE_STRING)
+	case RPC_QUERY_OP_REGEX:
+		if (rpc_get_type(item) != RPC_TYPE_STRING)
 			return (false);
 
+		return (g_regex_match(node->rqn_regex,
+		    rpc_string_get_string_ptr(item), 0, NULL));
+
+	case RPC_QUERY_OP_IN:
+		return (op_in(item, node->rqn_value));
+
+	case RPC_QUERY_OP_NIN:
+		return (!op_in(item, node->rqn_value));
+
+#ifndef _WIN32
+	case RPC_QUERY_OP_MATCH:
 		if (rpc_get_type(item) != RPC_TYPE_STRING)
 			return (false);
 
-		return (fnmatch(rpc_string_get_string_ptr(right),
+		return (fnmatch(rpc_string_get_string_ptr(node->rqn_value),
 		    rpc_string_get_string_ptr(item), 0) == 0);
-	}
 #endif
 
-	return (false);
-}
-
-static bool
-eval_rule(rpc_object_t obj, rpc_object_t rule)
-{
-	if (rpc_get_type(rule) != RPC_TYPE_ARRAY)
-		return (false);
-
-	switch (rule->ro_value.rv_list->len) {
-	case 2:
-		return (eval_logic_operator(obj, rule));
-	case 3:
-		return (eval_field_operator(obj, rule));
 	default:
 		return (false);
 	}
 }
 
-static rpc_object_t
-rpc_query_steal_apply(rpc_object_t object, rpc_object_t rules)
+static bool
+rpc_query_plan_eval(struct rpc_query_plan *plan, rpc_object_t obj)
 {
-	__block bool fail = false;
-
-	if (object == NULL)
-		return (NULL);
-
-	if (rules == NULL)
-		return (NULL);
+	guint i;
 
-	if (rpc_get_type(rules) != RPC_TYPE_ARRAY)
-		return (NULL);
+	if (plan == NULL || obj == NULL)
+		return (false);
 
-	rpc_array_apply(rules, ^(size_t idx __unused, rpc_object_t v) {
-		if (!eval_rule(object, v)) {
-			fail = true;
-			return ((bool)false);
-		}
-	    	return (bool)true;
-	});
+	for (i = 0; i < plan->rqp_rules->len; i++) {
+		if (!rpc_query_node_eval(g_ptr_array_index(plan->rqp_rules, i),
+		    obj))
+			return (false);
+	}
 
-	return (fail ? NULL : object);
+	return (true);
 }
 
 static rpc_object_t
@@ -269,9 +454,22 @@ rpc_query_find_next(rpc_query_iter_t iter)
 	rpc_object_t result = NULL;
 
 	do {
-		current = rpc_array_get_value(iter->rqi_source, iter->rqi_idx);
+		if (iter->rqi_candidates == NULL)
+			current = rpc_array_get_value(iter->rqi_source,
+			    iter->rqi_idx);
+		else if (iter->rqi_idx < iter->rqi_candidates->len)
+			current = rpc_array_get_value(iter->rqi_source,
+			    g_array_index(iter->rqi_candidates, size_t,
+			    iter->rqi_idx));
+		else
+			current = NULL;
+
 		iter->rqi_idx++;
-		result = rpc_query_steal_apply(current, iter->rqi_rules);
+		if (iter->rqi_prefiltered)
+			result = current;
+		else
+			result = rpc_query_plan_eval(iter->rqi_plan, current)
+			    ? current : NULL;
 
 	} while ((current != NULL) && (result == NULL));
 
@@ -287,6 +485,722 @@ rpc_query_find_next(rpc_query_iter_t iter)
 	return (result);
 }
 
+static void
+rpc_query_worker(gpointer data, gpointer user_data __unused)
+{
+	struct rpc_query_chunk *chunk = data;
+	struct rpc_query_job *job = chunk->rqc_job;
+	rpc_query_iter_t iter = job->rqj_iter;
+	rpc_object_t item;
+	GArray *matches;
+	size_t start;
+	size_t end;
+	size_t pos;
+	size_t i;
+
+	start = chunk->rqc_index * job->rqj_chunk_size;
+	end = MIN(start + job->rqj_chunk_size, job->rqj_total);
+	matches = g_array_new(false, false, sizeof(size_t));
+
+	for (i = start; i < end; i++) {
+		/* Someone else has found enough matches already */
+		if ((i - start) % RPC_QUERY_CHECK_INTERVAL == 0 &&
+		    chunk->rqc_index >= (guint)g_atomic_int_get(
+		    &job->rqj_stop_chunk))
+			break;
+
+		pos = iter->rqi_candidates != NULL
+		    ? g_array_index(iter->rqi_candidates, size_t, i) : i;
+		item = rpc_array_get_value(iter->rqi_source, pos);
+
+		if (rpc_query_plan_eval(iter->rqi_plan, item))
+			g_array_append_val(matches, pos);
+	}
+
+	g_mutex_lock(&job->rqj_mtx);
+	chunk->rqc_matches = matches;
+
+	if (iter->rqi_params->unordered) {
+		g_array_append_vals(job->rqj_merged, matches->data,
+		    matches->len);
+		if (job->rqj_needed > 0 &&
+		    job->rqj_merged->len >= job->rqj_needed)
+			g_atomic_int_set(&job->rqj_stop_chunk, 0);
+	} else {
+		/* Count matches in the finished prefix of the array */
+		while (job->rqj_prefix < job->rqj_nchunks &&
+		    job->rqj_chunks[job->rqj_prefix].rqc_matches != NULL) {
+			job->rqj_found += job->rqj_chunks[job->rqj_prefix]
+			    .rqc_matches->len;
+			job->rqj_prefix++;
+		}
+
+		/* Set the stop point once, later chunks may be incomplete */
+		if (job->rqj_needed > 0 && job->rqj_found >= job->rqj_needed &&
+		    g_atomic_int_get(&job->rqj_stop_chunk) ==
+		    (gint)job->rqj_nchunks)
+			g_atomic_int_set(&job->rqj_stop_chunk,
+			    (gint)job->rqj_prefix);
+	}
+
+	if (--job->rqj_remaining == 0)
+		g_cond_signal(&job->rqj_cv);
+
+	g_mutex_unlock(&job->rqj_mtx);
+}
+
+static GThreadPool *
+rpc_query_get_pool(void)
+{
+	static GThreadPool *pool = NULL;
+	static gsize initialized = 0;
+
+	if (g_once_init_enter(&initialized)) {
+		pool = g_thread_pool_new(rpc_query_worker, NULL,
+		    (gint)g_get_num_processors(), false, NULL);
+		g_once_init_leave(&initialized, 1);
+	}
+
+	return (pool);
+}
+
+/*
+ * Evaluates the plan over chunks of the source array on the worker pool
+ * and replaces the iterator's candidates with the matching positions.
+ * Returns false if the query is too small to be worth splitting.
+ */
+static bool
+rpc_query_run_parallel(rpc_query_iter_t iter)
+{
+	struct rpc_query_job job;
+	rpc_query_params_t params = iter->rqi_params;
+	GThreadPool *pool;
+	guint nworkers;
+	guint i;
+
+	job.rqj_total = iter->rqi_candidates != NULL
+	    ? iter->rqi_candidates->len
+	    : rpc_array_get_count(iter->rqi_source);
+
+	if (iter->rqi_plan == NULL ||
+	    job.rqj_total < 2 * RPC_QUERY_CHUNK_MIN)
+		return (false);
+
+	pool = rpc_query_get_pool();
+	if (pool == NULL)
+		return (false);
+
+	/* A few chunks per worker, so that uneven chunks even out */
+	nworkers = g_get_num_processors();
+	job.rqj_chunk_size = MAX(RPC_QUERY_CHUNK_MIN,
+	    job.rqj_total / (nworkers * 4) + 1);
+	job.rqj_nchunks = (guint)((job.rqj_total + job.rqj_chunk_size - 1) /
+	    job.rqj_chunk_size);
+
+	/* Callbacks may drop matches, so all of them are needed then */
+	job.rqj_needed = 0;
+	if (params->single)
+		job.rqj_needed = params->offset + 1;
+	else if (params->limit > 0 &&
+	    (params->count || params->callback == NULL))
+		job.rqj_needed = params->offset + params->limit;
+
+	job.rqj_iter = iter;
+	job.rqj_remaining = job.rqj_nchunks;
+	job.rqj_stop_chunk = (gint)job.rqj_nchunks;
+	job.rqj_prefix = 0;
+	job.rqj_found = 0;
+	job.rqj_merged = g_array_new(false, false, sizeof(size_t));
+	job.rqj_chunks = g_new0(struct rpc_query_chunk, job.rqj_nchunks);
+	g_mutex_init(&job.rqj_mtx);
+	g_cond_init(&job.rqj_cv);
+
+	for (i = 0; i < job.rqj_nchunks; i++) {
+		job.rqj_chunks[i].rqc_job = &job;
+		job.rqj_chunks[i].rqc_index = i;
+		g_thread_pool_push(pool, &job.rqj_chunks[i], NULL);
+	}
+
+	g_mutex_lock(&job.rqj_mtx);
+	while (job.rqj_remaining > 0)
+		g_cond_wait(&job.rqj_cv, &job.rqj_mtx);
+
+	g_mutex_unlock(&job.rqj_mtx);
+
+	/* Chunks past the stop point may be incomplete, leave them out */
+	for (i = 0; i < job.rqj_nchunks; i++) {
+		if (!params->unordered && i < (guint)job.rqj_stop_chunk)
+			g_array_append_vals(job.rqj_merged,
+			    job.rqj_chunks[i].rqc_matches->data,
+			    job.rqj_chunks[i].rqc_matches->len);
+
+		g_array_free(job.rqj_chunks[i].rqc_matches, true);
+	}
+
+	if (iter->rqi_candidates != NULL)
+		g_array_free(iter->rqi_candidates, true);
+
+	iter->rqi_candidates = job.rqj_merged;
+	iter->rqi_prefiltered = true;
+
+	g_mutex_clear(&job.rqj_mtx);
+	g_cond_clear(&job.rqj_cv);
+	g_free(job.rqj_chunks);
+	return (true);
+}
+
+rpc_query_plan_t
+rpc_query_compile(rpc_object_t rules)
+{
+	struct rpc_query_plan *plan;
+
+	if (rpc_get_type(rules) != RPC_TYPE_ARRAY) {
+		rpc_set_last_error(EINVAL, "Query rules have to be an array",
+		    NULL);
+		return (NULL);
+	}
+
+	plan = g_malloc0(sizeof(*plan));
+	plan->rqp_refcnt = 1;
+	plan->rqp_rules = g_ptr_array_new_with_free_func(
+	    (GDestroyNotify)rpc_query_node_free);
+
+	rpc_array_apply(rules, ^(size_t idx __unused, rpc_object_t v) {
+		g_ptr_array_add(plan->rqp_rules, rpc_query_compile_rule(v));
+		return ((bool)true);
+	});
+
+	return (plan);
+}
+
+rpc_query_plan_t
+rpc_query_plan_retain(rpc_query_plan_t plan)
+{
+
+	g_atomic_int_inc(&plan->rqp_refcnt);
+	return (plan);
+}
+
+void
+rpc_query_plan_release(rpc_query_plan_t plan)
+{
+
+	if (plan == NULL || !g_atomic_int_dec_and_test(&plan->rqp_refcnt))
+		return;
+
+	g_ptr_array_free(plan->rqp_rules, true);
+	g_free(plan);
+}
+
+static guint
+rpc_query_index_key_hash(gconstpointer key)
+{
+
+	return ((guint)rpc_hash((rpc_object_t)key));
+}
+
+static gboolean
+rpc_query_index_key_equal(gconstpointer k1, gconstpointer k2)
+{
+
+	return (rpc_equal((rpc_object_t)k1, (rpc_object_t)k2));
+}
+
+static gint
+rpc_query_sorted_entry_cmp(gconstpointer p1, gconstpointer p2)
+{
+	const struct rpc_query_sorted_entry *e1 = p1;
+	const struct rpc_query_sorted_entry *e2 = p2;
+
+	if (e1->rqs_hash != e2->rqs_hash)
+		return (e1->rqs_hash < e2->rqs_hash ? -1 : 1);
+
+	if (e1->rqs_pos != e2->rqs_pos)
+		return (e1->rqs_pos < e2->rqs_pos ? -1 : 1);
+
+	return (0);
+}
+
+/*
+ * Returns position of the first sorted entry whose hash is greater than
+ * (or equal to, if inclusive is set) a given one.
+ */
+static guint
+rpc_query_sorted_bound(GArray *sorted, gint hash, bool inclusive)
+{
+	struct rpc_query_sorted_entry *entry;
+	guint lo = 0;
+	guint hi = sorted->len;
+	guint mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		entry = &g_array_index(sorted, struct rpc_query_sorted_entry,
+		    mid);
+
+		if (entry->rqs_hash > hash ||
+		    (inclusive && entry->rqs_hash == hash))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return (lo);
+}
+
+static void
+rpc_query_index_add(struct rpc_query_index *index, size_t pos, bool sorted)
+{
+	struct rpc_query_sorted_entry entry;
+	rpc_object_t key;
+	GArray *positions;
+	guint i;
+
+	key = rpc_query_path_resolve(index->rqx_path, index->rqx_npath,
+	    rpc_array_get_value(index->rqx_array, pos));
+
+	if (key == NULL)
+		return;
+
+	if (index->rqx_type == RPC_QUERY_INDEX_HASH) {
+		positions = g_hash_table_lookup(index->rqx_hash, key);
+		if (positions == NULL) {
+			positions = g_array_new(false, false, sizeof(size_t));
+			g_hash_table_insert(index->rqx_hash, rpc_retain(key),
+			    positions);
+		}
+
+		/* Positions are only ever added at the end of the array */
+		g_array_append_val(positions, pos);
+		return;
+	}
+
+	entry.rqs_hash = (gint)rpc_hash(key);
+	entry.rqs_pos = pos;
+
+	if (!sorted) {
+		g_array_append_val(index->rqx_sorted, entry);
+		return;
+	}
+
+	i = rpc_query_sorted_bound(index->rqx_sorted, entry.rqs_hash, false);
+	g_array_insert_val(index->rqx_sorted, i, entry);
+}
+
+static void
+rpc_query_index_rebuild(struct rpc_query_index *index)
+{
+	size_t count;
+	size_t i;
+
+	if (index->rqx_type == RPC_QUERY_INDEX_HASH)
+		g_hash_table_remove_all(index->rqx_hash);
+	else
+		g_array_set_size(index->rqx_sorted, 0);
+
+	count = rpc_array_get_count(index->rqx_array);
+	for (i = 0; i < count; i++)
+		rpc_query_index_add(index, i, false);
+
+	if (index->rqx_type == RPC_QUERY_INDEX_SORTED)
+		g_array_sort(index->rqx_sorted, rpc_query_sorted_entry_cmp);
+
+	index->rqx_stale = false;
+}
+
+static void
+rpc_query_index_remove(struct rpc_query_index *index, size_t pos)
+{
+	struct rpc_query_sorted_entry *entry;
+	GHashTableIter iter;
+	GArray *positions;
+	size_t *p;
+	guint i;
+	guint j;
+
+	/* Drop the removed position and shift the ones that follow it */
+	if (index->rqx_type == RPC_QUERY_INDEX_HASH) {
+		g_hash_table_iter_init(&iter, index->rqx_hash);
+		while (g_hash_table_iter_next(&iter, NULL,
+		    (gpointer *)&positions)) {
+			for (i = 0, j = 0; i < positions->len; i++) {
+				p = &g_array_index(positions, size_t, i);
+				if (*p == pos)
+					continue;
+
+				g_array_index(positions, size_t, j++) =
+				    *p > pos ? *p - 1 : *p;
+			}
+
+			g_array_set_size(positions, j);
+			if (j == 0)
+				g_hash_table_iter_remove(&iter);
+		}
+
+		return;
+	}
+
+	for (i = 0, j = 0; i < index->rqx_sorted->len; i++) {
+		entry = &g_array_index(index->rqx_sorted,
+		    struct rpc_query_sorted_entry, i);
+		if (entry->rqs_pos == pos)
+			continue;
+
+		if (entry->rqs_pos > pos)
+			entry->rqs_pos--;
+
+		g_array_index(index->rqx_sorted,
+		    struct rpc_query_sorted_entry, j++) = *entry;
+	}
+
+	g_array_set_size(index->rqx_sorted, j);
+}
+
+/*
+ * Tells whether an array has any indexes, without touching the index
+ * registry, so modifications of unindexed arrays stay cheap.
+ */
+static inline bool
+rpc_query_index_present(rpc_object_t array)
+{
+
+	return (g_atomic_int_get(&array->ro_indexed) != 0);
+}
+
+static GPtrArray *
+rpc_query_indexes_of(rpc_object_t array)
+{
+
+	if (rpc_query_indexes == NULL)
+		return (NULL);
+
+	return (g_hash_table_lookup(rpc_query_indexes, array));
+}
+
+void
+rpc_query_index_notify_append(rpc_object_t array, size_t index)
+{
+	GPtrArray *indexes;
+	struct rpc_query_index *idx;
+	guint i;
+
+	if (!rpc_query_index_present(array))
+		return;
+
+	g_mutex_lock(&rpc_query_index_mtx);
+	indexes = rpc_query_indexes_of(array);
+	for (i = 0; indexes != NULL && i < indexes->len; i++) {
+		idx = g_ptr_array_index(indexes, i);
+		if (!idx->rqx_stale)
+			rpc_query_index_add(idx, index, true);
+	}
+
+	g_mutex_unlock(&rpc_query_index_mtx);
+}
+
+void
+rpc_query_index_notify_remove(rpc_object_t array, size_t index)
+{
+	GPtrArray *indexes;
+	struct rpc_query_index *idx;
+	guint i;
+
+	if (!rpc_query_index_present(array))
+		return;
+
+	g_mutex_lock(&rpc_query_index_mtx);
+	indexes = rpc_query_indexes_of(array);
+	for (i = 0; indexes != NULL && i < indexes->len; i++) {
+		idx = g_ptr_array_index(indexes, i);
+		if (!idx->rqx_stale)
+			rpc_query_index_remove(idx, index);
+	}
+
+	g_mutex_unlock(&rpc_query_index_mtx);
+}
+
+void
+rpc_query_index_notify_invalidate(rpc_object_t array)
+{
+	GPtrArray *indexes;
+	struct rpc_query_index *idx;
+	guint i;
+
+	if (!rpc_query_index_present(array))
+		return;
+
+	g_mutex_lock(&rpc_query_index_mtx);
+	indexes = rpc_query_indexes_of(array);
+	for (i = 0; indexes != NULL && i < indexes->len; i++) {
+		idx = g_ptr_array_index(indexes, i);
+		idx->rqx_stale = true;
+	}
+
+	g_mutex_unlock(&rpc_query_index_mtx);
+}
+
+static gint
+rpc_query_position_cmp(gconstpointer p1, gconstpointer p2)
+{
+	size_t pos1 = *(const size_t *)p1;
+	size_t pos2 = *(const size_t *)p2;
+
+	return ((pos1 > pos2) - (pos1 < pos2));
+}
+
+static GArray *
+rpc_query_index_lookup_hash(struct rpc_query_index *index,
+    struct rpc_query_node *node)
+{
+	GArray *result;
+	GArray *positions;
+	size_t count;
+	size_t i;
+	guint j;
+
+	result = g_array_new(false, false, sizeof(size_t));
+
+	if (node->rqn_op == RPC_QUERY_OP_EQ) {
+		positions = g_hash_table_lookup(index->rqx_hash,
+		    node->rqn_value);
+		if (positions != NULL)
+			g_array_append_vals(result, positions->data,
+			    positions->len);
+
+		return (result);
+	}
+
+	/* "in" with an array operand matches any of its elements */
+	count = rpc_array_get_count(node->rqn_value);
+	for (i = 0; i < count; i++) {
+		positions = g_hash_table_lookup(index->rqx_hash,
+		    rpc_array_get_value(node->rqn_value, i));
+		if (positions != NULL)
+			g_array_append_vals(result, positions->data,
+			    positions->len);
+	}
+
+	/* Restore the array order and drop duplicates */
+	g_array_sort(result, rpc_query_position_cmp);
+	for (i = 0, j = 0; i < result->len; i++) {
+		if (j > 0 && g_array_index(result, size_t, j - 1) ==
+		    g_array_index(result, size_t, i))
+			continue;
+
+		g_array_index(result, size_t, j++) =
+		    g_array_index(result, size_t, i);
+	}
+
+	g_array_set_size(result, j);
+	return (result);
+}
+
+static GArray *
+rpc_query_index_lookup_sorted(struct rpc_query_index *index,
+    struct rpc_query_plan *plan)
+{
+	struct rpc_query_node *node;
+	GArray *result;
+	guint start = 0;
+	guint end = index->rqx_sorted->len;
+	guint lo;
+	guint hi;
+	gint hash;
+	bool bounded = false;
+	guint i;
+
+	/* Intersect the ranges of all the rules on the indexed path */
+	for (i = 0; i < plan->rqp_rules->len; i++) {
+		node = g_ptr_array_index(plan->rqp_rules, i);
+		if (!node->rqn_has_path || !rpc_query_path_equal(
+		    node->rqn_path, node->rqn_npath, index->rqx_path,
+		    index->rqx_npath))
+			continue;
+
+		hash = (gint)rpc_hash(node->rqn_value);
+
+		switch (node->rqn_op) {
+		case RPC_QUERY_OP_EQ:
+			lo = rpc_query_sorted_bound(index->rqx_sorted, hash,
+			    true);
+			hi = rpc_query_sorted_bound(index->rqx_sorted, hash,
+			    false);
+			break;
+
+		case RPC_QUERY_OP_GT:
+		case RPC_QUERY_OP_GE:
+			lo = rpc_query_sorted_bound(index->rqx_sorted, hash,
+			    node->rqn_op == RPC_QUERY_OP_GE);
+			hi = index->rqx_sorted->len;
+			break;
+
+		case RPC_QUERY_OP_LT:
+		case RPC_QUERY_OP_LE:
+			lo = 0;
+			hi = rpc_query_sorted_bound(index->rqx_sorted, hash,
+			    node->rqn_op == RPC_QUERY_OP_LT);
+			break;
+
+		default:
+			continue;
+		}
+
+		start = MAX(start, lo);
+		end = MIN(end, hi);
+		bounded = true;
+	}
+
+	if (!bounded)
+		return (NULL);
+
+	result = g_array_new(false, false, sizeof(size_t));
+	for (i = start; i < end; i++) {
+		g_array_append_val(result, g_array_index(index->rqx_sorted,
+		    struct rpc_query_sorted_entry, i).rqs_pos);
+	}
+
+	g_array_sort(result, rpc_query_position_cmp);
+	return (result);
+}
+
+/*
+ * Picks an index able to narrow down the elements of an array that may
+ * match a plan. Returns positions of the candidates, in the array order,
+ * or NULL if the whole array has to be scanned.
+ */
+static GArray *
+rpc_query_index_plan(rpc_object_t array, struct rpc_query_plan *plan)
+{
+	GPtrArray *indexes;
+	struct rpc_query_index *index;
+	struct rpc_query_node *node;
+	GArray *result = NULL;
+	guint i;
+	guint j;
+
+	if (plan == NULL || !rpc_query_index_present(array))
+		return (NULL);
+
+	g_mutex_lock(&rpc_query_index_mtx);
+	indexes = rpc_query_indexes_of(array);
+	if (indexes == NULL)
+		goto done;
+
+	for (i = 0; i < indexes->len; i++) {
+		index = g_ptr_array_index(indexes, i);
+		if (index->rqx_type != RPC_QUERY_INDEX_HASH)
+			continue;
+
+		for (j = 0; j < plan->rqp_rules->len; j++) {
+			node = g_ptr_array_index(plan->rqp_rules, j);
+			if (node->rqn_op != RPC_QUERY_OP_EQ &&
+			    (node->rqn_op != RPC_QUERY_OP_IN ||
+			    rpc_get_type(node->rqn_value) != RPC_TYPE_ARRAY))
+				continue;
+
+			if (!node->rqn_has_path || !rpc_query_path_equal(
+			    node->rqn_path, node->rqn_npath, index->rqx_path,
+			    index->rqx_npath))
+				continue;
+
+			if (index->rqx_stale)
+				rpc_query_index_rebuild(index);
+
+			result = rpc_query_index_lookup_hash(index, node);
+			goto done;
+		}
+	}
+
+	for (i = 0; i < indexes->len; i++) {
+		index = g_ptr_array_index(indexes, i);
+		if (index->rqx_type != RPC_QUERY_INDEX_SORTED)
+			continue;
+
+		if (index->rqx_stale)
+			rpc_query_index_rebuild(index);
+
+		result = rpc_query_index_lookup_sorted(index, plan);
+		if (result != NULL)
+			goto done;
+	}
+
+done:
+	g_mutex_unlock(&rpc_query_index_mtx);
+	return (result);
+}
+
+rpc_query_index_t
+rpc_query_index_create(rpc_object_t array, const char *path,
+    rpc_query_index_type_t type)
+{
+	struct rpc_query_index *index;
+	GPtrArray *indexes;
+
+	if (rpc_get_type(array) != RPC_TYPE_ARRAY) {
+		rpc_set_last_error(EINVAL, "Only arrays can be indexed", NULL);
+		return (NULL);
+	}
+
+	index = g_malloc0(sizeof(*index));
+	index->rqx_array = rpc_retain(array);
+	index->rqx_type = type;
+	index->rqx_path = rpc_query_path_split(path, &index->rqx_npath);
+
+	if (type == RPC_QUERY_INDEX_HASH)
+		index->rqx_hash = g_hash_table_new_full(
+		    rpc_query_index_key_hash, rpc_query_index_key_equal,
+		    (GDestroyNotify)rpc_release_impl,
+		    (GDestroyNotify)g_array_unref);
+	else
+		index->rqx_sorted = g_array_new(false, false,
+		    sizeof(struct rpc_query_sorted_entry));
+
+	rpc_query_index_rebuild(index);
+
+	g_mutex_lock(&rpc_query_index_mtx);
+	if (rpc_query_indexes == NULL)
+		rpc_query_indexes = g_hash_table_new_full(g_direct_hash,
+		    g_direct_equal, NULL, (GDestroyNotify)g_ptr_array_unref);
+
+	indexes = g_hash_table_lookup(rpc_query_indexes, array);
+	if (indexes == NULL) {
+		indexes = g_ptr_array_new();
+		g_hash_table_insert(rpc_query_indexes, array, indexes);
+	}
+
+	g_ptr_array_add(indexes, index);
+	g_atomic_int_set(&array->ro_indexed, 1);
+	g_mutex_unlock(&rpc_query_index_mtx);
+
+	return (index);
+}
+
+void
+rpc_query_index_free(rpc_query_index_t index)
+{
+	GPtrArray *indexes;
+
+	g_mutex_lock(&rpc_query_index_mtx);
+	indexes = g_hash_table_lookup(rpc_query_indexes, index->rqx_array);
+	g_ptr_array_remove(indexes, index);
+	if (indexes->len == 0) {
+		g_atomic_int_set(&index->rqx_array->ro_indexed, 0);
+		g_hash_table_remove(rpc_query_indexes, index->rqx_array);
+	}
+
+	g_mutex_unlock(&rpc_query_index_mtx);
+
+	if (index->rqx_hash != NULL)
+		g_hash_table_destroy(index->rqx_hash);
+
+	if (index->rqx_sorted != NULL)
+		g_array_free(index->rqx_sorted, true);
+
+	rpc_query_path_free(index->rqx_path, index->rqx_npath);
+	rpc_release(index->rqx_array);
+	g_free(index);
+}
+
 rpc_object_t
 rpc_query_get(rpc_object_t object, const char *path, rpc_object_t default_val)
 {
@@ -487,7 +1401,8 @@ rpc_query_contains(rpc_object_t object, const char *path)
 }
 
 rpc_query_iter_t
-rpc_query(rpc_object_t object, rpc_query_params_t params, rpc_object_t rules)
+rpc_query_compiled(rpc_object_t object, rpc_query_params_t params,
+    rpc_query_plan_t plan)
 {
 	rpc_query_iter_t iter;
 	rpc_query_params_t local_params;
@@ -499,24 +1414,38 @@ rpc_query(rpc_object_t object, rpc_query_params_t params, rpc_object_t rules)
 	}
 
 	iter = g_malloc(sizeof(*iter));
-	local_params = g_malloc(sizeof(*local_params));
+	local_params = g_malloc0(sizeof(*local_params));
 
 	if (params != NULL)
 		*local_params = *params;
 
 	iter->rqi_source = object;
 	iter->rqi_idx = 0;
+	iter->rqi_candidates = NULL;
+	iter->rqi_prefiltered = false;
 	iter->rqi_params = local_params;
-	iter->rqi_rules = rules;
+	iter->rqi_plan = plan != NULL ? rpc_query_plan_retain(plan) : NULL;
 	iter->rqi_done = false;
 	iter->rqi_initialized = false;
 	iter->rqi_limit = 0;
 
-	rpc_retain(rules);
 	rpc_retain(object);
 	return (iter);
 }
 
+rpc_query_iter_t
+rpc_query(rpc_object_t object, rpc_query_params_t params, rpc_object_t rules)
+{
+	rpc_query_iter_t iter;
+	rpc_query_plan_t plan;
+
+	/* Without valid rules nothing matches */
+	plan = rules != NULL ? rpc_query_compile(rules) : NULL;
+	iter = rpc_query_compiled(object, params, plan);
+	rpc_query_plan_release(plan);
+	return (iter);
+}
+
 rpc_query_iter_t
 rpc_query_fmt(rpc_object_t object, rpc_query_params_t params,
     const char *rules_fmt, ...)
@@ -537,17 +1466,17 @@ rpc_query_fmt(rpc_object_t object, rpc_query_params_t params,
 rpc_object_t
 rpc_query_apply(rpc_object_t object, rpc_object_t rules)
 {
-	rpc_object_t result;
+	rpc_query_plan_t plan;
+	bool match;
 
 	if (rpc_get_type(rules) != RPC_TYPE_ARRAY)
 		return (NULL);
 
-	result = rpc_query_steal_apply(object, rules);
-
-	if (result != NULL)
-		rpc_retain(result);
+	plan = rpc_query_compile(rules);
+	match = rpc_query_plan_eval(plan, object);
+	rpc_query_plan_release(plan);
 
-	return (result);
+	return (match ? rpc_retain(object) : NULL);
 }
 
 bool
@@ -578,6 +1507,12 @@ rpc_query_next(rpc_query_iter_t iter, rpc_object_t *chunk)
 			iter->rqi_source = temp_obj;
 		}
 
+		iter->rqi_candidates = rpc_query_index_plan(iter->rqi_source,
+		    iter->rqi_plan);
+
+		if (iter->rqi_params->parallel)
+			rpc_query_run_parallel(iter);
+
 		for (i = 0; i < iter->rqi_params->offset; i++) {
 			temp_obj = rpc_query_find_next(iter);
 			if (temp_obj == NULL)
@@ -634,7 +1569,10 @@ void
 rpc_query_iter_free(rpc_query_iter_t iter)
 {
 
-	rpc_release(iter->rqi_rules);
+	if (iter->rqi_candidates != NULL)
+		g_array_free(iter->rqi_candidates, true);
+
+	rpc_query_plan_release(iter->rqi_plan);
 	rpc_release(iter->rqi_source);
 	g_free(iter->rqi_params);
 	g_free(iter);
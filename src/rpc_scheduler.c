@@ -0,0 +1,382 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <glib.h>
+#include "internal.h"
+
+/*
+ * Bounded work-stealing scheduler.
+ *
+ * Every worker owns a pair of deques per priority class: a shared one,
+ * which other workers may steal from, and a pinned one for tasks with
+ * affinity to that particular worker. Owners take tasks from the head,
+ * thieves from the tail. High priority work is always preferred, both
+ * locally and when stealing.
+ *
+ * A task that is going to run for a long time (a streaming call waiting
+ * for consumer credit) can detach its thread from the pool. A fresh
+ * thread then takes over the worker's queues, so the number of threads
+ * serving queued work stays constant. Only a bounded number of threads
+ * may be detached at a time; past that, long running tasks keep their
+ * worker. Pinned tasks never detach, as the fresh thread would run the
+ * next task pinned to the worker concurrently with them.
+ */
+
+#define	DETACHED_PER_WORKER	4
+
+struct rpc_task
+{
+	GFunc			rta_func;
+	gpointer		rta_data;
+	gpointer		rta_user_data;
+	rpc_priority_t		rta_prio;
+	bool			rta_pinned;
+};
+
+struct rpc_worker
+{
+	struct rpc_scheduler *	rwk_scheduler;
+	GThread *		rwk_thread;
+	GMutex			rwk_mtx;
+	GQueue			rwk_shared[RPC_PRIORITY_COUNT];
+	GQueue			rwk_pinned[RPC_PRIORITY_COUNT];
+	volatile gint		rwk_npinned;
+	guint			rwk_index;
+	bool			rwk_running_pinned;
+};
+
+struct rpc_scheduler
+{
+	struct rpc_worker *	rsc_workers;
+	guint			rsc_nworkers;
+	GMutex			rsc_mtx;
+	GCond			rsc_cv;
+	volatile gint		rsc_nshared;
+	volatile gint		rsc_queued[RPC_PRIORITY_COUNT];
+	volatile gint		rsc_running;
+	volatile gint		rsc_next;
+	volatile gsize		rsc_completed;
+	volatile gsize		rsc_stolen;
+	volatile gint		rsc_ndetached;
+	bool			rsc_stop;
+};
+
+static gpointer rpc_worker_main(gpointer arg);
+
+static GPrivate rpc_worker_current;
+
+static struct rpc_task *
+rpc_worker_pop(struct rpc_worker *worker, rpc_priority_t prio)
+{
+	struct rpc_task *task;
+
+	g_mutex_lock(&worker->rwk_mtx);
+	task = g_queue_pop_head(&worker->rwk_pinned[prio]);
+	if (task == NULL)
+		task = g_queue_pop_head(&worker->rwk_shared[prio]);
+	g_mutex_unlock(&worker->rwk_mtx);
+
+	return (task);
+}
+
+static struct rpc_task *
+rpc_worker_steal(struct rpc_worker *worker, rpc_priority_t prio)
+{
+	struct rpc_scheduler *sched = worker->rwk_scheduler;
+	struct rpc_worker *victim;
+	struct rpc_task *task;
+	guint i;
+
+	for (i = 1; i < sched->rsc_nworkers; i++) {
+		victim = &sched->rsc_workers[
+		    (worker->rwk_index + i) % sched->rsc_nworkers];
+
+		g_mutex_lock(&victim->rwk_mtx);
+		task = g_queue_pop_tail(&victim->rwk_shared[prio]);
+		g_mutex_unlock(&victim->rwk_mtx);
+
+		if (task != NULL) {
+			g_atomic_pointer_add(&sched->rsc_stolen, 1);
+			return (task);
+		}
+	}
+
+	return (NULL);
+}
+
+static struct rpc_task *
+rpc_worker_take(struct rpc_worker *worker)
+{
+	struct rpc_scheduler *sched = worker->rwk_scheduler;
+	struct rpc_task *task = NULL;
+	rpc_priority_t prio;
+
+	for (prio = 0; prio < RPC_PRIORITY_COUNT; prio++) {
+		task = rpc_worker_pop(worker, prio);
+		if (task == NULL && g_atomic_int_get(&sched->rsc_nshared) > 0)
+			task = rpc_worker_steal(worker, prio);
+
+		if (task != NULL)
+			break;
+	}
+
+	if (task == NULL)
+		return (NULL);
+
+	if (task->rta_pinned)
+		g_atomic_int_add(&worker->rwk_npinned, -1);
+	else
+		g_atomic_int_add(&sched->rsc_nshared, -1);
+
+	g_atomic_int_add(&sched->rsc_queued[task->rta_prio], -1);
+	return (task);
+}
+
+static void
+rpc_task_run(struct rpc_worker *worker, struct rpc_task *task)
+{
+	struct rpc_scheduler *sched = worker->rwk_scheduler;
+
+	worker->rwk_running_pinned = task->rta_pinned;
+	g_atomic_int_inc(&sched->rsc_running);
+	task->rta_func(task->rta_data, task->rta_user_data);
+	g_atomic_int_add(&sched->rsc_running, -1);
+	g_atomic_pointer_add(&sched->rsc_completed, 1);
+	g_free(task);
+}
+
+static gpointer
+rpc_worker_main(gpointer arg)
+{
+	struct rpc_worker *worker = arg;
+	struct rpc_scheduler *sched = worker->rwk_scheduler;
+	struct rpc_task *task;
+	bool stop;
+
+	g_private_set(&rpc_worker_current, worker);
+
+	for (;;) {
+		task = rpc_worker_take(worker);
+		if (task != NULL) {
+			rpc_task_run(worker, task);
+			if (g_private_get(&rpc_worker_current) != worker)
+				goto detached;
+
+			continue;
+		}
+
+		g_mutex_lock(&sched->rsc_mtx);
+		while (!sched->rsc_stop &&
+		    g_atomic_int_get(&sched->rsc_nshared) == 0 &&
+		    g_atomic_int_get(&worker->rwk_npinned) == 0)
+			g_cond_wait(&sched->rsc_cv, &sched->rsc_mtx);
+
+		/* Queued work is still processed when stopping */
+		stop = sched->rsc_stop &&
+		    g_atomic_int_get(&sched->rsc_nshared) == 0 &&
+		    g_atomic_int_get(&worker->rwk_npinned) == 0;
+		g_mutex_unlock(&sched->rsc_mtx);
+
+		if (stop)
+			break;
+	}
+
+	return (NULL);
+
+detached:
+	/* Another thread owns the worker now */
+	g_mutex_lock(&sched->rsc_mtx);
+	g_atomic_int_add(&sched->rsc_ndetached, -1);
+	g_cond_broadcast(&sched->rsc_cv);
+	g_mutex_unlock(&sched->rsc_mtx);
+	return (NULL);
+}
+
+struct rpc_scheduler *
+rpc_scheduler_new(guint nworkers)
+{
+	struct rpc_scheduler *sched;
+	struct rpc_worker *worker;
+	guint i;
+	guint j;
+
+	g_assert(nworkers > 0);
+
+	sched = g_malloc0(sizeof(*sched));
+	sched->rsc_nworkers = nworkers;
+	sched->rsc_workers = g_new0(struct rpc_worker, nworkers);
+	g_mutex_init(&sched->rsc_mtx);
+	g_cond_init(&sched->rsc_cv);
+
+	for (i = 0; i < nworkers; i++) {
+		worker = &sched->rsc_workers[i];
+		worker->rwk_scheduler = sched;
+		worker->rwk_index = i;
+		g_mutex_init(&worker->rwk_mtx);
+		for (j = 0; j < RPC_PRIORITY_COUNT; j++) {
+			g_queue_init(&worker->rwk_shared[j]);
+			g_queue_init(&worker->rwk_pinned[j]);
+		}
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		worker = &sched->rsc_workers[i];
+		worker->rwk_thread = g_thread_new("worker", rpc_worker_main,
+		    worker);
+	}
+
+	return (sched);
+}
+
+void
+rpc_scheduler_free(struct rpc_scheduler *sched)
+{
+	struct rpc_worker *worker;
+	guint i;
+
+	g_mutex_lock(&sched->rsc_mtx);
+	sched->rsc_stop = true;
+	g_cond_broadcast(&sched->rsc_cv);
+	g_mutex_unlock(&sched->rsc_mtx);
+
+	for (i = 0; i < sched->rsc_nworkers; i++) {
+		worker = &sched->rsc_workers[i];
+		g_thread_join(worker->rwk_thread);
+		g_mutex_clear(&worker->rwk_mtx);
+	}
+
+	g_mutex_lock(&sched->rsc_mtx);
+	while (g_atomic_int_get(&sched->rsc_ndetached) > 0)
+		g_cond_wait(&sched->rsc_cv, &sched->rsc_mtx);
+	g_mutex_unlock(&sched->rsc_mtx);
+
+	g_mutex_clear(&sched->rsc_mtx);
+	g_cond_clear(&sched->rsc_cv);
+	g_free(sched->rsc_workers);
+	g_free(sched);
+}
+
+guint
+rpc_scheduler_get_nworkers(struct rpc_scheduler *sched)
+{
+
+	return (sched->rsc_nworkers);
+}
+
+bool
+rpc_scheduler_detach(struct rpc_scheduler *sched)
+{
+	struct rpc_worker *worker;
+
+	worker = g_private_get(&rpc_worker_current);
+	if (worker == NULL || worker->rwk_scheduler != sched)
+		return (false);
+
+	if (worker->rwk_running_pinned)
+		return (false);
+
+	g_mutex_lock(&sched->rsc_mtx);
+	if (sched->rsc_stop || (guint)g_atomic_int_get(&sched->rsc_ndetached) >=
+	    sched->rsc_nworkers * DETACHED_PER_WORKER) {
+		g_mutex_unlock(&sched->rsc_mtx);
+		return (false);
+	}
+
+	/* The current thread exits once its task returns */
+	g_thread_unref(worker->rwk_thread);
+	worker->rwk_thread = g_thread_new("worker", rpc_worker_main, worker);
+	g_atomic_int_inc(&sched->rsc_ndetached);
+	g_mutex_unlock(&sched->rsc_mtx);
+
+	g_private_set(&rpc_worker_current, NULL);
+	return (true);
+}
+
+void
+rpc_scheduler_push(struct rpc_scheduler *sched, GFunc func, gpointer data,
+    gpointer user_data, rpc_priority_t prio, gint affinity)
+{
+	struct rpc_worker *worker;
+	struct rpc_task *task;
+	bool pinned = affinity >= 0;
+	guint index;
+
+	task = g_malloc(sizeof(*task));
+	task->rta_func = func;
+	task->rta_data = data;
+	task->rta_user_data = user_data;
+	task->rta_prio = prio;
+	task->rta_pinned = pinned;
+
+	if (pinned)
+		index = (guint)affinity % sched->rsc_nworkers;
+	else {
+		index = (guint)g_atomic_int_add(&sched->rsc_next, 1) %
+		    sched->rsc_nworkers;
+	}
+
+	worker = &sched->rsc_workers[index];
+	g_mutex_lock(&worker->rwk_mtx);
+	g_queue_push_tail(pinned
+	    ? &worker->rwk_pinned[prio]
+	    : &worker->rwk_shared[prio], task);
+	g_mutex_unlock(&worker->rwk_mtx);
+
+	/* The task may already be running (and freed) at this point */
+	g_atomic_int_inc(&sched->rsc_queued[prio]);
+	if (pinned)
+		g_atomic_int_inc(&worker->rwk_npinned);
+	else
+		g_atomic_int_inc(&sched->rsc_nshared);
+
+	/* Pinned tasks have to wake up their owner specifically */
+	g_mutex_lock(&sched->rsc_mtx);
+	if (pinned)
+		g_cond_broadcast(&sched->rsc_cv);
+	else
+		g_cond_signal(&sched->rsc_cv);
+	g_mutex_unlock(&sched->rsc_mtx);
+}
+
+void
+rpc_scheduler_get_stats(struct rpc_scheduler *sched,
+    struct rpc_context_stats *stats)
+{
+
+	stats->rcs_workers = sched->rsc_nworkers;
+	stats->rcs_running = (size_t)g_atomic_int_get(&sched->rsc_running);
+	stats->rcs_detached = (size_t)g_atomic_int_get(&sched->rsc_ndetached);
+	stats->rcs_queued_high = (size_t)g_atomic_int_get(
+	    &sched->rsc_queued[RPC_PRIORITY_HIGH]);
+	stats->rcs_queued_normal = (size_t)g_atomic_int_get(
+	    &sched->rsc_queued[RPC_PRIORITY_NORMAL]);
+	stats->rcs_completed = (uint64_t)g_atomic_pointer_get(
+	    &sched->rsc_completed);
+	stats->rcs_stolen = (uint64_t)g_atomic_pointer_get(
+	    &sched->rsc_stolen);
+}
@@ -44,6 +44,8 @@ static bool rpc_server_valid(rpc_server_t);
 static void * rpc_server_worker(void *);
 static gboolean rpc_server_listen(void *);
 static void server_queue_purge(rpc_server_t);
+static void rpc_server_invalidate_snapshot(rpc_server_t);
+static GPtrArray *rpc_server_get_snapshot(rpc_server_t);
 
 static void
 rpc_server_cleanup(rpc_server_t server)
@@ -89,8 +91,9 @@ rpc_server_accept(rpc_server_t server, rpc_connection_t conn)
 	conn->rco_rpc_context = server->rs_context;
 
 	g_rw_lock_writer_lock(&server->rs_connections_rwlock);
-	server->rs_connections = g_list_append(server->rs_connections, conn);
+	g_hash_table_add(server->rs_connections, conn);
 	rpc_connection_retain(conn);
+	rpc_server_invalidate_snapshot(server);
 	g_rw_lock_writer_unlock(&server->rs_connections_rwlock);
 
 	server->rs_conn_made++;
@@ -120,7 +123,8 @@ rpc_server_disconnect(rpc_server_t server, rpc_connection_t conn)
 	    != 0);
 
 	g_rw_lock_writer_lock(&server->rs_connections_rwlock);
-	server->rs_connections = g_list_remove(server->rs_connections, conn);
+	g_hash_table_remove(server->rs_connections, conn);
+	rpc_server_invalidate_snapshot(server);
 	g_rw_lock_writer_unlock(&server->rs_connections_rwlock);
 	g_mutex_unlock(&server->rs_mtx);
 
@@ -217,6 +221,8 @@ rpc_server_create_ex(const char *uri, rpc_context_t context, rpc_object_t params
 	server->rs_uri = uri;
 	server->rs_paused = true;
 	server->rs_calls = g_queue_new();
+	server->rs_connections = g_hash_table_new(NULL, NULL);
+	server->rs_retry_after = RPC_DEFAULT_RETRY_AFTER;
 	server->rs_context = context;
 	server->rs_accept = rpc_server_accept;
 	server->rs_valid = rpc_server_valid;
@@ -253,25 +259,82 @@ rpc_server_create_ex(const char *uri, rpc_context_t context, rpc_object_t params
 	return (server);
 }
 
-void
-rpc_server_broadcast_event(rpc_server_t server, const char *path,
-    const char *interface, const char *name, rpc_object_t args)
+/*
+ * Must be called with rs_connections_rwlock held for writing.
+ */
+static void
+rpc_server_invalidate_snapshot(rpc_server_t server)
 {
 
-	GList *item;
+	server->rs_conn_generation++;
+	g_clear_pointer(&server->rs_conn_snapshot, g_ptr_array_unref);
+}
+
+/*
+ * Returns a referenced array of retained connections. The array is
+ * shared by concurrent broadcasts and rebuilt only after the connection
+ * set changes, so broadcasting never holds the registry lock while
+ * sending and accepts never wait for a broadcast to finish.
+ */
+static GPtrArray *
+rpc_server_get_snapshot(rpc_server_t server)
+{
+	GPtrArray *snapshot;
+	GHashTableIter iter;
+	rpc_connection_t conn;
+	guint generation;
 
 	g_rw_lock_reader_lock(&server->rs_connections_rwlock);
-        if (server->rs_closed) {
+	if (server->rs_closed) {
 		g_rw_lock_reader_unlock(&server->rs_connections_rwlock);
-		return;
+		return (NULL);
 	}
 
-	for (item = g_list_first(server->rs_connections); item;
-	     item = item->next) {
-		rpc_connection_t conn = item->data;
-		rpc_connection_send_event(conn, path, interface, name, args);
+	if (server->rs_conn_snapshot != NULL) {
+		snapshot = g_ptr_array_ref(server->rs_conn_snapshot);
+		g_rw_lock_reader_unlock(&server->rs_connections_rwlock);
+		return (snapshot);
+	}
+
+	generation = server->rs_conn_generation;
+	snapshot = g_ptr_array_new_full(
+	    g_hash_table_size(server->rs_connections),
+	    (GDestroyNotify)rpc_connection_release);
+
+	g_hash_table_iter_init(&iter, server->rs_connections);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&conn, NULL)) {
+		rpc_connection_retain(conn);
+		g_ptr_array_add(snapshot, conn);
 	}
 	g_rw_lock_reader_unlock(&server->rs_connections_rwlock);
+
+	/* Publish it unless the connection set changed in the meantime */
+	g_rw_lock_writer_lock(&server->rs_connections_rwlock);
+	if (server->rs_conn_snapshot == NULL &&
+	    server->rs_conn_generation == generation)
+		server->rs_conn_snapshot = g_ptr_array_ref(snapshot);
+	g_rw_lock_writer_unlock(&server->rs_connections_rwlock);
+
+	return (snapshot);
+}
+
+void
+rpc_server_broadcast_event(rpc_server_t server, const char *path,
+    const char *interface, const char *name, rpc_object_t args)
+{
+	GPtrArray *snapshot;
+	guint i;
+
+	snapshot = rpc_server_get_snapshot(server);
+	if (snapshot == NULL)
+		return;
+
+	for (i = 0; i < snapshot->len; i++) {
+		rpc_connection_t conn = g_ptr_array_index(snapshot, i);
+		rpc_connection_send_event(conn, path, interface, name, args);
+	}
+
+	g_ptr_array_unref(snapshot);
 }
 
 void
@@ -286,6 +349,18 @@ rpc_server_set_event_handler(rpc_server_t server,
 		server->rs_event_handler = Block_copy(handler);
 }
 
+void
+rpc_server_set_limits(rpc_server_t server, size_t max_conn_calls,
+    size_t max_queued, uint32_t retry_after)
+{
+
+	g_mutex_lock(&server->rs_calls_mtx);
+	server->rs_max_conn_calls = max_conn_calls;
+	server->rs_max_queued = max_queued;
+	server->rs_retry_after = retry_after;
+	g_mutex_unlock(&server->rs_calls_mtx);
+}
+
 int
 rpc_server_dispatch(rpc_server_t server, struct rpc_call *call)
 {
@@ -301,6 +376,15 @@ rpc_server_dispatch(rpc_server_t server, struct rpc_call *call)
 	}
 
 	if (server->rs_paused || !g_queue_is_empty(server->rs_calls))  {
+		if (server->rs_max_queued > 0 &&
+		    g_queue_get_length(server->rs_calls) >=
+		    server->rs_max_queued) {
+			g_mutex_unlock(&server->rs_calls_mtx);
+			call->rc_err = rpc_error_create_busy(
+			    "Too many queued calls", server->rs_retry_after);
+			return (-1);
+		}
+
 		g_queue_push_tail(server->rs_calls, call);
 		g_mutex_unlock(&server->rs_calls_mtx);
 		return (0);
@@ -321,19 +405,19 @@ server_queue_purge(rpc_server_t server)
 		icall = g_queue_pop_head(server->rs_calls);
 
 		if (!server->rs_closed) {
+			/* Don't run inline calls with rs_calls_mtx held */
 			if (rpc_context_dispatch(server->rs_context,
-			    icall) == 0)
+			    icall) == 0 && (!icall->rc_inline ||
+			    rpc_context_submit(server->rs_context,
+			    icall) == 0))
 				continue;
 		} else {
 			icall->rc_err = rpc_error_create(ECONNRESET,
 			    "Server not active", NULL);
 		}
 
-		if (icall->rc_err != NULL) {
-			rpc_function_error(icall,
-			    rpc_error_get_code(icall->rc_err),
-			    rpc_error_get_message(icall->rc_err));
-		}
+		if (icall->rc_err != NULL)
+			rpc_function_error_ex(icall, rpc_retain(icall->rc_err));
 
 		rpc_connection_close_inbound_call(icall);
 	}
@@ -404,7 +488,7 @@ int
 rpc_server_close(rpc_server_t server)
 {
 	struct rpc_connection *conn;
-	GList *iter = NULL;
+	GHashTableIter iter;
 	int ret = 0;
 	int deref;
 
@@ -428,26 +512,29 @@ rpc_server_close(rpc_server_t server)
 
 	/* Drop all connections */
 	g_rw_lock_reader_lock(&server->rs_connections_rwlock);
-	if (server->rs_connections != NULL) {
-		for (iter = server->rs_connections; iter != NULL; iter = iter->next) {
-			conn = iter->data;
-			deref = rpc_connection_close(conn);
-			server->rs_conn_aborted++;
-			/* Once the rs_closed flag has been set calls to
-			 * rpc_server_disconnect() will fail. Drop the server's
-			 * ref on the connection here.
-			 */
-			rpc_connection_release(conn);
-		}
+	g_hash_table_iter_init(&iter, server->rs_connections);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&conn, NULL)) {
+		deref = rpc_connection_close(conn);
+		server->rs_conn_aborted++;
+		/* Once the rs_closed flag has been set calls to
+		 * rpc_server_disconnect() will fail. Drop the server's
+		 * ref on the connection here.
+		 */
+		rpc_connection_release(conn);
 	}
 	g_rw_lock_reader_unlock(&server->rs_connections_rwlock);
+
+	g_rw_lock_writer_lock(&server->rs_connections_rwlock);
+	g_hash_table_remove_all(server->rs_connections);
+	rpc_server_invalidate_snapshot(server);
+	g_rw_lock_writer_unlock(&server->rs_connections_rwlock);
 	if (server->rs_threaded_teardown) {
 		if (server->rs_teardown_end != NULL && ret == 0)
 			server->rs_teardown_end(server);
 		rpc_server_cleanup(server);
 	}
 
-	g_list_free(server->rs_connections); /*abort cleanup frees connections*/
+	g_hash_table_unref(server->rs_connections); /*abort cleanup frees connections*/
         rpc_server_release(server);
 
 	return (ret);
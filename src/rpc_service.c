@@ -36,8 +36,69 @@
 #include <glib/gprintf.h>
 #include "internal.h"
 
+#define	MAX_EMITTERS	8
+#define	MAX_YIELD_BATCH	1024
+#define	DISPATCH_CACHE_SIZE	1024
+#define	DEFAULT_INLINE_BUDGET	1000
+#define	INLINE_SLOTS		64
+#define	MIN_WORKERS		8
+#define	WORKERS_PER_CPU		4
+#define	INSTANCES_BATCH		256
+
+struct rpc_dispatch_key
+{
+	rpc_context_t		rdk_context;
+	const char *		rdk_path;
+	const char *		rdk_interface;
+	const char *		rdk_method;
+};
+
+struct rpc_dispatch_entry
+{
+	struct rpc_dispatch_key	rde_key;
+	rpc_instance_t		rde_instance;
+	struct rpc_if_member *	rde_member;
+};
+
+struct rpc_property_batch;
+
+struct rpc_property_fetch
+{
+	struct rpc_property_batch *rpf_batch;
+	struct rpc_if_member *	rpf_member;
+	rpc_object_t		rpf_value;
+	volatile gint		rpf_claimed;
+};
+
+struct rpc_property_batch
+{
+	volatile gint		rpb_refcnt;
+	GMutex			rpb_mtx;
+	GCond			rpb_cv;
+	guint			rpb_pending;
+	rpc_instance_t		rpb_instance;
+	guint			rpb_count;
+	struct rpc_property_fetch rpb_fetches[];
+};
+
+struct rpc_inline_slot
+{
+	volatile gint		ris_busy;
+	volatile gsize		ris_start;
+	struct rpc_if_method *	ris_method;
+};
+
+struct rpc_dispatch_cache
+{
+	volatile gint		rdc_busy;
+	guint			rdc_generation;
+	GHashTable *		rdc_names;
+	GHashTable *		rdc_entries;
+};
+
 static bool rpc_context_path_is_valid(const char *);
 static rpc_object_t rpc_get_objects(void *, rpc_object_t);
+static rpc_object_t rpc_stream_objects(void *, rpc_object_t);
 static rpc_object_t rpc_get_interfaces(void *, rpc_object_t);
 static rpc_object_t rpc_get_methods(void *, rpc_object_t);
 static rpc_object_t rpc_get_events(void *, rpc_object_t);
@@ -48,11 +109,32 @@ static rpc_object_t rpc_observable_property_set(void *, rpc_object_t);
 void rpc_interface_free(struct rpc_interface_priv *);
 void rpc_if_member_free(struct rpc_if_member *);
 static gpointer emit_events(gpointer data);
+static void rpc_dispatch_cache_free(gpointer data);
+static inline void rpc_dispatch_invalidate(void);
+static gpointer emitter_worker(gpointer data);
+static gpointer notify_worker(gpointer data);
+static void rpc_property_state_unref(struct rpc_property_state *);
+static void rpc_property_emit(rpc_instance_t, const char *, const char *,
+    rpc_object_t);
+static void rpc_context_enqueue_event(rpc_context_t, rpc_connection_t,
+    struct rpc_emit_item *);
+static void rpc_inline_watchdog_arm(rpc_context_t);
+static gboolean rpc_inline_watchdog_fire(gpointer);
+static int rpc_function_refuse_inline(struct rpc_call *);
+
+/* Marks an inline slot whose method is being demoted by the watchdog */
+static struct rpc_if_method rpc_inline_demoting;
+static volatile guint rpc_dispatch_generation = 0;
+static GMutex rpc_dispatch_caches_mtx;
+static GList *rpc_dispatch_caches = NULL;
+static GPrivate rpc_dispatch_cache_key =
+    G_PRIVATE_INIT(rpc_dispatch_cache_free);
 
 static const struct rpc_if_member rpc_discoverable_vtable[] = {
 	RPC_EVENT(instance_added),
 	RPC_EVENT(instance_removed),
 	RPC_METHOD(get_instances, rpc_get_objects),
+	RPC_METHOD(stream_instances, rpc_stream_objects),
 	RPC_MEMBER_END
 };
 
@@ -74,14 +156,6 @@ static const struct rpc_if_member rpc_observable_vtable[] = {
 	RPC_MEMBER_END
 };
 
-struct emit_item {
-	rpc_context_t	context;
-	char *		path;
-	char *		interface;
-	char *		name;
-	rpc_object_t	args;
-};
-
 static void
 rpc_context_tp_handler(gpointer data, gpointer user_data)
 {
@@ -146,8 +220,9 @@ done:
 rpc_context_t
 rpc_context_create(void)
 {
-	GError *err;
 	rpc_context_t result;
+	struct rpc_emitter *emitter;
+	guint i;
 
 	rpct_init(true);
 
@@ -155,12 +230,30 @@ rpc_context_create(void)
 	result->rcx_root = rpc_instance_new(NULL, "/");
 	result->rcx_servers = g_ptr_array_new();
 	result->rcx_instances = g_hash_table_new(g_str_hash, g_str_equal);
-	result->rcx_threadpool = g_thread_pool_new(rpc_context_tp_handler,
-	    result, -1, false, &err);
+	result->rcx_instance_tree = rpc_trie_new(NULL);
+	result->rcx_scheduler = rpc_scheduler_new(MAX(MIN_WORKERS,
+	    WORKERS_PER_CPU * g_get_num_processors()));
 	result->rcx_emit_queue = g_async_queue_new();
 	result->rcx_emit_thread = g_thread_new("emitter", emit_events,
 	    result->rcx_emit_queue);
 	result->rcx_event_watchers = g_hash_table_new(NULL, NULL);
+	result->rcx_inline_budget = DEFAULT_INLINE_BUDGET;
+	result->rcx_inline_slots = g_new0(struct rpc_inline_slot,
+	    INLINE_SLOTS);
+	result->rcx_g_context = g_main_context_new();
+	result->rcx_g_loop = g_main_loop_new(result->rcx_g_context, false);
+	result->rcx_g_thread = g_thread_new("notifier", notify_worker,
+	    result->rcx_g_loop);
+	result->rcx_n_emitters = MIN(g_get_num_processors(), MAX_EMITTERS);
+	result->rcx_emitters = g_new0(struct rpc_emitter,
+	    result->rcx_n_emitters);
+
+	for (i = 0; i < result->rcx_n_emitters; i++) {
+		emitter = &result->rcx_emitters[i];
+		emitter->re_queue = g_async_queue_new();
+		emitter->re_thread = g_thread_new("emitter shard",
+		    emitter_worker, emitter);
+	}
 
 	rpc_instance_set_description(result->rcx_root, "Root object");
 	rpc_context_register_instance(result, result->rcx_root);
@@ -170,28 +263,224 @@ rpc_context_create(void)
 void
 rpc_context_free(rpc_context_t context)
 {
-	struct emit_item *item;
+	struct rpc_emit_item *item;
+	struct rpc_emitter *emitter;
+	guint i;
 
 	if (context == NULL)
 		return;
 
-	g_thread_pool_free(context->rcx_threadpool, true, true);
+	/* Running calls may still attach sources to the main loop */
+	rpc_scheduler_free(context->rcx_scheduler);
+
+	/* Pending coalesced notifications are dropped */
+	g_main_context_invoke(context->rcx_g_context,
+	    (GSourceFunc)rpc_kill_main_loop, context->rcx_g_loop);
+	g_thread_join(context->rcx_g_thread);
+	g_main_loop_unref(context->rcx_g_loop);
+	g_main_context_unref(context->rcx_g_context);
+
 	rpc_instance_free(context->rcx_root);
 
-	item = g_malloc(sizeof (*item));
-	item->context = NULL;
+	item = g_malloc0(sizeof (*item));
+	item->rei_context = NULL;
 	g_async_queue_push(context->rcx_emit_queue, item);
 	g_thread_join(context->rcx_emit_thread);
 	g_async_queue_unref(context->rcx_emit_queue);
+
+	for (i = 0; i < context->rcx_n_emitters; i++) {
+		/* The emitter itself is used as a termination marker */
+		emitter = &context->rcx_emitters[i];
+		g_async_queue_push(emitter->re_queue, emitter);
+		g_thread_join(emitter->re_thread);
+		g_async_queue_unref(emitter->re_queue);
+	}
+
+	g_free(context->rcx_emitters);
+	g_free(context->rcx_inline_slots);
 	g_hash_table_destroy(context->rcx_event_watchers);
+	rpc_trie_free(context->rcx_instance_tree);
 	g_free(context);
 }
 
+static gpointer
+notify_worker(gpointer data)
+{
+	GMainLoop *loop = data;
+
+	g_main_context_push_thread_default(g_main_loop_get_context(loop));
+	g_main_loop_run(loop);
+	return (NULL);
+}
+
+static void
+rpc_dispatch_cache_free(gpointer data)
+{
+	struct rpc_dispatch_cache *cache = data;
+
+	g_mutex_lock(&rpc_dispatch_caches_mtx);
+	rpc_dispatch_caches = g_list_remove(rpc_dispatch_caches, cache);
+	g_mutex_unlock(&rpc_dispatch_caches_mtx);
+
+	g_hash_table_destroy(cache->rdc_entries);
+	g_hash_table_destroy(cache->rdc_names);
+	g_free(cache);
+}
+
+/*
+ * Cache entries don't hold references. Instead, anything about to free
+ * an instance or a member bumps the generation first, then waits for
+ * every thread that might have read the old generation to leave its
+ * cache. Once this returns, no thread can pick up an entry pointing to
+ * the freed memory.
+ */
+static inline void
+rpc_dispatch_invalidate(void)
+{
+	struct rpc_dispatch_cache *cache;
+	GList *iter;
+
+	g_atomic_int_inc(&rpc_dispatch_generation);
+
+	g_mutex_lock(&rpc_dispatch_caches_mtx);
+	for (iter = rpc_dispatch_caches; iter != NULL; iter = iter->next) {
+		cache = iter->data;
+		while (g_atomic_int_get(&cache->rdc_busy))
+			g_thread_yield();
+	}
+
+	g_mutex_unlock(&rpc_dispatch_caches_mtx);
+}
+
+static guint
+rpc_dispatch_key_hash(gconstpointer data)
+{
+	const struct rpc_dispatch_key *key = data;
+
+	return (g_direct_hash(key->rdk_context) ^
+	    g_direct_hash(key->rdk_path) * 31 ^
+	    g_direct_hash(key->rdk_interface) * 961 ^
+	    g_direct_hash(key->rdk_method) * 29791);
+}
+
+static gboolean
+rpc_dispatch_key_equal(gconstpointer a, gconstpointer b)
+{
+
+	return (memcmp(a, b, sizeof(struct rpc_dispatch_key)) == 0);
+}
+
+/*
+ * Returns the cache of the calling thread, marked busy. Any
+ * (un)registration anywhere invalidates the whole cache.
+ */
+static struct rpc_dispatch_cache *
+rpc_dispatch_cache_enter(void)
+{
+	struct rpc_dispatch_cache *cache;
+	guint generation;
+
+	cache = g_private_get(&rpc_dispatch_cache_key);
+	if (cache == NULL) {
+		cache = g_malloc0(sizeof(*cache));
+		cache->rdc_names = g_hash_table_new_full(g_str_hash,
+		    g_str_equal, g_free, NULL);
+		cache->rdc_entries = g_hash_table_new_full(
+		    rpc_dispatch_key_hash, rpc_dispatch_key_equal, NULL,
+		    g_free);
+		g_private_set(&rpc_dispatch_cache_key, cache);
+
+		g_mutex_lock(&rpc_dispatch_caches_mtx);
+		rpc_dispatch_caches = g_list_prepend(rpc_dispatch_caches,
+		    cache);
+		g_mutex_unlock(&rpc_dispatch_caches_mtx);
+	}
+
+	/* Has to be visible before the generation is read */
+	g_atomic_int_set(&cache->rdc_busy, 1);
+	generation = g_atomic_int_get(&rpc_dispatch_generation);
+	if (cache->rdc_generation != generation ||
+	    g_hash_table_size(cache->rdc_entries) >= DISPATCH_CACHE_SIZE ||
+	    g_hash_table_size(cache->rdc_names) >= DISPATCH_CACHE_SIZE * 3) {
+		g_hash_table_remove_all(cache->rdc_entries);
+		g_hash_table_remove_all(cache->rdc_names);
+		cache->rdc_generation = generation;
+	}
+
+	return (cache);
+}
+
+static inline void
+rpc_dispatch_cache_leave(struct rpc_dispatch_cache *cache)
+{
+
+	g_atomic_int_set(&cache->rdc_busy, 0);
+}
+
+/*
+ * Returns the thread's own copy of @p name, so that keys can be compared
+ * by pointer.
+ */
+static const char *
+rpc_dispatch_intern(struct rpc_dispatch_cache *cache, const char *name)
+{
+	char *interned;
+
+	if (name == NULL)
+		return (NULL);
+
+	interned = g_hash_table_lookup(cache->rdc_names, name);
+	if (interned == NULL) {
+		interned = g_strdup(name);
+		g_hash_table_add(cache->rdc_names, interned);
+	}
+
+	return (interned);
+}
+
+static int
+rpc_context_admit(struct rpc_call *call, struct rpc_if_member *member)
+{
+	struct rpc_member_priv *priv = (struct rpc_member_priv *)member;
+	struct rpc_call_counter *counter = priv->rmp_active;
+	rpc_server_t server = call->rc_conn->rco_server;
+	gint limit;
+
+	limit = g_atomic_int_get(&priv->rmp_limit);
+	if (limit == 0)
+		return (0);
+
+	if (g_atomic_int_add(&counter->rcc_active, 1) >= limit) {
+		g_atomic_int_add(&counter->rcc_active, -1);
+		call->rc_err = rpc_error_create_busy(
+		    "Too many concurrent calls of this method",
+		    server != NULL
+		    ? server->rs_retry_after
+		    : RPC_DEFAULT_RETRY_AFTER);
+		return (-1);
+	}
+
+	/* The member may go away before the call ends */
+	g_atomic_int_inc(&counter->rcc_refcnt);
+	call->rc_active = counter;
+	return (0);
+}
+
+void
+rpc_call_counter_release(struct rpc_call_counter *counter)
+{
+
+	if (g_atomic_int_dec_and_test(&counter->rcc_refcnt))
+		g_free(counter);
+}
+
 int
 rpc_context_dispatch(rpc_context_t context, struct rpc_call *call)
 {
+	struct rpc_dispatch_cache *cache;
+	struct rpc_dispatch_entry *entry;
+	struct rpc_dispatch_key key;
 	struct rpc_if_member *member;
-	GError *err = NULL;
 	rpc_instance_t instance = NULL;
 
 	debugf("call=%p, name=%s", call, call->rc_method_name);
@@ -200,6 +489,25 @@ rpc_context_dispatch(rpc_context_t context, struct rpc_call *call)
 		debugf("Can't dispatch call, conn %p closed", call->rc_conn);
 		return (-1);
 	}
+
+	cache = rpc_dispatch_cache_enter();
+	key.rdk_context = context;
+	key.rdk_path = rpc_dispatch_intern(cache, call->rc_path);
+	key.rdk_interface = rpc_dispatch_intern(cache, call->rc_interface);
+	key.rdk_method = rpc_dispatch_intern(cache, call->rc_method_name);
+	entry = call->rc_method_name != NULL
+	    ? g_hash_table_lookup(cache->rdc_entries, &key)
+	    : NULL;
+
+	if (entry != NULL && !entry->rde_instance->ri_destroyed) {
+		call->rc_instance = rpc_instance_retain(entry->rde_instance);
+		member = entry->rde_member;
+		rpc_dispatch_cache_leave(cache);
+		goto submit;
+	}
+
+	rpc_dispatch_cache_leave(cache);
+
 	if (call->rc_path == NULL)
 		instance = context->rcx_root;
 
@@ -228,17 +536,200 @@ rpc_context_dispatch(rpc_context_t context, struct rpc_call *call)
 		return (-1);
 	}
 
-	call->rc_if_method = &member->rim_method;
-	g_thread_pool_push(context->rcx_threadpool, call, &err);
-	if (err != NULL) {
-		call->rc_err = rpc_error_create(EFAULT, "Cannot submit call",
-		    NULL);
+	/*
+	 * The cache was invalidated if anything changed since it was
+	 * entered, so this entry is dropped before it can be used.
+	 */
+	if (call->rc_method_name != NULL) {
+		entry = g_malloc(sizeof(*entry));
+		entry->rde_key = key;
+		entry->rde_instance = instance;
+		entry->rde_member = member;
+		g_hash_table_insert(cache->rdc_entries, &entry->rde_key,
+		    entry);
+	}
+
+submit:
+	if (rpc_context_admit(call, member) != 0)
 		return (-1);
+
+	call->rc_if_method = &member->rim_method;
+	call->rc_context = context;
+
+	/*
+	 * Inline calls are run by the caller once it drops its locks.
+	 * Calls to pinned instances have to wait for their worker.
+	 */
+	if ((g_atomic_int_get(&member->rim_method.rm_flags) &
+	    RPC_METHOD_INLINE) && !call->rc_instance->ri_affinity) {
+		call->rc_inline = true;
+		return (0);
 	}
 
+	return (rpc_context_submit(context, call));
+}
+
+int
+rpc_context_submit(rpc_context_t context, struct rpc_call *call)
+{
+	rpc_instance_t instance = call->rc_instance;
+	rpc_priority_t prio = RPC_PRIORITY_NORMAL;
+	gint affinity = -1;
+
+	call->rc_inline = false;
+
+	if (call->rc_if_method->rm_flags & RPC_METHOD_HIGH_PRIORITY)
+		prio = RPC_PRIORITY_HIGH;
+
+	if (instance != NULL && instance->ri_affinity)
+		affinity = (gint)(g_str_hash(instance->ri_path) & G_MAXINT);
+
+	rpc_scheduler_push(context->rcx_scheduler, rpc_context_tp_handler,
+	    call, context, prio, affinity);
 	return (0);
 }
 
+void
+rpc_context_run_inline(rpc_context_t context, struct rpc_call *call)
+{
+	struct rpc_if_method *method = call->rc_if_method;
+	struct rpc_inline_slot *slot = NULL;
+	uint64_t budget;
+	gint64 start;
+	gint64 elapsed;
+	guint first;
+	guint i;
+
+	/* Claim a watchdog slot, starting from one picked by the thread */
+	first = (guint)(GPOINTER_TO_SIZE(g_thread_self()) >> 6);
+	for (i = 0; i < INLINE_SLOTS; i++) {
+		slot = &context->rcx_inline_slots[(first + i) % INLINE_SLOTS];
+		if (g_atomic_int_compare_and_exchange(&slot->ris_busy, 0, 1))
+			break;
+
+		slot = NULL;
+	}
+
+	/* Too many inline calls running at once */
+	if (slot == NULL) {
+		rpc_context_submit(context, call);
+		return;
+	}
+
+	budget = context->rcx_inline_budget;
+	start = g_get_monotonic_time();
+	g_atomic_pointer_set(&slot->ris_start, (gsize)start);
+	g_atomic_pointer_set(&slot->ris_method, method);
+	rpc_inline_watchdog_arm(context);
+
+	rpc_context_tp_handler(call, context);
+	elapsed = g_get_monotonic_time() - start;
+
+	/* Wait for the watchdog if it's demoting the method right now */
+	while (!g_atomic_pointer_compare_and_exchange(&slot->ris_method,
+	    method, NULL))
+		;
+
+	g_atomic_int_set(&slot->ris_busy, 0);
+
+	if ((uint64_t)elapsed > budget) {
+		debugf("demoting inline method %p, took %" G_GINT64_FORMAT
+		    " us", method, elapsed);
+		g_atomic_int_and(&method->rm_flags, ~RPC_METHOD_INLINE);
+	}
+}
+
+/*
+ * Attaches the watchdog source unless it's attached already. The source
+ * stays attached for as long as it finds inline calls running.
+ */
+static void
+rpc_inline_watchdog_arm(rpc_context_t context)
+{
+	GSource *timer;
+	guint interval;
+
+	if (!g_atomic_int_compare_and_exchange(&context->rcx_inline_armed,
+	    0, 1))
+		return;
+
+	interval = (guint)MAX(1, (context->rcx_inline_budget + 999) / 1000);
+	timer = g_timeout_source_new(interval);
+	g_source_set_callback(timer, rpc_inline_watchdog_fire, context, NULL);
+	g_source_attach(timer, context->rcx_g_context);
+	g_source_unref(timer);
+}
+
+static gboolean
+rpc_inline_watchdog_fire(gpointer user_data)
+{
+	rpc_context_t context = user_data;
+	struct rpc_inline_slot *slot;
+	struct rpc_if_method *method;
+	gsize now;
+	gsize start;
+	bool busy = false;
+	guint i;
+
+	for (i = 0; i < INLINE_SLOTS; i++) {
+		slot = &context->rcx_inline_slots[i];
+		method = g_atomic_pointer_get(&slot->ris_method);
+		if (method == NULL)
+			continue;
+
+		busy = true;
+		start = g_atomic_pointer_get(&slot->ris_start);
+		now = (gsize)g_get_monotonic_time();
+		if (now - start <= context->rcx_inline_budget)
+			continue;
+
+		/* Keeps the call, and so the method, from going away */
+		if (!g_atomic_pointer_compare_and_exchange(&slot->ris_method,
+		    method, &rpc_inline_demoting))
+			continue;
+
+		if (g_atomic_int_get(&method->rm_flags) & RPC_METHOD_INLINE) {
+			debugf("demoting inline method %p, still running",
+			    method);
+			g_atomic_int_and(&method->rm_flags,
+			    ~RPC_METHOD_INLINE);
+		}
+
+		g_atomic_pointer_set(&slot->ris_method, method);
+	}
+
+	if (busy)
+		return (G_SOURCE_CONTINUE);
+
+	/* A call may have claimed a slot after it was scanned */
+	g_atomic_int_set(&context->rcx_inline_armed, 0);
+	for (i = 0; i < INLINE_SLOTS; i++) {
+		if (g_atomic_pointer_get(
+		    &context->rcx_inline_slots[i].ris_method) != NULL)
+			busy = true;
+	}
+
+	if (busy && g_atomic_int_compare_and_exchange(
+	    &context->rcx_inline_armed, 0, 1))
+		return (G_SOURCE_CONTINUE);
+
+	return (G_SOURCE_REMOVE);
+}
+
+void
+rpc_context_set_inline_budget(rpc_context_t context, uint64_t usec)
+{
+
+	context->rcx_inline_budget = usec;
+}
+
+void
+rpc_context_get_stats(rpc_context_t context, struct rpc_context_stats *stats)
+{
+
+	rpc_scheduler_get_stats(context->rcx_scheduler, stats);
+}
+
 rpc_instance_t
 rpc_context_find_instance(rpc_context_t context, const char *path)
 {
@@ -296,6 +787,7 @@ rpc_instance_register_property(rpc_instance_t instance, const char *interface,
 	member.rim_property.rp_getter = getter;
 	member.rim_property.rp_setter = setter;
 	member.rim_property.rp_arg = arg;
+	member.rim_property.rp_flags = 0;
 
 	return (rpc_instance_register_member(instance, interface, &member));
 }
@@ -331,6 +823,8 @@ rpc_context_register_instance(rpc_context_t context, rpc_instance_t instance)
 	instance->ri_context = context;
 
 	g_hash_table_insert(context->rcx_instances, instance->ri_path, instance);
+	rpc_trie_insert(context->rcx_instance_tree, instance->ri_path, instance);
+	rpc_dispatch_invalidate();
 	g_rw_lock_writer_unlock(&context->rcx_rwlock);
 	return (0);
 }
@@ -342,9 +836,11 @@ rpc_context_unregister_instance(rpc_context_t context, const char *path)
 	g_rw_lock_writer_lock(&context->rcx_rwlock);
 
 	if (g_hash_table_remove(context->rcx_instances, path)) {
+		rpc_trie_steal(context->rcx_instance_tree, path);
 		rpc_context_emit_event(context, "/",
 		    RPC_DISCOVERABLE_INTERFACE, "instance_removed",
 		    rpc_string_create(path));
+		rpc_dispatch_invalidate();
 	}
 
 	g_rw_lock_writer_unlock(&context->rcx_rwlock);
@@ -387,10 +883,188 @@ rpc_context_unregister_member(rpc_context_t context, const char *interface,
 	    name));
 }
 
+void
+rpc_emit_item_release(struct rpc_emit_item *item)
+{
+
+	if (!g_atomic_int_dec_and_test(&item->rei_refcnt))
+		return;
+
+	rpc_release(item->rei_args);
+	g_free(item->rei_path);
+	g_free(item->rei_interface);
+	g_free(item->rei_name);
+	g_free(item);
+}
+
+static bool
+rpc_emit_item_same_kind(struct rpc_emit_item *a, struct rpc_emit_item *b)
+{
+
+	return (g_strcmp0(a->rei_path, b->rei_path) == 0 &&
+	    g_strcmp0(a->rei_interface, b->rei_interface) == 0 &&
+	    g_strcmp0(a->rei_name, b->rei_name) == 0);
+}
+
+static void
+rpc_context_enqueue_event(rpc_context_t context, rpc_connection_t conn,
+    struct rpc_emit_item *item)
+{
+	struct rpc_emitter *emitter;
+	struct rpc_emit_item *old;
+	GList *iter;
+	gsize limit;
+	bool schedule = false;
+	bool wake = false;
+
+	if (rpc_connection_retain_if_valid(conn, true) != 0)
+		return;
+
+	/*
+	 * Events the connection didn't subscribe to must neither count
+	 * against its queue limit nor push subscribed events out of it.
+	 */
+	if (!rpc_connection_is_subscribed(conn, item->rei_path,
+	    item->rei_interface, item->rei_name)) {
+		rpc_connection_release(conn);
+		return;
+	}
+
+	limit = (gsize)g_atomic_pointer_get(&context->rcx_event_queue_limit);
+
+	g_mutex_lock(&conn->rco_event_mtx);
+	if (conn->rco_event_overflow)
+		goto done;
+
+	if (limit > 0 && g_queue_get_length(conn->rco_event_queue) >= limit) {
+		switch (g_atomic_int_get(&context->rcx_event_overflow_policy)) {
+		case RPC_EVENT_COALESCE:
+			/*
+			 * Replace the most recent event of the same kind, so
+			 * that no older one gets delivered after it.
+			 */
+			for (iter = g_queue_peek_tail_link(conn->rco_event_queue);
+			    iter != NULL; iter = iter->prev) {
+				old = iter->data;
+				if (!rpc_emit_item_same_kind(old, item))
+					continue;
+
+				g_atomic_int_inc(&item->rei_refcnt);
+				iter->data = item;
+				rpc_emit_item_release(old);
+				goto done;
+			}
+
+			/* FALLTHROUGH */
+
+		case RPC_EVENT_DROP_OLDEST:
+			rpc_emit_item_release(
+			    g_queue_pop_head(conn->rco_event_queue));
+			break;
+
+		case RPC_EVENT_DISCONNECT:
+			/*
+			 * The emitter will close the connection, even if
+			 * it is waiting for the send queue to drain.
+			 */
+			conn->rco_event_overflow = true;
+			wake = conn->rco_event_scheduled;
+			goto schedule;
+		}
+	}
+
+	g_atomic_int_inc(&item->rei_refcnt);
+	g_queue_push_tail(conn->rco_event_queue, item);
+
+schedule:
+	if (!conn->rco_event_scheduled) {
+		conn->rco_event_scheduled = true;
+		schedule = true;
+	}
+
+done:
+	g_mutex_unlock(&conn->rco_event_mtx);
+
+	if (wake)
+		rpc_connection_wake_emitter(conn);
+
+	if (!schedule) {
+		rpc_connection_release(conn);
+		return;
+	}
+
+	/* Connection reference is passed to the emitter */
+	emitter = &context->rcx_emitters[g_direct_hash(conn) %
+	    context->rcx_n_emitters];
+	g_async_queue_push(emitter->re_queue, conn);
+}
+
+static gpointer
+emitter_worker(gpointer data)
+{
+	struct rpc_emitter *emitter = data;
+	struct rpc_emit_item *item;
+	rpc_connection_t conn;
+	bool overflow;
+	int ret;
+
+	for (;;) {
+		conn = g_async_queue_pop(emitter->re_queue);
+		if (conn == data)
+			break;
+
+		ret = 0;
+		for (;;) {
+			g_mutex_lock(&conn->rco_event_mtx);
+			overflow = conn->rco_event_overflow;
+			item = overflow ? NULL :
+			    g_queue_pop_head(conn->rco_event_queue);
+
+			if (item == NULL) {
+				conn->rco_event_scheduled = false;
+				g_mutex_unlock(&conn->rco_event_mtx);
+				break;
+			}
+
+			g_mutex_unlock(&conn->rco_event_mtx);
+			ret = rpc_connection_queue_event(conn, emitter,
+			    item->rei_path, item->rei_interface, item->rei_name,
+			    item->rei_args);
+
+			if (ret == 1) {
+				/*
+				 * The send queue is full. Keep the event, the
+				 * connection stays scheduled and gets back to
+				 * this shard once the queue drains.
+				 */
+				g_mutex_lock(&conn->rco_event_mtx);
+				g_queue_push_head(conn->rco_event_queue, item);
+				g_mutex_unlock(&conn->rco_event_mtx);
+				break;
+			}
+
+			rpc_emit_item_release(item);
+		}
+
+		/* Connection reference is now held by its send queue */
+		if (ret == 1)
+			continue;
+
+		if (overflow) {
+			debugf("Closing slow event consumer %p", conn);
+			rpc_connection_close(conn);
+		}
+
+		rpc_connection_release(conn);
+	}
+
+	return (NULL);
+}
+
 static gpointer
 emit_events(gpointer data)
 {
-	struct emit_item *item;
+	struct rpc_emit_item *item;
 	GAsyncQueue *q = data;
 	rpc_connection_t conn;
 	rpc_context_t context;
@@ -398,23 +1072,21 @@ emit_events(gpointer data)
 
 	for (;;) {
 		item = g_async_queue_pop(q);
-		if (item->context == NULL)
+		if (item->rei_context == NULL) {
+			g_free(item);
 			break;
-		context = item->context;
+		}
 
+		context = item->rei_context;
+
+		/* Fan out to per-connection queues; never blocks on I/O */
 		g_rw_lock_reader_lock(&context->rcx_rwlock);
 		g_hash_table_iter_init(&iter, context->rcx_event_watchers);
-		while (g_hash_table_iter_next(&iter, (gpointer)&conn, NULL)) {
-			rpc_connection_send_event(conn, item->path,
-			    item->interface, item->name, item->args);
-		}
+		while (g_hash_table_iter_next(&iter, (gpointer)&conn, NULL))
+			rpc_context_enqueue_event(context, conn, item);
 
 		g_rw_lock_reader_unlock(&context->rcx_rwlock);
-		rpc_release(item->args);
-		g_free(item->path);
-		g_free(item->interface);
-		g_free(item->name);
-		g_free(item);
+		rpc_emit_item_release(item);
 	}
 	return (NULL);
 }
@@ -423,17 +1095,27 @@ void
 rpc_context_emit_event(rpc_context_t context, const char *path,
     const char *interface, const char *name, rpc_object_t args)
 {
-	struct emit_item *item = g_malloc(sizeof (*item));
+	struct rpc_emit_item *item = g_malloc(sizeof (*item));
 
-	item->context = context;
-	item->path = g_strdup(path);
-	item->interface = g_strdup(interface);
-	item->name = g_strdup(name);
-	item->args = args;
+	item->rei_context = context;
+	item->rei_path = g_strdup(path);
+	item->rei_interface = g_strdup(interface);
+	item->rei_name = g_strdup(name);
+	item->rei_args = args;
+	item->rei_refcnt = 1;
 
 	g_async_queue_push(context->rcx_emit_queue, item);
 }
 
+void
+rpc_context_set_event_queue_limit(rpc_context_t context, size_t limit,
+    rpc_event_overflow_policy_t policy)
+{
+
+	g_atomic_int_set(&context->rcx_event_overflow_policy, (gint)policy);
+	g_atomic_pointer_set(&context->rcx_event_queue_limit, limit);
+}
+
 inline void *
 rpc_function_get_arg(void *cookie)
 {
@@ -551,6 +1233,24 @@ rpc_function_error_ex_impl(void *cookie, rpc_object_t exception)
 	call->rc_responded = true;
 }
 
+/*
+ * Streaming calls wait for credit from the consumer, which would
+ * deadlock the reader thread an inline call runs on. The call fails
+ * instead and its method goes to the worker pool from then on.
+ */
+static int
+rpc_function_refuse_inline(struct rpc_call *call)
+{
+
+	g_atomic_int_and(&call->rc_if_method->rm_flags, ~RPC_METHOD_INLINE);
+	if (!call->rc_responded)
+		rpc_function_error(call, EINVAL,
+		    "Inline methods can't stream");
+
+	rpc_set_last_errorf(EINVAL, "Inline methods can't stream");
+	return (-1);
+}
+
 int
 rpc_function_start_stream(void *cookie)
 {
@@ -565,6 +1265,12 @@ rpc_function_start_stream_impl(void *cookie)
 	struct rpc_call *call = cookie;
 	struct rpc_context *context = call->rc_context;
 
+	if (call->rc_inline)
+		return (rpc_function_refuse_inline(call));
+
+	/* Producers may wait for credit indefinitely */
+	rpc_scheduler_detach(context->rcx_scheduler);
+
 	g_mutex_lock(&call->rc_mtx);
 
 	while (call->rc_producer_seqno == call->rc_consumer_seqno &&
@@ -610,6 +1316,11 @@ rpc_function_yield_impl(void *cookie, rpc_object_t fragment)
 	struct rpc_call *call = cookie;
 	struct rpc_context *context = call->rc_context;
 
+	if (call->rc_inline) {
+		rpc_release(fragment);
+		return (rpc_function_refuse_inline(call));
+	}
+
 	g_mutex_lock(&call->rc_mtx);
 
 	while (call->rc_producer_seqno == call->rc_consumer_seqno &&
@@ -642,6 +1353,82 @@ rpc_function_yield_impl(void *cookie, rpc_object_t fragment)
 	return (0);
 }
 
+int
+rpc_function_yield_many(void *cookie, rpc_object_t fragments)
+{
+	struct rpc_call *call = cookie;
+
+	return (call->rc_conn->rco_fn_cbs.rcf_fn_yield_many(cookie,
+	    fragments));
+}
+
+int
+rpc_function_yield_many_impl(void *cookie, rpc_object_t fragments)
+{
+	struct rpc_call *call = cookie;
+	rpc_object_t chunk;
+	size_t count;
+	size_t done = 0;
+	size_t credit;
+	size_t i;
+
+	if (rpc_get_type(fragments) != RPC_TYPE_ARRAY) {
+		rpc_set_last_errorf(EINVAL, "Fragments must be an array");
+		rpc_release(fragments);
+		return (-1);
+	}
+
+	if (call->rc_inline) {
+		rpc_release(fragments);
+		return (rpc_function_refuse_inline(call));
+	}
+
+	count = rpc_array_get_count(fragments);
+	g_mutex_lock(&call->rc_mtx);
+
+	while (done < count) {
+		while (call->rc_producer_seqno == call->rc_consumer_seqno &&
+		    !call->rc_aborted) {
+			g_mutex_unlock(&call->rc_mtx);
+			notify_wait(&call->rc_notify);
+			g_mutex_lock(&call->rc_mtx);
+		}
+
+		if (call->rc_aborted) {
+			if (!call->rc_ended) {
+				rpc_function_error(call, ECONNRESET,
+				    "Call aborted");
+				call->rc_ended = true;
+			}
+
+			g_mutex_unlock(&call->rc_mtx);
+			rpc_release(fragments);
+			return (-1);
+		}
+
+		/* Send as many fragments as the consumer has credit for */
+		credit = (size_t)(call->rc_consumer_seqno -
+		    call->rc_producer_seqno);
+		credit = MIN(credit, MIN(count - done, MAX_YIELD_BATCH));
+		chunk = rpc_array_create();
+		for (i = 0; i < credit; i++) {
+			rpc_array_append_value(chunk,
+			    rpc_array_get_value(fragments, done + i));
+		}
+
+		rpc_connection_send_fragments(call->rc_conn, call->rc_id,
+		    call->rc_producer_seqno, chunk);
+
+		call->rc_producer_seqno += credit;
+		call->rc_streaming = true;
+		done += credit;
+	}
+
+	g_mutex_unlock(&call->rc_mtx);
+	rpc_release(fragments);
+	return (0);
+}
+
 int
 rpc_function_retain(void *cookie)
 {
@@ -671,6 +1458,13 @@ rpc_function_end_impl(void *cookie)
 {
 	struct rpc_call *call = cookie;
 
+	if (call->rc_inline) {
+		rpc_function_refuse_inline(call);
+		call->rc_ended = true;
+		rpc_connection_close_inbound_call(call);
+		return;
+	}
+
 	g_mutex_lock(&call->rc_mtx);
 
 	while (call->rc_producer_seqno == call->rc_consumer_seqno &&
@@ -810,6 +1604,30 @@ rpc_instance_set_description(rpc_instance_t instance, const char *fmt, ...)
 	instance->ri_descr = description;
 }
 
+void
+rpc_instance_set_affinity(rpc_instance_t instance, bool affinity)
+{
+
+	instance->ri_affinity = affinity;
+}
+
+int
+rpc_instance_set_method_limit(rpc_instance_t instance, const char *interface,
+    const char *name, size_t max)
+{
+	struct rpc_member_priv *priv;
+
+	priv = (struct rpc_member_priv *)rpc_instance_find_member(instance,
+	    interface, name);
+	if (priv == NULL || priv->rmp_member.rim_type != RPC_MEMBER_METHOD) {
+		rpc_set_last_error(ENOENT, "Method not found", NULL);
+		return (-1);
+	}
+
+	g_atomic_int_set(&priv->rmp_limit, (gint)MIN(max, G_MAXINT));
+	return (0);
+}
+
 void *
 rpc_instance_get_arg(rpc_instance_t instance)
 {
@@ -836,6 +1654,12 @@ rpc_instance_free(rpc_instance_t instance)
 
 	g_mutex_lock(&instance->ri_mtx);
 	instance->ri_destroyed = true;
+	g_mutex_unlock(&instance->ri_mtx);
+
+	/* Cache hits retain the instance, so invalidate without ri_mtx */
+	rpc_dispatch_invalidate();
+
+	g_mutex_lock(&instance->ri_mtx);
 	while (instance->ri_refcnt > 0)
 		g_cond_wait(&instance->ri_cv, &instance->ri_mtx);
 
@@ -909,6 +1733,7 @@ rpc_instance_register_interface(rpc_instance_t instance,
 	g_rw_lock_writer_lock(&instance->ri_rwlock);
 	g_hash_table_insert(instance->ri_interfaces, g_strdup(priv->rip_name),
 	    priv);
+	rpc_dispatch_invalidate();
 	g_rw_lock_writer_unlock(&instance->ri_rwlock);
 
 	if (vtable != NULL) {
@@ -928,6 +1753,7 @@ rpc_instance_unregister_interface(rpc_instance_t instance,
     const char *interface)
 {
 	g_rw_lock_writer_lock(&instance->ri_rwlock);
+	rpc_dispatch_invalidate();
 	g_hash_table_remove(instance->ri_interfaces, interface);
 	g_rw_lock_writer_unlock(&instance->ri_rwlock);
 
@@ -945,13 +1771,32 @@ rpc_interface_free(struct rpc_interface_priv *priv)
 	g_free(priv);
 }
 
+static void
+rpc_property_state_unref(struct rpc_property_state *state)
+{
+
+	if (!g_atomic_int_dec_and_test(&state->rps_refcnt))
+		return;
+
+	rpc_release(state->rps_value);
+	rpc_release(state->rps_pending);
+	g_mutex_clear(&state->rps_mtx);
+	g_free(state->rps_interface);
+	g_free(state->rps_name);
+	g_free(state);
+}
+
 void
 rpc_if_member_free(struct rpc_if_member *member)
 {
+	struct rpc_property_state *state;
 
 	if (member->rim_type == RPC_MEMBER_METHOD) {
 		if (member->rim_method.rm_block != NULL)
 			Block_release(member->rim_method.rm_block);
+
+		rpc_call_counter_release(
+		    ((struct rpc_member_priv *)member)->rmp_active);
 	}
 
 	if (member->rim_type == RPC_MEMBER_PROPERTY) {
@@ -960,6 +1805,13 @@ rpc_if_member_free(struct rpc_if_member *member)
 
 		if (member->rim_property.rp_setter != NULL)
 			Block_release(member->rim_property.rp_setter);
+
+		/* A pending flush may still hold a reference */
+		state = ((struct rpc_member_priv *)member)->rmp_prop;
+		g_mutex_lock(&state->rps_mtx);
+		state->rps_dead = true;
+		g_mutex_unlock(&state->rps_mtx);
+		rpc_property_state_unref(state);
 	}
 
 	g_free((void *)member->rim_name);
@@ -970,6 +1822,7 @@ int rpc_instance_register_member(rpc_instance_t instance, const char *interface,
     const struct rpc_if_member *member)
 {
 	struct rpc_interface_priv *priv;
+	struct rpc_member_priv *mpriv;
 	struct rpc_if_member *copy;
 
 	if (interface == NULL)
@@ -981,7 +1834,9 @@ int rpc_instance_register_member(rpc_instance_t instance, const char *interface,
 		return (-1);
 	}
 
-	copy = g_memdup(member, sizeof(*member));
+	mpriv = g_malloc0(sizeof(*mpriv));
+	mpriv->rmp_member = *member;
+	copy = &mpriv->rmp_member;
 	copy->rim_name = g_strdup(member->rim_name);
 
 	if (copy->rim_type == RPC_MEMBER_METHOD) {
@@ -990,6 +1845,9 @@ int rpc_instance_register_member(rpc_instance_t instance, const char *interface,
 
 		if (copy->rim_method.rm_arg == NULL)
 			copy->rim_method.rm_arg = priv->rip_arg;
+
+		mpriv->rmp_active = g_malloc0(sizeof(*mpriv->rmp_active));
+		mpriv->rmp_active->rcc_refcnt = 1;
 	}
 
 	if (copy->rim_type == RPC_MEMBER_PROPERTY) {
@@ -1006,10 +1864,17 @@ int rpc_instance_register_member(rpc_instance_t instance, const char *interface,
 		if (copy->rim_property.rp_arg == NULL)
 			copy->rim_property.rp_arg = priv->rip_arg;
 
+		mpriv->rmp_prop = g_malloc0(sizeof(*mpriv->rmp_prop));
+		mpriv->rmp_prop->rps_refcnt = 1;
+		mpriv->rmp_prop->rps_instance = instance;
+		mpriv->rmp_prop->rps_interface = g_strdup(interface);
+		mpriv->rmp_prop->rps_name = g_strdup(member->rim_name);
+		g_mutex_init(&mpriv->rmp_prop->rps_mtx);
 	}
 
 	g_rw_lock_writer_lock(&priv->rip_rwlock);
 	g_hash_table_insert(priv->rip_members, g_strdup(member->rim_name), copy);
+	rpc_dispatch_invalidate();
 	g_rw_lock_writer_unlock(&priv->rip_rwlock);
 	return (0);
 }
@@ -1024,6 +1889,7 @@ rpc_instance_register_block(rpc_instance_t instance, const char *interface,
 	member.rim_type = RPC_MEMBER_METHOD;
 	member.rim_method.rm_block = func;
 	member.rim_method.rm_arg = arg;
+	member.rim_method.rm_flags = 0;
 
 	return (rpc_instance_register_member(instance, interface, &member));
 }
@@ -1062,6 +1928,8 @@ rpc_instance_unregister_member(rpc_instance_t instance, const char *interface,
 		return (-1);
 	}
 
+	/* Invalidate cached dispatches before the member is freed */
+	rpc_dispatch_invalidate();
 	g_hash_table_remove(priv->rip_members, name);
 	g_rw_lock_writer_unlock(&priv->rip_rwlock);
 
@@ -1106,13 +1974,136 @@ rpc_instance_get_property_rights(rpc_instance_t instance, const char *interface,
 	return (rights);
 }
 
+/*
+ * Sends the "changed" event. Consumes @p value.
+ */
+static void
+rpc_property_emit(rpc_instance_t instance, const char *interface,
+    const char *name, rpc_object_t value)
+{
+	rpc_object_t payload;
+
+	payload = rpc_dictionary_create();
+	rpc_dictionary_set_string(payload, "interface", interface);
+	rpc_dictionary_set_string(payload, "name", name);
+	rpc_dictionary_steal_value(payload, "value", value);
+	rpc_instance_emit_event(instance, RPC_OBSERVABLE_INTERFACE, "changed",
+	    payload);
+}
+
+static gboolean
+rpc_property_flush(gpointer data)
+{
+	struct rpc_property_state *state = data;
+	rpc_object_t value;
+
+	g_mutex_lock(&state->rps_mtx);
+	value = state->rps_pending;
+	state->rps_pending = NULL;
+	state->rps_timer = NULL;
+	state->rps_last_emit = g_get_monotonic_time();
+
+	/* Emitting under the lock keeps rpc_if_member_free() out */
+	if (!state->rps_dead && value != NULL) {
+		rpc_property_emit(state->rps_instance, state->rps_interface,
+		    state->rps_name, value);
+	} else
+		rpc_release(value);
+
+	g_mutex_unlock(&state->rps_mtx);
+	return (G_SOURCE_REMOVE);
+}
+
+static void
+rpc_property_flush_done(gpointer data)
+{
+	struct rpc_property_state *state = data;
+
+	rpc_instance_release(state->rps_instance);
+	rpc_property_state_unref(state);
+}
+
+/*
+ * Arms the flush timer. Must be called with rps_mtx held.
+ */
+static bool
+rpc_property_schedule_flush(struct rpc_property_state *state, gint64 delay)
+{
+	rpc_instance_t instance = state->rps_instance;
+	rpc_context_t context;
+
+	g_mutex_lock(&instance->ri_mtx);
+	context = instance->ri_context;
+	g_mutex_unlock(&instance->ri_mtx);
+
+	if (context == NULL)
+		return (false);
+
+	/* Released in rpc_property_flush_done() */
+	g_atomic_int_inc(&state->rps_refcnt);
+	rpc_instance_retain(instance);
+
+	state->rps_timer = g_timeout_source_new(
+	    (guint)((MAX(delay, 0) + 999) / 1000));
+	g_source_set_callback(state->rps_timer, rpc_property_flush, state,
+	    rpc_property_flush_done);
+	g_source_attach(state->rps_timer, context->rcx_g_context);
+	g_source_unref(state->rps_timer);
+	return (true);
+}
+
+/*
+ * Returns the cached value, if any. Otherwise stores the sequence number
+ * of the cache in @p seq, to be passed to rpc_property_set_cached() with
+ * the value the getter returns.
+ */
+static rpc_object_t
+rpc_property_get_cached(struct rpc_if_member *member, guint *seq)
+{
+	struct rpc_property_state *state;
+	rpc_object_t result = NULL;
+
+	state = ((struct rpc_member_priv *)member)->rmp_prop;
+	g_mutex_lock(&state->rps_mtx);
+	if (state->rps_cacheable && state->rps_value != NULL)
+		result = rpc_retain(state->rps_value);
+
+	*seq = state->rps_seq;
+	g_mutex_unlock(&state->rps_mtx);
+	return (result);
+}
+
+/*
+ * Caches a value returned by the getter. The getter runs without
+ * rps_mtx, so if the value changed in the meantime, what it returned
+ * may already be stale and is not stored.
+ */
+static void
+rpc_property_set_cached(struct rpc_if_member *member, rpc_object_t value,
+    guint seq)
+{
+	struct rpc_property_state *state;
+
+	state = ((struct rpc_member_priv *)member)->rmp_prop;
+	g_mutex_lock(&state->rps_mtx);
+	if (state->rps_cacheable && value != NULL && state->rps_seq == seq) {
+		rpc_release(state->rps_value);
+		state->rps_value = rpc_retain(value);
+		state->rps_seq++;
+	}
+
+	g_mutex_unlock(&state->rps_mtx);
+}
+
 void
 rpc_instance_property_changed(rpc_instance_t instance, const char *interface,
     const char *name, rpc_object_t value)
 {
 	struct rpc_if_member *prop;
+	struct rpc_property_state *state;
 	struct rpc_property_cookie cookie;
-	bool release = false;
+	gint64 now;
+	gint64 delay;
 
 	prop = rpc_instance_find_member(instance, interface, name);
 	g_assert(prop != NULL);
@@ -1127,18 +2118,71 @@ rpc_instance_property_changed(rpc_instance_t instance, const char *interface,
 
 		if (cookie.error != NULL)
 			return;
+	} else
+		rpc_retain(value);
+
+	state = ((struct rpc_member_priv *)prop)->rmp_prop;
+	g_mutex_lock(&state->rps_mtx);
 
-		release = true;
+	if (state->rps_cacheable) {
+		rpc_release(state->rps_value);
+		state->rps_value = rpc_retain(value);
 	}
 
-	rpc_instance_emit_event(instance, RPC_OBSERVABLE_INTERFACE, "changed",
-	    rpc_object_pack("{s,s,v}",
-		"interface", interface,
-		"name", name,
-		"value", rpc_retain(value)));
+	state->rps_seq++;
 
-	if (release)
-		rpc_release(value);
+	if (state->rps_interval > 0) {
+		now = g_get_monotonic_time();
+		delay = state->rps_last_emit + state->rps_interval - now;
+
+		if (state->rps_timer != NULL) {
+			/* Last value wins */
+			rpc_release(state->rps_pending);
+			state->rps_pending = value;
+			g_mutex_unlock(&state->rps_mtx);
+			return;
+		}
+
+		if (delay > 0 && rpc_property_schedule_flush(state, delay)) {
+			rpc_release(state->rps_pending);
+			state->rps_pending = value;
+			g_mutex_unlock(&state->rps_mtx);
+			return;
+		}
+
+		state->rps_last_emit = now;
+	}
+
+	g_mutex_unlock(&state->rps_mtx);
+	rpc_property_emit(instance, interface, name, value);
+}
+
+int
+rpc_instance_set_property_policy(rpc_instance_t instance,
+    const char *interface, const char *name, bool cacheable,
+    uint32_t min_interval)
+{
+	struct rpc_if_member *prop;
+	struct rpc_property_state *state;
+
+	prop = rpc_instance_find_member(instance, interface, name);
+	if (prop == NULL || prop->rim_type != RPC_MEMBER_PROPERTY) {
+		rpc_set_last_error(ENOENT, "Property not found", NULL);
+		return (-1);
+	}
+
+	state = ((struct rpc_member_priv *)prop)->rmp_prop;
+	g_mutex_lock(&state->rps_mtx);
+	state->rps_cacheable = cacheable;
+	state->rps_interval = (gint64)min_interval * 1000;
+
+	if (!cacheable)
+		g_clear_pointer(&state->rps_value, rpc_release);
+
+	state->rps_seq++;
+
+	g_mutex_unlock(&state->rps_mtx);
+	return (0);
 }
 
 rpc_instance_t
@@ -1181,39 +2225,82 @@ rpc_property_error(void *cookie, int code, const char *fmt, ...)
 
 }
 
-static rpc_object_t
-rpc_get_objects(void *cookie, rpc_object_t args __unused)
+/*
+ * Collects descriptors of instances below the instance the call was made
+ * on into arrays of at most @p batch elements each. When called on the
+ * root instance, the root itself is included as well.
+ */
+static GPtrArray *
+rpc_collect_objects(void *cookie, size_t batch)
 {
 	rpc_context_t context = rpc_function_get_context(cookie);
-	GHashTableIter iter;
-	const char *k;
-	char *prefix = NULL;
-	rpc_instance_t instance;
-	rpc_instance_t v;
-	rpc_object_t list;
-
-	instance = rpc_function_get_instance(cookie);
-	list = rpc_array_create();
+	rpc_instance_t instance = rpc_function_get_instance(cookie);
+	GPtrArray *result;
+	const char *path;
+	__block rpc_object_t chunk = NULL;
 
-	if (strlen(rpc_instance_get_path(instance)) > 1)
-		prefix = g_strdup_printf("%s/", rpc_instance_get_path(instance));
+	result = g_ptr_array_new_with_free_func((GDestroyNotify)rpc_release);
+	path = rpc_instance_get_path(instance);
 
 	g_rw_lock_reader_lock(&context->rcx_rwlock);
-	g_hash_table_iter_init(&iter, context->rcx_instances);
+	rpc_trie_apply_subtree(context->rcx_instance_tree, path,
+	    strlen(path) == 1, ^(const char *key __unused, void *value) {
+		rpc_instance_t v = value;
 
-	while (g_hash_table_iter_next(&iter, (gpointer)&k, (gpointer)&v)) {
-		if (prefix != NULL && !g_str_has_prefix(v->ri_path, prefix))
-			continue;
-		rpc_array_append_stolen_value(list, rpc_object_pack("{s,s}",
+		if (chunk == NULL || rpc_array_get_count(chunk) == batch) {
+			chunk = rpc_array_create();
+			g_ptr_array_add(result, chunk);
+		}
+
+		rpc_array_append_stolen_value(chunk, rpc_object_pack("{s,s}",
 		    "path", v->ri_path,
 		    "description", v->ri_descr));
-	}
+		return ((bool)true);
+	});
 
 	g_rw_lock_reader_unlock(&context->rcx_rwlock);
-	g_free(prefix);
+	return (result);
+}
+
+static rpc_object_t
+rpc_get_objects(void *cookie, rpc_object_t args __unused)
+{
+	GPtrArray *chunks;
+	rpc_object_t list;
+
+	chunks = rpc_collect_objects(cookie, G_MAXSIZE);
+	list = chunks->len > 0
+	    ? rpc_retain(g_ptr_array_index(chunks, 0))
+	    : rpc_array_create();
+
+	g_ptr_array_free(chunks, true);
 	return (list);
 }
 
+static rpc_object_t
+rpc_stream_objects(void *cookie, rpc_object_t args __unused)
+{
+	GPtrArray *chunks;
+	guint i;
+
+	/* Descriptors are gathered first so no lock is held while yielding */
+	chunks = rpc_collect_objects(cookie, INSTANCES_BATCH);
+	if (rpc_function_start_stream(cookie) != 0) {
+		/* The call was aborted and has been answered already */
+		g_ptr_array_free(chunks, true);
+		return (NULL);
+	}
+
+	for (i = 0; i < chunks->len; i++) {
+		if (rpc_function_yield_many(cookie,
+		    rpc_retain(g_ptr_array_index(chunks, i))) != 0)
+			break;
+	}
+
+	g_ptr_array_free(chunks, true);
+	return (NULL);
+}
+
 static rpc_object_t
 rpc_get_interfaces(void *cookie, rpc_object_t args __unused)
 {
@@ -1331,6 +2418,7 @@ rpc_observable_property_get(void *cookie, rpc_object_t args)
 	struct rpc_if_member *member;
 	const char *interface;
 	const char *name;
+	guint seq;
 
 	if (rpc_object_unpack(args, "[s,s]", &interface, &name) < 2) {
 		rpc_function_error(cookie, EINVAL, "Invalid arguments passed");
@@ -1348,6 +2436,10 @@ rpc_observable_property_get(void *cookie, rpc_object_t args)
 		return (NULL);
 	}
 
+	result = rpc_property_get_cached(member, &seq);
+	if (result != NULL)
+		return (result);
+
 	prop.instance = inst;
 	prop.name = name;
 	prop.arg = member->rim_property.rp_arg;
@@ -1359,6 +2451,7 @@ rpc_observable_property_get(void *cookie, rpc_object_t args)
 		return (NULL);
 	}
 
+	rpc_property_set_cached(member, result, seq);
 	return (result);
 }
 
@@ -1366,11 +2459,13 @@ static rpc_object_t
 rpc_observable_property_set(void *cookie, rpc_object_t args)
 {
 	rpc_instance_t inst = rpc_function_get_instance(cookie);
+	struct rpc_property_state *state;
 	struct rpc_property_cookie prop;
 	struct rpc_if_member *member;
 	const char *interface;
 	const char *name;
 	rpc_object_t value;
+	bool readback;
 
 	if (rpc_object_unpack(args, "[s,s,v]", &interface, &name, &value) < 3) {
 		rpc_function_error(cookie, EINVAL, "Invalid arguments passed");
@@ -1399,23 +2494,128 @@ rpc_observable_property_set(void *cookie, rpc_object_t args)
 		return (NULL);
 	}
 
-	rpc_instance_property_changed(inst, interface, name, value);
+	/*
+	 * The setter may adjust the value. Cached properties read it back,
+	 * so the cache doesn't hold what the setter didn't store.
+	 */
+	state = ((struct rpc_member_priv *)member)->rmp_prop;
+	g_mutex_lock(&state->rps_mtx);
+	readback = state->rps_cacheable &&
+	    member->rim_property.rp_getter != NULL;
+	g_mutex_unlock(&state->rps_mtx);
+
+	rpc_instance_property_changed(inst, interface, name,
+	    readback ? NULL : value);
 	return (NULL);
 }
 
+static rpc_object_t
+rpc_property_descriptor(const char *name, rpc_object_t value)
+{
+	rpct_typei_t typei;
+	rpc_object_t result;
+
+	/*
+	 * Served from the typing context's instance cache, so a reloaded
+	 * typing context never hands out a stale instance.
+	 */
+	typei = rpct_new_typei("com.twoporeguys.librpc.PropertyDescriptor");
+
+	result = rpc_dictionary_create();
+	rpc_dictionary_set_string(result, "name", name);
+	rpc_dictionary_steal_value(result, "value", value);
+
+	if (typei != NULL) {
+		rpct_set_typei(typei, result);
+		rpct_typei_release(typei);
+	}
+
+	return (result);
+}
+
+static void
+rpc_property_batch_unref(struct rpc_property_batch *batch)
+{
+	guint i;
+
+	if (!g_atomic_int_dec_and_test(&batch->rpb_refcnt))
+		return;
+
+	for (i = 0; i < batch->rpb_count; i++)
+		rpc_release(batch->rpb_fetches[i].rpf_value);
+
+	g_mutex_clear(&batch->rpb_mtx);
+	g_cond_clear(&batch->rpb_cv);
+	g_free(batch);
+}
+
+/*
+ * Runs a getter of a single property, unless some other thread already
+ * claimed it.
+ */
+static void
+rpc_property_fetch_run(struct rpc_property_fetch *fetch)
+{
+	struct rpc_property_batch *batch = fetch->rpf_batch;
+	struct rpc_if_member *member = fetch->rpf_member;
+	struct rpc_property_cookie prop;
+	rpc_object_t value;
+	guint seq;
+
+	if (!g_atomic_int_compare_and_exchange(&fetch->rpf_claimed, 0, 1))
+		return;
+
+	if (member->rim_property.rp_getter == NULL)
+		value = rpc_error_create(EPERM, "Not readable", NULL);
+	else {
+		value = rpc_property_get_cached(member, &seq);
+		if (value == NULL) {
+			prop.instance = batch->rpb_instance;
+			prop.name = member->rim_name;
+			prop.arg = member->rim_property.rp_arg;
+			prop.error = NULL;
+			value = member->rim_property.rp_getter(&prop);
+
+			if (prop.error != NULL)
+				value = prop.error;
+			else
+				rpc_property_set_cached(member, value, seq);
+		}
+	}
+
+	fetch->rpf_value = value;
+
+	g_mutex_lock(&batch->rpb_mtx);
+	if (--batch->rpb_pending == 0)
+		g_cond_broadcast(&batch->rpb_cv);
+
+	g_mutex_unlock(&batch->rpb_mtx);
+}
+
+static void
+rpc_property_fetch_task(gpointer data, gpointer user_data __unused)
+{
+	struct rpc_property_fetch *fetch = data;
+	struct rpc_property_batch *batch = fetch->rpf_batch;
+
+	rpc_property_fetch_run(fetch);
+	rpc_property_batch_unref(batch);
+}
+
 static rpc_object_t
 rpc_observable_property_get_all(void *cookie, rpc_object_t args)
 {
+	rpc_context_t context = rpc_function_get_context(cookie);
 	rpc_instance_t inst = rpc_function_get_instance(cookie);
 	GHashTableIter iter;
-	struct rpc_property_cookie prop;
 	const char *interface;
-	const char *k;
 	struct rpc_if_member *v;
 	struct rpc_interface_priv *priv;
-	rpc_object_t value;
+	struct rpc_property_batch *batch;
+	struct rpc_property_fetch *fetch;
 	rpc_object_t result;
-	rpc_object_t item;
+	guint count = 0;
+	guint i;
 
 	if (rpc_object_unpack(args, "[s]", &interface) < 1) {
 		rpc_function_error(cookie, EINVAL, "Invalid arguments passed");
@@ -1428,43 +2628,64 @@ rpc_observable_property_get_all(void *cookie, rpc_object_t args)
 		return (NULL);
 	}
 
-	result = rpc_array_create();
 	g_rw_lock_reader_lock(&priv->rip_rwlock);
-	g_hash_table_iter_init(&iter, priv->rip_members);
+	batch = g_malloc0(sizeof(*batch) + g_hash_table_size(
+	    priv->rip_members) * sizeof(struct rpc_property_fetch));
+	batch->rpb_refcnt = 1;
+	batch->rpb_instance = inst;
+	g_mutex_init(&batch->rpb_mtx);
+	g_cond_init(&batch->rpb_cv);
 
-	while (g_hash_table_iter_next(&iter, (gpointer)&k, (gpointer)&v)) {
+	g_hash_table_iter_init(&iter, priv->rip_members);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&v)) {
 		if (v->rim_type != RPC_MEMBER_PROPERTY)
 			continue;
 
-		if (v->rim_property.rp_getter == NULL) {
-			value = rpc_error_create(EPERM, "Not readable", NULL);
-			item = rpc_object_pack(
-			    "<com.twoporeguys.librpc.PropertyDescriptor>{s,v}",
-			    "name", v->rim_name,
-			    "value", value);
+		fetch = &batch->rpb_fetches[count++];
+		fetch->rpf_batch = batch;
+		fetch->rpf_member = v;
+	}
+
+	batch->rpb_count = count;
+	batch->rpb_pending = count;
 
-			rpc_array_append_stolen_value(result, item);
+	/* Hand independent getters over to the worker pool */
+	for (i = 0; i < count; i++) {
+		fetch = &batch->rpb_fetches[i];
+		v = fetch->rpf_member;
+		if ((v->rim_property.rp_flags & RPC_PROPERTY_INDEPENDENT) == 0)
 			continue;
-		}
 
-		prop.instance = inst;
-		prop.name = k;
-		prop.arg = v->rim_property.rp_arg;
-		prop.error = NULL;
-		value = v->rim_property.rp_getter(&prop);
+		g_atomic_int_inc(&batch->rpb_refcnt);
+		rpc_scheduler_push(context->rcx_scheduler,
+		    rpc_property_fetch_task, fetch, NULL,
+		    RPC_PRIORITY_NORMAL, -1);
+	}
+
+	/*
+	 * Run the rest here, along with any independent getter no worker
+	 * picked up yet. This also keeps get_all from deadlocking when all
+	 * the workers are busy.
+	 */
+	for (i = 0; i < count; i++)
+		rpc_property_fetch_run(&batch->rpb_fetches[i]);
 
-		if (prop.error != NULL)
-			value = prop.error;
+	g_mutex_lock(&batch->rpb_mtx);
+	while (batch->rpb_pending > 0)
+		g_cond_wait(&batch->rpb_cv, &batch->rpb_mtx);
 
-		item = rpc_object_pack(
-		    "<com.twoporeguys.librpc.PropertyDescriptor>{s,v}",
-		    "name", v->rim_name,
-		    "value", value);
+	g_mutex_unlock(&batch->rpb_mtx);
 
-		rpc_array_append_stolen_value(result, item);
+	result = rpc_array_create();
+	for (i = 0; i < count; i++) {
+		fetch = &batch->rpb_fetches[i];
+		rpc_array_append_stolen_value(result, rpc_property_descriptor(
+		    fetch->rpf_member->rim_name, fetch->rpf_value));
+		fetch->rpf_value = NULL;
 	}
 
 	g_rw_lock_reader_unlock(&priv->rip_rwlock);
+	rpc_property_batch_unref(batch);
 	return (result);
 }
 
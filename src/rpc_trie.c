@@ -0,0 +1,367 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <glib.h>
+#include "internal.h"
+
+struct rpc_trie_node
+{
+	char *			rtn_name;
+	char *			rtn_path;
+	void *			rtn_value;
+	struct rpc_trie_node *	rtn_parent;
+	GTree *			rtn_children;
+};
+
+struct rpc_trie
+{
+	struct rpc_trie_node *	rt_root;
+	GDestroyNotify		rt_value_free;
+	size_t			rt_count;
+};
+
+struct rpc_trie_component
+{
+	const char *		rtc_name;
+	size_t			rtc_len;
+};
+
+struct rpc_trie_apply_ctx
+{
+	rpc_trie_applier_t	applier;
+	bool			stopped;
+};
+
+static struct rpc_trie_node *rpc_trie_node_new(struct rpc_trie_node *,
+    const char *);
+static void rpc_trie_node_free(struct rpc_trie *, struct rpc_trie_node *);
+static struct rpc_trie_node *rpc_trie_find_node(struct rpc_trie *,
+    const char *, bool);
+static void rpc_trie_prune(struct rpc_trie *, struct rpc_trie_node *);
+static bool rpc_trie_node_apply(struct rpc_trie_node *,
+    struct rpc_trie_apply_ctx *);
+
+static struct rpc_trie_node *
+rpc_trie_node_new(struct rpc_trie_node *parent, const char *name)
+{
+	struct rpc_trie_node *node;
+
+	node = g_malloc0(sizeof(*node));
+	node->rtn_parent = parent;
+	node->rtn_name = g_strdup(name);
+	node->rtn_children = g_tree_new((GCompareFunc)strcmp);
+
+	if (parent == NULL)
+		node->rtn_path = g_strdup("/");
+	else if (parent->rtn_parent == NULL)
+		node->rtn_path = g_strdup_printf("/%s", name);
+	else
+		node->rtn_path = g_strdup_printf("%s/%s", parent->rtn_path,
+		    name);
+
+	return (node);
+}
+
+static gboolean
+rpc_trie_node_free_child(gpointer key __unused, gpointer value, gpointer data)
+{
+
+	rpc_trie_node_free(data, value);
+	return (false);
+}
+
+static void
+rpc_trie_node_free(struct rpc_trie *trie, struct rpc_trie_node *node)
+{
+
+	g_tree_foreach(node->rtn_children, rpc_trie_node_free_child, trie);
+	g_tree_destroy(node->rtn_children);
+
+	if (node->rtn_value != NULL && trie->rt_value_free != NULL)
+		trie->rt_value_free(node->rtn_value);
+
+	g_free(node->rtn_name);
+	g_free(node->rtn_path);
+	g_free(node);
+}
+
+/*
+ * Compares a path component that isn't NUL-terminated with a node name,
+ * consistently with the strcmp() ordering of the children trees.
+ */
+static gint
+rpc_trie_component_cmp(gconstpointer key, gconstpointer data)
+{
+	const struct rpc_trie_component *comp = data;
+	const char *name = key;
+	int ret;
+
+	ret = strncmp(comp->rtc_name, name, comp->rtc_len);
+	if (ret != 0)
+		return (ret);
+
+	return (name[comp->rtc_len] == '\0' ? 0 : -1);
+}
+
+/*
+ * Advances @p path past the next non-empty component, which is
+ * returned in @p comp. Returns false once the path is exhausted.
+ */
+static bool
+rpc_trie_next_component(const char **path, struct rpc_trie_component *comp)
+{
+	const char *p = *path;
+
+	while (*p == '/')
+		p++;
+
+	if (*p == '\0')
+		return (false);
+
+	comp->rtc_name = p;
+	comp->rtc_len = strcspn(p, "/");
+	*path = p + comp->rtc_len;
+	return (true);
+}
+
+static struct rpc_trie_node *
+rpc_trie_find_child(struct rpc_trie_node *node, struct rpc_trie_component *comp)
+{
+
+	return (g_tree_search(node->rtn_children, rpc_trie_component_cmp,
+	    comp));
+}
+
+/*
+ * Walks down the trie along the components of @p path. If @p create
+ * is set, missing intermediate nodes are created on the way.
+ */
+static struct rpc_trie_node *
+rpc_trie_find_node(struct rpc_trie *trie, const char *path, bool create)
+{
+	struct rpc_trie_node *node = trie->rt_root;
+	struct rpc_trie_node *child;
+	struct rpc_trie_component comp;
+	char *name;
+
+	if (path == NULL)
+		return (NULL);
+
+	while (rpc_trie_next_component(&path, &comp)) {
+		child = rpc_trie_find_child(node, &comp);
+		if (child == NULL) {
+			if (!create)
+				return (NULL);
+
+			name = g_strndup(comp.rtc_name, comp.rtc_len);
+			child = rpc_trie_node_new(node, name);
+			g_tree_insert(node->rtn_children, child->rtn_name,
+			    child);
+			g_free(name);
+		}
+
+		node = child;
+	}
+
+	return (node);
+}
+
+/*
+ * Removes empty leaf nodes, starting at @p node and going up.
+ */
+static void
+rpc_trie_prune(struct rpc_trie *trie, struct rpc_trie_node *node)
+{
+	struct rpc_trie_node *parent;
+
+	while (node != trie->rt_root && node->rtn_value == NULL &&
+	    g_tree_nnodes(node->rtn_children) == 0) {
+		parent = node->rtn_parent;
+		g_tree_remove(parent->rtn_children, node->rtn_name);
+		rpc_trie_node_free(trie, node);
+		node = parent;
+	}
+}
+
+static gboolean
+rpc_trie_node_apply_child(gpointer key __unused, gpointer value,
+    gpointer data)
+{
+	struct rpc_trie_apply_ctx *ctx = data;
+
+	return (!rpc_trie_node_apply(value, ctx));
+}
+
+static bool
+rpc_trie_node_apply(struct rpc_trie_node *node, struct rpc_trie_apply_ctx *ctx)
+{
+
+	if (node->rtn_value != NULL) {
+		if (!ctx->applier(node->rtn_path, node->rtn_value)) {
+			ctx->stopped = true;
+			return (false);
+		}
+	}
+
+	g_tree_foreach(node->rtn_children, rpc_trie_node_apply_child, ctx);
+	return (!ctx->stopped);
+}
+
+struct rpc_trie *
+rpc_trie_new(GDestroyNotify value_free)
+{
+	struct rpc_trie *trie;
+
+	trie = g_malloc0(sizeof(*trie));
+	trie->rt_root = rpc_trie_node_new(NULL, "");
+	trie->rt_value_free = value_free;
+	return (trie);
+}
+
+void
+rpc_trie_free(struct rpc_trie *trie)
+{
+
+	if (trie == NULL)
+		return;
+
+	rpc_trie_node_free(trie, trie->rt_root);
+	g_free(trie);
+}
+
+size_t
+rpc_trie_count(struct rpc_trie *trie)
+{
+
+	return (trie->rt_count);
+}
+
+void *
+rpc_trie_lookup(struct rpc_trie *trie, const char *path)
+{
+	struct rpc_trie_node *node;
+
+	node = rpc_trie_find_node(trie, path, false);
+	return (node != NULL ? node->rtn_value : NULL);
+}
+
+bool
+rpc_trie_insert(struct rpc_trie *trie, const char *path, void *value)
+{
+	struct rpc_trie_node *node;
+
+	g_assert_nonnull(value);
+
+	node = rpc_trie_find_node(trie, path, true);
+	if (node == NULL || node->rtn_value != NULL)
+		return (false);
+
+	node->rtn_value = value;
+	trie->rt_count++;
+	return (true);
+}
+
+void *
+rpc_trie_steal(struct rpc_trie *trie, const char *path)
+{
+	struct rpc_trie_node *node;
+	void *value;
+
+	node = rpc_trie_find_node(trie, path, false);
+	if (node == NULL || node->rtn_value == NULL)
+		return (NULL);
+
+	value = node->rtn_value;
+	node->rtn_value = NULL;
+	trie->rt_count--;
+	rpc_trie_prune(trie, node);
+	return (value);
+}
+
+bool
+rpc_trie_remove(struct rpc_trie *trie, const char *path)
+{
+	void *value;
+
+	value = rpc_trie_steal(trie, path);
+	if (value == NULL)
+		return (false);
+
+	if (trie->rt_value_free != NULL)
+		trie->rt_value_free(value);
+
+	return (true);
+}
+
+bool
+rpc_trie_walk(struct rpc_trie *trie, const char *path,
+    rpc_trie_applier_t applier)
+{
+	struct rpc_trie_node *node = trie->rt_root;
+	struct rpc_trie_component comp;
+
+	if (path == NULL)
+		return (true);
+
+	/* Runs on every event delivery, so don't copy the path */
+	while (node != NULL) {
+		if (node->rtn_value != NULL) {
+			if (!applier(node->rtn_path, node->rtn_value))
+				return (false);
+		}
+
+		if (!rpc_trie_next_component(&path, &comp))
+			break;
+
+		node = rpc_trie_find_child(node, &comp);
+	}
+
+	return (true);
+}
+
+bool
+rpc_trie_apply_subtree(struct rpc_trie *trie, const char *path,
+    bool include_self, rpc_trie_applier_t applier)
+{
+	struct rpc_trie_apply_ctx ctx;
+	struct rpc_trie_node *node;
+
+	node = rpc_trie_find_node(trie, path, false);
+	if (node == NULL)
+		return (true);
+
+	ctx.applier = applier;
+	ctx.stopped = false;
+
+	if (include_self)
+		return (rpc_trie_node_apply(node, &ctx));
+
+	g_tree_foreach(node->rtn_children, rpc_trie_node_apply_child, &ctx);
+	return (!ctx.stopped);
+}
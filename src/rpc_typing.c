@@ -25,17 +25,35 @@
  */
 
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <yaml.h>
 #include <rpc/object.h>
 #include <rpc/serializer.h>
 #include "internal.h"
 
 #define SYSTEM_IDL_PATH		TOSTRING(RPC_PREFIX) "/share/idl"
+#define IDL_CACHE_NAME		"idl.cache"
+#define IDL_CACHE_VERSION	2
+#define IDL_STREAM_BUFSIZE	65536
+
+/*
+ * Incremental reader splitting an IDL byte stream into YAML documents.
+ * Every complete document is handed to rpct_read_idl() as soon as it
+ * has been received.
+ */
+struct rpct_idl_stream
+{
+	GString *		ris_doc;
+	GString *		ris_line;
+	bool			ris_content;
+	guint			ris_count;
+	int			ris_id;
+};
 
 static int rpct_read_meta(struct rpct_file *, rpc_object_t);
-static int rpct_lookup_type(const char *, const char **, rpc_object_t *,
-    struct rpct_file **);
 static struct rpct_type *rpct_find_type(const char *);
 static struct rpct_type *rpct_find_type_fuzzy(const char *, struct rpct_file *);
 static rpc_object_t rpct_stream_idl(void *, rpc_object_t);
@@ -45,9 +63,20 @@ static inline bool rpct_type_is_fully_specialized(struct rpct_typei *inst);
 #endif
 static inline struct rpct_typei *rpct_unwind_typei(struct rpct_typei *);
 static char *rpct_canonical_type(struct rpct_typei *);
+static bool rpct_typei_is_concrete(struct rpct_typei *);
 static int rpct_read_type(struct rpct_file *, const char *, rpc_object_t);
 static int rpct_parse_type(const char *, GPtrArray *);
 static void rpct_interface_free(struct rpct_interface *);
+static int rpct_read_interface(struct rpct_file *, const char *,
+    rpc_object_t);
+static bool rpct_decl_should_read(struct rpct_decl *);
+static void rpct_decl_set_failed(struct rpct_decl *);
+static void rpct_index_file(struct rpct_file *);
+static void rpct_resolve_all(void);
+static void *rpct_context_lookup(struct rpct_lookup *, const char *);
+static void rpct_context_insert(GHashTable *, struct rpct_lookup *,
+    gpointer, gpointer);
+static GPtrArray *rpct_context_snapshot(GHashTable *);
 
 static GRegex *rpct_instance_regex = NULL;
 static GRegex *rpct_interface_regex = NULL;
@@ -55,6 +84,8 @@ static GRegex *rpct_type_regex = NULL;
 static GRegex *rpct_method_regex = NULL;
 static GRegex *rpct_property_regex = NULL;
 static GRegex *rpct_event_regex = NULL;
+static volatile gint rpct_stream_seq = 0;
+static volatile gint rpct_generation = 0;
 
 static struct rpct_context *context = NULL;
 static const char *builtin_types[] = {
@@ -91,6 +122,7 @@ rpc_object_t
 rpct_new(const char *decl, rpc_object_t object)
 {
 	struct rpct_typei *typei;
+	rpc_object_t ret;
 
 	if (g_strcmp0(decl, "?") == 0)
 		decl = "com.twoporeguys.librpc.Optional";
@@ -99,7 +131,9 @@ rpct_new(const char *decl, rpc_object_t object)
 	if (typei == NULL)
 		return (NULL);
 
-	return (rpct_newi(typei, object));
+	ret = rpct_newi(typei, object);
+	rpct_typei_release(typei);
+	return (ret);
 }
 
 rpc_object_t
@@ -251,45 +285,300 @@ rpct_find_type_fuzzy(const char *name, struct rpct_file *origin)
 static struct rpct_type *
 rpct_find_type(const char *name)
 {
-	struct rpct_file *file;
+	struct rpct_decl *decl;
 	rpct_type_t type = NULL;
 
-	type = g_hash_table_lookup(context->types, name);
+	type = rpct_context_lookup(&context->types_lookup, name);
+	if (type != NULL)
+		return (type);
 
+	g_rec_mutex_lock(&context->load_lock);
+	type = g_hash_table_lookup(context->types, name);
 	if (type == NULL) {
-		const char *decl;
-		rpc_object_t obj;
+		decl = g_hash_table_lookup(context->type_index, name);
+		if (decl != NULL && rpct_decl_should_read(decl)) {
+			debugf("type %s not loaded yet, reading it from %s",
+			    name, decl->file->path);
+
+			rpct_read_type(decl->file, decl->decl, decl->body);
+			type = g_hash_table_lookup(context->types, name);
+			if (type == NULL)
+				rpct_decl_set_failed(decl);
+		}
+	}
+
+	g_rec_mutex_unlock(&context->load_lock);
+	return (type);
+
+}
+
+/*
+ * A declaration that failed to read is only retried after more files
+ * were loaded, as one of them might provide what it was missing.
+ */
+static bool
+rpct_decl_should_read(struct rpct_decl *decl)
+{
+
+	return (!decl->failed ||
+	    decl->failed_nfiles != g_hash_table_size(context->files));
+}
+
+static void
+rpct_decl_set_failed(struct rpct_decl *decl)
+{
+
+	decl->failed = true;
+	decl->failed_nfiles = g_hash_table_size(context->files);
+}
+
+/*
+ * Records names of all types and interfaces declared in @p file without
+ * reading them. Declarations are materialized by rpct_find_type() and
+ * rpct_find_interface() when first referenced.
+ */
+static void
+rpct_index_file(struct rpct_file *file)
+{
+
+	rpc_dictionary_apply(file->body, ^(const char *key, rpc_object_t v) {
+		GMatchInfo *m;
+		GHashTable *index;
+		struct rpct_decl *decl;
+		char *name;
+		char *full_name;
 
-		debugf("type %s not found, trying to look it up", name);
+		if (g_strcmp0(key, "meta") == 0)
+			return ((bool)true);
+
+		if (g_str_has_prefix(key, "interface")) {
+			index = context->interface_index;
+			if (!g_regex_match(rpct_interface_regex, key, 0, &m)) {
+				g_match_info_free(m);
+				return ((bool)true);
+			}
+
+			name = g_match_info_fetch(m, 1);
+		} else {
+			index = context->type_index;
+			if (!g_regex_match(rpct_type_regex, key, 0, &m)) {
+				g_match_info_free(m);
+				return ((bool)true);
+			}
+
+			name = g_match_info_fetch(m, 2);
+		}
+
+		g_match_info_free(m);
+		full_name = file->ns != NULL
+		    ? g_strdup_printf("%s.%s", file->ns, name)
+		    : g_strdup(name);
 
-		if (rpct_lookup_type(name, &decl, &obj, &file) == 0)
-			rpct_read_type(file, decl, obj);
+		g_free(name);
+
+		if (g_hash_table_contains(index, full_name)) {
+			g_free(full_name);
+			return ((bool)true);
+		}
+
+		decl = g_malloc0(sizeof(*decl));
+		decl->file = file;
+		decl->decl = key;
+		decl->body = v;
+		g_hash_table_insert(index, full_name, decl);
+		return ((bool)true);
+	});
+}
 
-		debugf("hopefully %s is loaded now", name);
+/*
+ * Materializes every indexed declaration. Used by functions that
+ * enumerate all known types or interfaces.
+ */
+static void
+rpct_resolve_all(void)
+{
+	GHashTableIter iter;
+	const char *name;
 
-		type = g_hash_table_lookup(context->types, name);
-		if (type != NULL)
-			debugf("successfully chain-loaded %s", name);
+	g_rec_mutex_lock(&context->load_lock);
+	g_hash_table_iter_init(&iter, context->type_index);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&name, NULL))
+		rpct_find_type(name);
+
+	g_hash_table_iter_init(&iter, context->interface_index);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&name, NULL)) {
+		if (!g_hash_table_contains(context->interfaces, name))
+			rpct_find_interface(name);
 	}
 
-	return (type);
+	g_rec_mutex_unlock(&context->load_lock);
+}
+
+static void *
+rpct_context_lookup(struct rpct_lookup *lookup, const char *name)
+{
+	struct rpct_lookup_array *array;
+	struct rpct_lookup_slot *slot;
+	const char *key;
+	guint i;
+
+	array = g_atomic_pointer_get(&lookup->array);
+	if (array == NULL)
+		return (NULL);
+
+	for (i = g_str_hash(name);; i++) {
+		slot = &array->slots[i & (array->size - 1)];
+		key = g_atomic_pointer_get(&slot->key);
+		if (key == NULL)
+			return (NULL);
+
+		if (g_strcmp0(key, name) == 0)
+			return (slot->value);
+	}
+}
+
+/*
+ * Publishes @p value under @p key, which has to live as long as the
+ * context. Must be called with the context lock held for writing.
+ */
+static void
+rpct_lookup_insert(struct rpct_lookup *lookup, const char *key,
+    gpointer value)
+{
+	struct rpct_lookup_array *array;
+	struct rpct_lookup_array *grown;
+	struct rpct_lookup_slot *slot;
+	guint size;
+	guint i;
+	guint j;
+
+	array = g_atomic_pointer_get(&lookup->array);
+	if (array == NULL || (lookup->count + 1) * 2 > array->size) {
+		size = array != NULL ? array->size * 2 : 64;
+		grown = g_malloc0(sizeof(*grown) +
+		    size * sizeof(struct rpct_lookup_slot));
+		grown->size = size;
+
+		for (i = 0; array != NULL && i < array->size; i++) {
+			if (array->slots[i].key == NULL)
+				continue;
+
+			for (j = g_str_hash(array->slots[i].key);; j++) {
+				slot = &grown->slots[j & (size - 1)];
+				if (slot->key == NULL) {
+					*slot = array->slots[i];
+					break;
+				}
+			}
+		}
+
+		if (array != NULL)
+			g_ptr_array_add(lookup->retired, array);
+
+		g_atomic_pointer_set(&lookup->array, grown);
+		array = grown;
+	}
+
+	for (i = g_str_hash(key);; i++) {
+		slot = &array->slots[i & (array->size - 1)];
+		if (slot->key == NULL) {
+			slot->value = value;
+			g_atomic_pointer_set(&slot->key, (gpointer)key);
+			lookup->count++;
+			return;
+		}
+
+		if (g_strcmp0(slot->key, key) == 0) {
+			slot->value = value;
+			return;
+		}
+	}
+}
+
+static void
+rpct_lookup_free(struct rpct_lookup *lookup)
+{
 
+	g_free(lookup->array);
+	g_ptr_array_free(lookup->retired, true);
+}
+
+static void
+rpct_context_insert(GHashTable *table, struct rpct_lookup *lookup,
+    gpointer key, gpointer value)
+{
+	gpointer orig_key;
+
+	g_rw_lock_writer_lock(&context->lock);
+
+	/* The table keeps an existing key and frees the new one */
+	if (!g_hash_table_lookup_extended(table, key, &orig_key, NULL))
+		orig_key = key;
+
+	g_hash_table_insert(table, key, value);
+	rpct_lookup_insert(lookup, orig_key, value);
+	g_rw_lock_writer_unlock(&context->lock);
+}
+
+/*
+ * Returns values of a context table as an array, so that callers can
+ * iterate them without holding any lock.
+ */
+static GPtrArray *
+rpct_context_snapshot(GHashTable *table)
+{
+	GHashTableIter iter;
+	GPtrArray *ret;
+	gpointer value;
+
+	g_rw_lock_reader_lock(&context->lock);
+	ret = g_ptr_array_sized_new(g_hash_table_size(table));
+	g_hash_table_iter_init(&iter, table);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		g_ptr_array_add(ret, value);
+
+	g_rw_lock_reader_unlock(&context->lock);
+	return (ret);
+}
+
+static bool
+rpct_file_loaded(const char *path)
+{
+	bool ret;
+
+	g_rec_mutex_lock(&context->load_lock);
+	ret = g_hash_table_contains(context->files, path);
+	g_rec_mutex_unlock(&context->load_lock);
+	return (ret);
 }
 
 static rpc_object_t
 rpct_stream_idl(void *cookie, rpc_object_t args __unused)
 {
 	GHashTableIter iter;
+	GPtrArray *files;
 	struct rpct_file *file;
+	guint i;
 
+	/* Don't hold the lock while yielding */
+	g_rec_mutex_lock(&context->load_lock);
+	files = g_ptr_array_sized_new(g_hash_table_size(context->files));
 	g_hash_table_iter_init(&iter, context->files);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&file))
+		g_ptr_array_add(files, file);
+
+	g_rec_mutex_unlock(&context->load_lock);
+
 	rpc_function_start_stream(cookie);
-	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&file)) {
-		rpc_function_yield(cookie, rpc_object_pack("{s,v}",
+	for (i = 0; i < files->len; i++) {
+		file = g_ptr_array_index(files, i);
+		if (rpc_function_yield(cookie, rpc_object_pack("{s,v}",
 		    "name", file->path,
-		    "body", rpc_retain(file->body)));
+		    "body", rpc_retain(file->body))) != 0)
+			break;
 	}
 
+	g_ptr_array_free(files, true);
 	return (NULL);
 }
 
@@ -340,8 +629,11 @@ rpct_instantiate_type(const char *decl, struct rpct_typei *parent,
 	struct rpct_type *type = NULL;
 	struct rpct_typei *ret = NULL;
 	struct rpct_typei *subtype;
+	struct rpct_typei *cached;
+	struct rpct_typei *built = NULL;
 	char *decltype = NULL;
 	char *declvars = NULL;
+	char *key;
 	int found_proxy_type = -1;
 
 	debugf("instantiating type %s", decl);
@@ -351,6 +643,16 @@ rpct_instantiate_type(const char *decl, struct rpct_typei *parent,
 		return (NULL);
 	}
 
+	/*
+	 * Without a parent, parent type and origin file the declaration
+	 * alone determines the result, so it can be looked up verbatim.
+	 */
+	if (parent == NULL && ptype == NULL && origin == NULL) {
+		ret = rpct_context_lookup(&context->typei_lookup, decl);
+		if (ret != NULL)
+			return (rpct_typei_retain(ret));
+	}
+
 	if (!g_regex_match(rpct_instance_regex, decl, 0, &match)) {
 		rpc_set_last_errorf(EINVAL, "Invalid type specification: %s",
 		    decl);
@@ -372,7 +674,7 @@ rpct_instantiate_type(const char *decl, struct rpct_typei *parent,
 		 * up in the cache
 		 */
 
-		ret = g_hash_table_lookup(context->typei_cache, decltype);
+		ret = rpct_context_lookup(&context->typei_lookup, decltype);
 		if (ret != NULL) {
 			g_free(decltype);
 			g_match_info_free(match);
@@ -393,7 +695,7 @@ rpct_instantiate_type(const char *decl, struct rpct_typei *parent,
 				    cur->specializations, decltype);
 
 				if (subtype) {
-					ret = subtype;
+					ret = rpct_typei_retain(subtype);
 					goto done;
 				}
 			}
@@ -410,6 +712,7 @@ rpct_instantiate_type(const char *decl, struct rpct_typei *parent,
 
 			if (found_proxy_type != -1) {
 				subtype = g_malloc0(sizeof(*subtype));
+				subtype->refcnt = 1;
 				subtype->proxy = true;
 				subtype->variable = g_strdup(decltype);
 				subtype->canonical_form = g_strdup(decltype);
@@ -489,10 +792,39 @@ done:
 	if (declvars != NULL)
 		g_free(declvars);
 
-	if (ret != NULL && ret->type != NULL && !ret->type->generic) {
-		rpct_typei_retain(ret);
-		g_hash_table_insert(context->typei_cache,
-		    g_strdup(ret->canonical_form), ret);
+	/*
+	 * Generic instances are hash-consed by their canonical form,
+	 * once all type variables are bound to actual types.
+	 */
+	if (ret != NULL && ret->type != NULL &&
+	    (!ret->type->generic || rpct_typei_is_concrete(ret))) {
+		/* Another thread might have cached the same type already */
+		g_rw_lock_writer_lock(&context->lock);
+		cached = g_hash_table_lookup(context->typei_cache,
+		    ret->canonical_form);
+		if (cached == NULL) {
+			key = g_strdup(ret->canonical_form);
+			g_hash_table_insert(context->typei_cache, key,
+			    rpct_typei_retain(ret));
+			rpct_lookup_insert(&context->typei_lookup, key, ret);
+		} else if (cached != ret) {
+			built = ret;
+			ret = rpct_typei_retain(cached);
+		}
+
+		if (parent == NULL && ptype == NULL && origin == NULL &&
+		    !g_hash_table_contains(context->typei_cache, decl)) {
+			key = g_strdup(decl);
+			g_hash_table_insert(context->typei_cache, key,
+			    rpct_typei_retain(ret));
+			rpct_lookup_insert(&context->typei_lookup, key, ret);
+		}
+
+		g_rw_lock_writer_unlock(&context->lock);
+
+		/* Drop the instance we built in favor of the cached one */
+		if (built != NULL)
+			rpct_typei_release(built);
 	}
 
 	return (ret);
@@ -502,11 +834,52 @@ static struct rpct_typei *
 rpct_instantiate_member(struct rpct_member *member, struct rpct_typei *parent)
 {
 	struct rpct_typei *ret;
+	struct rpct_typei *copy;
 
 	ret = rpct_instantiate_type(member->type->canonical_form,
 	    parent, parent->type, parent->type->file);
-	ret->constraints = member->constraints;
-	return (ret);
+	if (ret == NULL || ret->constraints == member->constraints ||
+	    g_hash_table_size(member->constraints) == 0)
+		return (ret);
+
+	/*
+	 * The instance may be shared through the typei cache, so member
+	 * constraints go on a private copy instead.
+	 */
+	copy = g_malloc0(sizeof(*copy));
+	copy->refcnt = 1;
+	copy->proxy = ret->proxy;
+	copy->parent = ret->parent;
+	copy->type = ret->type;
+	copy->variable = ret->variable;
+	copy->canonical_form = g_strdup(ret->canonical_form);
+	copy->constraints = member->constraints;
+	if (ret->specializations != NULL)
+		copy->specializations = g_hash_table_ref(ret->specializations);
+
+	rpct_typei_release(ret);
+	return (copy);
+}
+
+static bool
+rpct_typei_is_concrete(struct rpct_typei *typei)
+{
+	GHashTableIter iter;
+	struct rpct_typei *value;
+
+	if (typei->proxy)
+		return (false);
+
+	if (typei->specializations == NULL)
+		return (true);
+
+	g_hash_table_iter_init(&iter, typei->specializations);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&value)) {
+		if (!rpct_typei_is_concrete(value))
+			return (false);
+	}
+
+	return (true);
 }
 
 static void
@@ -688,11 +1061,11 @@ static char *
 rpct_canonical_type(struct rpct_typei *typei)
 {
 	GString *ret;
-	GHashTableIter iter;
 	struct rpct_typei *value;
-	const char *key;
+	const char *var;
 	char *substr;
-	guint i = 0;
+	bool written = false;
+	guint i;
 
 	if (typei->proxy)
 		return (g_strdup(typei->variable));
@@ -702,73 +1075,27 @@ rpct_canonical_type(struct rpct_typei *typei)
 	if (!typei->type->generic)
 		return (g_string_free(ret, false));
 
+	/* Follow declaration order, so equal types get equal names */
 	g_string_append(ret, "<");
-	g_hash_table_iter_init(&iter, typei->specializations);
+	for (i = 0; i < typei->type->generic_vars->len; i++) {
+		var = g_ptr_array_index(typei->type->generic_vars, i);
+		value = g_hash_table_lookup(typei->specializations, var);
+		if (value == NULL)
+			continue;
+
+		if (written)
+			g_string_append(ret, ",");
 
-	while (g_hash_table_iter_next(&iter, (gpointer *)&key,
-	    (gpointer *)&value)) {
 		substr = rpct_canonical_type(value);
 		g_string_append(ret, substr);
 		g_free(substr);
-
-		if (i < g_hash_table_size(typei->specializations)- 1)
-			g_string_append(ret, ",");
-
-		i++;
+		written = true;
 	}
 
 	g_string_append(ret, ">");
 	return (g_string_free(ret, false));
 }
 
-static int
-rpct_lookup_type(const char *name, const char **decl, rpc_object_t *result,
-    struct rpct_file **filep)
-{
-	GHashTableIter iter;
-	const char *filename;
-	struct rpct_file *file;
-	__block int ret = -1;
-
-	g_hash_table_iter_init(&iter, context->files);
-
-	while (g_hash_table_iter_next(&iter, (gpointer *)&filename,
-	    (gpointer *)&file)) {
-
-		debugf("looking for %s in %s", name, filename);
-
-		rpc_dictionary_apply(file->body,
-		    ^(const char *key, rpc_object_t value) {
-			GMatchInfo *m;
-			g_autofree char *type_name = NULL;
-			g_autofree char *full_name = NULL;
-
-			if (!g_regex_match(rpct_type_regex, key, 0, &m)) {
-				g_match_info_free(m);
-				return ((bool)true);
-			}
-			type_name = g_match_info_fetch(m, 2);
-			full_name = file->ns != NULL
-			    ? g_strdup_printf("%s.%s", file->ns, type_name)
-			    : g_strdup(type_name);
-
-			if (g_strcmp0(full_name, name) == 0) {
-				*decl = key;
-				*result = value;
-				*filep = file;
-				ret = 0;
-				g_match_info_free(m);
-				return ((bool)false);
-			}
-
-			g_match_info_free(m);
-			return ((bool)true);
-		});
-	}
-
-	return (ret);
-}
-
 static int
 rpct_read_type(struct rpct_file *file, const char *decl, rpc_object_t obj)
 {
@@ -912,8 +1239,8 @@ rpct_read_type(struct rpct_file *file, const char *decl, rpc_object_t obj)
 		g_assert_nonnull(type->value_type);
 	}
 
-	if (!g_hash_table_insert(context->types, g_strdup(type->name), type))
-		g_assert_not_reached();
+	rpct_context_insert(context->types, &context->types_lookup,
+	    g_strdup(type->name), type);
 
 	debugf("inserted type %s", declname);
 done:
@@ -1249,7 +1576,8 @@ rpct_read_interface(struct rpct_file *file, const char *decl, rpc_object_t obj)
 		goto abort;
 	}
 
-	g_hash_table_insert(context->interfaces, iface->name, iface);
+	rpct_context_insert(context->interfaces, &context->interfaces_lookup,
+	    iface->name, iface);
 	g_hash_table_insert(file->interfaces, iface->name, iface);
 	return (ret);
 
@@ -1285,12 +1613,17 @@ rpct_read_idl(const char *name, rpc_object_t idl)
 		return (-1);
 	}
 
+	g_rec_mutex_lock(&context->load_lock);
 	if (g_hash_table_contains(context->files, name)) {
 		debugf("file %s already loaded", name);
+		g_rec_mutex_unlock(&context->load_lock);
+		rpct_file_free(file);
 		return (0);
 	}
 
 	g_hash_table_insert(context->files, g_strdup(name), file);
+	rpct_index_file(file);
+	g_rec_mutex_unlock(&context->load_lock);
 	return (0);
 }
 
@@ -1304,7 +1637,7 @@ rpct_read_file(const char *path)
 
 	debugf("trying to read %s", path);
 
-	if (g_hash_table_contains(context->files, path)) {
+	if (rpct_file_loaded(path)) {
 		debugf("file %s already loaded", path);
 		return (0);
 	}
@@ -1323,18 +1656,198 @@ rpct_read_file(const char *path)
 	return (rpct_read_idl(path, obj));
 }
 
+static bool
+rpct_builtin_type(const char *name, rpc_type_t *type)
+{
+	rpc_type_t t;
+
+	for (t = RPC_TYPE_NULL; t <= RPC_TYPE_ERROR; t++) {
+		if (g_strcmp0(rpc_get_type_name(t), name) == 0) {
+			*type = t;
+			return (true);
+		}
+	}
+
+#if defined(__linux__)
+	if (g_strcmp0(rpc_get_type_name(RPC_TYPE_SHMEM), name) == 0) {
+		*type = RPC_TYPE_SHMEM;
+		return (true);
+	}
+#endif
+
+	return (false);
+}
+
+static void
+rpct_validation_plan_free(struct rpct_validation_plan *plan)
+{
+	struct rpct_validation_step *step;
+	guint i;
+
+	for (i = 0; i < plan->rvp_nsteps; i++) {
+		step = &plan->rvp_steps[i];
+		if (step->rvs_state != NULL && step->rvs_validator->release)
+			step->rvs_validator->release(step->rvs_state);
+	}
+
+	/* Member and value typeis are references taken by the plan */
+	for (i = 0; i < plan->rvp_nmembers; i++) {
+		if (plan->rvp_members[i].rpm_typei != NULL)
+			rpct_typei_release(plan->rvp_members[i].rpm_typei);
+	}
+
+	if (plan->rvp_value != NULL)
+		rpct_typei_release(plan->rvp_value);
+
+	g_free(plan->rvp_steps);
+	g_free(plan->rvp_members);
+	g_free(plan);
+}
+
+static struct rpct_validation_plan *
+rpct_validation_plan_new(struct rpct_typei *typei)
+{
+	struct rpct_validation_plan *plan;
+	struct rpct_validation_step *step;
+	GHashTableIter iter;
+	const char *key;
+	rpc_object_t value;
+	GArray *members;
+
+	plan = g_malloc0(sizeof(*plan));
+	plan->rvp_handler = rpc_find_class_handler(NULL, typei->type->clazz);
+	plan->rvp_raw = rpct_unwind_typei(typei);
+	plan->rvp_any = g_strcmp0(plan->rvp_raw->canonical_form, "any") == 0;
+	plan->rvp_nullptr = g_strcmp0(plan->rvp_raw->canonical_form,
+	    "nullptr") == 0;
+	plan->rvp_builtin = rpct_builtin_type(plan->rvp_raw->canonical_form,
+	    &plan->rvp_builtin_type);
+
+	/*
+	 * Validators are looked up by the type of the validated object.
+	 * That's only known up front for builtin types and structs.
+	 */
+	plan->rvp_constraints = typei->constraints;
+	if (typei->type->clazz == RPC_TYPING_STRUCT) {
+		plan->rvp_steps_valid = true;
+		plan->rvp_steps_type = RPC_TYPE_DICTIONARY;
+	} else if (plan->rvp_builtin) {
+		plan->rvp_steps_valid = true;
+		plan->rvp_steps_type = plan->rvp_builtin_type;
+	}
+
+	if (plan->rvp_steps_valid && typei->constraints != NULL) {
+		plan->rvp_steps = g_new0(struct rpct_validation_step,
+		    g_hash_table_size(typei->constraints));
+
+		g_hash_table_iter_init(&iter, typei->constraints);
+		while (g_hash_table_iter_next(&iter, (gpointer *)&key,
+		    (gpointer *)&value)) {
+			step = &plan->rvp_steps[plan->rvp_nsteps++];
+			step->rvs_name = key;
+			step->rvs_params = value;
+			step->rvs_validator = rpc_find_validator(
+			    rpc_get_type_name(plan->rvp_steps_type), key);
+
+			if (step->rvs_validator != NULL &&
+			    step->rvs_validator->prepare != NULL)
+				step->rvs_state =
+				    step->rvs_validator->prepare(value);
+		}
+	}
+
+	if (typei->type->clazz == RPC_TYPING_STRUCT) {
+		members = g_array_new(false, true,
+		    sizeof(struct rpct_plan_member));
+
+		rpct_members_apply(typei->type, ^(struct rpct_member *member) {
+			struct rpct_plan_member pm;
+
+			/* Unresolvable members are reported when validating */
+			pm.rpm_member = member;
+			pm.rpm_typei = rpct_typei_get_member_type(typei,
+			    member);
+			g_array_append_val(members, pm);
+
+			return ((bool)true);
+		});
+
+		plan->rvp_nmembers = members->len;
+		plan->rvp_members = (struct rpct_plan_member *)g_array_free(
+		    members, false);
+	}
+
+	/*
+	 * typei->type->value_type might be a generic variable reference,
+	 * eg. "T" so we must instantiate it in context of a parent type.
+	 */
+	if (typei->type->clazz == RPC_TYPING_CONTAINER &&
+	    typei->type->value_type != NULL) {
+		plan->rvp_value = rpct_instantiate_type(
+		    typei->type->value_type->canonical_form, typei,
+		    typei->type, typei->type->file);
+	}
+
+	return (plan);
+}
+
+struct rpct_validation_plan *
+rpct_typei_get_plan(struct rpct_typei *typei)
+{
+	struct rpct_validation_plan *plan;
+
+	plan = g_atomic_pointer_get(&typei->plan);
+	if (plan != NULL)
+		return (plan);
+
+	/* Two threads may race here; the loser throws its plan away */
+	plan = rpct_validation_plan_new(typei);
+	if (!g_atomic_pointer_compare_and_exchange(&typei->plan, NULL, plan)) {
+		rpct_validation_plan_free(plan);
+		plan = g_atomic_pointer_get(&typei->plan);
+	}
+
+	return (plan);
+}
+
 bool
 rpct_run_validators(struct rpct_typei *typei, rpc_object_t obj,
     struct rpct_error_context *errctx)
 {
 	GHashTableIter iter;
 	const struct rpct_validator *v;
-	const char *typename = rpc_get_type_name(rpc_get_type(obj));
+	const struct rpct_validation_step *step;
+	struct rpct_validation_plan *plan;
+	const char *typename;
 	const char *key;
 	rpc_object_t value;
 	bool valid = true;
+	guint i;
+
+	plan = rpct_typei_get_plan(typei);
+	if (plan->rvp_steps_valid && plan->rvp_constraints ==
+	    typei->constraints && rpc_get_type(obj) == plan->rvp_steps_type) {
+		for (i = 0; i < plan->rvp_nsteps; i++) {
+			step = &plan->rvp_steps[i];
+			v = step->rvs_validator;
+			if (v == NULL) {
+				rpct_add_error(errctx, NULL,
+				    "Validator %s not found", step->rvs_name);
+				valid = false;
+				continue;
+			}
+
+			if (!(step->rvs_state != NULL
+			    ? v->run(obj, step->rvs_state, typei, errctx)
+			    : v->validate(obj, step->rvs_params, typei, errctx)))
+				valid = false;
+		}
+
+		return (valid);
+	}
 
 	/* Run validators */
+	typename = rpc_get_type_name(rpc_get_type(obj));
 	g_hash_table_iter_init(&iter, typei->constraints);
 	while (g_hash_table_iter_next(&iter, (gpointer *)&key,
 	    (gpointer *)&value)) {
@@ -1358,25 +1871,23 @@ bool
 rpct_validate_instance(struct rpct_typei *typei, rpc_object_t obj,
     struct rpct_error_context *errctx)
 {
-	const struct rpct_class_handler *handler;
+	struct rpct_validation_plan *plan;
 	struct rpct_typei *raw_typei;
 	bool valid;
 
-	raw_typei = rpct_unwind_typei(typei);
+	plan = rpct_typei_get_plan(typei);
+	raw_typei = plan->rvp_raw;
 
 	/* Step 1: is it typed at all? */
 	if (obj->ro_typei == NULL) {
 		/* Can only be builtin type */
-		if (g_strcmp0(raw_typei->canonical_form, "any") == 0)
+		if (plan->rvp_any)
 			goto step3;
 
-		if (g_strcmp0(raw_typei->canonical_form, "nullptr") == 0) {
-			if (obj->ro_type == RPC_TYPE_NULL)
-				goto step3;
-		}
+		if (plan->rvp_nullptr && obj->ro_type == RPC_TYPE_NULL)
+			goto step3;
 
-		if (g_strcmp0(rpc_get_type_name(obj->ro_type),
-		    raw_typei->canonical_form) == 0)
+		if (plan->rvp_builtin && obj->ro_type == plan->rvp_builtin_type)
 			goto step3;
 
 		rpct_add_error(errctx, NULL,
@@ -1399,11 +1910,10 @@ rpct_validate_instance(struct rpct_typei *typei, rpc_object_t obj,
 	}
 
 step3:
-	handler = rpc_find_class_handler(NULL, typei->type->clazz);
-	g_assert_nonnull(handler);
+	g_assert_nonnull(plan->rvp_handler);
 
 	/* Step 3: run per-class validator */
-	valid = handler->validate_fn(typei, obj, errctx);
+	valid = plan->rvp_handler->validate_fn(typei, obj, errctx);
 
 done:
 	return (valid);
@@ -1422,6 +1932,7 @@ rpct_validate_args(struct rpct_if_member *func, rpc_object_t args,
 		return (true);
 
 	errctx.path = "";
+	errctx.parent = NULL;
 	errctx.errors = g_ptr_array_new();
 
 	rpc_array_apply(args, ^(size_t idx, rpc_object_t i) {
@@ -1479,6 +1990,7 @@ rpct_validate(struct rpct_typei *typei, rpc_object_t obj, rpc_object_t *errors)
 	guint i;
 
 	errctx.path = "";
+	errctx.parent = NULL;
 	errctx.errors = g_ptr_array_new();
 
 	valid = rpct_validate_instance(typei, obj, &errctx);
@@ -1556,9 +2068,8 @@ int
 rpct_download_idl(rpc_connection_t conn)
 {
 	rpc_call_t call;
-	rpc_object_t result;
-	rpc_object_t body;
-	const char *name;
+	rpc_object_t batch;
+	bool fail;
 	int ret = 0;
 
 	call = rpc_connection_call(conn, "/", RPCT_TYPING_INTERFACE,
@@ -1571,22 +2082,41 @@ next:
 
 	switch (rpc_call_status(call)) {
 	case RPC_CALL_STREAM_START:
-		rpc_call_continue(call, true);
+		rpc_call_continue(call, false);
 		goto next;
 
 	case RPC_CALL_MORE_AVAILABLE:
-		result = rpc_call_result(call);
-		if (rpc_object_unpack(result, "{s,v}",
-		    "name", &name,
-		    "body", &body) < 2) {
+		/*
+		 * Take everything received so far. Consuming the batch
+		 * hands out credit right away, so the server keeps sending
+		 * while we're reading these.
+		 */
+		batch = rpc_call_result_batch(call, 0);
+		if (batch == NULL) {
 			ret = -1;
 			break;
 		}
 
-		if (rpct_read_idl(name, body) < 0)
+		fail = rpc_array_apply(batch, ^(size_t idx __unused,
+		    rpc_object_t result) {
+			rpc_object_t body;
+			const char *name;
+
+			if (rpc_object_unpack(result, "{s,v}",
+			    "name", &name,
+			    "body", &body) < 2)
+				return ((bool)false);
+
+			return ((bool)(rpct_read_idl(name, body) == 0));
+		});
+
+		rpc_release(batch);
+		if (fail) {
 			ret = -1;
+			rpc_call_abort(call);
+			break;
+		}
 
-		rpc_call_continue(call, true);
 		goto next;
 
 	case RPC_CALL_ENDED:
@@ -1601,8 +2131,8 @@ next:
 		g_assert_not_reached();
 	}
 
+	/* Types are materialized on first reference */
 	rpc_call_free(call);
-	rpct_load_types_cached();
 	return (ret);
 }
 
@@ -1631,14 +2161,24 @@ rpct_init(bool load_system_types)
 	    G_REGEX_MATCH_NOTEMPTY, NULL);
 
 	context = g_malloc0(sizeof(*context));
+	g_rw_lock_init(&context->lock);
+	g_rec_mutex_init(&context->load_lock);
 	context->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
 	    (GDestroyNotify)rpct_file_free);
 	context->types = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
 	    (GDestroyNotify)rpct_type_free);
 	context->interfaces = g_hash_table_new_full(g_str_hash, g_str_equal,
 	    NULL, (GDestroyNotify)rpct_interface_free);
+	context->type_index = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, g_free);
+	context->interface_index = g_hash_table_new_full(g_str_hash,
+	    g_str_equal, g_free, g_free);
 	context->typei_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
 	    g_free, (GDestroyNotify)rpct_typei_release);
+	context->types_lookup.retired = g_ptr_array_new_with_free_func(g_free);
+	context->interfaces_lookup.retired =
+	    g_ptr_array_new_with_free_func(g_free);
+	context->typei_lookup.retired = g_ptr_array_new_with_free_func(g_free);
 
 	for (b = builtin_types; *b != NULL; b++) {
 		type = g_malloc0(sizeof(*type));
@@ -1650,7 +2190,8 @@ rpct_init(bool load_system_types)
 		    g_str_equal, g_free, (GDestroyNotify)rpc_release_impl);
 		type->description = g_strdup_printf("Builtin %s type", *b);
 		type->generic_vars = g_ptr_array_new();
-		g_hash_table_insert(context->types, g_strdup(type->name), type);
+		rpct_context_insert(context->types, &context->types_lookup,
+		    g_strdup(type->name), type);
 	}
 
 	/* Load system-wide types */
@@ -1664,8 +2205,29 @@ void
 rpct_free(void)
 {
 
+	if (context == NULL)
+		return;
+
+	g_hash_table_unref(context->type_index);
+	g_hash_table_unref(context->interface_index);
 	g_hash_table_unref(context->files);
+	rpct_lookup_free(&context->types_lookup);
+	rpct_lookup_free(&context->interfaces_lookup);
+	rpct_lookup_free(&context->typei_lookup);
+	g_rw_lock_clear(&context->lock);
+	g_rec_mutex_clear(&context->load_lock);
 	g_free(context);
+	context = NULL;
+
+	/* Typeis resolved until now refer to the old context */
+	g_atomic_int_inc(&rpct_generation);
+}
+
+int
+rpct_get_generation(void)
+{
+
+	return (g_atomic_int_get(&rpct_generation));
 }
 
 rpct_typei_t
@@ -1682,8 +2244,11 @@ rpct_typei_release(rpct_typei_t typei)
 	if (!g_atomic_int_dec_and_test(&typei->refcnt))
 		return;
 
+	if (typei->plan != NULL)
+		rpct_validation_plan_free(typei->plan);
+
 	if (typei->specializations != NULL)
-		g_hash_table_destroy(typei->specializations);
+		g_hash_table_unref(typei->specializations);
 
 	g_free(typei->canonical_form);
 	g_free(typei);
@@ -1697,17 +2262,17 @@ rpct_load_types(const char *path)
 	char *errmsg;
 	bool fail;
 
-	file = g_hash_table_lookup(context->files, path);
-	if (file == NULL) {
-		if (rpct_read_file(path) != 0)
-			return (-1);
-	}
+	if (rpct_read_file(path) != 0)
+		return (-1);
 
-	if (file == NULL)
-		g_assert_not_reached();
+	g_rec_mutex_lock(&context->load_lock);
+	file = g_hash_table_lookup(context->files, path);
+	g_assert_nonnull(file);
 
-	if (file->loaded)
+	if (file->loaded) {
+		g_rec_mutex_unlock(&context->load_lock);
 		return (-1);
+	}
 
 	fail = rpc_dictionary_apply(file->body, ^bool(const char *key,
 	    rpc_object_t v) {
@@ -1727,6 +2292,8 @@ rpct_load_types(const char *path)
 		return (true);
 	});
 
+	g_rec_mutex_unlock(&context->load_lock);
+
 	if (fail) {
 		error = rpc_get_last_error();
 		errmsg = g_strdup_printf("%s: %s", path,
@@ -1743,24 +2310,141 @@ rpct_load_types(const char *path)
 	return (0);
 }
 
-int
-rpct_load_types_dir(const char *path)
+/*
+ * Opens the precompiled IDL cache written by rpct_compile_types_dir().
+ * Returns a table mapping file paths to cache entries, or NULL if there
+ * is no usable cache in @p path.
+ */
+static GHashTable *
+rpct_idl_cache_open(const char *path)
+{
+	GMappedFile *mapped;
+	GHashTable *result;
+	rpc_object_t cache;
+	rpc_object_t files = NULL;
+	char *cache_path;
+	int64_t version = -1;
+
+	cache_path = g_build_filename(path, IDL_CACHE_NAME, NULL);
+	mapped = g_mapped_file_new(cache_path, false, NULL);
+	g_free(cache_path);
+
+	if (mapped == NULL)
+		return (NULL);
+
+	cache = rpc_serializer_load("msgpack",
+	    g_mapped_file_get_contents(mapped),
+	    g_mapped_file_get_length(mapped));
+	g_mapped_file_unref(mapped);
+
+	if (cache == NULL)
+		return (NULL);
+
+	if (rpc_object_unpack(cache, "{i,v}", "version", &version,
+	    "files", &files) < 2 || version != IDL_CACHE_VERSION ||
+	    rpc_get_type(files) != RPC_TYPE_ARRAY) {
+		debugf("ignoring invalid IDL cache in %s", path);
+		rpc_release(cache);
+		return (NULL);
+	}
+
+	result = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	    (GDestroyNotify)rpc_release_impl);
+
+	rpc_array_apply(files, ^(size_t idx __unused, rpc_object_t entry) {
+		const char *name = rpc_dictionary_get_string(entry, "path");
+
+		if (name != NULL)
+			g_hash_table_insert(result, (gpointer)name,
+			    rpc_retain(entry));
+
+		return ((bool)true);
+	});
+
+	rpc_release(cache);
+	return (result);
+}
+
+/*
+ * Returns the name of @p file relative to the IDL directory @p dir.
+ * Files are stored under that name in the cache, so the cache stays
+ * valid when the directory is moved or referred to by another path.
+ */
+static const char *
+rpct_idl_cache_name(const char *dir, const char *file)
+{
+	const char *name = file;
+
+	if (g_str_has_prefix(file, dir))
+		name += strlen(dir);
+
+	while (*name == G_DIR_SEPARATOR)
+		name++;
+
+	return (name);
+}
+
+/*
+ * Returns the modification time of a file in nanoseconds, so edits made
+ * within the same second as the cache was written are still noticed.
+ */
+static int64_t
+rpct_idl_cache_mtime(const GStatBuf *st)
+{
+#ifdef __APPLE__
+	return ((int64_t)st->st_mtimespec.tv_sec * 1000000000 +
+	    st->st_mtimespec.tv_nsec);
+#else
+	return ((int64_t)st->st_mtim.tv_sec * 1000000000 +
+	    st->st_mtim.tv_nsec);
+#endif
+}
+
+/*
+ * Reads an IDL file, using its cached body if the cache entry matches
+ * the file's current size and modification time.
+ */
+static int
+rpct_read_file_cached(const char *dir, const char *path, GHashTable *cache)
+{
+	GStatBuf st;
+	rpc_object_t entry;
+	rpc_object_t body;
+
+	if (cache == NULL)
+		return (rpct_read_file(path));
+
+	entry = g_hash_table_lookup(cache, rpct_idl_cache_name(dir, path));
+	if (entry == NULL || g_stat(path, &st) != 0)
+		return (rpct_read_file(path));
+
+	if (rpc_dictionary_get_int64(entry, "mtime") !=
+	    rpct_idl_cache_mtime(&st) ||
+	    rpc_dictionary_get_int64(entry, "size") != (int64_t)st.st_size) {
+		debugf("cached copy of %s is stale", path);
+		return (rpct_read_file(path));
+	}
+
+	body = rpc_dictionary_get_value(entry, "body");
+	if (body == NULL)
+		return (rpct_read_file(path));
+
+	if (rpct_file_loaded(path))
+		return (0);
+
+	return (rpct_read_idl(path, body));
+}
+
+static void
+rpct_scan_types_dir(const char *path, GPtrArray *files)
 {
 	GDir *dir;
-	GPtrArray *files;
-	GError *error = NULL;
 	const char *name;
 	char *s;
-	guint i;
-
-	dir = g_dir_open(path, 0, &error);
-	if (dir == NULL) {
-		rpc_set_last_gerror(error);
-		g_error_free(error);
-		return (-1);
-	}
 
-	files = g_ptr_array_new_with_free_func((GDestroyNotify)g_free);
+	dir = g_dir_open(path, 0, NULL);
+	if (dir == NULL)
+		return;
 
 	for (;;) {
 		name = g_dir_read_name(dir);
@@ -1769,7 +2453,7 @@ rpct_load_types_dir(const char *path)
 
 		s = g_build_filename(path, name, NULL);
 		if (g_file_test(s, G_FILE_TEST_IS_DIR)) {
-			rpct_load_types_dir(s);
+			rpct_scan_types_dir(s, files);
 			g_free(s);
 			continue;
 		}
@@ -1779,31 +2463,271 @@ rpct_load_types_dir(const char *path)
 			continue;
 		}
 
-		if (rpct_read_file(s) != 0) {
-			g_free(s);
-			continue;
-		}
-
 		g_ptr_array_add(files, s);
 	}
 
 	g_dir_close(dir);
+}
+
+int
+rpct_load_types_dir(const char *path)
+{
+	GPtrArray *files;
+	GHashTable *cache;
+	GError *error = NULL;
+	const char *s;
+	guint i;
+
+	if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+		g_set_error(&error, G_FILE_ERROR, G_FILE_ERROR_NOTDIR,
+		    "%s is not a directory", path);
+		rpc_set_last_gerror(error);
+		g_error_free(error);
+		return (-1);
+	}
+
+	files = g_ptr_array_new_with_free_func((GDestroyNotify)g_free);
+	rpct_scan_types_dir(path, files);
+	cache = rpct_idl_cache_open(path);
+
+	/* Types are only indexed here and read on first reference */
+	for (i = 0; i < files->len; i++) {
+		s = g_ptr_array_index(files, i);
+		rpct_read_file_cached(path, s, cache);
+	}
+
+	if (cache != NULL)
+		g_hash_table_destroy(cache);
+
+	g_ptr_array_free(files, true);
+	return (0);
+}
+
+int
+rpct_compile_types_dir(const char *path)
+{
+	GPtrArray *files;
+	GError *err = NULL;
+	GStatBuf st;
+	rpc_object_t entries;
+	rpc_object_t body;
+	rpc_object_t cache;
+	const char *s;
+	char *contents;
+	char *cache_path;
+	void *frame;
+	size_t length;
+	guint i;
+	int ret = 0;
+
+	files = g_ptr_array_new_with_free_func((GDestroyNotify)g_free);
+	rpct_scan_types_dir(path, files);
+	entries = rpc_array_create();
 
 	for (i = 0; i < files->len; i++) {
 		s = g_ptr_array_index(files, i);
-		rpct_load_types(s);
+
+		if (g_stat(s, &st) != 0) {
+			rpc_set_last_errorf(errno, "Cannot stat %s", s);
+			ret = -1;
+			goto done;
+		}
+
+		if (!g_file_get_contents(s, &contents, &length, &err)) {
+			rpc_set_last_gerror(err);
+			g_error_free(err);
+			ret = -1;
+			goto done;
+		}
+
+		body = rpc_serializer_load("yaml", contents, length);
+		g_free(contents);
+
+		if (body == NULL) {
+			ret = -1;
+			goto done;
+		}
+
+		rpc_array_append_stolen_value(entries, rpc_object_pack(
+		    "{s,i,i,v}",
+		    "path", rpct_idl_cache_name(path, s),
+		    "mtime", rpct_idl_cache_mtime(&st),
+		    "size", (int64_t)st.st_size,
+		    "body", body));
+	}
+
+	cache = rpc_object_pack("{i,V}",
+	    "version", (int64_t)IDL_CACHE_VERSION,
+	    "files", entries);
+
+	if (rpc_serializer_dump("msgpack", cache, &frame, &length) != 0) {
+		rpc_release(cache);
+		ret = -1;
+		goto done;
+	}
+
+	rpc_release(cache);
+	cache_path = g_build_filename(path, IDL_CACHE_NAME, NULL);
+
+	if (!g_file_set_contents(cache_path, frame, length, &err)) {
+		rpc_set_last_gerror(err);
+		g_error_free(err);
+		ret = -1;
 	}
 
+	g_free(cache_path);
+	g_free(frame);
+
+done:
+	rpc_release(entries);
 	g_ptr_array_free(files, true);
+	return (ret);
+}
+
+static int
+rpct_idl_stream_flush(struct rpct_idl_stream *stream)
+{
+	rpc_object_t obj;
+	char *name;
+	int ret;
+
+	if (!stream->ris_content) {
+		g_string_truncate(stream->ris_doc, 0);
+		return (0);
+	}
+
+	obj = rpc_serializer_load("yaml", stream->ris_doc->str,
+	    stream->ris_doc->len);
+	g_string_truncate(stream->ris_doc, 0);
+	stream->ris_content = false;
+
+	if (obj == NULL)
+		return (-1);
+
+	name = g_strdup_printf("<stream %d:%u>", stream->ris_id,
+	    stream->ris_count++);
+	ret = rpct_read_idl(name, obj);
+	rpc_release(obj);
+	g_free(name);
+	return (ret);
+}
+
+static bool
+rpct_idl_stream_marker(const char *line, const char *marker)
+{
+
+	if (!g_str_has_prefix(line, marker))
+		return (false);
+
+	line += strlen(marker);
+	return (*line == '\0' || g_ascii_isspace(*line));
+}
+
+static int
+rpct_idl_stream_line(struct rpct_idl_stream *stream)
+{
+	const char *line = stream->ris_line->str;
+	const char *p;
+
+	/* Start of a new document ends the previous one */
+	if (rpct_idl_stream_marker(line, "---")) {
+		if (rpct_idl_stream_flush(stream) != 0)
+			return (-1);
+
+		g_string_append(stream->ris_doc, line);
+		return (0);
+	}
+
+	if (rpct_idl_stream_marker(line, "..."))
+		return (rpct_idl_stream_flush(stream));
+
+	g_string_append(stream->ris_doc, line);
+
+	p = line;
+	while (g_ascii_isspace(*p))
+		p++;
+
+	if (*p != '\0' && *p != '#')
+		stream->ris_content = true;
+
+	return (0);
+}
+
+static int
+rpct_idl_stream_feed(struct rpct_idl_stream *stream, const char *buf,
+    size_t len)
+{
+	const char *nl;
+
+	while (len > 0) {
+		nl = memchr(buf, '\n', len);
+		if (nl == NULL) {
+			g_string_append_len(stream->ris_line, buf, len);
+			return (0);
+		}
+
+		g_string_append_len(stream->ris_line, buf, nl - buf + 1);
+		len -= nl - buf + 1;
+		buf = nl + 1;
+
+		if (rpct_idl_stream_line(stream) != 0)
+			return (-1);
+
+		g_string_truncate(stream->ris_line, 0);
+	}
+
 	return (0);
 }
 
 int
 rpct_load_types_stream(int fd)
 {
+	struct rpct_idl_stream stream;
+	char *buf;
+	ssize_t ret;
+	int result = 0;
+
+	stream.ris_doc = g_string_new(NULL);
+	stream.ris_line = g_string_new(NULL);
+	stream.ris_content = false;
+	stream.ris_count = 0;
+	stream.ris_id = g_atomic_int_add(&rpct_stream_seq, 1);
+	buf = g_malloc(IDL_STREAM_BUFSIZE);
+
+	for (;;) {
+		ret = read(fd, buf, IDL_STREAM_BUFSIZE);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			rpc_set_last_errorf(errno, "Cannot read IDL stream: %s",
+			    g_strerror(errno));
+			result = -1;
+			break;
+		}
 
-	rpc_set_last_errorf(ENOTSUP, "Not implemented");
-	return (-1);
+		if (ret == 0) {
+			/* Last line might not be terminated */
+			if (stream.ris_line->len > 0)
+				result = rpct_idl_stream_line(&stream);
+
+			if (result == 0)
+				result = rpct_idl_stream_flush(&stream);
+
+			break;
+		}
+
+		if (rpct_idl_stream_feed(&stream, buf, (size_t)ret) != 0) {
+			result = -1;
+			break;
+		}
+	}
+
+	close(fd);
+	g_free(buf);
+	g_string_free(stream.ris_doc, true);
+	g_string_free(stream.ris_line, true);
+	return (result);
 }
 
 int
@@ -1811,17 +2735,22 @@ rpct_load_types_cached(void)
 {
 	GHashTableIter iter;
 	struct rpct_file *file;
+	int ret = 0;
 
+	g_rec_mutex_lock(&context->load_lock);
 	g_hash_table_iter_init(&iter, context->files);
 	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&file)) {
 		if (file->loaded)
 			continue;
 
-		if (rpct_load_types(file->path) != 0)
-			return (-1);
+		if (rpct_load_types(file->path) != 0) {
+			ret = -1;
+			break;
+		}
 	}
 
-	return (0);
+	g_rec_mutex_unlock(&context->load_lock);
+	return (ret);
 }
 
 const char *
@@ -2058,18 +2987,21 @@ rpct_argument_get_typei(rpct_argument_t arg)
 bool
 rpct_types_apply(rpct_type_applier_t applier)
 {
-	GHashTableIter iter;
-	char *key;
-	rpct_type_t value;
+	GPtrArray *types;
+	bool ret = true;
+	guint i;
 
-	g_hash_table_iter_init(&iter, context->types);
-	while (g_hash_table_iter_next(&iter, (gpointer *)&key,
-	    (gpointer *)&value)) {
-		if (!applier(value))
-			return (false);
+	rpct_resolve_all();
+	types = rpct_context_snapshot(context->types);
+	for (i = 0; i < types->len; i++) {
+		if (!applier(g_ptr_array_index(types, i))) {
+			ret = false;
+			break;
+		}
 	}
 
-	return (true);
+	g_ptr_array_free(types, true);
+	return (ret);
 }
 
 bool
@@ -2094,20 +3026,20 @@ rpct_members_apply(rpct_type_t type, rpct_member_applier_t applier)
 bool
 rpct_interface_apply(rpct_interface_applier_t applier)
 {
-	GHashTableIter iter;
-	char *key;
-	struct rpct_interface *value;
+	GPtrArray *interfaces;
 	bool flag = false;
+	guint i;
 
-	g_hash_table_iter_init(&iter, context->interfaces);
-	while (g_hash_table_iter_next(&iter, (gpointer *)&key,
-	    (gpointer *)&value)) {
-		if (!applier(value)) {
+	rpct_resolve_all();
+	interfaces = rpct_context_snapshot(context->interfaces);
+	for (i = 0; i < interfaces->len; i++) {
+		if (!applier(g_ptr_array_index(interfaces, i))) {
 			flag = true;
 			break;
 		}
 	}
 
+	g_ptr_array_free(interfaces, true);
 	return (flag);
 }
 
@@ -2134,8 +3066,24 @@ rpct_interface_t
 rpct_find_interface(const char *name)
 {
 	struct rpct_interface *iface;
+	struct rpct_decl *decl;
+
+	iface = rpct_context_lookup(&context->interfaces_lookup, name);
+	if (iface == NULL) {
+		g_rec_mutex_lock(&context->load_lock);
+		iface = g_hash_table_lookup(context->interfaces, name);
+		decl = g_hash_table_lookup(context->interface_index, name);
+		if (iface == NULL && decl != NULL &&
+		    rpct_decl_should_read(decl)) {
+			rpct_read_interface(decl->file, decl->decl, decl->body);
+			iface = g_hash_table_lookup(context->interfaces, name);
+			if (iface == NULL)
+				rpct_decl_set_failed(decl);
+		}
+
+		g_rec_mutex_unlock(&context->load_lock);
+	}
 
-	iface = g_hash_table_lookup(context->interfaces, name);
 	if (iface == NULL) {
 		rpc_set_last_errorf(ENOENT, "Interface not found");
 		return (NULL);
@@ -2263,15 +3211,39 @@ rpct_derive_error_context(struct rpct_error_context *newctx,
     struct rpct_error_context *oldctx, const char *name)
 {
 
-	newctx->path = g_strdup_printf("%s.%s", oldctx->path, name);
+	newctx->path = NULL;
+	newctx->parent = oldctx;
+	newctx->name = name;
+	newctx->index = 0;
 	newctx->errors = oldctx->errors;
 }
 
 void
-rpct_release_error_context(struct rpct_error_context *ctx)
+rpct_derive_error_context_index(struct rpct_error_context *newctx,
+    struct rpct_error_context *oldctx, size_t index)
+{
+
+	newctx->path = NULL;
+	newctx->parent = oldctx;
+	newctx->name = NULL;
+	newctx->index = index;
+	newctx->errors = oldctx->errors;
+}
+
+static void
+rpct_format_error_path(struct rpct_error_context *ctx, GString *path)
 {
 
-	g_free(ctx->path);
+	if (ctx->parent == NULL) {
+		g_string_append(path, ctx->path);
+		return;
+	}
+
+	rpct_format_error_path(ctx->parent, path);
+	if (ctx->name != NULL)
+		g_string_append_printf(path, ".%s", ctx->name);
+	else
+		g_string_append_printf(path, ".%zu", ctx->index);
 }
 
 void
@@ -2280,10 +3252,14 @@ rpct_add_error(struct rpct_error_context *ctx, rpc_object_t extra,
 {
 	va_list ap;
 	struct rpct_validation_error *err;
+	GString *path;
+
+	path = g_string_new(NULL);
+	rpct_format_error_path(ctx, path);
 
 	va_start(ap, fmt);
 	err = g_malloc0(sizeof(*err));
-	err->path = g_strdup(ctx->path);
+	err->path = g_string_free(path, false);
 	err->message = g_strdup_vprintf(fmt, ap);
 	err->extra = extra;
 	va_end(ap);
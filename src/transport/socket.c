@@ -41,11 +41,13 @@
 #include "../internal.h"
 
 #define SC_ABORT_TIMEOUT 30
+#define SC_SEND_STACK_ITEMS 8
 
 static GSocketAddress *socket_parse_uri(const char *);
 static int socket_connect(struct rpc_connection *, const char *, rpc_object_t);
 static int socket_listen(struct rpc_server *, const char *, rpc_object_t);
 static int socket_send_msg(void *, const void *, size_t, const int *, size_t);
+static int socket_send_msgv(void *, struct rpc_send_item *const *, size_t);
 static int socket_teardown(struct rpc_server *);
 static int socket_abort(void *);
 static int socket_get_fd(void *);
@@ -207,6 +209,7 @@ socket_accept(GObject *source __unused, GAsyncResult *result, void *data)
 
 	rco = rpc_connection_alloc(srv);
 	rco->rco_send_msg = socket_send_msg;
+	rco->rco_send_msgv = socket_send_msgv;
 	rco->rco_get_fd = socket_get_fd;
 	rco->rco_arg = conn;
 	conn->sc_parent = rco;
@@ -294,6 +297,7 @@ socket_connect(struct rpc_connection *rco, const char *uri,
 
 	conn->sc_socket = sock;
 	rco->rco_send_msg = socket_send_msg;
+	rco->rco_send_msgv = socket_send_msgv;
 	rco->rco_get_fd = socket_get_fd;
 	conn->sc_cancellable = g_cancellable_new ();
 	conn->sc_reader_thread = g_thread_new("socket reader thread",
@@ -409,23 +413,70 @@ socket_listen(struct rpc_server *srv, const char *uri,
 static int
 socket_send_msg(void *arg, const void *buf, size_t size, const int *fds,
     size_t nfds)
+{
+	struct rpc_send_item item = {
+		.rsi_buf = (void *)buf,
+		.rsi_len = size,
+		.rsi_fds = (int *)fds,
+		.rsi_nfds = nfds
+	};
+	struct rpc_send_item *items[1] = { &item };
+
+	return (socket_send_msgv(arg, items, 1));
+}
+
+static int
+socket_send_msgv(void *arg, struct rpc_send_item *const *items,
+    size_t nitems)
 {
 	struct socket_connection *conn = arg;
 	GError *err = NULL;
 	GSocketControlMessage *cmsg[2] = { NULL };
-	GOutputVector iov[2];
-	uint32_t header[4] = { 0xdeadbeef, (uint32_t)size, 0, 0 };
+	GOutputVector iov_stack[SC_SEND_STACK_ITEMS * 2];
+	uint32_t headers_stack[SC_SEND_STACK_ITEMS * 4];
+	GOutputVector *iov = iov_stack;
+	uint32_t *headers = headers_stack;
+	size_t niov = nitems * 2;
+	size_t total = 0;
 	size_t done = 0;
+	size_t nfds = 0;
+	const int *fds = NULL;
 	ssize_t step;
 	size_t tmp;
 	int ncmsg = 0;
 	int ret = 0;
-	int i;
+	size_t i;
 
-	debugf("sending frame: addr=%p, len=%zu, nfds=%zu", buf, size, nfds);
+	/* Single frames and small batches don't need the heap */
+	if (nitems > SC_SEND_STACK_ITEMS) {
+		iov = g_new0(GOutputVector, niov);
+		headers = g_new0(uint32_t, nitems * 4);
+	}
 
-	iov[0] = (GOutputVector){ .buffer = header, .size = sizeof(header) };
-	iov[1] = (GOutputVector){ .buffer = buf, .size = size };
+	for (i = 0; i < nitems; i++) {
+		debugf("sending frame: addr=%p, len=%zu, nfds=%zu",
+		    items[i]->rsi_buf, items[i]->rsi_len, items[i]->rsi_nfds);
+
+		headers[i * 4] = 0xdeadbeef;
+		headers[i * 4 + 1] = (uint32_t)items[i]->rsi_len;
+		headers[i * 4 + 2] = 0;
+		headers[i * 4 + 3] = 0;
+		iov[i * 2] = (GOutputVector){
+			.buffer = &headers[i * 4],
+			.size = sizeof(uint32_t) * 4
+		};
+		iov[i * 2 + 1] = (GOutputVector){
+			.buffer = items[i]->rsi_buf,
+			.size = items[i]->rsi_len
+		};
+		total += sizeof(uint32_t) * 4 + items[i]->rsi_len;
+
+		if (items[i]->rsi_nfds > 0) {
+			/* Callers never batch more than one frame with fds */
+			fds = items[i]->rsi_fds;
+			nfds = items[i]->rsi_nfds;
+		}
+	}
 
 #ifndef _WIN32
 	if (g_unix_credentials_message_is_supported()) {
@@ -441,8 +492,8 @@ socket_send_msg(void *arg, const void *buf, size_t size, const int *fds,
 #endif
 
 	for (;;) {
-		step = g_socket_send_message(conn->sc_socket, NULL, iov, 2,
-		    cmsg, ncmsg, 0, NULL, &err);
+		step = g_socket_send_message(conn->sc_socket, NULL, iov,
+		    (gint)niov, cmsg, ncmsg, 0, NULL, &err);
 		if (err != NULL) {
 			conn->sc_parent->rco_error =
 			    rpc_error_create_from_gerror(err);
@@ -460,10 +511,10 @@ socket_send_msg(void *arg, const void *buf, size_t size, const int *fds,
 
 		done += step;
 
-		if (done == size + sizeof(header))
+		if (done == total)
 			break;
 
-		for (i = 0; i < 2; i++) {
+		for (i = 0; i < niov; i++) {
 			tmp = MIN((size_t)step, (size_t)iov[i].size);
 			iov[i].size -= tmp;
 			iov[i].buffer += tmp;
@@ -472,9 +523,14 @@ socket_send_msg(void *arg, const void *buf, size_t size, const int *fds,
 	}
 
 done:
-	for (i = 0; i < ncmsg; i++)
+	for (i = 0; i < (size_t)ncmsg; i++)
 		g_object_unref(cmsg[i]);
 
+	if (iov != iov_stack) {
+		g_free(iov);
+		g_free(headers);
+	}
+
 	return (ret);
 }
 
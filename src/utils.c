@@ -39,6 +39,18 @@ SET_DECLARE(vr_set, struct rpct_validator);
 SET_DECLARE(cs_set, struct rpct_class_handler);
 static GPrivate rpc_last_error = G_PRIVATE_INIT((GDestroyNotify)rpc_release_impl);
 
+#define	REGEX_CACHE_SIZE	128
+
+struct rpc_regex_entry
+{
+	char *			rre_pattern;
+	GRegex *		rre_regex;	/* NULL if the pattern is invalid */
+};
+
+static GMutex rpc_regex_mtx;
+static GHashTable *rpc_regex_table;
+static GQueue rpc_regex_lru = G_QUEUE_INIT;
+
 const struct rpc_transport *
 rpc_find_transport(const char *scheme)
 {
@@ -103,6 +115,66 @@ rpc_find_class_handler(const char *name, rpct_class_t cls)
 	return (NULL);
 }
 
+/*
+ * Returns a compiled regular expression for @p pattern, or NULL if it
+ * doesn't compile. Compiled patterns are kept in a small LRU shared by
+ * validators and queries. Patterns that fail to compile are cached as
+ * well, so they are neither recompiled nor reported again; callers
+ * surface the failure their own way. The caller owns the returned
+ * reference.
+ */
+GRegex *
+rpc_regex_get(const char *pattern)
+{
+	struct rpc_regex_entry *entry;
+	GRegex *regex;
+	GList *link;
+
+	g_mutex_lock(&rpc_regex_mtx);
+	if (rpc_regex_table == NULL)
+		rpc_regex_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	link = g_hash_table_lookup(rpc_regex_table, pattern);
+	if (link != NULL) {
+		g_queue_unlink(&rpc_regex_lru, link);
+		g_queue_push_head_link(&rpc_regex_lru, link);
+		entry = link->data;
+		regex = entry->rre_regex != NULL
+		    ? g_regex_ref(entry->rre_regex)
+		    : NULL;
+		g_mutex_unlock(&rpc_regex_mtx);
+		return (regex);
+	}
+
+	g_mutex_unlock(&rpc_regex_mtx);
+
+	/* Compile outside of the lock */
+	regex = g_regex_new(pattern, G_REGEX_OPTIMIZE, 0, NULL);
+
+	g_mutex_lock(&rpc_regex_mtx);
+	if (!g_hash_table_contains(rpc_regex_table, pattern)) {
+		entry = g_malloc(sizeof(*entry));
+		entry->rre_pattern = g_strdup(pattern);
+		entry->rre_regex = regex != NULL ? g_regex_ref(regex) : NULL;
+		g_queue_push_head(&rpc_regex_lru, entry);
+		g_hash_table_insert(rpc_regex_table, entry->rre_pattern,
+		    g_queue_peek_head_link(&rpc_regex_lru));
+	}
+
+	while (g_queue_get_length(&rpc_regex_lru) > REGEX_CACHE_SIZE) {
+		entry = g_queue_pop_tail(&rpc_regex_lru);
+		g_hash_table_remove(rpc_regex_table, entry->rre_pattern);
+		if (entry->rre_regex != NULL)
+			g_regex_unref(entry->rre_regex);
+
+		g_free(entry->rre_pattern);
+		g_free(entry);
+	}
+
+	g_mutex_unlock(&rpc_regex_mtx);
+	return (regex);
+}
+
 void
 rpc_set_last_error(int code, const char *msg, rpc_object_t extra)
 {
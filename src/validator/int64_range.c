@@ -28,16 +28,36 @@
 #include "../linker_set.h"
 #include "../internal.h"
 
+struct int64_range
+{
+	int64_t		min;
+	int64_t		max;
+};
+
+static void *
+prepare_int64_range(rpc_object_t params)
+{
+	struct int64_range *range;
+
+	range = g_malloc(sizeof(*range));
+	range->min = -1;
+	range->max = -1;
+	rpc_object_unpack(params, "{i,i}", "min", &range->min,
+	    "max", &range->max);
+
+	return (range);
+}
+
 static bool
-validate_int64_range(rpc_object_t obj, rpc_object_t params,
+run_int64_range(rpc_object_t obj, void *state,
     struct rpct_typei *typei __unused, struct rpct_error_context *errctx)
 {
-	int64_t min = -1;
-	int64_t max = -1;
+	struct int64_range *range = state;
+	int64_t min = range->min;
+	int64_t max = range->max;
 	int64_t value;
 	bool valid = true;
 
-	rpc_object_unpack(params, "{i,i}", "min", &min, "max", &max);
 	value = rpc_int64_get_value(obj);
 
 	if (max != -1 && value > max) {
@@ -51,16 +71,31 @@ validate_int64_range(rpc_object_t obj, rpc_object_t params,
 		valid = false;
 		rpct_add_error(errctx, NULL,
 		    "Value %" PRId64 " is smaller than the minimum allowed: %" PRId64,
-		    value, max);
+		    value, min);
 	}
 
 	return (valid);
 }
 
+static bool
+validate_int64_range(rpc_object_t obj, rpc_object_t params,
+    struct rpct_typei *typei, struct rpct_error_context *errctx)
+{
+	struct int64_range range = { .min = -1, .max = -1 };
+
+	rpc_object_unpack(params, "{i,i}", "min", &range.min,
+	    "max", &range.max);
+
+	return (run_int64_range(obj, &range, typei, errctx));
+}
+
 struct rpct_validator validator_int64_range = {
 	.type = "int64",
 	.name = "range",
-	.validate = validate_int64_range
+	.validate = validate_int64_range,
+	.prepare = prepare_int64_range,
+	.run = run_int64_range,
+	.release = g_free
 };
 
 DECLARE_VALIDATOR(validator_int64_range);
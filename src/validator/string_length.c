@@ -27,16 +27,36 @@
 #include "../linker_set.h"
 #include "../internal.h"
 
+struct string_length
+{
+	int64_t		min;
+	int64_t		max;
+};
+
+static void *
+prepare_string_length(rpc_object_t params)
+{
+	struct string_length *limits;
+
+	limits = g_malloc(sizeof(*limits));
+	limits->min = -1;
+	limits->max = -1;
+	rpc_object_unpack(params, "{i,i}", "min", &limits->min,
+	    "max", &limits->max);
+
+	return (limits);
+}
+
 static bool
-validate_string_length(rpc_object_t obj, rpc_object_t params,
+run_string_length(rpc_object_t obj, void *state,
     struct rpct_typei *typei __unused, struct rpct_error_context *errctx)
 {
-	int64_t min = -1;
-	int64_t max = -1;
+	struct string_length *limits = state;
+	int64_t min = limits->min;
+	int64_t max = limits->max;
 	ssize_t length;
 	bool valid = true;
 
-	rpc_object_unpack(params, "{i,i}", "min", &min, "max", &max);
 	length = rpc_string_get_length(obj);
 
 	if (max != -1 && length > max) {
@@ -56,10 +76,25 @@ validate_string_length(rpc_object_t obj, rpc_object_t params,
 	return (valid);
 }
 
+static bool
+validate_string_length(rpc_object_t obj, rpc_object_t params,
+    struct rpct_typei *typei, struct rpct_error_context *errctx)
+{
+	struct string_length limits = { .min = -1, .max = -1 };
+
+	rpc_object_unpack(params, "{i,i}", "min", &limits.min,
+	    "max", &limits.max);
+
+	return (run_string_length(obj, &limits, typei, errctx));
+}
+
 struct rpct_validator validator_string_length = {
 	.type = "string",
 	.name = "length",
-	.validate = validate_string_length
+	.validate = validate_string_length,
+	.prepare = prepare_string_length,
+	.run = run_string_length,
+	.release = g_free
 };
 
 DECLARE_VALIDATOR(validator_string_length);
@@ -28,29 +28,59 @@
 #include "../linker_set.h"
 #include "../internal.h"
 
+static void *
+prepare_string_regex(rpc_object_t params)
+{
+	const char *pattern = NULL;
+
+	if (rpc_object_unpack(params, "{s}", "pattern", &pattern) < 1)
+		return (NULL);
+
+	return (rpc_regex_get(pattern));
+}
+
 static bool
-validate_string_regex(rpc_object_t obj, rpc_object_t params,
+run_string_regex(rpc_object_t obj, void *state,
     struct rpct_typei *typei __unused, struct rpct_error_context *errctx)
 {
-	bool valid = true;
-	const char *pattern;
+	GRegex *regex = state;
 	const char *str;
 
-	rpc_object_unpack(params, "{s}", "pattern", &pattern);
 	str = rpc_string_get_string_ptr(obj);
 
-	if (!g_regex_match_simple(pattern, str, 0, 0)) {
-		valid = false;
+	if (!g_regex_match(regex, str, 0, NULL)) {
 		rpct_add_error(errctx, NULL, "String doesn't match");
+		return (false);
+	}
+
+	return (true);
+}
+
+static bool
+validate_string_regex(rpc_object_t obj, rpc_object_t params,
+    struct rpct_typei *typei, struct rpct_error_context *errctx)
+{
+	GRegex *regex;
+	bool valid;
+
+	regex = prepare_string_regex(params);
+	if (regex == NULL) {
+		rpct_add_error(errctx, NULL, "Invalid pattern");
+		return (false);
 	}
 
+	valid = run_string_regex(obj, regex, typei, errctx);
+	g_regex_unref(regex);
 	return (valid);
 }
 
 struct rpct_validator validator_string_regex = {
 	.type = "string",
 	.name = "regex",
-	.validate = validate_string_regex
+	.validate = validate_string_regex,
+	.prepare = prepare_string_regex,
+	.run = run_string_regex,
+	.release = (GDestroyNotify)g_regex_unref
 };
 
 DECLARE_VALIDATOR(validator_string_regex);
@@ -1433,34 +1433,370 @@ SCENARIO("RPC_DESCRIPTION_TEST", "Create a tree of RPC objects and print their d
 #include "../tests.h"
 #include "../../src/linker_set.h"
 #include <glib.h>
+#include <errno.h>
+#include <rpc/object.h>
+#include <rpc/typing.h>
 
+#define	OBJECT_NFORMATS		1024
 
 typedef struct {
-
+	rpc_object_t	obj;
+	rpc_object_t	result;
+	rpc_pack_fmt_t	fmt;
 } object_fixture;
 
 static void
-object_test(object_fixture *fixture, gconstpointer user_data)
+object_test_array_set_up(object_fixture *fixture, gconstpointer user_data)
 {
 
+	fixture->obj = rpc_object_pack("[i,i,i,i]", (int64_t)10, (int64_t)11,
+	    (int64_t)12, (int64_t)13);
+	fixture->result = NULL;
+	fixture->fmt = NULL;
 }
 
 static void
-object_test_single_set_up(object_fixture *fixture, gconstpointer user_data)
+object_test_dict_set_up(object_fixture *fixture, gconstpointer user_data)
 {
 
+	fixture->obj = rpc_object_pack("{a:i,c:i}", (int64_t)1, (int64_t)3);
+	fixture->result = NULL;
+	fixture->fmt = NULL;
 }
 
 static void
 object_test_tear_down(object_fixture *fixture, gconstpointer user_data)
 {
 
+	rpc_release(fixture->obj);
+	if (fixture->result != NULL)
+		rpc_release(fixture->result);
+
+	rpc_pack_fmt_release(fixture->fmt);
+}
+
+static void
+object_test_unpack_index(object_fixture *fixture, gconstpointer user_data)
+{
+	int64_t a = -1;
+	int64_t b = -1;
+	int64_t c = -1;
+	int64_t d = -1;
+
+	/* An explicit index doesn't advance the implicit one */
+	g_assert_cmpint(rpc_object_unpack(fixture->obj, "[2:i,i]", &a, &b),
+	    ==, 2);
+	g_assert_cmpint(a, ==, 12);
+	g_assert_cmpint(b, ==, 12);
+
+	fixture->fmt = rpc_pack_fmt_compile("[i,3:i,0:i,i]");
+	g_assert_nonnull(fixture->fmt);
+	g_assert_cmpint(rpc_object_unpack_compiled(fixture->obj, fixture->fmt,
+	    &a, &b, &c, &d), ==, 4);
+	g_assert_cmpint(a, ==, 10);
+	g_assert_cmpint(b, ==, 13);
+	g_assert_cmpint(c, ==, 10);
+	g_assert_cmpint(d, ==, 10);
+}
+
+static void
+object_test_unpack_skip(object_fixture *fixture, gconstpointer user_data)
+{
+	int64_t a = -1;
+	int64_t b = -1;
+	int64_t c = -1;
+
+	/* '*' takes an argument only when the index is missing */
+	g_assert_cmpint(rpc_object_unpack(fixture->obj, "[*,i,*,*,*,i]",
+	    &a, &b, &c), ==, 4);
+	g_assert_cmpint(a, ==, 11);
+	g_assert_cmpint(b, ==, -1);
+	g_assert_cmpint(c, ==, -1);
+
+	fixture->fmt = rpc_pack_fmt_compile("[*,*,i,*,*,i]");
+	g_assert_nonnull(fixture->fmt);
+	g_assert_cmpint(rpc_object_unpack_compiled(fixture->obj, fixture->fmt,
+	    &a, &b, &c), ==, 4);
+	g_assert_cmpint(a, ==, 12);
+	g_assert_cmpint(b, ==, -1);
+	g_assert_cmpint(c, ==, -1);
+}
+
+static void
+object_test_unpack_rest(object_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t expected;
+	int64_t a = -1;
+
+	/* R starts one past the index following it */
+	expected = rpc_object_pack("[i]", (int64_t)13);
+	g_assert_cmpint(rpc_object_unpack(fixture->obj, "[i,R]", &a,
+	    &fixture->result), ==, 2);
+	g_assert_cmpint(a, ==, 10);
+	g_assert_true(rpc_equal(fixture->result, expected));
+	rpc_release(fixture->result);
+	fixture->result = NULL;
+	rpc_release(expected);
+
+	expected = rpc_object_pack("[i,i]", (int64_t)12, (int64_t)13);
+	fixture->fmt = rpc_pack_fmt_compile("[1:R]");
+	g_assert_nonnull(fixture->fmt);
+	g_assert_cmpint(rpc_object_unpack_compiled(fixture->obj, fixture->fmt,
+	    &fixture->result), ==, 1);
+	g_assert_true(rpc_equal(fixture->result, expected));
+	rpc_release(expected);
+}
+
+static void
+object_test_unpack_missing(object_fixture *fixture, gconstpointer user_data)
+{
+	int64_t a = -1;
+	int64_t b = -1;
+	int64_t c = -1;
+
+	g_assert_cmpint(rpc_object_unpack(fixture->obj, "{a:i,b:i,c:i}",
+	    &a, &b, &c), ==, 2);
+	g_assert_cmpint(a, ==, 1);
+	g_assert_cmpint(b, ==, -1);
+	g_assert_cmpint(c, ==, 3);
+
+	a = c = -1;
+	fixture->fmt = rpc_pack_fmt_compile("{b:i,a:i,c:i}");
+	g_assert_nonnull(fixture->fmt);
+	g_assert_cmpint(rpc_object_unpack_compiled(fixture->obj, fixture->fmt,
+	    &b, &a, &c), ==, 2);
+	g_assert_cmpint(a, ==, 1);
+	g_assert_cmpint(b, ==, -1);
+	g_assert_cmpint(c, ==, 3);
+}
+
+static void
+object_test_unpack_interp(object_fixture *fixture, gconstpointer user_data)
+{
+	const char *formats[] = {
+		"[i,i]", "[2:i,i]", "[i,3:i,0:i,i]", "[*,i,*,*,*,i]",
+		"[*,*,i,*,i]", "[i,i,i,i,i,i]", "[5:i,i]", "[1:*,i]",
+		"[3:i,1:i,i]", NULL
+	};
+	const char **fmt;
+	char *copy;
+	int64_t cached[6];
+	int64_t interp[6];
+	int ret;
+	guint i;
+
+	/*
+	 * Literal formats are compiled and cached, copies on the heap are
+	 * interpreted. Both have to agree on every argument.
+	 */
+	for (fmt = formats; *fmt != NULL; fmt++) {
+		for (i = 0; i < 6; i++)
+			cached[i] = interp[i] = -1;
+
+		copy = g_strdup(*fmt);
+		ret = rpc_object_unpack(fixture->obj, *fmt, &cached[0],
+		    &cached[1], &cached[2], &cached[3], &cached[4], &cached[5]);
+		g_assert_cmpint(rpc_object_unpack(fixture->obj, copy,
+		    &interp[0], &interp[1], &interp[2], &interp[3], &interp[4],
+		    &interp[5]), ==, ret);
+		g_free(copy);
+
+		for (i = 0; i < 6; i++)
+			g_assert_cmpint(cached[i], ==, interp[i]);
+	}
+}
+
+static void
+object_test_pack_literal(object_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t expected;
+
+	expected = rpc_object_pack("[s,i]", "a", (int64_t)1);
+	fixture->result = rpc_object_pack("['a',i]", (int64_t)1);
+	g_assert_true(rpc_equal(fixture->result, expected));
+	rpc_release(fixture->result);
+	rpc_release(expected);
+
+	expected = rpc_object_pack("{k:s,n:i}", "v", (int64_t)5);
+	fixture->fmt = rpc_pack_fmt_compile("{k:'v',n:i}");
+	g_assert_nonnull(fixture->fmt);
+	fixture->result = rpc_object_pack_compiled(fixture->fmt, (int64_t)5);
+	g_assert_true(rpc_equal(fixture->result, expected));
+	rpc_release(expected);
+}
+
+static void
+object_test_compile_invalid(object_fixture *fixture, gconstpointer user_data)
+{
+	const char *formats[] = {
+		"", "i,i", "[i,", "{a:}", "[x]", "[<int64>i]", "'abc", "['a']",
+		NULL
+	};
+	const char **fmt;
+
+	for (fmt = formats; *fmt != NULL; fmt++) {
+		errno = 0;
+		g_assert_null(rpc_pack_fmt_compile(*fmt));
+		g_assert_cmpint(errno, ==, EINVAL);
+	}
+
+	rpc_pack_fmt_release(NULL);
+}
+
+static void
+object_test_compile_reuse(object_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t expected;
+	const char *name;
+	int64_t a;
+	int64_t b;
+	bool flag;
+	int64_t i;
+
+	fixture->fmt = rpc_pack_fmt_compile("{name:s,values:[i,i],flag:b}");
+	g_assert_nonnull(fixture->fmt);
+
+	for (i = 0; i < 4; i++) {
+		expected = rpc_object_pack("{name:s,values:[i,i],flag:b}",
+		    "test", i, i + 1, i % 2 == 0);
+		fixture->result = rpc_object_pack_compiled(fixture->fmt,
+		    "test", i, i + 1, i % 2 == 0);
+		g_assert_true(rpc_equal(fixture->result, expected));
+		rpc_release(expected);
+
+		g_assert_cmpint(rpc_object_unpack_compiled(fixture->result,
+		    fixture->fmt, &name, &a, &b, &flag), ==, 4);
+		g_assert_cmpstr(name, ==, "test");
+		g_assert_cmpint(a, ==, i);
+		g_assert_cmpint(b, ==, i + 1);
+		g_assert_true(flag == (i % 2 == 0));
+
+		rpc_release(fixture->result);
+		fixture->result = NULL;
+	}
+}
+
+static void
+object_test_compile_cache(object_fixture *fixture, gconstpointer user_data)
+{
+	char *formats[OBJECT_NFORMATS];
+	rpc_object_t obj;
+	int64_t value;
+	guint i;
+	guint n;
+
+	/* Formats built at runtime are interpreted, not cached */
+	for (i = 0; i < OBJECT_NFORMATS; i++)
+		formats[i] = g_strdup_printf("[%u:i]", i % 64);
+
+	for (n = 0; n < 2; n++) {
+		for (i = 0; i < OBJECT_NFORMATS; i++) {
+			obj = rpc_object_pack(formats[i], (int64_t)i);
+			g_assert_nonnull(obj);
+			value = -1;
+			g_assert_cmpint(rpc_object_unpack(obj, formats[i],
+			    &value), ==, 1);
+			g_assert_cmpint(value, ==, i);
+			rpc_release(obj);
+		}
+	}
+
+	/* Freed buffers get reused for different formats */
+	for (i = 0; i < OBJECT_NFORMATS; i++) {
+		g_free(formats[i]);
+		formats[i] = g_strdup_printf("{k%u:i}", i);
+	}
+
+	for (i = 0; i < OBJECT_NFORMATS; i++) {
+		obj = rpc_object_pack(formats[i], (int64_t)i);
+		g_assert_cmpint(rpc_get_type(obj), ==, RPC_TYPE_DICTIONARY);
+		value = -1;
+		g_assert_cmpint(rpc_object_unpack(obj, formats[i], &value),
+		    ==, 1);
+		g_assert_cmpint(value, ==, i);
+		rpc_release(obj);
+		g_free(formats[i]);
+	}
+}
+
+static void
+object_test_compile_typing(object_fixture *fixture, gconstpointer user_data)
+{
+	const char *fmt = "<int64>i";
+
+	g_assert_cmpint(rpct_init(false), ==, 0);
+	fixture->fmt = rpc_pack_fmt_compile(fmt);
+	g_assert_nonnull(fixture->fmt);
+
+	fixture->result = rpc_object_pack(fmt, (int64_t)1);
+	g_assert_nonnull(fixture->result);
+	rpc_release(fixture->result);
+
+	/* Programs compiled earlier must not use the freed types */
+	rpct_free();
+	g_assert_null(rpc_object_pack_compiled(fixture->fmt, (int64_t)1));
+	g_assert_null(rpc_object_pack(fmt, (int64_t)1));
+
+	g_assert_cmpint(rpct_init(false), ==, 0);
+	fixture->result = rpc_object_pack_compiled(fixture->fmt, (int64_t)2);
+	g_assert_nonnull(fixture->result);
+	g_assert_true(rpct_typei_get_type(rpct_get_typei(fixture->result)) ==
+	    rpct_get_type("int64"));
+	rpc_release(fixture->result);
+
+	fixture->result = rpc_object_pack(fmt, (int64_t)3);
+	g_assert_nonnull(fixture->result);
+	g_assert_true(rpct_typei_get_type(rpct_get_typei(fixture->result)) ==
+	    rpct_get_type("int64"));
+	rpc_release(fixture->result);
+	fixture->result = NULL;
+
+	rpct_free();
 }
 
 static void
 object_test_register()
 {
 
+	g_test_add("/object/unpack/index", object_fixture, NULL,
+	    object_test_array_set_up, object_test_unpack_index,
+	    object_test_tear_down);
+
+	g_test_add("/object/unpack/skip", object_fixture, NULL,
+	    object_test_array_set_up, object_test_unpack_skip,
+	    object_test_tear_down);
+
+	g_test_add("/object/unpack/rest", object_fixture, NULL,
+	    object_test_array_set_up, object_test_unpack_rest,
+	    object_test_tear_down);
+
+	g_test_add("/object/unpack/missing", object_fixture, NULL,
+	    object_test_dict_set_up, object_test_unpack_missing,
+	    object_test_tear_down);
+
+	g_test_add("/object/unpack/interp", object_fixture, NULL,
+	    object_test_array_set_up, object_test_unpack_interp,
+	    object_test_tear_down);
+
+	g_test_add("/object/pack/literal", object_fixture, NULL,
+	    object_test_array_set_up, object_test_pack_literal,
+	    object_test_tear_down);
+
+	g_test_add("/object/compile/invalid", object_fixture, NULL,
+	    object_test_array_set_up, object_test_compile_invalid,
+	    object_test_tear_down);
+
+	g_test_add("/object/compile/reuse", object_fixture, NULL,
+	    object_test_array_set_up, object_test_compile_reuse,
+	    object_test_tear_down);
+
+	g_test_add("/object/compile/cache", object_fixture, NULL,
+	    object_test_array_set_up, object_test_compile_cache,
+	    object_test_tear_down);
+
+	g_test_add("/object/compile/typing", object_fixture, NULL,
+	    object_test_array_set_up, object_test_compile_typing,
+	    object_test_tear_down);
 }
 
 static struct librpc_test object = {
@@ -1468,4 +1804,4 @@ static struct librpc_test object = {
     .register_f = &object_test_register
 };
 
-DECLARE_TEST(object);
\ No newline at end of file
+DECLARE_TEST(object);
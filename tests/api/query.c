@@ -28,34 +28,730 @@
 #include "../tests.h"
 #include "../../src/linker_set.h"
 #include <glib.h>
+#include <errno.h>
+#include <rpc/object.h>
+#include <rpc/query.h>
 
+#define	QUERY_NITEMS	10
+#define	QUERY_NLARGE	20000
+#define	QUERY_NPATTERNS	300	/* More than the regex cache holds */
 
 typedef struct {
-
+	rpc_object_t	array;
+	rpc_query_plan_t plan;
+	rpc_query_index_t index;
 } query_fixture;
 
+/*
+ * Runs a query and returns an array of everything it yielded.
+ */
+static rpc_object_t
+query_collect(rpc_object_t array, rpc_query_params_t params,
+    rpc_query_plan_t plan)
+{
+	rpc_query_iter_t iter;
+	rpc_object_t result;
+	rpc_object_t obj;
+	bool more;
+
+	result = rpc_array_create();
+	iter = rpc_query_compiled(array, params, plan);
+	g_assert_nonnull(iter);
+
+	do {
+		more = rpc_query_next(iter, &obj);
+		if (obj != NULL)
+			rpc_array_append_stolen_value(result, obj);
+	} while (more);
+
+	rpc_query_iter_free(iter);
+	return (result);
+}
+
+/*
+ * Compiles @p rules, which are consumed, and returns the number
+ * of matching elements of the fixture array.
+ */
+static size_t
+query_count(query_fixture *fixture, rpc_object_t rules)
+{
+	rpc_query_plan_t plan;
+	rpc_object_t result;
+	size_t count;
+
+	plan = rpc_query_compile(rules);
+	g_assert_nonnull(plan);
+
+	result = query_collect(fixture->array, NULL, plan);
+	count = rpc_array_get_count(result);
+
+	rpc_release(result);
+	rpc_query_plan_release(plan);
+	rpc_release(rules);
+	return (count);
+}
+
+/*
+ * Like query_count(), but also checks that the (possibly indexed)
+ * fixture array yields exactly what a plain scan of its copy does.
+ */
+static size_t
+query_count_indexed(query_fixture *fixture, rpc_object_t rules)
+{
+	rpc_query_plan_t plan;
+	rpc_object_t scan;
+	rpc_object_t expected;
+	rpc_object_t result;
+	size_t count;
+
+	plan = rpc_query_compile(rules);
+	g_assert_nonnull(plan);
+
+	scan = rpc_copy(fixture->array);
+	expected = query_collect(scan, NULL, plan);
+	result = query_collect(fixture->array, NULL, plan);
+	g_assert_true(rpc_equal(result, expected));
+	count = rpc_array_get_count(result);
+
+	rpc_release(result);
+	rpc_release(expected);
+	rpc_release(scan);
+	rpc_query_plan_release(plan);
+	rpc_release(rules);
+	return (count);
+}
+
 static void
-query_test(query_fixture *fixture, gconstpointer user_data)
+query_test_set_up(query_fixture *fixture, gconstpointer user_data)
+{
+	char *name;
+	int64_t i;
+
+	fixture->array = rpc_array_create();
+	fixture->plan = NULL;
+	fixture->index = NULL;
+
+	for (i = 0; i < QUERY_NITEMS; i++) {
+		name = g_strdup_printf("item%" G_GINT64_FORMAT, i);
+		rpc_array_append_stolen_value(fixture->array,
+		    rpc_object_pack("{name:s,value:i}", name, i));
+		g_free(name);
+	}
+
+	/* An element without the "value" field */
+	rpc_array_append_stolen_value(fixture->array,
+	    rpc_object_pack("{name:s}", "novalue"));
+}
+
+/*
+ * Runs a query in parallel and sequentially and checks that both
+ * yield the same. Returns the results of the parallel run.
+ */
+static rpc_object_t
+query_collect_parallel(rpc_object_t array, struct rpc_query_params params,
+    rpc_query_plan_t plan)
+{
+	rpc_object_t expected;
+	rpc_object_t result;
+
+	params.parallel = false;
+	expected = query_collect(array, &params, plan);
+	params.parallel = true;
+	result = query_collect(array, &params, plan);
+	g_assert_true(rpc_equal(result, expected));
+
+	rpc_release(expected);
+	return (result);
+}
+
+static int
+query_value_cmp(void *arg __unused, rpc_object_t o1, rpc_object_t o2)
 {
+	int64_t v1 = rpc_dictionary_get_int64(o1, "value");
+	int64_t v2 = rpc_dictionary_get_int64(o2, "value");
 
+	return ((v1 > v2) - (v1 < v2));
 }
 
 static void
-query_test_single_set_up(query_fixture *fixture, gconstpointer user_data)
+query_test_set_up_large(query_fixture *fixture, gconstpointer user_data)
 {
+	rpc_object_t rules;
+	char *name;
+	int64_t i;
+
+	fixture->array = rpc_array_create();
+	fixture->index = NULL;
+
+	for (i = 0; i < QUERY_NLARGE; i++) {
+		name = g_strdup_printf("item%" G_GINT64_FORMAT, i);
+		rpc_array_append_stolen_value(fixture->array,
+		    rpc_object_pack("{name:s,value:i}", name, i));
+		g_free(name);
+	}
 
+	/* Matches spread over the whole array */
+	rules = rpc_object_pack("[[s,s,s]]", "name", "~", "7$");
+	fixture->plan = rpc_query_compile(rules);
+	rpc_release(rules);
 }
 
 static void
 query_test_tear_down(query_fixture *fixture, gconstpointer user_data)
 {
 
+	if (fixture->index != NULL)
+		rpc_query_index_free(fixture->index);
+
+	rpc_query_plan_release(fixture->plan);
+	rpc_release(fixture->array);
+}
+
+static void
+query_test_compile(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t rules;
+	rpc_object_t result;
+
+	rules = rpc_string_create("value");
+	g_assert_null(rpc_query_compile(rules));
+	g_assert_cmpint(rpc_error_get_code(rpc_get_last_error()), ==, EINVAL);
+	rpc_release(rules);
+
+	rules = rpc_object_pack("[[s,s,i]]", "value", ">=", (int64_t)5);
+	fixture->plan = rpc_query_compile(rules);
+	rpc_release(rules);
+	g_assert_nonnull(fixture->plan);
+
+	/* The plan outlives the rules it was compiled from */
+	g_assert_true(rpc_query_plan_retain(fixture->plan) == fixture->plan);
+	rpc_query_plan_release(fixture->plan);
+	rpc_query_plan_release(NULL);
+
+	result = query_collect(fixture->array, NULL, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 5);
+	rpc_release(result);
+
+	/* Without rules nothing matches */
+	result = query_collect(fixture->array, NULL, NULL);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 0);
+	rpc_release(result);
+}
+
+static void
+query_test_reuse(query_fixture *fixture, gconstpointer user_data)
+{
+	struct rpc_query_params params = { .single = true };
+	rpc_object_t other;
+	rpc_object_t result;
+	rpc_object_t rules;
+	int i;
+
+	rules = rpc_object_pack("[[s,s,i]]", "value", ">=", (int64_t)5);
+	fixture->plan = rpc_query_compile(rules);
+
+	for (i = 0; i < 3; i++) {
+		result = query_collect(fixture->array, NULL, fixture->plan);
+		g_assert_cmpint(rpc_array_get_count(result), ==, 5);
+		rpc_release(result);
+	}
+
+	/* The same plan on another array and with other parameters */
+	other = rpc_object_pack("[{value:i},{value:i},{value:i}]",
+	    (int64_t)1, (int64_t)7, (int64_t)9);
+	result = query_collect(other, &params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 1);
+	g_assert_cmpint(rpc_dictionary_get_int64(
+	    rpc_array_get_value(result, 0), "value"), ==, 7);
+	rpc_release(result);
+
+	/* rpc_query_apply() evaluates the same rules on a single object */
+	result = rpc_query_apply(rpc_array_get_value(other, 1), rules);
+	g_assert_true(result == rpc_array_get_value(other, 1));
+	rpc_release(result);
+	g_assert_null(rpc_query_apply(rpc_array_get_value(other, 0), rules));
+
+	rpc_release(other);
+	rpc_release(rules);
+}
+
+static void
+query_test_logic(query_fixture *fixture, gconstpointer user_data)
+{
+
+	g_assert_cmpint(query_count(fixture, rpc_object_pack(
+	    "[[s,[[s,s,i],[s,[[s,s,i],[s,s,s]]]]]]",
+	    "or",
+	    "value", "<", (int64_t)2,
+	    "and",
+	    "value", ">", (int64_t)7,
+	    "name", "!=", "item9")), ==, 3);
+
+	/* A rule made of rules is an implicit "and" */
+	g_assert_cmpint(query_count(fixture, rpc_object_pack(
+	    "[[[s,s,i],[s,s,i]]]",
+	    "value", ">=", (int64_t)3,
+	    "value", "<=", (int64_t)4)), ==, 2);
+
+	g_assert_cmpint(query_count(fixture, rpc_object_pack(
+	    "[[s,[[s,s,i]]]]",
+	    "nor",
+	    "value", "<", (int64_t)8)), ==, 3);
+
+	/* Empty logic operators never match */
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,[]]]",
+	    "and")), ==, 0);
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,[]]]",
+	    "or")), ==, 0);
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,[]]]",
+	    "nor")), ==, 0);
+
+	/* So do unknown ones */
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,[]]]",
+	    "xor")), ==, 0);
+}
+
+static void
+query_test_regex(query_fixture *fixture, gconstpointer user_data)
+{
+
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,s,s]]",
+	    "name", "~", "^item[0-3]$")), ==, 4);
+
+	/* Invalid patterns and non-string operands never match */
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,s,s]]",
+	    "name", "~", "(")), ==, 0);
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,s,i]]",
+	    "name", "~", (int64_t)1)), ==, 0);
+	g_assert_cmpint(query_count(fixture, rpc_object_pack(
+	    "[[s,[[s,s,s]]]]", "nor", "name", "~", "(")), ==,
+	    QUERY_NITEMS + 1);
+}
+
+static void
+query_test_regex_cache(query_fixture *fixture, gconstpointer user_data)
+{
+	char *pattern;
+	int i;
+	int pass;
+
+	/* Cached patterns keep matching the same */
+	for (i = 0; i < 3; i++) {
+		g_assert_cmpint(query_count(fixture, rpc_object_pack(
+		    "[[s,s,s]]", "name", "~", "^item[0-3]$")), ==, 4);
+	}
+
+	/*
+	 * Go through enough distinct patterns to evict everything
+	 * a couple of times over; evicted ones are compiled again.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < QUERY_NPATTERNS; i++) {
+			pattern = g_strdup_printf("^item%d$|^none%d$",
+			    i % QUERY_NITEMS, i);
+			g_assert_cmpint(query_count(fixture, rpc_object_pack(
+			    "[[s,s,s]]", "name", "~", pattern)), ==, 1);
+			g_free(pattern);
+		}
+
+		g_assert_cmpint(query_count(fixture, rpc_object_pack(
+		    "[[s,s,s]]", "name", "~", "^item[0-3]$")), ==, 4);
+	}
+}
+
+static void
+query_test_regex_invalid(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t rules;
+	rpc_object_t error;
+	char *pattern;
+	int i;
+
+	rules = rpc_string_create("value");
+	g_assert_null(rpc_query_compile(rules));
+	rpc_release(rules);
+	error = rpc_get_last_error();
+	g_assert_cmpint(rpc_error_get_code(error), ==, EINVAL);
+
+	/*
+	 * Invalid patterns are cached like valid ones: they never match
+	 * and compiling them doesn't replace the last error, not even
+	 * after they were evicted.
+	 */
+	for (i = 0; i < QUERY_NPATTERNS; i++) {
+		g_assert_cmpint(query_count(fixture, rpc_object_pack(
+		    "[[s,s,s]]", "name", "~", "(")), ==, 0);
+
+		pattern = g_strdup_printf("(%d", i);
+		g_assert_cmpint(query_count(fixture, rpc_object_pack(
+		    "[[s,s,s]]", "name", "~", pattern)), ==, 0);
+		g_free(pattern);
+	}
+
+	g_assert_true(rpc_get_last_error() == error);
+}
+
+static void
+query_test_missing(query_fixture *fixture, gconstpointer user_data)
+{
+
+	/* A field operator on a missing field never matches */
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,s,i]]",
+	    "value", "!=", (int64_t)100)), ==, QUERY_NITEMS);
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,s,[i,i]]]",
+	    "value", "nin", (int64_t)1, (int64_t)2)), ==, QUERY_NITEMS - 2);
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,s,n]]",
+	    "value", "=")), ==, 0);
+	g_assert_cmpint(query_count(fixture, rpc_object_pack("[[s,s,i]]",
+	    "missing.path.0", "!=", (int64_t)1)), ==, 0);
+
+	/* But it can be negated */
+	g_assert_cmpint(query_count(fixture, rpc_object_pack(
+	    "[[s,[[s,s,i]]]]", "nor", "value", "!=", (int64_t)100)), ==, 1);
+}
+
+static void
+query_test_index_hash(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t object;
+
+	object = rpc_string_create("value");
+	g_assert_null(rpc_query_index_create(object, "value",
+	    RPC_QUERY_INDEX_HASH));
+	g_assert_cmpint(rpc_error_get_code(rpc_get_last_error()), ==, EINVAL);
+	rpc_release(object);
+
+	fixture->index = rpc_query_index_create(fixture->array, "value",
+	    RPC_QUERY_INDEX_HASH);
+	g_assert_nonnull(fixture->index);
+
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)3)), ==, 1);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)100)), ==, 0);
+
+	/* Duplicate operands yield an element once, in the array order */
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,[i,i,i,i]]]", "value", "in", (int64_t)7, (int64_t)1,
+	    (int64_t)7, (int64_t)100)), ==, 2);
+
+	/* The remaining rules still apply to the candidates */
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,[i,i]],[s,s,s]]", "value", "in", (int64_t)1, (int64_t)2,
+	    "name", "=", "item2")), ==, 1);
+}
+
+static void
+query_test_index_sorted(query_fixture *fixture, gconstpointer user_data)
+{
+
+	fixture->index = rpc_query_index_create(fixture->array, "value",
+	    RPC_QUERY_INDEX_SORTED);
+	g_assert_nonnull(fixture->index);
+
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i],[s,s,i]]", "value", ">=", (int64_t)3,
+	    "value", "<", (int64_t)7)), ==, 4);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", ">", (int64_t)7)), ==, 2);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "<=", (int64_t)0)), ==, 1);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)5)), ==, 1);
+
+	/* Disjoint ranges leave no candidates */
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i],[s,s,i]]", "value", ">", (int64_t)5,
+	    "value", "<", (int64_t)3)), ==, 0);
+
+	/* Rules the index can't serve fall back to a scan */
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,s]]", "name", "~", "^item[12]$")), ==, 2);
+}
+
+static void
+query_test_index_update(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_query_index_t sorted;
+
+	fixture->index = rpc_query_index_create(fixture->array, "value",
+	    RPC_QUERY_INDEX_HASH);
+	sorted = rpc_query_index_create(fixture->array, "value",
+	    RPC_QUERY_INDEX_SORTED);
+
+	rpc_array_append_stolen_value(fixture->array,
+	    rpc_object_pack("{name:s,value:i}", "appended", (int64_t)3));
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)3)), ==, 2);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", ">=", (int64_t)3)), ==, 8);
+
+	/* Removal shifts the positions of the following elements */
+	rpc_array_remove_index(fixture->array, 0);
+	rpc_array_remove_index(fixture->array, 4);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)0)), ==, 0);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)5)), ==, 0);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,[i,i]]]", "value", "in", (int64_t)3, (int64_t)9)), ==, 3);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "<", (int64_t)5)), ==, 5);
+
+	/* Arrays without indexes are unaffected */
+	rpc_query_index_free(sorted);
+	rpc_query_index_free(fixture->index);
+	fixture->index = NULL;
+	rpc_array_append_stolen_value(fixture->array,
+	    rpc_object_pack("{value:i}", (int64_t)3));
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)3)), ==, 3);
+}
+
+static void
+query_test_index_stale(query_fixture *fixture, gconstpointer user_data)
+{
+	rpc_query_index_t sorted;
+	rpc_object_t result;
+	rpc_object_t rules;
+
+	fixture->index = rpc_query_index_create(fixture->array, "value",
+	    RPC_QUERY_INDEX_HASH);
+	sorted = rpc_query_index_create(fixture->array, "value",
+	    RPC_QUERY_INDEX_SORTED);
+
+	/* Overwriting an element invalidates the indexes */
+	rpc_array_set_value(fixture->array, 2,
+	    rpc_object_pack("{name:s,value:i}", "replaced", (int64_t)42));
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)42)), ==, 1);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)2)), ==, 0);
+
+	/* So does sorting; results then follow the new order */
+	rpc_array_sort(fixture->array, ^(rpc_object_t o1, rpc_object_t o2) {
+		int64_t v1 = rpc_dictionary_get_int64(o1, "value");
+		int64_t v2 = rpc_dictionary_get_int64(o2, "value");
+
+		return ((v2 > v1) - (v2 < v1));
+	});
+
+	rules = rpc_object_pack("[[s,s,i]]", "value", ">=", (int64_t)8);
+	fixture->plan = rpc_query_compile(rules);
+	rpc_release(rules);
+	result = query_collect(fixture->array, NULL, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 3);
+	g_assert_cmpint(rpc_dictionary_get_int64(
+	    rpc_array_get_value(result, 0), "value"), ==, 42);
+	g_assert_cmpint(rpc_dictionary_get_int64(
+	    rpc_array_get_value(result, 2), "value"), ==, 8);
+	rpc_release(result);
+
+	/* Emptying and refilling the array */
+	rpc_array_remove_all(fixture->array);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)42)), ==, 0);
+	rpc_array_append_stolen_value(fixture->array,
+	    rpc_object_pack("{value:i}", (int64_t)42));
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", "=", (int64_t)42)), ==, 1);
+	g_assert_cmpint(query_count_indexed(fixture, rpc_object_pack(
+	    "[[s,s,i]]", "value", ">", (int64_t)40)), ==, 1);
+
+	rpc_query_index_free(sorted);
+}
+
+static void
+query_test_parallel_ordered(query_fixture *fixture, gconstpointer user_data)
+{
+	struct rpc_query_params params = { .parallel = true };
+	rpc_object_t result;
+	rpc_object_t rules;
+
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, QUERY_NLARGE / 10);
+	g_assert_cmpint(rpc_dictionary_get_int64(
+	    rpc_array_get_value(result, 0), "value"), ==, 7);
+	rpc_release(result);
+
+	/* Index candidates are split among the workers too */
+	rpc_query_plan_release(fixture->plan);
+	rules = rpc_object_pack("[[s,s,i],[s,s,s]]", "value", ">=",
+	    (int64_t)1000, "name", "~", "7$");
+	fixture->plan = rpc_query_compile(rules);
+	rpc_release(rules);
+
+	fixture->index = rpc_query_index_create(fixture->array, "value",
+	    RPC_QUERY_INDEX_SORTED);
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==,
+	    (QUERY_NLARGE - 1000) / 10);
+	rpc_release(result);
+}
+
+static void
+query_test_parallel_unordered(query_fixture *fixture,
+    gconstpointer user_data)
+{
+	struct rpc_query_params params = { .parallel = true };
+	rpc_object_t expected;
+	rpc_object_t result;
+
+	expected = query_collect(fixture->array, NULL, fixture->plan);
+	params.unordered = true;
+	result = query_collect(fixture->array, &params, fixture->plan);
+
+	/* The same matches, in whatever order the workers found them */
+	rpc_array_sort(result, RPC_ARRAY_CMP(query_value_cmp, NULL));
+	g_assert_true(rpc_equal(result, expected));
+
+	rpc_release(result);
+	rpc_release(expected);
+}
+
+static void
+query_test_parallel_limit(query_fixture *fixture, gconstpointer user_data)
+{
+	struct rpc_query_params params = { .parallel = true };
+	rpc_object_t result;
+	rpc_object_t item;
+	size_t i;
+
+	/* Ordered early stops give what a sequential run does */
+	params.single = true;
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 1);
+	rpc_release(result);
+
+	params.offset = 1500;
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	g_assert_cmpint(rpc_dictionary_get_int64(
+	    rpc_array_get_value(result, 0), "value"), ==, 15007);
+	rpc_release(result);
+
+	params.single = false;
+	params.offset = 15;
+	params.limit = 10;
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 10);
+	g_assert_cmpint(rpc_dictionary_get_int64(
+	    rpc_array_get_value(result, 0), "value"), ==, 157);
+	rpc_release(result);
+
+	/* A limit past the matches near the end of the array */
+	params.offset = QUERY_NLARGE / 10 - 5;
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 5);
+	rpc_release(result);
+
+	/* Unordered ones give any matches, but as many as requested */
+	params.unordered = true;
+	params.offset = 15;
+	result = query_collect(fixture->array, &params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 10);
+	for (i = 0; i < rpc_array_get_count(result); i++) {
+		item = rpc_array_get_value(result, i);
+		g_assert_cmpint(rpc_dictionary_get_int64(item, "value") % 10,
+		    ==, 7);
+	}
+
+	rpc_release(result);
+
+	params.single = true;
+	params.limit = 0;
+	result = query_collect(fixture->array, &params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 1);
+	rpc_release(result);
+}
+
+static void
+query_test_parallel_count(query_fixture *fixture, gconstpointer user_data)
+{
+	struct rpc_query_params params = { .parallel = true, .count = true };
+	rpc_object_t result;
+
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	g_assert_cmpint(rpc_array_get_count(result), ==, 1);
+	rpc_release(result);
+
+	params.offset = 100;
+	params.limit = 50;
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	rpc_release(result);
+
+	/* Arrays below the parallel threshold are counted the same way */
+	rpc_array_remove_all(fixture->array);
+	rpc_array_append_stolen_value(fixture->array,
+	    rpc_object_pack("{name:s,value:i}", "item7", (int64_t)7));
+	params.offset = 0;
+	params.limit = 0;
+	result = query_collect_parallel(fixture->array, params, fixture->plan);
+	rpc_release(result);
 }
 
 static void
 query_test_register()
 {
 
+	g_test_add("/query/compile", query_fixture, NULL,
+	    query_test_set_up, query_test_compile,
+	    query_test_tear_down);
+
+	g_test_add("/query/compile/reuse", query_fixture, NULL,
+	    query_test_set_up, query_test_reuse,
+	    query_test_tear_down);
+
+	g_test_add("/query/rules/logic", query_fixture, NULL,
+	    query_test_set_up, query_test_logic,
+	    query_test_tear_down);
+
+	g_test_add("/query/rules/regex", query_fixture, NULL,
+	    query_test_set_up, query_test_regex,
+	    query_test_tear_down);
+
+	g_test_add("/query/rules/regex/cache", query_fixture, NULL,
+	    query_test_set_up, query_test_regex_cache,
+	    query_test_tear_down);
+
+	g_test_add("/query/rules/regex/invalid", query_fixture, NULL,
+	    query_test_set_up, query_test_regex_invalid,
+	    query_test_tear_down);
+
+	g_test_add("/query/rules/missing", query_fixture, NULL,
+	    query_test_set_up, query_test_missing,
+	    query_test_tear_down);
+
+	g_test_add("/query/index/hash", query_fixture, NULL,
+	    query_test_set_up, query_test_index_hash,
+	    query_test_tear_down);
+
+	g_test_add("/query/index/sorted", query_fixture, NULL,
+	    query_test_set_up, query_test_index_sorted,
+	    query_test_tear_down);
+
+	g_test_add("/query/index/update", query_fixture, NULL,
+	    query_test_set_up, query_test_index_update,
+	    query_test_tear_down);
+
+	g_test_add("/query/index/stale", query_fixture, NULL,
+	    query_test_set_up, query_test_index_stale,
+	    query_test_tear_down);
+
+	g_test_add("/query/parallel/ordered", query_fixture, NULL,
+	    query_test_set_up_large, query_test_parallel_ordered,
+	    query_test_tear_down);
+
+	g_test_add("/query/parallel/unordered", query_fixture, NULL,
+	    query_test_set_up_large, query_test_parallel_unordered,
+	    query_test_tear_down);
+
+	g_test_add("/query/parallel/limit", query_fixture, NULL,
+	    query_test_set_up_large, query_test_parallel_limit,
+	    query_test_tear_down);
+
+	g_test_add("/query/parallel/count", query_fixture, NULL,
+	    query_test_set_up_large, query_test_parallel_count,
+	    query_test_tear_down);
 }
 
 static struct librpc_test query = {
@@ -63,4 +759,4 @@ static struct librpc_test query = {
     .register_f = &query_test_register
 };
 
-DECLARE_TEST(query);
\ No newline at end of file
+DECLARE_TEST(query);
@@ -29,17 +29,28 @@
 #include "../../src/linker_set.h"
 #include "../../src/internal.h"
 #include <glib.h>
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <rpc/object.h>
 #include <rpc/service.h>
 #include <rpc/server.h>
 #include <rpc/client.h>
 #include <rpc/connection.h>
+#include <rpc/serializer.h>
 
 #define THREADS 50
 #define STREAMS 50
+#define	PREFETCH_ITEMS		2000
+#define	PREFETCH_MAX		256
+#define	OVERFLOW_EVENTS		200
+#define	OVERFLOW_LIMIT		4
+#define	OVERFLOW_PAYLOAD	(64 * 1024)
+#define	OVERFLOW_INTERFACE	"com.twoporeguys.librpc.test.Overflow"
 
 struct b {
 	char *	path;
@@ -221,6 +232,25 @@ server_test_stream_setup(server_fixture *fix, gconstpointer u_data)
 	    });
 	g_assert(res == 0);
 
+	res = rpc_context_register_block(fixture->ctx, base.interface,
+	    "stream_batch", NULL, ^rpc_object_t (void *cookie,
+	    rpc_object_t args __unused) {
+		rpc_object_t batch;
+		int cnt;
+
+		batch = rpc_array_create();
+		for (cnt = 1; cnt <= fixture->count; cnt++) {
+			rpc_array_append_stolen_value(batch, rpc_object_pack(
+			    "[s, i, i]", fixture->str, (int64_t)26,
+			    (int64_t)cnt));
+		}
+
+		rpc_function_start_stream(cookie);
+		rpc_function_yield_many(cookie, batch);
+		rpc_function_end(cookie);
+		return (RPC_FUNCTION_STILL_RUNNING);
+	    });
+	g_assert(res == 0);
 }
 
 static void
@@ -262,6 +292,7 @@ server_test_stream_tear_down(server_fixture *fixture, gconstpointer user_data)
 	if (fixture->str)
 		g_free(fixture->str);
 	rpc_context_unregister_member(fixture->ctx, NULL, "stream");
+	rpc_context_unregister_member(fixture->ctx, NULL, "stream_batch");
 	server_test_valid_server_tear_down(fixture, user_data);
 }
 
@@ -334,6 +365,72 @@ done:
 	return (NULL);
 }
 
+static gpointer
+thread_stream_batch_func (gpointer data)
+{
+
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	rpc_call_t call;
+	__block int cnt = 0;
+
+	client = rpc_client_create(data, 0);
+	if (client == NULL)
+		g_thread_exit (GINT_TO_POINTER (0));
+
+	conn = rpc_client_get_connection(client);
+
+	call = rpc_connection_call(conn, NULL, NULL, "stream_batch",
+	    rpc_array_create(), NULL);
+	if (call == NULL) {
+		rpc_client_close(client);
+		g_thread_exit (GINT_TO_POINTER (0));
+	}
+	for (;;) {
+		rpc_call_wait(call);
+
+		switch (rpc_call_status(call)) {
+		case RPC_CALL_STREAM_START:
+			rpc_call_continue(call, false);
+			break;
+
+		case RPC_CALL_MORE_AVAILABLE:
+			result = rpc_call_result_batch(call, 0);
+			g_assert(result != NULL);
+			g_assert(rpc_array_get_count(result) > 0);
+			rpc_array_apply(result, ^(size_t idx __unused,
+			    rpc_object_t value) {
+				const char *str;
+				int64_t len;
+				int64_t num;
+
+				g_assert(rpc_object_unpack(value, "[s, i, i]",
+				    &str, &len, &num) == 3);
+				g_assert(len == (int)strlen(str));
+				g_assert(num == ++cnt);
+				return ((bool)true);
+			});
+			rpc_release(result);
+			break;
+
+		case RPC_CALL_DONE:
+		case RPC_CALL_ENDED:
+		case RPC_CALL_ERROR:
+			goto done;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+
+done:
+	rpc_call_free(call);
+	rpc_client_close(client);
+	g_thread_exit (GINT_TO_POINTER (cnt));
+	return (NULL);
+}
+
 static gpointer
 thread_func (gpointer data)
 {
@@ -469,6 +566,16 @@ server_test_stream_run(server_fixture *fixture, gconstpointer user_data)
 	g_assert(ret == fixture->count);
 }
 
+static void
+server_test_stream_batch(server_fixture *fixture, gconstpointer user_data)
+{
+	int ret;
+
+	rpc_server_resume(fixture->srv);
+	ret = thread_test(1, &thread_stream_batch_func, fixture);
+	g_assert(ret == fixture->count);
+}
+
 static void
 server_test_stream_close(server_fixture *fixture, gconstpointer user_data)
 {
@@ -499,6 +606,144 @@ server_test_stream_kill(server_fixture *fixture, gconstpointer user_data)
 	ret = thread_test(1, &thread_stream_func, fixture);
 }
 
+struct prefetch_stats
+{
+	uint64_t	min_window;
+	uint64_t	max_window;
+	uint64_t	max_credit;
+	int		items;
+};
+
+/*
+ * Consumes the "stream" method, recording the prefetch window and the
+ * credit granted to the server after every continue.
+ */
+static void
+server_prefetch_consume(rpc_call_t call, struct prefetch_stats *stats)
+{
+	uint64_t credit;
+
+	stats->min_window = UINT64_MAX;
+	stats->max_window = 0;
+	stats->max_credit = 0;
+	stats->items = 0;
+
+	for (;;) {
+		rpc_call_wait(call);
+
+		switch (rpc_call_status(call)) {
+		case RPC_CALL_MORE_AVAILABLE:
+			stats->items++;
+			/* FALLTHROUGH */
+
+		case RPC_CALL_STREAM_START:
+			rpc_call_continue(call, false);
+			g_mutex_lock(&call->rc_mtx);
+			credit = call->rc_producer_seqno -
+			    call->rc_consumer_seqno;
+			stats->min_window = MIN(stats->min_window,
+			    call->rc_prefetch);
+			stats->max_window = MAX(stats->max_window,
+			    call->rc_prefetch);
+			stats->max_credit = MAX(stats->max_credit, credit);
+			g_mutex_unlock(&call->rc_mtx);
+			break;
+
+		case RPC_CALL_DONE:
+		case RPC_CALL_ENDED:
+			return;
+
+		default:
+			g_assert_not_reached();
+		}
+	}
+}
+
+static rpc_call_t
+server_prefetch_call(server_fixture *fixture, rpc_client_t *client)
+{
+	rpc_call_t call;
+
+	fixture->count = PREFETCH_ITEMS;
+	rpc_server_resume(fixture->srv);
+	*client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(*client);
+
+	call = rpc_connection_call(rpc_client_get_connection(*client), NULL,
+	    NULL, "stream", rpc_array_create(), NULL);
+	g_assert_nonnull(call);
+	return (call);
+}
+
+static void
+server_test_prefetch_growth(server_fixture *fixture, gconstpointer user_data)
+{
+	struct prefetch_stats stats;
+	rpc_client_t client;
+	rpc_call_t call;
+
+	call = server_prefetch_call(fixture, &client);
+	server_prefetch_consume(call, &stats);
+	g_assert_cmpint(stats.items, ==, PREFETCH_ITEMS);
+
+	/* A consumer that keeps up makes the window grow from 1 */
+	g_assert_cmpuint(stats.min_window, ==, 1);
+	g_assert_cmpuint(stats.max_window, >, 1);
+	g_assert_cmpuint(stats.max_window, <=, PREFETCH_MAX);
+	g_assert_cmpuint(stats.max_credit, <=, PREFETCH_MAX);
+
+	rpc_call_free(call);
+	rpc_client_close(client);
+}
+
+static void
+server_test_prefetch_bounds(server_fixture *fixture, gconstpointer user_data)
+{
+	struct prefetch_stats stats;
+	rpc_client_t client;
+	rpc_call_t call;
+
+	call = server_prefetch_call(fixture, &client);
+
+	g_assert_cmpint(rpc_call_set_prefetch_bounds(call, 0, 8), ==, -1);
+	g_assert_cmpint(rpc_error_get_code(rpc_get_last_error()), ==, EINVAL);
+	g_assert_cmpint(rpc_call_set_prefetch_bounds(call, 16, 8), ==, -1);
+	g_assert_cmpint(rpc_error_get_code(rpc_get_last_error()), ==, EINVAL);
+
+	/* The current window is clamped into the new bounds right away */
+	g_assert_cmpint(rpc_call_set_prefetch_bounds(call, 4, 8), ==, 0);
+	g_assert_cmpuint(call->rc_prefetch, ==, 4);
+
+	server_prefetch_consume(call, &stats);
+	g_assert_cmpint(stats.items, ==, PREFETCH_ITEMS);
+	g_assert_cmpuint(stats.min_window, >=, 4);
+	g_assert_cmpuint(stats.max_window, <=, 8);
+	g_assert_cmpuint(stats.max_credit, <=, 8);
+
+	rpc_call_free(call);
+	rpc_client_close(client);
+}
+
+static void
+server_test_prefetch_fixed(server_fixture *fixture, gconstpointer user_data)
+{
+	struct prefetch_stats stats;
+	rpc_client_t client;
+	rpc_call_t call;
+
+	call = server_prefetch_call(fixture, &client);
+	g_assert_cmpint(rpc_call_set_prefetch(call, 16), ==, 0);
+
+	server_prefetch_consume(call, &stats);
+	g_assert_cmpint(stats.items, ==, PREFETCH_ITEMS);
+	g_assert_cmpuint(stats.min_window, ==, 16);
+	g_assert_cmpuint(stats.max_window, ==, 16);
+	g_assert_cmpuint(stats.max_credit, <=, 16);
+
+	rpc_call_free(call);
+	rpc_client_close(client);
+}
+
 static void
 server_test_flush(server_fixture *fixture, gconstpointer user_data)
 {
@@ -610,6 +855,685 @@ server_test_nullables(server_fixture *fixture, gconstpointer user_data)
 	rpc_client_close(client);
 }
 
+static void
+server_test_event_set_up(server_fixture *fixture, gconstpointer u_data)
+{
+
+	base = args[0];
+	valid_server_set_up(fixture, u_data);
+
+	rpc_context_register_block(fixture->ctx, NULL, "emit_tree",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		const char *paths[] = { "/ab/c", "/a", "/a/b", "/a/b/c",
+		    "//a///z", NULL };
+
+		rpc_object_t path;
+
+		for (int i = 0; paths[i] != NULL; i++) {
+			path = rpc_string_create(paths[i]);
+			rpc_server_broadcast_event(fixture->srv, paths[i],
+			    NULL, "tree.changed", path);
+			rpc_server_broadcast_event(fixture->srv, paths[i],
+			    NULL, "tree.other", path);
+			rpc_release(path);
+		}
+
+		return (rpc_null_create());
+	    });
+}
+
+static void
+server_test_event_tear_down(server_fixture *fixture, gconstpointer user_data)
+{
+
+	rpc_context_unregister_member(fixture->ctx, NULL, "emit_tree");
+	server_test_valid_server_tear_down(fixture, user_data);
+}
+
+static GPtrArray *
+server_collect_events(server_fixture *fixture, const char **subscriptions,
+    int expected)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	static GMutex mtx;
+	GPtrArray *received;
+	int i;
+
+	received = g_ptr_array_new_with_free_func(g_free);
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	for (i = 0; subscriptions[i] != NULL; i++) {
+		g_assert_nonnull(rpc_connection_register_event_handler(conn,
+		    subscriptions[i], NULL, "tree.changed",
+		    ^(const char *path, const char *interface __unused,
+		    const char *name, rpc_object_t ev_args) {
+			g_assert_cmpstr(name, ==, "tree.changed");
+			g_assert_cmpstr(rpc_string_get_string_ptr(ev_args),
+			    ==, path);
+			g_mutex_lock(&mtx);
+			g_ptr_array_add(received, g_strdup(path));
+			g_mutex_unlock(&mtx);
+		    }));
+	}
+
+	/* Subscriptions are processed before the call that follows them */
+	result = rpc_connection_call_simple(conn, "emit_tree", RPC_NULL_FORMAT);
+	g_assert(result != NULL && !rpc_is_error(result));
+
+	/* Events on a single connection are delivered in order */
+	for (i = 0; i < 100; i++) {
+		g_mutex_lock(&mtx);
+		if ((int)received->len >= expected) {
+			g_mutex_unlock(&mtx);
+			break;
+		}
+
+		g_mutex_unlock(&mtx);
+		g_usleep(50 * 1000);
+	}
+
+	rpc_client_close(client);
+	return (received);
+}
+
+static void
+server_test_event_subscriptions(server_fixture *fixture,
+    gconstpointer user_data)
+{
+	const char *subscriptions[] = { "/a", "/a/b/c", NULL };
+	GPtrArray *received;
+
+	received = server_collect_events(fixture, subscriptions, 2);
+	g_assert_cmpint(received->len, ==, 2);
+	g_assert_cmpstr(g_ptr_array_index(received, 0), ==, "/a");
+	g_assert_cmpstr(g_ptr_array_index(received, 1), ==, "/a/b/c");
+	g_ptr_array_free(received, true);
+}
+
+static void
+server_test_event_wildcard(server_fixture *fixture, gconstpointer user_data)
+{
+	const char *subscriptions[] = { "/a/*", NULL };
+	GPtrArray *received;
+
+	/* Matches below the prefix, but not the prefix itself */
+	received = server_collect_events(fixture, subscriptions, 3);
+	g_assert_cmpint(received->len, ==, 3);
+	g_assert_cmpstr(g_ptr_array_index(received, 0), ==, "/a/b");
+	g_assert_cmpstr(g_ptr_array_index(received, 1), ==, "/a/b/c");
+	g_assert_cmpstr(g_ptr_array_index(received, 2), ==, "//a///z");
+	g_ptr_array_free(received, true);
+}
+
+static void
+server_test_send_queue_error(server_fixture *fixture, gconstpointer user_data)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result = NULL;
+	int i;
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+	g_assert_cmpint(rpc_connection_set_send_queue(conn, 4), ==, 0);
+
+	result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+	g_assert(result != NULL && !rpc_is_error(result));
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "hello world!");
+	rpc_release(result);
+
+	/* Once the peer is gone, sends have to fail instead of vanishing */
+	fixture->iclose = 1;
+	rpc_server_close(fixture->srv);
+
+	for (i = 0; i < 100; i++) {
+		result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+		if (result == NULL || rpc_is_error(result))
+			break;
+
+		rpc_release(result);
+		g_usleep(50 * 1000);
+	}
+
+	g_assert(result == NULL || rpc_is_error(result));
+	if (result == NULL)
+		g_assert_nonnull(rpc_get_last_error());
+
+	rpc_client_close(client);
+}
+
+static rpc_object_t
+server_overflow_subscription(const char *name)
+{
+
+	return (rpc_object_pack("{name:s,interface:s,path:s}", name,
+	    OVERFLOW_INTERFACE, "/"));
+}
+
+static void
+server_overflow_send(int fd, rpc_object_t frame)
+{
+	uint32_t header[4] = { 0xdeadbeef, 0, 0, 0 };
+	void *buf;
+	size_t len;
+
+	g_assert_cmpint(rpc_serializer_dump("msgpack", frame, &buf, &len), ==,
+	    0);
+	header[1] = (uint32_t)len;
+	g_assert_cmpint(write(fd, header, sizeof(header)), ==, sizeof(header));
+	g_assert_cmpint(write(fd, buf, len), ==, (ssize_t)len);
+	g_free(buf);
+	rpc_release(frame);
+}
+
+/*
+ * Returns 1 once @p len bytes are read, 0 on end of file and -1 if
+ * nothing arrives for a while.
+ */
+static int
+server_overflow_read(int fd, void *buf, size_t len)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		if (poll(&pfd, 1, 2000) < 1)
+			return (-1);
+
+		ret = read(fd, (char *)buf + done, len - done);
+		if (ret <= 0)
+			return (ret == 0 ? 0 : -1);
+
+		done += (size_t)ret;
+	}
+
+	return (1);
+}
+
+/*
+ * Subscribes a raw socket to "first" and "second" events, emits a burst
+ * of large events while not reading anything and then collects indexes
+ * of events that made it through into @p first and @p second. Returns
+ * true if the server closed the connection.
+ */
+static bool
+server_overflow_collect(server_fixture *fixture,
+    rpc_event_overflow_policy_t policy, GArray *first, GArray *second)
+{
+	struct sockaddr_un sun;
+	uint32_t header[4];
+	rpc_object_t frame;
+	rpc_object_t subscriptions;
+	rpc_object_t event;
+	char *payload;
+	void *buf;
+	int64_t index;
+	int fd;
+	int ret;
+	int i;
+
+	rpc_context_set_event_queue_limit(fixture->ctx, OVERFLOW_LIMIT,
+	    policy);
+	rpc_server_resume(fixture->srv);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	g_strlcpy(sun.sun_path, "test.sock", sizeof(sun.sun_path));
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	g_assert_cmpint(fd, >=, 0);
+	g_assert_cmpint(connect(fd, (struct sockaddr *)&sun, sizeof(sun)), ==,
+	    0);
+
+	subscriptions = rpc_array_create();
+	rpc_array_append_stolen_value(subscriptions,
+	    server_overflow_subscription("first"));
+	rpc_array_append_stolen_value(subscriptions,
+	    server_overflow_subscription("second"));
+
+	frame = rpc_dictionary_create();
+	rpc_dictionary_set_string(frame, "namespace", "events");
+	rpc_dictionary_set_string(frame, "name", "subscribe");
+	rpc_dictionary_steal_value(frame, "id", rpc_null_create());
+	rpc_dictionary_steal_value(frame, "args", subscriptions);
+	server_overflow_send(fd, frame);
+	g_usleep(200 * 1000);
+
+	/* Nothing is read until all events are emitted */
+	payload = g_malloc(OVERFLOW_PAYLOAD + 1);
+	memset(payload, 'x', OVERFLOW_PAYLOAD);
+	payload[OVERFLOW_PAYLOAD] = '\0';
+
+	for (i = 0; i < OVERFLOW_EVENTS; i++) {
+		rpc_context_emit_event(fixture->ctx, "/", OVERFLOW_INTERFACE,
+		    i % 2 == 0 ? "first" : "second",
+		    rpc_object_pack("{index:i,data:s}", (int64_t)i, payload));
+	}
+
+	g_free(payload);
+	g_usleep(500 * 1000);
+
+	for (;;) {
+		ret = server_overflow_read(fd, header, sizeof(header));
+		if (ret < 1)
+			break;
+
+		g_assert_cmphex(header[0], ==, 0xdeadbeef);
+		buf = g_malloc(header[1]);
+		g_assert_cmpint(server_overflow_read(fd, buf, header[1]), ==,
+		    1);
+		frame = rpc_serializer_load("msgpack", buf, header[1]);
+		g_assert_nonnull(frame);
+		g_free(buf);
+
+		if (g_strcmp0(rpc_dictionary_get_string(frame, "name"),
+		    "event") == 0) {
+			event = rpc_dictionary_get_value(frame, "args");
+			index = rpc_dictionary_get_int64(
+			    rpc_dictionary_get_value(event, "args"), "index");
+			g_array_append_val(g_strcmp0(rpc_dictionary_get_string(
+			    event, "name"), "first") == 0 ? first : second,
+			    index);
+		}
+
+		rpc_release(frame);
+	}
+
+	close(fd);
+	return (ret == 0);
+}
+
+/*
+ * Events of one kind have to arrive in order, and some of them must have
+ * been dropped on the way. Returns the last index received.
+ */
+static int64_t
+server_overflow_check(GArray *indexes)
+{
+	guint i;
+
+	g_assert_cmpuint(indexes->len, >, 0);
+	g_assert_cmpuint(indexes->len, <, OVERFLOW_EVENTS / 2);
+
+	for (i = 1; i < indexes->len; i++) {
+		g_assert_cmpint(g_array_index(indexes, int64_t, i - 1), <,
+		    g_array_index(indexes, int64_t, i));
+	}
+
+	return (g_array_index(indexes, int64_t, indexes->len - 1));
+}
+
+static void
+server_test_event_overflow(server_fixture *fixture,
+    rpc_event_overflow_policy_t policy)
+{
+	GArray *first;
+	GArray *second;
+	bool closed;
+
+	first = g_array_new(false, false, sizeof(int64_t));
+	second = g_array_new(false, false, sizeof(int64_t));
+	closed = server_overflow_collect(fixture, policy, first, second);
+
+	if (policy == RPC_EVENT_DISCONNECT) {
+		/* Whatever was sent before the overflow still arrives */
+		g_assert_true(closed);
+		server_overflow_check(first);
+		server_overflow_check(second);
+	} else {
+		/* The most recent events always make it through */
+		g_assert_false(closed);
+		g_assert_cmpint(server_overflow_check(first), ==,
+		    OVERFLOW_EVENTS - 2);
+		g_assert_cmpint(server_overflow_check(second), ==,
+		    OVERFLOW_EVENTS - 1);
+	}
+
+	g_array_free(first, true);
+	g_array_free(second, true);
+}
+
+static void
+server_test_event_drop_oldest(server_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	server_test_event_overflow(fixture, RPC_EVENT_DROP_OLDEST);
+}
+
+static void
+server_test_event_coalesce(server_fixture *fixture, gconstpointer user_data)
+{
+
+	server_test_event_overflow(fixture, RPC_EVENT_COALESCE);
+}
+
+static void
+server_test_event_disconnect(server_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	server_test_event_overflow(fixture, RPC_EVENT_DISCONNECT);
+}
+
+static void
+server_test_scheduler_set_up(server_fixture *fixture, gconstpointer u_data)
+{
+
+	base = args[0];
+	valid_server_set_up(fixture, u_data);
+
+	rpc_context_register_block(fixture->ctx, NULL, "stall",
+	    NULL, ^(void *cookie, rpc_object_t args __unused) {
+		rpc_object_t item;
+
+		if (rpc_function_start_stream(cookie) != 0)
+			return (RPC_FUNCTION_STILL_RUNNING);
+
+		/* Blocks until the consumer asks for more or aborts */
+		item = rpc_int64_create(1);
+		while (rpc_function_yield(cookie, rpc_retain(item)) == 0);
+		rpc_release(item);
+		rpc_function_end(cookie);
+		return (RPC_FUNCTION_STILL_RUNNING);
+	    });
+}
+
+static void
+server_test_scheduler_tear_down(server_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	rpc_context_unregister_member(fixture->ctx, NULL, "stall");
+	server_test_valid_server_tear_down(fixture, user_data);
+}
+
+static void
+server_test_scheduler_stats(server_fixture *fixture, gconstpointer user_data)
+{
+	struct rpc_context_stats stats;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	int i;
+
+	rpc_context_get_stats(fixture->ctx, &stats);
+	g_assert_cmpuint(stats.rcs_workers, >=, 8);
+	g_assert_cmpuint(stats.rcs_running, ==, 0);
+	g_assert_cmpuint(stats.rcs_detached, ==, 0);
+	g_assert_cmpuint(stats.rcs_queued_high, ==, 0);
+	g_assert_cmpuint(stats.rcs_queued_normal, ==, 0);
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	for (i = 0; i < 10; i++) {
+		result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+		g_assert(result != NULL && !rpc_is_error(result));
+		rpc_release(result);
+	}
+
+	rpc_client_close(client);
+
+	/* Completion is counted after the response has been sent */
+	for (i = 0; i < 100; i++) {
+		rpc_context_get_stats(fixture->ctx, &stats);
+		if (stats.rcs_completed >= 10)
+			break;
+
+		g_usleep(50 * 1000);
+	}
+
+	g_assert_cmpuint(stats.rcs_completed, >=, 10);
+	g_assert_cmpuint(stats.rcs_completed, >=, stats.rcs_stolen);
+	g_assert_cmpuint(g_atomic_int_get(&fixture->count), ==, 10);
+}
+
+static void
+server_test_scheduler_streams(server_fixture *fixture,
+    gconstpointer user_data)
+{
+	struct rpc_context_stats stats;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t result;
+	rpc_call_t *calls;
+	size_t ncalls;
+	size_t i;
+
+	rpc_context_get_stats(fixture->ctx, &stats);
+	ncalls = stats.rcs_workers + 1;
+	calls = g_new0(rpc_call_t, ncalls);
+
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	/* More stalled producers than there are workers */
+	for (i = 0; i < ncalls; i++) {
+		calls[i] = rpc_connection_call(conn, NULL, NULL, "stall",
+		    rpc_array_create(), NULL);
+		g_assert_nonnull(calls[i]);
+	}
+
+	for (i = 0; i < 100; i++) {
+		rpc_context_get_stats(fixture->ctx, &stats);
+		if (stats.rcs_detached == ncalls)
+			break;
+
+		g_usleep(50 * 1000);
+	}
+
+	g_assert_cmpuint(stats.rcs_detached, ==, ncalls);
+
+	/* The pool still serves regular calls */
+	result = rpc_connection_call_simple(conn, "hi", "[s]", "world");
+	g_assert(result != NULL && !rpc_is_error(result));
+	g_assert_cmpstr(rpc_string_get_string_ptr(result), ==, "hello world!");
+	rpc_release(result);
+
+	for (i = 0; i < ncalls; i++) {
+		rpc_call_abort(calls[i]);
+		rpc_call_free(calls[i]);
+	}
+
+	rpc_client_close(client);
+	g_free(calls);
+
+	for (i = 0; i < 100; i++) {
+		rpc_context_get_stats(fixture->ctx, &stats);
+		if (stats.rcs_detached == 0)
+			break;
+
+		g_usleep(50 * 1000);
+	}
+
+	g_assert_cmpuint(stats.rcs_detached, ==, 0);
+}
+
+static void
+server_test_limits_set_up(server_fixture *fixture, gconstpointer u_data)
+{
+
+	base = args[0];
+	valid_server_set_up(fixture, u_data);
+	fixture->called = 0;
+	fixture->woke = 0;
+
+	rpc_context_register_block(fixture->ctx, NULL, "gate",
+	    NULL, ^(void *cookie __unused, rpc_object_t args __unused) {
+		g_atomic_int_inc(&fixture->called);
+		while (g_atomic_int_get(&fixture->woke) == 0)
+			g_usleep(10 * 1000);
+
+		return (rpc_string_create("open"));
+	    });
+}
+
+static void
+server_test_limits_tear_down(server_fixture *fixture, gconstpointer user_data)
+{
+
+	rpc_context_unregister_member(fixture->ctx, NULL, "gate");
+	server_test_valid_server_tear_down(fixture, user_data);
+}
+
+static void
+server_wait_called(server_fixture *fixture, int called)
+{
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		if (g_atomic_int_get(&fixture->called) >= called)
+			break;
+
+		g_usleep(50 * 1000);
+	}
+
+	g_assert_cmpint(g_atomic_int_get(&fixture->called), ==, called);
+}
+
+static void
+server_assert_busy(rpc_call_t call, uint64_t retry_after)
+{
+	rpc_object_t error;
+
+	g_assert_cmpint(rpc_call_wait(call), ==, 0);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_ERROR);
+	error = rpc_call_result(call);
+	g_assert_nonnull(error);
+	g_assert_cmpint(rpc_error_get_code(error), ==, EBUSY);
+	g_assert_nonnull(rpc_error_get_extra(error));
+	g_assert_cmpuint(rpc_dictionary_get_uint64(rpc_error_get_extra(error),
+	    "retry_after"), ==, retry_after);
+}
+
+static void
+server_assert_done(rpc_call_t call, const char *expected)
+{
+
+	g_assert_cmpint(rpc_call_wait(call), ==, 0);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_DONE);
+	g_assert_cmpstr(rpc_string_get_string_ptr(rpc_call_result(call)), ==,
+	    expected);
+}
+
+static void
+server_test_limits_connection(server_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t gate;
+	rpc_call_t call;
+
+	rpc_server_set_limits(fixture->srv, 1, 0, 250);
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	gate = rpc_connection_call(conn, NULL, NULL, "gate",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(gate);
+	server_wait_called(fixture, 1);
+
+	call = rpc_connection_call(conn, NULL, NULL, "hi",
+	    rpc_object_pack("[s]", "world"), NULL);
+	g_assert_nonnull(call);
+	server_assert_busy(call, 250);
+	rpc_call_free(call);
+
+	g_atomic_int_set(&fixture->woke, 1);
+	server_assert_done(gate, "open");
+	rpc_call_free(gate);
+	rpc_client_close(client);
+}
+
+static void
+server_test_limits_method(server_fixture *fixture, gconstpointer user_data)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t gate;
+	rpc_call_t call;
+
+	g_assert_cmpint(rpc_instance_set_method_limit(
+	    rpc_context_find_instance(fixture->ctx, "/"), NULL, "gate", 1),
+	    ==, 0);
+	rpc_server_set_limits(fixture->srv, 0, 0, 300);
+	rpc_server_resume(fixture->srv);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	gate = rpc_connection_call(conn, NULL, NULL, "gate",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(gate);
+	server_wait_called(fixture, 1);
+
+	/* The hint comes from the server, not from the default */
+	call = rpc_connection_call(conn, NULL, NULL, "gate",
+	    rpc_array_create(), NULL);
+	g_assert_nonnull(call);
+	server_assert_busy(call, 300);
+	rpc_call_free(call);
+
+	/* Other methods aren't affected */
+	call = rpc_connection_call(conn, NULL, NULL, "hi",
+	    rpc_object_pack("[s]", "world"), NULL);
+	g_assert_nonnull(call);
+	server_assert_done(call, "hello world!");
+	rpc_call_free(call);
+
+	g_atomic_int_set(&fixture->woke, 1);
+	server_assert_done(gate, "open");
+	rpc_call_free(gate);
+	rpc_client_close(client);
+}
+
+static void
+server_test_limits_queue(server_fixture *fixture, gconstpointer user_data)
+{
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_call_t calls[3];
+	int i;
+
+	/* Calls are queued while the server is paused */
+	rpc_server_set_limits(fixture->srv, 0, 2, 400);
+	client = rpc_client_create(uris[fixture->iuri].cli, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	for (i = 0; i < 3; i++) {
+		calls[i] = rpc_connection_call(conn, NULL, NULL, "hi",
+		    rpc_object_pack("[s]", "world"), NULL);
+		g_assert_nonnull(calls[i]);
+	}
+
+	server_assert_busy(calls[2], 400);
+	rpc_server_resume(fixture->srv);
+	server_assert_done(calls[0], "hello world!");
+	server_assert_done(calls[1], "hello world!");
+
+	for (i = 0; i < 3; i++)
+		rpc_call_free(calls[i]);
+
+	rpc_client_close(client);
+}
+
 /*
 static void
 server_test(server_fixture *fixture, gconstpointer user_data)
@@ -690,6 +1614,22 @@ server_test_register()
 	    server_test_stream_setup, server_test_stream_run,
 	    server_test_stream_tear_down);
 
+	g_test_add("/server/stream/batch", server_fixture, (void *)TCP_GOOD,
+	    server_test_stream_setup, server_test_stream_batch,
+	    server_test_stream_tear_down);
+
+	g_test_add("/server/prefetch/growth", server_fixture,
+	    (void *)TCP_GOOD, server_test_stream_setup,
+	    server_test_prefetch_growth, server_test_stream_tear_down);
+
+	g_test_add("/server/prefetch/bounds", server_fixture,
+	    (void *)TCP_GOOD, server_test_stream_setup,
+	    server_test_prefetch_bounds, server_test_stream_tear_down);
+
+	g_test_add("/server/prefetch/fixed", server_fixture, (void *)TCP_GOOD,
+	    server_test_stream_setup, server_test_prefetch_fixed,
+	    server_test_stream_tear_down);
+
 	g_test_add("/server/stream/close", server_fixture, (void *)TCP_GOOD,
 	    server_test_stream_setup, server_test_stream_close,
 	    server_test_stream_tear_down);
@@ -705,6 +1645,50 @@ server_test_register()
 	g_test_add("/server/flush/loopback", server_fixture, (void *)LB_GOOD,
 	    server_test_valid_server_set_up, server_test_flush,
 	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/send-queue/error", server_fixture, (void *)TCP_GOOD,
+	    server_test_valid_server_set_up, server_test_send_queue_error,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/events/subscriptions", server_fixture,
+	    (void *)TCP_GOOD, server_test_event_set_up,
+	    server_test_event_subscriptions, server_test_event_tear_down);
+
+	g_test_add("/server/events/wildcard", server_fixture, (void *)TCP_GOOD,
+	    server_test_event_set_up, server_test_event_wildcard,
+	    server_test_event_tear_down);
+
+	g_test_add("/server/events/drop-oldest", server_fixture,
+	    (void *)DS_GOOD, server_test_valid_server_set_up,
+	    server_test_event_drop_oldest, server_test_valid_server_tear_down);
+
+	g_test_add("/server/events/coalesce", server_fixture, (void *)DS_GOOD,
+	    server_test_valid_server_set_up, server_test_event_coalesce,
+	    server_test_valid_server_tear_down);
+
+	g_test_add("/server/events/disconnect", server_fixture,
+	    (void *)DS_GOOD, server_test_valid_server_set_up,
+	    server_test_event_disconnect, server_test_valid_server_tear_down);
+
+	g_test_add("/server/scheduler/stats", server_fixture, (void *)TCP_GOOD,
+	    server_test_scheduler_set_up, server_test_scheduler_stats,
+	    server_test_scheduler_tear_down);
+
+	g_test_add("/server/scheduler/streams", server_fixture,
+	    (void *)TCP_GOOD, server_test_scheduler_set_up,
+	    server_test_scheduler_streams, server_test_scheduler_tear_down);
+
+	g_test_add("/server/limits/connection", server_fixture,
+	    (void *)TCP_GOOD, server_test_limits_set_up,
+	    server_test_limits_connection, server_test_limits_tear_down);
+
+	g_test_add("/server/limits/method", server_fixture, (void *)TCP_GOOD,
+	    server_test_limits_set_up, server_test_limits_method,
+	    server_test_limits_tear_down);
+
+	g_test_add("/server/limits/queue", server_fixture, (void *)TCP_GOOD,
+	    server_test_limits_set_up, server_test_limits_queue,
+	    server_test_limits_tear_down);
 }
 
 static struct librpc_test server = {
@@ -28,34 +28,748 @@
 #include "../tests.h"
 #include "../../src/linker_set.h"
 #include <glib.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <rpc/object.h>
+#include <rpc/service.h>
+#include <rpc/server.h>
+#include <rpc/client.h>
+#include <rpc/connection.h>
 
+#define	SERVICE_URI		"loopback://3"
+#define	SERVICE_PATH		"/prop"
+#define	SERVICE_INTERFACE	"com.twoporeguys.librpc.test.Property"
+#define	SERVICE_NPROPS		8
 
 typedef struct {
-
+	rpc_context_t	ctx;
+	rpc_server_t	srv;
+	rpc_client_t	client;
+	rpc_connection_t conn;
+	rpc_instance_t	instance;
+	volatile gint	value;
+	volatile gint	getter_calls;
+	volatile gint	running;
+	volatile gint	peak;
+	volatile gint	release;
+	volatile gint	failures;
+	volatile gint	events;
+	volatile gint	last_event;
 } service_fixture;
 
+static int64_t
+service_get(service_fixture *fixture)
+{
+	rpc_object_t result;
+	int64_t value;
+
+	result = rpc_connection_call_syncp(fixture->conn, SERVICE_PATH,
+	    RPC_OBSERVABLE_INTERFACE, "get", "[s,s]", SERVICE_INTERFACE,
+	    "value");
+	g_assert(result != NULL && !rpc_is_error(result));
+	value = rpc_int64_get_value(result);
+	rpc_release(result);
+	return (value);
+}
+
+static void
+service_connect(service_fixture *fixture)
+{
+
+	fixture->srv = rpc_server_create(SERVICE_URI, fixture->ctx);
+	g_assert_nonnull(fixture->srv);
+	rpc_server_resume(fixture->srv);
+	fixture->client = rpc_client_create(SERVICE_URI, 0);
+	g_assert_nonnull(fixture->client);
+	fixture->conn = rpc_client_get_connection(fixture->client);
+}
+
+static void
+service_test_property_set_up(service_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_instance_t instance;
+
+	fixture->value = 0;
+	fixture->getter_calls = 0;
+	fixture->running = 0;
+	fixture->peak = 0;
+	fixture->release = 0;
+	fixture->failures = 0;
+	fixture->events = 0;
+	fixture->last_event = -1;
+	fixture->ctx = rpc_context_create();
+
+	instance = rpc_instance_new(NULL, SERVICE_PATH);
+	g_assert_nonnull(instance);
+	fixture->instance = instance;
+	g_assert_cmpint(rpc_instance_register_interface(instance,
+	    SERVICE_INTERFACE, NULL, NULL), ==, 0);
+
+	/* The setter clamps the value, so it differs from what was sent */
+	g_assert_cmpint(rpc_instance_register_property(instance,
+	    SERVICE_INTERFACE, "value", NULL,
+	    ^(void *cookie __unused) {
+		g_atomic_int_inc(&fixture->getter_calls);
+		return (rpc_int64_create(g_atomic_int_get(&fixture->value)));
+	    },
+	    ^(void *cookie __unused, rpc_object_t value) {
+		g_atomic_int_set(&fixture->value,
+		    (gint)MIN(rpc_int64_get_value(value), 10));
+	    }), ==, 0);
+
+	g_assert_cmpint(rpc_instance_set_property_policy(instance,
+	    SERVICE_INTERFACE, "value", true, 0), ==, 0);
+
+	for (int i = 0; i < SERVICE_NPROPS; i++) {
+		struct rpc_if_member member;
+		char *name;
+
+		name = g_strdup_printf("p%d", i);
+		member.rim_name = name;
+		member.rim_type = RPC_MEMBER_PROPERTY;
+		member.rim_property.rp_arg = NULL;
+		member.rim_property.rp_setter = NULL;
+		member.rim_property.rp_notify = false;
+		member.rim_property.rp_flags = RPC_PROPERTY_INDEPENDENT;
+		member.rim_property.rp_getter = ^(void *cookie __unused) {
+			gint running;
+			gint peak;
+
+			running = g_atomic_int_add(&fixture->running, 1) + 1;
+			do {
+				peak = g_atomic_int_get(&fixture->peak);
+			} while (running > peak &&
+			    !g_atomic_int_compare_and_exchange(&fixture->peak,
+			    peak, running));
+
+			g_usleep(50 * 1000);
+			g_atomic_int_add(&fixture->running, -1);
+			return (rpc_int64_create(i));
+		};
+
+		g_assert_cmpint(rpc_instance_register_member(instance,
+		    SERVICE_INTERFACE, &member), ==, 0);
+		g_free(name);
+	}
+	g_assert_cmpint(rpc_context_register_instance(fixture->ctx, instance),
+	    ==, 0);
+
+	service_connect(fixture);
+}
+
+static void
+service_test_tear_down(service_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	rpc_client_close(fixture->client);
+	rpc_server_close(fixture->srv);
+	rpc_context_free(fixture->ctx);
+}
+
+static void
+service_test_property_cache(service_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_object_t value;
+
+	/* The first read goes to the getter, the second one to the cache */
+	g_assert_cmpint(service_get(fixture), ==, 0);
+	g_assert_cmpint(service_get(fixture), ==, 0);
+	g_assert_cmpint(g_atomic_int_get(&fixture->getter_calls), ==, 1);
+
+	/* A notification replaces the cached value */
+	value = rpc_int64_create(5);
+	rpc_instance_property_changed(rpc_context_find_instance(fixture->ctx,
+	    SERVICE_PATH), SERVICE_INTERFACE, "value", value);
+	rpc_release(value);
+	g_assert_cmpint(service_get(fixture), ==, 5);
+	g_assert_cmpint(g_atomic_int_get(&fixture->getter_calls), ==, 1);
+}
+
+static void
+service_test_property_set(service_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t result;
+
+	g_assert_cmpint(service_get(fixture), ==, 0);
+
+	result = rpc_connection_call_syncp(fixture->conn, SERVICE_PATH,
+	    RPC_OBSERVABLE_INTERFACE, "set", "[s,s,i]", SERVICE_INTERFACE,
+	    "value", (int64_t)42);
+	g_assert(result != NULL && !rpc_is_error(result));
+	rpc_release(result);
+
+	/* The cache holds what the setter stored, not what was sent */
+	g_assert_cmpint(service_get(fixture), ==, 10);
+	g_assert_cmpint(g_atomic_int_get(&fixture->getter_calls), ==, 2);
+
+	g_assert_cmpint(service_get(fixture), ==, 10);
+	g_assert_cmpint(g_atomic_int_get(&fixture->getter_calls), ==, 2);
+}
+
 static void
-service_test(service_fixture *fixture, gconstpointer user_data)
+service_test_property_set_uncached(service_fixture *fixture,
+    gconstpointer user_data)
 {
+	rpc_object_t result;
 
+	g_assert_cmpint(rpc_instance_set_property_policy(fixture->instance,
+	    SERVICE_INTERFACE, "value", false, 0), ==, 0);
+
+	result = rpc_connection_call_syncp(fixture->conn, SERVICE_PATH,
+	    RPC_OBSERVABLE_INTERFACE, "set", "[s,s,i]", SERVICE_INTERFACE,
+	    "value", (int64_t)7);
+	g_assert(result != NULL && !rpc_is_error(result));
+	rpc_release(result);
+
+	/* Without a cache to keep right, the value isn't read back */
+	g_assert_cmpint(g_atomic_int_get(&fixture->getter_calls), ==, 0);
+	g_assert_cmpint(service_get(fixture), ==, 7);
+	g_assert_cmpint(g_atomic_int_get(&fixture->getter_calls), ==, 1);
 }
 
 static void
-service_test_single_set_up(service_fixture *fixture, gconstpointer user_data)
+service_watch(service_fixture *fixture)
 {
 
+	g_assert_nonnull(rpc_connection_watch_property(fixture->conn,
+	    SERVICE_PATH, SERVICE_INTERFACE, "value",
+	    ^(rpc_object_t value) {
+		g_atomic_int_set(&fixture->last_event,
+		    (gint)rpc_int64_get_value(value));
+		g_atomic_int_inc(&fixture->events);
+	    }));
+
+	/* Calls are handled after the subscription */
+	service_get(fixture);
 }
 
 static void
-service_test_tear_down(service_fixture *fixture, gconstpointer user_data)
+service_changed(service_fixture *fixture, int64_t value)
 {
+	rpc_object_t obj;
 
+	obj = rpc_int64_create(value);
+	rpc_instance_property_changed(fixture->instance, SERVICE_INTERFACE,
+	    "value", obj);
+	rpc_release(obj);
+}
+
+static void
+service_wait_events(service_fixture *fixture, gint count)
+{
+	int i;
+
+	for (i = 0; i < 2000; i++) {
+		if (g_atomic_int_get(&fixture->events) >= count)
+			break;
+
+		g_usleep(1000);
+	}
+
+	g_assert_cmpint(g_atomic_int_get(&fixture->events), ==, count);
+}
+
+static void
+service_test_property_coalesce(service_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	service_watch(fixture);
+	g_assert_cmpint(rpc_instance_set_property_policy(fixture->instance,
+	    SERVICE_INTERFACE, "value", true, 200), ==, 0);
+
+	/* The first change goes out right away */
+	service_changed(fixture, 1);
+	service_wait_events(fixture, 1);
+	g_assert_cmpint(g_atomic_int_get(&fixture->last_event), ==, 1);
+
+	/* The following ones wait for the timer, and the last value wins */
+	service_changed(fixture, 2);
+	service_changed(fixture, 3);
+	service_changed(fixture, 4);
+	g_usleep(50 * 1000);
+	g_assert_cmpint(g_atomic_int_get(&fixture->events), ==, 1);
+
+	service_wait_events(fixture, 2);
+	g_assert_cmpint(g_atomic_int_get(&fixture->last_event), ==, 4);
+	g_assert_cmpint(service_get(fixture), ==, 4);
+
+	g_usleep(300 * 1000);
+	g_assert_cmpint(g_atomic_int_get(&fixture->events), ==, 2);
+}
+
+static void
+service_test_property_unregister(service_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	service_watch(fixture);
+	g_assert_cmpint(rpc_instance_set_property_policy(fixture->instance,
+	    SERVICE_INTERFACE, "value", true, 200), ==, 0);
+
+	service_changed(fixture, 1);
+	service_wait_events(fixture, 1);
+
+	/* A flush pending for an unregistered property is dropped */
+	service_changed(fixture, 2);
+	g_assert_cmpint(rpc_instance_unregister_member(fixture->instance,
+	    SERVICE_INTERFACE, "value"), ==, 0);
+
+	g_usleep(400 * 1000);
+	g_assert_cmpint(g_atomic_int_get(&fixture->events), ==, 1);
+	g_assert_cmpint(g_atomic_int_get(&fixture->last_event), ==, 1);
+}
+
+static void
+service_test_property_get_all(service_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_object_t result;
+	__block int found = 0;
+
+	result = rpc_connection_call_syncp(fixture->conn, SERVICE_PATH,
+	    RPC_OBSERVABLE_INTERFACE, "get_all", "[s]", SERVICE_INTERFACE);
+	g_assert(result != NULL && !rpc_is_error(result));
+	g_assert_cmpint(rpc_array_get_count(result), ==, SERVICE_NPROPS + 1);
+
+	rpc_array_apply(result, ^(size_t idx __unused, rpc_object_t desc) {
+		const char *name;
+		rpc_object_t value;
+
+		name = rpc_dictionary_get_string(desc, "name");
+		value = rpc_dictionary_get_value(desc, "value");
+		g_assert_nonnull(name);
+		g_assert_nonnull(value);
+
+		if (g_strcmp0(name, "value") == 0)
+			g_assert_cmpint(rpc_int64_get_value(value), ==, 0);
+		else {
+			g_assert_cmpint(rpc_int64_get_value(value), ==,
+			    atoi(name + 1));
+		}
+
+		found++;
+		return ((bool)true);
+	});
+
+	g_assert_cmpint(found, ==, SERVICE_NPROPS + 1);
+	rpc_release(result);
+
+	/* Independent getters ran on the worker pool, not one by one */
+	g_assert_cmpint(g_atomic_int_get(&fixture->peak), >, 1);
+	g_assert_cmpint(g_atomic_int_get(&fixture->running), ==, 0);
+}
+
+static void
+service_test_method_set_up(service_fixture *fixture, gconstpointer user_data)
+{
+
+	fixture->value = 0;
+	fixture->getter_calls = 0;
+	fixture->running = 0;
+	fixture->peak = 0;
+	fixture->release = 0;
+	fixture->failures = 0;
+	fixture->events = 0;
+	fixture->last_event = -1;
+	fixture->ctx = rpc_context_create();
+	fixture->instance = rpc_instance_new(NULL, SERVICE_PATH);
+	g_assert_nonnull(fixture->instance);
+	g_assert_cmpint(rpc_instance_register_interface(fixture->instance,
+	    SERVICE_INTERFACE, NULL, NULL), ==, 0);
+	g_assert_cmpint(rpc_context_register_instance(fixture->ctx,
+	    fixture->instance), ==, 0);
+
+	service_connect(fixture);
+}
+
+static void
+service_register_method(service_fixture *fixture, const char *name,
+    int flags, rpc_function_t fn)
+{
+	struct rpc_if_member member;
+
+	member.rim_name = name;
+	member.rim_type = RPC_MEMBER_METHOD;
+	member.rim_method.rm_block = fn;
+	member.rim_method.rm_arg = NULL;
+	member.rim_method.rm_flags = flags;
+	g_assert_cmpint(rpc_instance_register_member(fixture->instance,
+	    SERVICE_INTERFACE, &member), ==, 0);
+}
+
+/*
+ * Registers a method that sleeps for the number of milliseconds it gets,
+ * or until the fixture is released if that's negative, and tells whether
+ * it ran on the worker pool.
+ */
+static void
+service_register_sleepy(service_fixture *fixture, const char *name,
+    int flags)
+{
+
+	service_register_method(fixture, name, flags,
+	    ^(void *cookie __unused, rpc_object_t args) {
+		struct rpc_context_stats stats;
+		int64_t delay;
+
+		delay = rpc_array_get_int64(args, 0);
+		if (delay < 0) {
+			g_atomic_int_set(&fixture->running, 1);
+			while (!g_atomic_int_get(&fixture->release))
+				g_usleep(1000);
+		} else
+			g_usleep((gulong)delay * 1000);
+
+		rpc_context_get_stats(fixture->ctx, &stats);
+		return (rpc_bool_create(stats.rcs_running > 0));
+	});
+}
+
+static bool
+service_on_pool(rpc_connection_t conn, const char *method, int64_t delay)
+{
+	rpc_object_t result;
+	bool pooled;
+
+	result = rpc_connection_call_syncp(conn, SERVICE_PATH,
+	    SERVICE_INTERFACE, method, "[i]", delay);
+	g_assert(result != NULL && !rpc_is_error(result));
+	pooled = rpc_bool_get_value(result);
+	rpc_release(result);
+	return (pooled);
+}
+
+/*
+ * Consumes a streaming call. Returns the error code it failed with,
+ * or 0 if it ended normally.
+ */
+static int
+service_stream(rpc_connection_t conn, const char *method, int *count)
+{
+	rpc_call_t call;
+	int error = 0;
+
+	*count = 0;
+	call = rpc_connection_call(conn, SERVICE_PATH, SERVICE_INTERFACE,
+	    method, NULL, NULL);
+	g_assert_nonnull(call);
+
+	for (;;) {
+		rpc_call_wait(call);
+
+		switch (rpc_call_status(call)) {
+		case RPC_CALL_STREAM_START:
+			rpc_call_continue(call, false);
+			continue;
+
+		case RPC_CALL_MORE_AVAILABLE:
+			(*count)++;
+			rpc_call_continue(call, false);
+			continue;
+
+		case RPC_CALL_ERROR:
+			error = rpc_error_get_code(rpc_call_result(call));
+			break;
+
+		default:
+			break;
+		}
+
+		break;
+	}
+
+	rpc_call_free(call);
+	return (error);
+}
+
+static void
+service_test_inline_flag(service_fixture *fixture, gconstpointer user_data)
+{
+	int i;
+
+	service_register_sleepy(fixture, "inline", RPC_METHOD_INLINE);
+	service_register_sleepy(fixture, "pooled", 0);
+	g_assert_cmpint(rpc_instance_register_block(fixture->instance,
+	    SERVICE_INTERFACE, "block", NULL,
+	    ^(void *cookie __unused, rpc_object_t args __unused) {
+		struct rpc_context_stats stats;
+
+		rpc_context_get_stats(fixture->ctx, &stats);
+		return (rpc_bool_create(stats.rcs_running > 0));
+	    }), ==, 0);
+
+	for (i = 0; i < 10; i++) {
+		g_assert_false(service_on_pool(fixture->conn, "inline", 0));
+		g_assert_true(service_on_pool(fixture->conn, "pooled", 0));
+	}
+
+	/* Methods registered without flags go to the pool */
+	g_assert_true(service_on_pool(fixture->conn, "block", 0));
+}
+
+static void
+service_test_inline_budget(service_fixture *fixture, gconstpointer user_data)
+{
+
+	service_register_sleepy(fixture, "inline", RPC_METHOD_INLINE);
+
+	/* Within a generous budget the method stays inline */
+	rpc_context_set_inline_budget(fixture->ctx, 10 * 1000 * 1000);
+	g_assert_false(service_on_pool(fixture->conn, "inline", 20));
+	g_assert_false(service_on_pool(fixture->conn, "inline", 0));
+
+	/* Exceeding the budget once moves it to the pool for good */
+	rpc_context_set_inline_budget(fixture->ctx, 5 * 1000);
+	g_assert_false(service_on_pool(fixture->conn, "inline", 0));
+	g_assert_false(service_on_pool(fixture->conn, "inline", 20));
+	g_assert_true(service_on_pool(fixture->conn, "inline", 0));
+	g_assert_true(service_on_pool(fixture->conn, "inline", 0));
+}
+
+static void
+service_test_inline_watchdog(service_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_client_t other;
+	rpc_object_t args;
+	rpc_call_t call;
+
+	service_register_sleepy(fixture, "inline", RPC_METHOD_INLINE);
+	rpc_context_set_inline_budget(fixture->ctx, 5 * 1000);
+	g_assert_false(service_on_pool(fixture->conn, "inline", 0));
+
+	args = rpc_object_pack("[i]", (int64_t)-1);
+	call = rpc_connection_call(fixture->conn, SERVICE_PATH,
+	    SERVICE_INTERFACE, "inline", args, NULL);
+	g_assert_nonnull(call);
+	rpc_release(args);
+
+	while (!g_atomic_int_get(&fixture->running))
+		g_usleep(1000);
+
+	/* The watchdog demotes the method while the first call still runs */
+	g_usleep(50 * 1000);
+	other = rpc_client_create(SERVICE_URI, 0);
+	g_assert_nonnull(other);
+	g_assert_true(service_on_pool(rpc_client_get_connection(other),
+	    "inline", 0));
+	rpc_client_close(other);
+
+	g_atomic_int_set(&fixture->release, 1);
+	rpc_call_wait(call);
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_DONE);
+	g_assert_false(rpc_bool_get_value(rpc_call_result(call)));
+	rpc_call_free(call);
+}
+
+static void
+service_test_inline_stream(service_fixture *fixture, gconstpointer user_data)
+{
+	int count;
+
+	/* Ignores errors, like quite a few streaming methods do */
+	service_register_method(fixture, "stream", RPC_METHOD_INLINE,
+	    ^(void *cookie, rpc_object_t args __unused) {
+		int64_t i;
+
+		if (rpc_function_start_stream(cookie) != 0)
+			g_atomic_int_inc(&fixture->failures);
+
+		for (i = 0; i < 3; i++) {
+			if (rpc_function_yield(cookie,
+			    rpc_int64_create(i)) != 0)
+				g_atomic_int_inc(&fixture->failures);
+		}
+
+		rpc_function_end(cookie);
+		return (RPC_FUNCTION_STILL_RUNNING);
+	});
+
+	/* Streaming inline fails instead of blocking the connection */
+	g_assert_cmpint(service_stream(fixture->conn, "stream", &count), ==,
+	    EINVAL);
+	g_assert_cmpint(count, ==, 0);
+	g_assert_cmpint(g_atomic_int_get(&fixture->failures), ==, 4);
+
+	/* And the method streams from the worker pool after that */
+	g_assert_cmpint(service_stream(fixture->conn, "stream", &count), ==,
+	    0);
+	g_assert_cmpint(count, ==, 3);
+	g_assert_cmpint(g_atomic_int_get(&fixture->failures), ==, 4);
+}
+
+static void
+service_test_inline_affinity(service_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	service_register_sleepy(fixture, "inline", RPC_METHOD_INLINE);
+
+	/* Pinned instances serialize inline calls on their worker too */
+	rpc_instance_set_affinity(fixture->instance, true);
+	g_assert_true(service_on_pool(fixture->conn, "inline", 0));
+	g_assert_true(service_on_pool(fixture->conn, "inline", 0));
+
+	rpc_instance_set_affinity(fixture->instance, false);
+	g_assert_false(service_on_pool(fixture->conn, "inline", 0));
+}
+
+/*
+ * Calls @p method and returns the number it returned, or the negated
+ * error code it failed with.
+ */
+static int64_t
+service_call(rpc_connection_t conn, const char *method)
+{
+	rpc_object_t result;
+	int64_t ret;
+
+	result = rpc_connection_call_syncp(conn, SERVICE_PATH,
+	    SERVICE_INTERFACE, method, "[]");
+	g_assert_nonnull(result);
+	ret = rpc_is_error(result)
+	    ? -rpc_error_get_code(result)
+	    : rpc_int64_get_value(result);
+
+	rpc_release(result);
+	return (ret);
+}
+
+static void
+service_register_value(service_fixture *fixture, const char *name,
+    int64_t value)
+{
+
+	service_register_method(fixture, name, 0,
+	    ^(void *cookie __unused, rpc_object_t args __unused) {
+		return (rpc_int64_create(value));
+	});
+}
+
+static void
+service_test_dispatch_member(service_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	service_register_value(fixture, "method", 1);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 1);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 1);
+
+	/* The cached member must not outlive its registration */
+	g_assert_cmpint(rpc_instance_unregister_member(fixture->instance,
+	    SERVICE_INTERFACE, "method"), ==, 0);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, -ENOENT);
+
+	service_register_value(fixture, "method", 2);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 2);
+}
+
+static void
+service_test_dispatch_interface(service_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	service_register_value(fixture, "method", 1);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 1);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 1);
+
+	rpc_instance_unregister_interface(fixture->instance,
+	    SERVICE_INTERFACE);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, -ENOENT);
+
+	g_assert_cmpint(rpc_instance_register_interface(fixture->instance,
+	    SERVICE_INTERFACE, NULL, NULL), ==, 0);
+	service_register_value(fixture, "method", 3);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 3);
+}
+
+static void
+service_test_dispatch_instance(service_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	service_register_value(fixture, "method", 1);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 1);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 1);
+
+	rpc_context_unregister_instance(fixture->ctx, SERVICE_PATH);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, -ENOENT);
+	rpc_instance_free(fixture->instance);
+
+	/* A new instance under the same path replaces the cached one */
+	fixture->instance = rpc_instance_new(NULL, SERVICE_PATH);
+	g_assert_nonnull(fixture->instance);
+	g_assert_cmpint(rpc_instance_register_interface(fixture->instance,
+	    SERVICE_INTERFACE, NULL, NULL), ==, 0);
+	service_register_value(fixture, "method", 4);
+	g_assert_cmpint(rpc_context_register_instance(fixture->ctx,
+	    fixture->instance), ==, 0);
+	g_assert_cmpint(service_call(fixture->conn, "method"), ==, 4);
 }
 
 static void
 service_test_register()
 {
 
+	g_test_add("/service/property/cache", service_fixture, NULL,
+	    service_test_property_set_up, service_test_property_cache,
+	    service_test_tear_down);
+
+	g_test_add("/service/property/set", service_fixture, NULL,
+	    service_test_property_set_up, service_test_property_set,
+	    service_test_tear_down);
+
+	g_test_add("/service/property/set_uncached", service_fixture, NULL,
+	    service_test_property_set_up, service_test_property_set_uncached,
+	    service_test_tear_down);
+
+	g_test_add("/service/property/coalesce", service_fixture, NULL,
+	    service_test_property_set_up, service_test_property_coalesce,
+	    service_test_tear_down);
+
+	g_test_add("/service/property/unregister", service_fixture, NULL,
+	    service_test_property_set_up, service_test_property_unregister,
+	    service_test_tear_down);
+
+	g_test_add("/service/property/get_all", service_fixture, NULL,
+	    service_test_property_set_up, service_test_property_get_all,
+	    service_test_tear_down);
+
+	g_test_add("/service/inline/flag", service_fixture, NULL,
+	    service_test_method_set_up, service_test_inline_flag,
+	    service_test_tear_down);
+
+	g_test_add("/service/inline/budget", service_fixture, NULL,
+	    service_test_method_set_up, service_test_inline_budget,
+	    service_test_tear_down);
+
+	g_test_add("/service/inline/watchdog", service_fixture, NULL,
+	    service_test_method_set_up, service_test_inline_watchdog,
+	    service_test_tear_down);
+
+	g_test_add("/service/inline/stream", service_fixture, NULL,
+	    service_test_method_set_up, service_test_inline_stream,
+	    service_test_tear_down);
+
+	g_test_add("/service/inline/affinity", service_fixture, NULL,
+	    service_test_method_set_up, service_test_inline_affinity,
+	    service_test_tear_down);
+
+	g_test_add("/service/dispatch/member", service_fixture, NULL,
+	    service_test_method_set_up, service_test_dispatch_member,
+	    service_test_tear_down);
+
+	g_test_add("/service/dispatch/interface", service_fixture, NULL,
+	    service_test_method_set_up, service_test_dispatch_interface,
+	    service_test_tear_down);
+
+	g_test_add("/service/dispatch/instance", service_fixture, NULL,
+	    service_test_method_set_up, service_test_dispatch_instance,
+	    service_test_tear_down);
 }
 
 static struct librpc_test service = {
@@ -63,4 +777,4 @@ static struct librpc_test service = {
     .register_f = &service_test_register
 };
 
-DECLARE_TEST(service);
\ No newline at end of file
+DECLARE_TEST(service);
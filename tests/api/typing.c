@@ -28,34 +28,1243 @@
 #include "../tests.h"
 #include "../../src/linker_set.h"
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <rpc/object.h>
+#include <rpc/service.h>
+#include <rpc/server.h>
+#include <rpc/client.h>
+#include <rpc/connection.h>
+#include <rpc/typing.h>
 
+#define	TYPING_IDL	"validation.yaml"
+#define	TYPING_POINT	"com.twoporeguys.librpc.test.Point"
+#define	TYPING_REGEX_IDL	"regex.yaml"
+#define	TYPING_REGEX_NS		"com.twoporeguys.librpc.test.regex"
+#define	TYPING_CACHE_NS	"com.twoporeguys.librpc.test.cache"
+#define	TYPING_LAZY_NS	"com.twoporeguys.librpc.test.lazy"
+#define	TYPING_LAZY_IDL							\
+    "---\n"								\
+    "meta:\n"								\
+    "  version: 1\n"							\
+    "  namespace: %s\n"							\
+    "  description: Lazy resolution test types\n"			\
+    "%s"								\
+    "\n"								\
+    "%s"
+#define	TYPING_STREAM_NS	"com.twoporeguys.librpc.test.stream"
+#define	TYPING_STREAM_DOC(_ns, _type)					\
+    "---\n"								\
+    "meta:\n"								\
+    "  version: 1\n"							\
+    "  namespace: " TYPING_STREAM_NS "." _ns "\n"			\
+    "  description: Stream test types\n"				\
+    "\n"								\
+    "type " _type ":\n"							\
+    "  type: string\n"
+#define	TYPING_DOWNLOAD_NS	"com.twoporeguys.librpc.test.download"
+#define	TYPING_DOWNLOAD_URI	"loopback://44"
+#define	TYPING_DOWNLOAD_FILES	300
+#define	TYPING_GENERIC_NS	"com.twoporeguys.librpc.test.generic"
+#define	TYPING_GENERIC_IDL						\
+    "---\n"								\
+    "meta:\n"								\
+    "  version: 1\n"							\
+    "  namespace: " TYPING_GENERIC_NS "\n"				\
+    "  description: Generic test types\n"				\
+    "\n"								\
+    "container List<T>:\n"						\
+    "  type: array\n"							\
+    "  value-type: T\n"							\
+    "\n"								\
+    "struct Dict<K,V>:\n"						\
+    "  members:\n"							\
+    "    keys:\n"							\
+    "      type: List<K>\n"						\
+    "    values:\n"							\
+    "      type: List<V>\n"						\
+    "\n"								\
+    "struct Box<T>:\n"							\
+    "  members:\n"							\
+    "    items:\n"							\
+    "      type: List<T>\n"						\
+    "    entries:\n"							\
+    "      type: Dict<string,T>\n"
+#define	TYPING_PATH_NS	"com.twoporeguys.librpc.test.path"
+#define	TYPING_PATH_IDL							\
+    "---\n"								\
+    "meta:\n"								\
+    "  version: 1\n"							\
+    "  namespace: " TYPING_PATH_NS "\n"					\
+    "  description: Error path test types\n"				\
+    "\n"								\
+    "container List<T>:\n"						\
+    "  type: array\n"							\
+    "  value-type: T\n"							\
+    "\n"								\
+    "container Map<T>:\n"						\
+    "  type: dictionary\n"						\
+    "  value-type: T\n"							\
+    "\n"								\
+    "struct Item:\n"							\
+    "  members:\n"							\
+    "    name:\n"							\
+    "      type: string\n"						\
+    "      constraints:\n"						\
+    "        length:\n"							\
+    "          min: 2\n"						\
+    "          max: 4\n"						\
+    "    count:\n"							\
+    "      type: int64\n"						\
+    "      constraints:\n"						\
+    "        range:\n"							\
+    "          min: 0\n"						\
+    "          max: 10\n"						\
+    "\n"								\
+    "struct Order:\n"							\
+    "  members:\n"							\
+    "    owner:\n"							\
+    "      type: Item\n"						\
+    "    items:\n"							\
+    "      type: List<Item>\n"						\
+    "    tags:\n"							\
+    "      type: Map<Item>\n"						\
+    "    nested:\n"							\
+    "      type: List<Map<Item>>\n"
+#define	TYPING_PATH_ITEMS	5
+#define	TYPING_LOOKUP_NS	"com.twoporeguys.librpc.test.lookup"
+#define	TYPING_LOOKUP_TYPES	200
+#define	TYPING_LOOKUP_THREADS	4
+#define	TYPING_CACHE_IDL						\
+    "---\n"								\
+    "meta:\n"								\
+    "  version: 1\n"							\
+    "  namespace: %s\n"							\
+    "  description: Cache test types\n"					\
+    "\n"								\
+    "type %s:\n"							\
+    "  type: string\n"
 
 typedef struct {
-
+	rpct_typei_t	typei;
+	rpc_object_t	errors;
+	char *		dir;
+	volatile gint	loaded;
+	volatile gint	done;
 } typing_fixture;
 
+static bool
+typing_validate(typing_fixture *fixture, int64_t x, const char *name)
+{
+	rpc_object_t obj;
+	rpc_object_t typed;
+	bool valid;
+
+	if (fixture->errors != NULL)
+		rpc_release(fixture->errors);
+
+	obj = name != NULL
+	    ? rpc_object_pack("{x:i,name:s}", x, name)
+	    : rpc_object_pack("{x:i}", x);
+
+	typed = rpct_newi(fixture->typei, obj);
+	valid = rpct_validate(fixture->typei, typed, &fixture->errors);
+	rpc_release(typed);
+	rpc_release(obj);
+	return (valid);
+}
+
+static const char *
+typing_error_path(typing_fixture *fixture, size_t index)
+{
+	const char *path = NULL;
+
+	rpc_object_unpack(rpc_array_get_value(fixture->errors, index),
+	    "{path:s}", &path);
+
+	return (path);
+}
+
+static void
+typing_test_validation_set_up(typing_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_object_t idl;
+
+	g_assert_cmpint(rpct_init(false), ==, 0);
+	if (rpct_get_type(TYPING_POINT) == NULL) {
+		idl = rpc_object_pack("{meta:{version:i,namespace:s,"
+		    "description:s},struct Point:{members:{"
+		    "x:{type:s,constraints:{range:{min:i,max:i}}},"
+		    "name:{type:s,constraints:{length:{min:i,max:i}}}}}}",
+		    (int64_t)1, "com.twoporeguys.librpc.test",
+		    "Validation test types",
+		    "int64", (int64_t)0, (int64_t)10,
+		    "string", (int64_t)2, (int64_t)4);
+
+		g_assert_cmpint(rpct_read_idl(TYPING_IDL, idl), ==, 0);
+		g_assert_cmpint(rpct_load_types(TYPING_IDL), ==, 0);
+		rpc_release(idl);
+	}
+
+	fixture->typei = rpct_new_typei(TYPING_POINT);
+	fixture->errors = NULL;
+	g_assert_nonnull(fixture->typei);
+}
+
 static void
-typing_test(typing_fixture *fixture, gconstpointer user_data)
+typing_test_validation_tear_down(typing_fixture *fixture,
+    gconstpointer user_data)
 {
 
+	rpct_typei_release(fixture->typei);
+	if (fixture->errors != NULL)
+		rpc_release(fixture->errors);
 }
 
 static void
-typing_test_single_set_up(typing_fixture *fixture, gconstpointer user_data)
+typing_test_validation_range(typing_fixture *fixture,
+    gconstpointer user_data)
 {
 
+	g_assert_true(typing_validate(fixture, 0, "ab"));
+	g_assert_true(typing_validate(fixture, 10, "ab"));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 0);
+
+	g_assert_false(typing_validate(fixture, 11, "ab"));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==, ".x");
+
+	g_assert_false(typing_validate(fixture, -5, "ab"));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==, ".x");
+}
+
+static void
+typing_test_validation_length(typing_fixture *fixture,
+    gconstpointer user_data)
+{
+
+	g_assert_true(typing_validate(fixture, 5, "abcd"));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 0);
+
+	g_assert_false(typing_validate(fixture, 5, "a"));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==, ".name");
+
+	g_assert_false(typing_validate(fixture, 5, "abcde"));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==, ".name");
+
+	/* Both members are checked */
+	g_assert_false(typing_validate(fixture, 50, "abcde"));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 2);
+}
+
+static void
+typing_test_validation_plan(typing_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpct_typei_t typei;
+	int i;
+
+	/* The cached plan must give the same answers on every use */
+	for (i = 0; i < 3; i++) {
+		g_assert_true(typing_validate(fixture, 5, "abc"));
+		g_assert_false(typing_validate(fixture, 5, NULL));
+		g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+		g_assert_false(typing_validate(fixture, 11, "abc"));
+	}
+
+	/* Looking the type up again reuses the same plan */
+	typei = rpct_new_typei(TYPING_POINT);
+	g_assert_nonnull(typei);
+	rpct_typei_release(fixture->typei);
+	fixture->typei = typei;
+	g_assert_true(typing_validate(fixture, 1, "abc"));
+	g_assert_false(typing_validate(fixture, 1, "abcdef"));
+}
+
+/*
+ * Validates the string @p str against the regex test type @p type
+ * and returns the validation errors in @p errors.
+ */
+static bool
+typing_regex_validate(const char *type, const char *str,
+    rpc_object_t *errors)
+{
+	rpct_typei_t typei;
+	rpc_object_t obj;
+	rpc_object_t typed;
+	char *name;
+	bool valid;
+
+	name = g_strdup_printf("%s.%s", TYPING_REGEX_NS, type);
+	typei = rpct_new_typei(name);
+	g_assert_nonnull(typei);
+
+	obj = rpc_string_create(str);
+	typed = rpct_newi(typei, obj);
+	valid = rpct_validate(typei, typed, errors);
+	rpc_release(typed);
+	rpc_release(obj);
+	rpct_typei_release(typei);
+	g_free(name);
+	return (valid);
+}
+
+static void
+typing_test_validation_regex(typing_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_object_t error;
+	rpc_object_t idl;
+	const char *message = NULL;
+	int i;
+
+	if (rpct_get_type(TYPING_REGEX_NS ".Name") == NULL) {
+		idl = rpc_object_pack("{meta:{version:i,namespace:s,"
+		    "description:s},"
+		    "type Name:{type:s,constraints:{regex:{pattern:s}}},"
+		    "type Broken:{type:s,constraints:{regex:{pattern:s}}}}",
+		    (int64_t)1, TYPING_REGEX_NS, "Regex test types",
+		    "string", "^[a-z]+$", "string", "(");
+
+		g_assert_cmpint(rpct_read_idl(TYPING_REGEX_IDL, idl), ==, 0);
+		g_assert_cmpint(rpct_load_types(TYPING_REGEX_IDL), ==, 0);
+		rpc_release(idl);
+	}
+
+	/* Make sure there is an error around to compare against */
+	g_assert_null(rpct_new_typei("!"));
+	error = rpc_get_last_error();
+	g_assert_cmpint(rpc_error_get_code(error), ==, EINVAL);
+
+	for (i = 0; i < 3; i++) {
+		g_assert_true(typing_regex_validate("Name", "abc",
+		    &fixture->errors));
+		rpc_release(fixture->errors);
+		g_assert_false(typing_regex_validate("Name", "ABC",
+		    &fixture->errors));
+		g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+		rpc_release(fixture->errors);
+
+		/* An invalid pattern never matches and is reported as such */
+		g_assert_false(typing_regex_validate("Broken", "abc",
+		    &fixture->errors));
+		g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+		rpc_object_unpack(rpc_array_get_value(fixture->errors, 0),
+		    "{message:s}", &message);
+		g_assert_cmpstr(message, ==, "Invalid pattern");
+		rpc_release(fixture->errors);
+		fixture->errors = NULL;
+	}
+
+	/* Compiling the invalid pattern didn't touch the last error */
+	g_assert_true(rpc_get_last_error() == error);
+}
+
+/*
+ * Writes an IDL file declaring @p type with a fixed modification time,
+ * which only differs by its nanoseconds part across calls.
+ */
+static void
+typing_cache_write(typing_fixture *fixture, const char *ns, const char *type,
+    long nsec)
+{
+	struct timespec times[2];
+	char *contents;
+	char *path;
+
+	path = g_build_filename(fixture->dir, "types.yaml", NULL);
+	contents = g_strdup_printf(TYPING_CACHE_IDL, ns, type);
+	g_assert_true(g_file_set_contents(path, contents, -1, NULL));
+
+	times[0].tv_sec = times[1].tv_sec = 1000000000;
+	times[0].tv_nsec = times[1].tv_nsec = nsec;
+	g_assert_cmpint(utimensat(AT_FDCWD, path, times, 0), ==, 0);
+
+	g_free(contents);
+	g_free(path);
+}
+
+static bool
+typing_cache_has_type(const char *ns, const char *type)
+{
+	char *name;
+	bool ret;
+
+	name = g_strdup_printf("%s.%s", ns, type);
+	ret = rpct_get_type(name) != NULL;
+	g_free(name);
+	return (ret);
+}
+
+static void
+typing_test_cache_set_up(typing_fixture *fixture, gconstpointer user_data)
+{
+
+	g_assert_cmpint(rpct_init(false), ==, 0);
+	fixture->dir = g_dir_make_tmp("librpc-idl-XXXXXX", NULL);
+	g_assert_nonnull(fixture->dir);
+}
+
+static void
+typing_remove_dir(const char *dir)
+{
+	GDir *handle;
+	const char *name;
+	char *path;
+
+	handle = g_dir_open(dir, 0, NULL);
+	g_assert_nonnull(handle);
+
+	while ((name = g_dir_read_name(handle)) != NULL) {
+		path = g_build_filename(dir, name, NULL);
+		g_remove(path);
+		g_free(path);
+	}
+
+	g_dir_close(handle);
+	g_rmdir(dir);
 }
 
 static void
-typing_test_tear_down(typing_fixture *fixture, gconstpointer user_data)
+typing_test_cache_tear_down(typing_fixture *fixture, gconstpointer user_data)
 {
 
+	typing_remove_dir(fixture->dir);
+	g_free(fixture->dir);
+}
+
+static void
+typing_test_cache_moved(typing_fixture *fixture, gconstpointer user_data)
+{
+	const char *ns = TYPING_CACHE_NS ".moved";
+	char *dir;
+
+	typing_cache_write(fixture, ns, "Cached", 500);
+	g_assert_cmpint(rpct_compile_types_dir(fixture->dir), ==, 0);
+
+	/* Same size and mtime, so only the cache can provide "Cached" */
+	typing_cache_write(fixture, ns, "Parsed", 500);
+
+	dir = g_strconcat(fixture->dir, "-moved", NULL);
+	g_assert_cmpint(g_rename(fixture->dir, dir), ==, 0);
+	g_free(fixture->dir);
+	fixture->dir = dir;
+
+	g_assert_cmpint(rpct_load_types_dir(fixture->dir), ==, 0);
+	g_assert_true(typing_cache_has_type(ns, "Cached"));
+	g_assert_false(typing_cache_has_type(ns, "Parsed"));
+}
+
+static void
+typing_test_cache_mtime(typing_fixture *fixture, gconstpointer user_data)
+{
+	const char *ns = TYPING_CACHE_NS ".mtime";
+
+	typing_cache_write(fixture, ns, "Cached", 500);
+	g_assert_cmpint(rpct_compile_types_dir(fixture->dir), ==, 0);
+
+	/* Modified within the same second as the cached copy */
+	typing_cache_write(fixture, ns, "Parsed", 0);
+
+	g_assert_cmpint(rpct_load_types_dir(fixture->dir), ==, 0);
+	g_assert_true(typing_cache_has_type(ns, "Parsed"));
+	g_assert_false(typing_cache_has_type(ns, "Cached"));
+}
+
+/*
+ * Writes an IDL file named @p file into @p dir, declaring @p decls in
+ * namespace @p ns which uses namespace @p use, if not NULL.
+ */
+static void
+typing_lazy_write(const char *dir, const char *file, const char *ns,
+    const char *use, const char *decls)
+{
+	char *contents;
+	char *uses;
+	char *path;
+
+	uses = use != NULL ? g_strdup_printf("  use:\n    - %s\n", use) :
+	    g_strdup("");
+	contents = g_strdup_printf(TYPING_LAZY_IDL, ns, uses, decls);
+	path = g_build_filename(dir, file, NULL);
+	g_assert_true(g_file_set_contents(path, contents, -1, NULL));
+
+	g_free(path);
+	g_free(contents);
+	g_free(uses);
+}
+
+static void
+typing_test_lazy_reference(typing_fixture *fixture, gconstpointer user_data)
+{
+	const char *ns = TYPING_LAZY_NS ".reference";
+	rpc_object_t error;
+	char *name;
+
+	typing_lazy_write(fixture->dir, "types.yaml", ns, NULL,
+	    "struct Used:\n"
+	    "  members:\n"
+	    "    x:\n"
+	    "      type: int64\n"
+	    "\n"
+	    "struct Broken:\n"
+	    "  inherits: Missing\n"
+	    "  members:\n"
+	    "    y:\n"
+	    "      type: int64\n");
+
+	/* Nothing is read until referenced, so the broken type is fine */
+	g_assert_cmpint(rpct_load_types_dir(fixture->dir), ==, 0);
+	g_assert_true(typing_cache_has_type(ns, "Used"));
+
+	name = g_strdup_printf("%s.Broken", ns);
+	g_assert_null(rpct_get_type(name));
+	error = rpc_get_last_error();
+	g_assert_nonnull(error);
+	g_assert_cmpint(rpc_error_get_code(error), ==, ENOENT);
+
+	/* The failure is remembered instead of reading it over again */
+	g_assert_null(rpct_get_type(name));
+	g_assert_true(rpc_get_last_error() == error);
+	g_free(name);
+}
+
+static void
+typing_test_lazy_use(typing_fixture *fixture, gconstpointer user_data)
+{
+	const char *ns = TYPING_LAZY_NS ".use";
+	const char *base_ns = TYPING_LAZY_NS ".use.base";
+	const char *late_ns = TYPING_LAZY_NS ".use.late";
+	rpct_type_t child;
+	char *dir;
+	char *name;
+
+	typing_lazy_write(fixture->dir, "child.yaml", ns, base_ns,
+	    "struct Child:\n"
+	    "  inherits: Base\n"
+	    "  members:\n"
+	    "    x:\n"
+	    "      type: int64\n"
+	    "\n"
+	    "struct Orphan:\n"
+	    "  inherits: " TYPING_LAZY_NS ".use.late.Late\n"
+	    "  members:\n"
+	    "    x:\n"
+	    "      type: int64\n");
+
+	typing_lazy_write(fixture->dir, "base.yaml", base_ns, NULL,
+	    "struct Base:\n"
+	    "  members:\n"
+	    "    y:\n"
+	    "      type: int64\n");
+
+	g_assert_cmpint(rpct_load_types_dir(fixture->dir), ==, 0);
+
+	/* Resolving Child reads Base from the other file on demand */
+	name = g_strdup_printf("%s.Child", ns);
+	child = rpct_get_type(name);
+	g_assert_nonnull(child);
+	g_assert_nonnull(rpct_type_get_parent(child));
+	g_assert_cmpstr(rpct_type_get_name(rpct_type_get_parent(child)), ==,
+	    TYPING_LAZY_NS ".use.base.Base");
+	g_free(name);
+
+	/* A failed declaration is retried once more files are loaded */
+	name = g_strdup_printf("%s.Orphan", ns);
+	g_assert_null(rpct_get_type(name));
+
+	dir = g_dir_make_tmp("librpc-idl-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+	typing_lazy_write(dir, "late.yaml", late_ns, NULL,
+	    "struct Late:\n"
+	    "  members:\n"
+	    "    z:\n"
+	    "      type: int64\n");
+
+	g_assert_cmpint(rpct_load_types_dir(dir), ==, 0);
+	g_assert_nonnull(rpct_get_type(name));
+	typing_remove_dir(dir);
+	g_free(dir);
+	g_free(name);
+}
+
+struct typing_stream_writer
+{
+	int		fd;
+	const char *	data;
+	size_t		chunk;
+};
+
+static gpointer
+typing_stream_write(gpointer arg)
+{
+	struct typing_stream_writer *writer = arg;
+	const char *data = writer->data;
+	size_t len = strlen(data);
+	size_t step;
+
+	/* Pause between chunks, so that each one takes a separate read */
+	while (len > 0) {
+		step = MIN(len, writer->chunk);
+		g_assert_cmpint(write(writer->fd, data, step), ==,
+		    (ssize_t)step);
+		data += step;
+		len -= step;
+		g_usleep(1000);
+	}
+
+	close(writer->fd);
+	return (NULL);
+}
+
+/*
+ * Feeds @p data to rpct_load_types_stream() through a pipe, in pieces of
+ * @p chunk bytes, or all at once if @p chunk is 0.
+ */
+static int
+typing_stream_load(const char *data, size_t chunk)
+{
+	struct typing_stream_writer writer;
+	GThread *thread = NULL;
+	int fds[2];
+	int ret;
+
+	g_assert_cmpint(pipe(fds), ==, 0);
+	writer.fd = fds[1];
+	writer.data = data;
+	writer.chunk = chunk > 0 ? chunk : strlen(data);
+
+	if (chunk > 0)
+		thread = g_thread_new("idl writer", typing_stream_write,
+		    &writer);
+	else
+		typing_stream_write(&writer);
+
+	ret = rpct_load_types_stream(fds[0]);
+	if (thread != NULL)
+		g_thread_join(thread);
+
+	/* The stream is closed in any case */
+	g_assert_cmpint(fcntl(fds[0], F_GETFD), ==, -1);
+	return (ret);
+}
+
+static void
+typing_stream_set_up(typing_fixture *fixture, gconstpointer user_data)
+{
+
+	g_assert_cmpint(rpct_init(false), ==, 0);
+}
+
+static void
+typing_stream_tear_down(typing_fixture *fixture, gconstpointer user_data)
+{
+
+}
+
+static void
+typing_test_stream_split(typing_fixture *fixture, gconstpointer user_data)
+{
+	const char *data =
+	    TYPING_STREAM_DOC("split.a", "First")
+	    TYPING_STREAM_DOC("split.b", "Second");
+
+	/* Pieces end in the middle of lines and document markers */
+	g_assert_cmpint(typing_stream_load(data, 7), ==, 0);
+	g_assert_true(typing_cache_has_type(TYPING_STREAM_NS ".split.a",
+	    "First"));
+	g_assert_true(typing_cache_has_type(TYPING_STREAM_NS ".split.b",
+	    "Second"));
+}
+
+static void
+typing_test_stream_terminator(typing_fixture *fixture,
+    gconstpointer user_data)
+{
+	const char *data =
+	    TYPING_STREAM_DOC("end.a", "First")
+	    "...\n"
+	    "# Comments between documents are no document\n"
+	    "...\n"
+	    TYPING_STREAM_DOC("end.b", "Second")
+	    "...\n";
+
+	g_assert_cmpint(typing_stream_load(data, 0), ==, 0);
+	g_assert_true(typing_cache_has_type(TYPING_STREAM_NS ".end.a",
+	    "First"));
+	g_assert_true(typing_cache_has_type(TYPING_STREAM_NS ".end.b",
+	    "Second"));
+}
+
+static void
+typing_test_stream_newline(typing_fixture *fixture, gconstpointer user_data)
+{
+	const char *data =
+	    TYPING_STREAM_DOC("newline", "First")
+	    "\n"
+	    "struct Last:\n"
+	    "  members:\n"
+	    "    x:\n"
+	    "      type: int64";
+	rpct_type_t type;
+
+	g_assert_cmpint(typing_stream_load(data, 16), ==, 0);
+	type = rpct_get_type(TYPING_STREAM_NS ".newline.Last");
+	g_assert_nonnull(type);
+	g_assert_nonnull(rpct_type_get_member(type, "x"));
+}
+
+static void
+typing_test_stream_error(typing_fixture *fixture, gconstpointer user_data)
+{
+	const char *data =
+	    TYPING_STREAM_DOC("error.a", "First")
+	    "---\n"
+	    "meta:\n"
+	    "  version: 2\n"
+	    "  namespace: " TYPING_STREAM_NS ".error.b\n"
+	    "  description: Unsupported version\n"
+	    TYPING_STREAM_DOC("error.c", "Third");
+
+	/* Documents before the error are kept, the rest isn't read */
+	g_assert_cmpint(typing_stream_load(data, 0), ==, -1);
+	g_assert_nonnull(rpc_get_last_error());
+	g_assert_true(typing_cache_has_type(TYPING_STREAM_NS ".error.a",
+	    "First"));
+	g_assert_false(typing_cache_has_type(TYPING_STREAM_NS ".error.c",
+	    "Third"));
+}
+
+static void
+typing_test_stream_download(typing_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpc_context_t context;
+	rpc_server_t server;
+	rpc_client_t client;
+	rpc_connection_t conn;
+	rpc_object_t batch;
+	rpc_call_t call;
+	GString *data;
+	__block int received = 0;
+	int i;
+
+	data = g_string_new(NULL);
+	for (i = 0; i < TYPING_DOWNLOAD_FILES; i++) {
+		g_string_append_printf(data, "---\nmeta:\n  version: 1\n"
+		    "  namespace: %s.n%d\n  description: Download test\n\n"
+		    "type T:\n  type: string\n", TYPING_DOWNLOAD_NS, i);
+	}
+
+	g_assert_cmpint(typing_stream_load(data->str, 4096), ==, 0);
+	g_string_free(data, true);
+
+	context = rpc_context_create();
+	rpct_allow_idl_download(context);
+	server = rpc_server_create(TYPING_DOWNLOAD_URI, context);
+	g_assert_nonnull(server);
+	rpc_server_resume(server);
+
+	client = rpc_client_create(TYPING_DOWNLOAD_URI, 0);
+	g_assert_nonnull(client);
+	conn = rpc_client_get_connection(client);
+
+	/* Every file arrives, however the stream gets batched */
+	call = rpc_connection_call(conn, "/", RPCT_TYPING_INTERFACE,
+	    "download", NULL, NULL);
+	g_assert_nonnull(call);
+
+	for (;;) {
+		rpc_call_wait(call);
+		if (rpc_call_status(call) == RPC_CALL_STREAM_START) {
+			rpc_call_continue(call, false);
+			continue;
+		}
+
+		if (rpc_call_status(call) != RPC_CALL_MORE_AVAILABLE)
+			break;
+
+		batch = rpc_call_result_batch(call, 0);
+		g_assert_nonnull(batch);
+		rpc_array_apply(batch, ^(size_t idx __unused,
+		    rpc_object_t value) {
+			const char *ns;
+
+			ns = rpc_dictionary_get_string(rpc_dictionary_get_value(
+			    rpc_dictionary_get_value(value, "body"), "meta"),
+			    "namespace");
+			if (g_str_has_prefix(ns, TYPING_DOWNLOAD_NS "."))
+				received++;
+
+			return ((bool)true);
+		});
+		rpc_release(batch);
+	}
+
+	g_assert_cmpint(rpc_call_status(call), ==, RPC_CALL_ENDED);
+	g_assert_cmpint(received, ==, TYPING_DOWNLOAD_FILES);
+	rpc_call_free(call);
+
+	g_assert_cmpint(rpct_download_idl(conn), ==, 0);
+	g_assert_true(typing_cache_has_type(TYPING_DOWNLOAD_NS ".n0", "T"));
+
+	rpc_client_close(client);
+	rpc_server_close(server);
+	rpc_context_free(context);
+}
+
+static rpc_object_t
+typing_path_item(void)
+{
+
+	return (rpc_object_pack("{name:s,count:i}", "abc", (int64_t)1));
+}
+
+/*
+ * Returns a valid Order: a few items, one tag and two nested maps.
+ */
+static rpc_object_t
+typing_path_order(void)
+{
+	rpc_object_t order;
+	rpc_object_t items;
+	rpc_object_t tags;
+	rpc_object_t nested;
+	rpc_object_t map;
+	int i;
+
+	items = rpc_array_create();
+	for (i = 0; i < TYPING_PATH_ITEMS; i++)
+		rpc_array_append_stolen_value(items, typing_path_item());
+
+	tags = rpc_dictionary_create();
+	rpc_dictionary_steal_value(tags, "first", typing_path_item());
+
+	nested = rpc_array_create();
+	for (i = 0; i < 2; i++) {
+		map = rpc_dictionary_create();
+		rpc_dictionary_steal_value(map, "key", typing_path_item());
+		rpc_array_append_stolen_value(nested, map);
+	}
+
+	order = rpc_dictionary_create();
+	rpc_dictionary_steal_value(order, "owner", typing_path_item());
+	rpc_dictionary_steal_value(order, "items", items);
+	rpc_dictionary_steal_value(order, "tags", tags);
+	rpc_dictionary_steal_value(order, "nested", nested);
+	return (order);
+}
+
+/*
+ * Validates @p order, which is consumed, against the fixture type.
+ */
+static bool
+typing_path_validate(typing_fixture *fixture, rpc_object_t order)
+{
+	rpc_object_t typed;
+	bool valid;
+
+	if (fixture->errors != NULL)
+		rpc_release(fixture->errors);
+
+	typed = rpct_newi(fixture->typei, order);
+	valid = rpct_validate(fixture->typei, typed, &fixture->errors);
+	rpc_release(typed);
+	rpc_release(order);
+	return (valid);
+}
+
+static rpc_object_t
+typing_path_get(rpc_object_t order, const char *member, size_t index)
+{
+
+	return (rpc_array_get_value(rpc_dictionary_get_value(order, member),
+	    index));
+}
+
+static void
+typing_test_path_set_up(typing_fixture *fixture, gconstpointer user_data)
+{
+	char *path;
+
+	typing_test_cache_set_up(fixture, user_data);
+	path = g_build_filename(fixture->dir, "types.yaml", NULL);
+	g_assert_true(g_file_set_contents(path, TYPING_PATH_IDL, -1, NULL));
+
+	if (rpct_get_type(TYPING_PATH_NS ".Order") == NULL)
+		g_assert_cmpint(rpct_load_types(path), ==, 0);
+
+	fixture->typei = rpct_new_typei(TYPING_PATH_NS ".Order");
+	fixture->errors = NULL;
+	g_assert_nonnull(fixture->typei);
+	g_free(path);
+}
+
+static void
+typing_test_path_tear_down(typing_fixture *fixture, gconstpointer user_data)
+{
+
+	typing_test_validation_tear_down(fixture, user_data);
+	typing_test_cache_tear_down(fixture, user_data);
+}
+
+static void
+typing_test_path_nested(typing_fixture *fixture, gconstpointer user_data)
+{
+	rpc_object_t order;
+	const char *first;
+	const char *second;
+
+	g_assert_true(typing_path_validate(fixture, typing_path_order()));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 0);
+
+	/* Struct member of a struct */
+	order = typing_path_order();
+	rpc_dictionary_set_int64(rpc_dictionary_get_value(order, "owner"),
+	    "count", 11);
+	g_assert_false(typing_path_validate(fixture, order));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==, ".owner.count");
+
+	/* A missing member is reported at the struct itself */
+	order = typing_path_order();
+	rpc_dictionary_remove_key(rpc_dictionary_get_value(order, "owner"),
+	    "count");
+	g_assert_false(typing_path_validate(fixture, order));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==, ".owner");
+
+	/* Array elements are named by their index */
+	order = typing_path_order();
+	rpc_dictionary_set_string(typing_path_get(order, "items", 3), "name",
+	    "x");
+	g_assert_false(typing_path_validate(fixture, order));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==, ".items.3.name");
+
+	/* Validation of an array stops at its first invalid element */
+	order = typing_path_order();
+	rpc_dictionary_set_string(typing_path_get(order, "items", 1), "name",
+	    "x");
+	rpc_dictionary_set_int64(typing_path_get(order, "items", 4), "count",
+	    -1);
+	g_assert_false(typing_path_validate(fixture, order));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==, ".items.1.name");
+
+	/* Dictionary values are named by their key */
+	order = typing_path_order();
+	rpc_dictionary_set_int64(rpc_dictionary_get_value(
+	    rpc_dictionary_get_value(order, "tags"), "first"), "count", 50);
+	g_assert_false(typing_path_validate(fixture, order));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==,
+	    ".tags.first.count");
+
+	/* Dictionaries nested in an array */
+	order = typing_path_order();
+	rpc_dictionary_set_string(rpc_dictionary_get_value(
+	    typing_path_get(order, "nested", 1), "key"), "name", "abcdef");
+	g_assert_false(typing_path_validate(fixture, order));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 1);
+	g_assert_cmpstr(typing_error_path(fixture, 0), ==,
+	    ".nested.1.key.name");
+
+	/* Every invalid member of a struct gets its own path */
+	order = typing_path_order();
+	rpc_dictionary_set_int64(rpc_dictionary_get_value(order, "owner"),
+	    "count", 11);
+	rpc_dictionary_set_string(typing_path_get(order, "items", 0), "name",
+	    "x");
+	g_assert_false(typing_path_validate(fixture, order));
+	g_assert_cmpint(rpc_array_get_count(fixture->errors), ==, 2);
+	first = typing_error_path(fixture, 0);
+	second = typing_error_path(fixture, 1);
+	g_assert_true((!g_strcmp0(first, ".owner.count") &&
+	    !g_strcmp0(second, ".items.0.name")) ||
+	    (!g_strcmp0(first, ".items.0.name") &&
+	    !g_strcmp0(second, ".owner.count")));
+}
+
+static rpct_typei_t
+typing_member_type(rpct_typei_t typei, const char *name)
+{
+	rpct_member_t member;
+
+	member = rpct_type_get_member(rpct_typei_get_type(typei), name);
+	g_assert_nonnull(member);
+	return (rpct_typei_get_member_type(typei, member));
+}
+
+static void
+typing_assert_canonical(rpct_typei_t typei, const char *form)
+{
+
+	g_assert_nonnull(typei);
+	g_assert_cmpstr(rpct_typei_get_canonical_form(typei), ==, form);
+	g_assert_null(strstr(form, "<,"));
+}
+
+static void
+typing_test_generic_set_up(typing_fixture *fixture, gconstpointer user_data)
+{
+	char *path;
+
+	typing_test_cache_set_up(fixture, user_data);
+	path = g_build_filename(fixture->dir, "types.yaml", NULL);
+	g_assert_true(g_file_set_contents(path, TYPING_GENERIC_IDL, -1,
+	    NULL));
+
+	if (rpct_get_type(TYPING_GENERIC_NS ".Box") == NULL)
+		g_assert_cmpint(rpct_load_types(path), ==, 0);
+
+	g_free(path);
+}
+
+static void
+typing_test_generic_reuse(typing_fixture *fixture, gconstpointer user_data)
+{
+	rpct_typei_t list;
+	rpct_typei_t dict;
+	rpct_typei_t box;
+	rpct_typei_t typei;
+
+	list = rpct_new_typei(TYPING_GENERIC_NS ".List<int64>");
+	typing_assert_canonical(list, TYPING_GENERIC_NS ".List<int64>");
+	typei = rpct_new_typei(TYPING_GENERIC_NS ".List<int64>");
+	g_assert_true(typei == list);
+	rpct_typei_release(typei);
+
+	dict = rpct_new_typei(TYPING_GENERIC_NS ".Dict<string,int64>");
+	typing_assert_canonical(dict,
+	    TYPING_GENERIC_NS ".Dict<string,int64>");
+	typei = rpct_new_typei(TYPING_GENERIC_NS ".Dict<string,int64>");
+	g_assert_true(typei == dict);
+	rpct_typei_release(typei);
+
+	/* Instances built while specializing members are shared too */
+	box = rpct_new_typei(TYPING_GENERIC_NS ".Box<int64>");
+	g_assert_nonnull(box);
+
+	typei = typing_member_type(box, "items");
+	g_assert_true(typei == list);
+	rpct_typei_release(typei);
+
+	typei = typing_member_type(box, "entries");
+	g_assert_true(typei == dict);
+	rpct_typei_release(typei);
+
+	typei = typing_member_type(dict, "values");
+	g_assert_true(typei == list);
+	rpct_typei_release(typei);
+
+	rpct_typei_release(box);
+	rpct_typei_release(dict);
+	rpct_typei_release(list);
+}
+
+static void
+typing_test_generic_canonical(typing_fixture *fixture,
+    gconstpointer user_data)
+{
+	rpct_typei_t dict;
+	rpct_typei_t box;
+	rpct_typei_t typei;
+
+	dict = rpct_new_typei(TYPING_GENERIC_NS ".Dict<"
+	    TYPING_GENERIC_NS ".List<int64>,string>");
+	typing_assert_canonical(dict, TYPING_GENERIC_NS ".Dict<"
+	    TYPING_GENERIC_NS ".List<int64>,string>");
+
+	typei = typing_member_type(dict, "keys");
+	typing_assert_canonical(typei, TYPING_GENERIC_NS ".List<"
+	    TYPING_GENERIC_NS ".List<int64>>");
+	rpct_typei_release(typei);
+
+	typei = typing_member_type(dict, "values");
+	typing_assert_canonical(typei, TYPING_GENERIC_NS ".List<string>");
+	rpct_typei_release(typei);
+
+	/* Variables bound through the parent keep their position */
+	box = rpct_new_typei(TYPING_GENERIC_NS ".Box<double>");
+	typei = typing_member_type(box, "entries");
+	typing_assert_canonical(typei,
+	    TYPING_GENERIC_NS ".Dict<string,double>");
+	rpct_typei_release(typei);
+
+	rpct_typei_release(box);
+	rpct_typei_release(dict);
+}
+
+static char *
+typing_lookup_name(int index)
+{
+
+	return (g_strdup_printf("%s.Type%d", TYPING_LOOKUP_NS, index));
+}
+
+static gpointer
+typing_lookup_worker(gpointer arg)
+{
+	typing_fixture *fixture = arg;
+	rpct_typei_t typei;
+	rpct_type_t type;
+	char *name;
+	int loaded;
+	int i;
+
+	while (!g_atomic_int_get(&fixture->done)) {
+		type = rpct_get_type(TYPING_POINT);
+		g_assert_nonnull(type);
+		g_assert_cmpstr(rpct_type_get_name(type), ==, TYPING_POINT);
+
+		typei = rpct_new_typei("int64");
+		g_assert_nonnull(typei);
+		g_assert_cmpstr(rpct_typei_get_canonical_form(typei), ==,
+		    "int64");
+		rpct_typei_release(typei);
+
+		/* Types loaded so far have to be visible, later ones not */
+		loaded = g_atomic_int_get(&fixture->loaded);
+		for (i = 0; i < TYPING_LOOKUP_TYPES; i++) {
+			name = typing_lookup_name(i);
+			type = rpct_get_type(name);
+			if (i < loaded) {
+				g_assert_nonnull(type);
+				g_assert_cmpstr(rpct_type_get_name(type), ==,
+				    name);
+			} else if (type != NULL)
+				g_assert_cmpstr(rpct_type_get_name(type), ==,
+				    name);
+
+			g_free(name);
+		}
+	}
+
+	return (NULL);
+}
+
+static void
+typing_test_lookup_concurrent(typing_fixture *fixture,
+    gconstpointer user_data)
+{
+	GThread *threads[TYPING_LOOKUP_THREADS];
+	rpc_object_t idl;
+	rpc_object_t body;
+	char *file;
+	char *decl;
+	int i;
+
+	g_atomic_int_set(&fixture->loaded, 0);
+	g_atomic_int_set(&fixture->done, 0);
+
+	for (i = 0; i < TYPING_LOOKUP_THREADS; i++) {
+		threads[i] = g_thread_new("typing lookup",
+		    typing_lookup_worker, fixture);
+	}
+
+	for (i = 0; i < TYPING_LOOKUP_TYPES; i++) {
+		file = g_strdup_printf("lookup%d.yaml", i);
+		decl = g_strdup_printf("struct Type%d", i);
+		idl = rpc_object_pack("{meta:{version:i,namespace:s,"
+		    "description:s}}", (int64_t)1, TYPING_LOOKUP_NS,
+		    "Lookup test types");
+		body = rpc_object_pack("{members:{x:{type:s}}}", "int64");
+		rpc_dictionary_steal_value(idl, decl, body);
+
+		g_assert_cmpint(rpct_read_idl(file, idl), ==, 0);
+		g_assert_cmpint(rpct_load_types(file), ==, 0);
+		g_atomic_int_inc(&fixture->loaded);
+
+		rpc_release(idl);
+		g_free(decl);
+		g_free(file);
+	}
+
+	g_atomic_int_set(&fixture->done, 1);
+	for (i = 0; i < TYPING_LOOKUP_THREADS; i++)
+		g_thread_join(threads[i]);
 }
 
 static void
 typing_test_register()
 {
 
+	g_test_add("/typing/validation/range", typing_fixture, NULL,
+	    typing_test_validation_set_up, typing_test_validation_range,
+	    typing_test_validation_tear_down);
+
+	g_test_add("/typing/validation/length", typing_fixture, NULL,
+	    typing_test_validation_set_up, typing_test_validation_length,
+	    typing_test_validation_tear_down);
+
+	g_test_add("/typing/validation/plan", typing_fixture, NULL,
+	    typing_test_validation_set_up, typing_test_validation_plan,
+	    typing_test_validation_tear_down);
+
+	g_test_add("/typing/validation/regex", typing_fixture, NULL,
+	    typing_test_validation_set_up, typing_test_validation_regex,
+	    typing_test_validation_tear_down);
+
+	g_test_add("/typing/validation/path", typing_fixture, NULL,
+	    typing_test_path_set_up, typing_test_path_nested,
+	    typing_test_path_tear_down);
+
+	g_test_add("/typing/stream/split", typing_fixture, NULL,
+	    typing_stream_set_up, typing_test_stream_split,
+	    typing_stream_tear_down);
+
+	g_test_add("/typing/stream/terminator", typing_fixture, NULL,
+	    typing_stream_set_up, typing_test_stream_terminator,
+	    typing_stream_tear_down);
+
+	g_test_add("/typing/stream/newline", typing_fixture, NULL,
+	    typing_stream_set_up, typing_test_stream_newline,
+	    typing_stream_tear_down);
+
+	g_test_add("/typing/stream/error", typing_fixture, NULL,
+	    typing_stream_set_up, typing_test_stream_error,
+	    typing_stream_tear_down);
+
+	g_test_add("/typing/stream/download", typing_fixture, NULL,
+	    typing_stream_set_up, typing_test_stream_download,
+	    typing_stream_tear_down);
+
+	g_test_add("/typing/lazy/reference", typing_fixture, NULL,
+	    typing_test_cache_set_up, typing_test_lazy_reference,
+	    typing_test_cache_tear_down);
+
+	g_test_add("/typing/lazy/use", typing_fixture, NULL,
+	    typing_test_cache_set_up, typing_test_lazy_use,
+	    typing_test_cache_tear_down);
+
+	g_test_add("/typing/generic/reuse", typing_fixture, NULL,
+	    typing_test_generic_set_up, typing_test_generic_reuse,
+	    typing_test_cache_tear_down);
+
+	g_test_add("/typing/generic/canonical", typing_fixture, NULL,
+	    typing_test_generic_set_up, typing_test_generic_canonical,
+	    typing_test_cache_tear_down);
+
+	g_test_add("/typing/lookup/concurrent", typing_fixture, NULL,
+	    typing_test_validation_set_up, typing_test_lookup_concurrent,
+	    typing_test_validation_tear_down);
+
+	g_test_add("/typing/cache/moved", typing_fixture, NULL,
+	    typing_test_cache_set_up, typing_test_cache_moved,
+	    typing_test_cache_tear_down);
+
+	g_test_add("/typing/cache/mtime", typing_fixture, NULL,
+	    typing_test_cache_set_up, typing_test_cache_mtime,
+	    typing_test_cache_tear_down);
 }
 
 static struct librpc_test typing = {
@@ -63,4 +1272,4 @@ static struct librpc_test typing = {
     .register_f = &typing_test_register
 };
 
-DECLARE_TEST(typing);
\ No newline at end of file
+DECLARE_TEST(typing);
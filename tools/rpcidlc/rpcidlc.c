@@ -0,0 +1,79 @@
+/*
+ * Copyright 2015-2017 Two Pore Guys, Inc.
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <rpc/object.h>
+#include <rpc/typing.h>
+
+static char **dirs;
+
+static GOptionEntry options[] = {
+	{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &dirs, "", NULL },
+	{ }
+};
+
+int
+main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *err = NULL;
+	rpc_object_t error;
+	char **dir;
+	int ret = 0;
+
+	context = g_option_context_new("DIRECTORY... - precompile IDL files");
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &err)) {
+		fprintf(stderr, "Cannot parse options: %s\n", err->message);
+		g_error_free(err);
+		return (1);
+	}
+
+	if (dirs == NULL) {
+		fprintf(stderr, "%s", g_option_context_get_help(context, true,
+		    NULL));
+		g_option_context_free(context);
+		return (1);
+	}
+
+	g_option_context_free(context);
+	rpct_init(false);
+
+	for (dir = dirs; *dir != NULL; dir++) {
+		if (rpct_compile_types_dir(*dir) != 0) {
+			error = rpc_get_last_error();
+			fprintf(stderr, "Cannot compile %s: %s\n", *dir,
+			    rpc_error_get_message(error));
+			ret = 1;
+		}
+	}
+
+	return (ret);
+}